@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets printsupport
 
@@ -22,7 +22,36 @@ SOURCES += main.cpp\
            hubtool.cpp \
            qcustomplot.cpp \
            stemworker.cpp \
-           plotwindow.cpp
+           plotwindow.cpp \
+           pollscheduler.cpp \
+           fleetmanager.cpp \
+           fleetwindow.cpp \
+           ueirouter.cpp \
+           hubsnapshot.cpp \
+           ratecontroller.cpp \
+           commandqueue.cpp \
+           connectionmonitor.cpp \
+           hotplugwatcher.cpp \
+           simulatedhub.cpp \
+           latencyhistogram.cpp \
+           ueicallstats.cpp \
+           calltimingwindow.cpp \
+           packetcapture.cpp \
+           linkrecording.cpp \
+           samplerecorder.cpp \
+           minmaxpyramid.cpp \
+           sampleexporter.cpp \
+           exportprogressdialog.cpp \
+           samplestore.cpp \
+           sampleplayer.cpp \
+           playbackwindow.cpp \
+           energymeter.cpp \
+           energywindow.cpp \
+           rollingstats.cpp \
+           triggerengine.cpp \
+           openmetrics.cpp \
+           metricsserver.cpp \
+           controlserver.cpp
 
 HEADERS  += hubtool.h \
             clickablelabel.h \
@@ -30,7 +59,38 @@ HEADERS  += hubtool.h \
             qcustomplot.h \
             stemworker.h \
             plotwindow.h \
-            appnap.h
+            appnap.h \
+            pollscheduler.h \
+            fleetmanager.h \
+            fleetwindow.h \
+            ueirouter.h \
+            hubsnapshot.h \
+            spscring.h \
+            triplebuffer.h \
+            ratecontroller.h \
+            commandqueue.h \
+            connectionmonitor.h \
+            hotplugwatcher.h \
+            simulatedhub.h \
+            latencyhistogram.h \
+            ueicallstats.h \
+            calltimingwindow.h \
+            packetcapture.h \
+            linkrecording.h \
+            samplerecorder.h \
+            minmaxpyramid.h \
+            sampleexporter.h \
+            exportprogressdialog.h \
+            samplestore.h \
+            sampleplayer.h \
+            playbackwindow.h \
+            energymeter.h \
+            energywindow.h \
+            rollingstats.h \
+            triggerengine.h \
+            openmetrics.h \
+            metricsserver.h \
+            controlserver.h
 
 FORMS    += hubtool.ui \
             clicktoeditlabel.ui \
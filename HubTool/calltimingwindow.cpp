@@ -0,0 +1,132 @@
+#include "calltimingwindow.h"
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QFileDialog>
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
+
+enum CallTimingColumn {
+    columnCall = 0,
+    columnCount,
+    columnP50,
+    columnP99,
+    columnMax,
+    columnMean,
+    columnErrors,
+    columnTimeouts,
+    columnTotal
+};
+
+CallTimingWindow::CallTimingWindow(QWidget *parent) :
+    QWidget(parent)
+{
+    setWindowTitle("UEI call timings");
+
+    m_table = new QTableWidget(0, columnTotal, this);
+    m_statusLabel = new QLabel("Waiting for the first timings...", this);
+    m_exportButton = new QPushButton("Export CSV...", this);
+    m_resetButton = new QPushButton("Reset", this);
+
+    QStringList headers;
+    headers << "Call" << "Count" << "p50 (us)" << "p99 (us)" << "Max (us)" << "Mean (us)" << "Errors" << "Timeouts";
+    m_table->setHorizontalHeaderLabels(headers);
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->verticalHeader()->setVisible(false);
+    m_table->horizontalHeader()->setSectionResizeMode(columnCall, QHeaderView::Stretch);
+
+    QHBoxLayout *buttons = new QHBoxLayout();
+    buttons->addWidget(m_statusLabel, 1);
+    buttons->addWidget(m_resetButton);
+    buttons->addWidget(m_exportButton);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(m_table);
+    layout->addLayout(buttons);
+    setLayout(layout);
+    resize(800, 500);
+
+    connect(m_exportButton, SIGNAL(clicked()), this, SLOT(exportCsv()));
+    connect(m_resetButton, SIGNAL(clicked()), this, SLOT(resetTimings()));
+}
+
+void CallTimingWindow::showEvent(QShowEvent *e){
+    emit timingEnabledChanged(true);
+    QWidget::showEvent(e);
+}
+
+void CallTimingWindow::hideEvent(QHideEvent *e){
+    emit timingEnabledChanged(false);
+    QWidget::hideEvent(e);
+}
+
+void CallTimingWindow::setCell(int row, int column, const QString &text){
+    // reuse the items so a refresh doesn't allocate a new one per cell
+    QTableWidgetItem *item = m_table->item(row, column);
+    if(!item){
+        item = new QTableWidgetItem();
+        if(column != columnCall) item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        m_table->setItem(row, column, item);
+    }
+    if(item->text() != text){
+        item->setText(text);
+    }
+}
+
+void CallTimingWindow::handleCallTimings(QList<UEICallSummary> summaries){
+    if(!isVisible())
+        return;
+
+    m_summaries = summaries;
+    if(m_table->rowCount() != summaries.size()){
+        m_table->setRowCount(summaries.size());
+    }
+
+    quint64 totalCount = 0;
+    quint64 totalFailures = 0;
+    for(int row = 0; row < summaries.size(); row++){
+        const UEICallSummary &call = summaries[row];
+        totalCount += call.count;
+        totalFailures += call.errors + call.timeouts;
+
+        setCell(row, columnCall, call.name);
+        setCell(row, columnCount, QString::number(call.count));
+        setCell(row, columnP50, QString::number(call.p50Us));
+        setCell(row, columnP99, QString::number(call.p99Us));
+        setCell(row, columnMax, QString::number(call.maxUs));
+        setCell(row, columnMean, QString::number(call.meanUs, 'f', 1));
+        setCell(row, columnErrors, QString::number(call.errors));
+        setCell(row, columnTimeouts, QString::number(call.timeouts));
+    }
+
+    m_statusLabel->setText(QString("%1 replies, %2 failed, updated %3")
+                           .arg(totalCount)
+                           .arg(totalFailures)
+                           .arg(QTime::currentTime().toString("HH:mm:ss")));
+}
+
+// turning the timing back on in the worker starts it from empty
+void CallTimingWindow::resetTimings(){
+    emit timingEnabledChanged(true);
+    m_summaries.clear();
+    m_table->setRowCount(0);
+    m_statusLabel->setText("Reset, waiting for timings...");
+}
+
+void CallTimingWindow::exportCsv(){
+    QString defaultName = QString("uei-timings-%1.csv").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+    QString path = QFileDialog::getSaveFileName(this, "Export call timings", defaultName, "CSV files (*.csv)");
+    if(path.isEmpty())
+        return;
+
+    QFile file(path);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)){
+        m_statusLabel->setText(QString("Error writing %1: %2").arg(path).arg(file.errorString()));
+        return;
+    }
+    QTextStream out(&file);
+    out << UEICallStats::toCsv(m_summaries);
+    m_statusLabel->setText(QString("Exported %1 calls to %2").arg(m_summaries.size()).arg(path));
+}
@@ -0,0 +1,45 @@
+#ifndef CALLTIMINGWINDOW_H
+#define CALLTIMINGWINDOW_H
+
+#include <QWidget>
+#include <QTableWidget>
+#include <QLabel>
+#include <QPushButton>
+
+#include "ueicallstats.h"
+
+// Diagnostics panel for the per UEI call timings: one row per call with its
+// latency percentiles, errors and timeouts, refreshed as the worker sends
+// them. Timing is only switched on in the worker while this is showing.
+class CallTimingWindow : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit CallTimingWindow(QWidget *parent = nullptr);
+
+signals:
+    void timingEnabledChanged(bool enabled);
+
+public slots:
+    void handleCallTimings(QList<UEICallSummary> summaries);
+
+protected:
+    void showEvent(QShowEvent *e);
+    void hideEvent(QHideEvent *e);
+
+private slots:
+    void exportCsv();
+    void resetTimings();
+
+private:
+    void setCell(int row, int column, const QString &text);
+
+    QTableWidget *m_table;
+    QLabel *m_statusLabel;
+    QPushButton *m_exportButton;
+    QPushButton *m_resetButton;
+    QList<UEICallSummary> m_summaries;
+};
+
+#endif // CALLTIMINGWINDOW_H
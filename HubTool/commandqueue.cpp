@@ -0,0 +1,86 @@
+#include "commandqueue.h"
+
+CommandQueue::CommandQueue() :
+    m_coalescedCount(0)
+{
+}
+
+// whatever is still queued is dropped without running its callbacks, their
+// owner is most likely being torn down too
+CommandQueue::~CommandQueue(){
+}
+
+CommandQueue::Key CommandQueue::makeKey(uint8_t command, uint8_t setting, uint8_t index, int subindex){
+    Key key = ((Key)command << 32) | ((Key)setting << 24) | ((Key)index << 16);
+    if(subindex != UEIRouter::NoSubindex){
+        key |= 0x100 | (uint8_t)subindex;
+    }
+    return key;
+}
+
+void CommandQueue::post(uint8_t command, uint8_t setting, uint8_t option, uint8_t index, int subindex,
+                        uint32_t value, uint8_t valueSize, Callback callback){
+    Key key = makeKey(command, setting, index, subindex);
+
+    Command queued;
+    queued.command = command;
+    queued.option = option;
+    queued.index = index;
+    queued.subindex = subindex;
+    queued.value = value;
+    queued.valueSize = valueSize;
+
+    auto found = m_positions.find(key);
+    if(found != m_positions.end()){
+        // last writer wins, the earlier write never goes out. The new one goes
+        // to the back, after anything posted since that it might overlap
+        // (a data enable covers the HS and SS settings, say).
+        size_t position = found->second;
+        queued.callbacks.swap(m_commands[position].callbacks);
+        m_commands.erase(m_commands.begin() + position);
+        for(auto &entry: m_positions){
+            if(entry.second > position) entry.second--;
+        }
+        m_coalescedCount++;
+    }
+    if(callback) queued.callbacks.push_back(callback);
+
+    m_positions[key] = m_commands.size();
+    m_commands.push_back(queued);
+}
+
+int CommandQueue::flush(UEIRouter &router, unsigned long msTimeout){
+    if(m_commands.empty())
+        return 0;
+
+    // take the batch first, so callbacks can post more writes for the next flush
+    std::vector<Command> batch;
+    batch.swap(m_commands);
+    m_positions.clear();
+
+    for(const Command &queued: batch){
+        std::vector<Callback> callbacks = queued.callbacks;
+        router.submitSet(queued.command, queued.option, queued.index, queued.subindex,
+                         queued.value, queued.valueSize, [callbacks](aErr err, uint32_t value){
+            for(const Callback &callback: callbacks){
+                callback(err, value);
+            }
+        });
+    }
+
+    // anything still outstanding after this hears aErrTimeout from the router
+    router.awaitAll(msTimeout);
+    return (int)batch.size();
+}
+
+void CommandQueue::clear(aErr err){
+    std::vector<Command> batch;
+    batch.swap(m_commands);
+    m_positions.clear();
+
+    for(const Command &queued: batch){
+        for(const Callback &callback: queued.callbacks){
+            callback(err, 0);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <QString>
+
+#include <map>
+#include <vector>
+
+#include "ueirouter.h"
+
+// Collects user writes between flushes so a burst of edits (a spin box being
+// scrolled, a row of checkboxes toggled) turns into one pipelined burst on
+// the link instead of a blocking round trip apiece.
+//
+// Writes are keyed by (command, setting, index, subindex). The setting is the
+// thing being changed, so paired options like usbPowerEnable/usbPowerDisable
+// share one and replace each other. A later write to the same key replaces
+// the earlier one and takes its place at the back of the line, so writes that
+// overlap under different keys still go out in the order they were posted.
+// Every callback posted for the key hears the result of the write that
+// actually went out.
+//
+// Like the router, the queue has to be used from the thread that polls the
+// module.
+class CommandQueue
+{
+public:
+    typedef UEIRouter::Callback Callback;
+
+    CommandQueue();
+    ~CommandQueue();
+
+    void post(uint8_t command, uint8_t setting, uint8_t option, uint8_t index, int subindex,
+              uint32_t value, uint8_t valueSize, Callback callback);
+
+    // send everything queued on the router back to back, then wait for the
+    // replies; the callbacks run before this returns. Returns how many
+    // writes went out.
+    int flush(UEIRouter &router, unsigned long msTimeout = UEIRouter::DefaultTimeoutMs);
+
+    // fail everything queued without sending it
+    void clear(aErr err);
+
+    bool isEmpty() const { return m_commands.empty(); }
+    int pendingCount() const { return (int)m_commands.size(); }
+
+    // running count of writes that were replaced before they were sent
+    uint32_t coalescedCount() const { return m_coalescedCount; }
+
+private:
+    struct Command {
+        uint8_t command;
+        uint8_t option;
+        uint8_t index;
+        int subindex;
+        uint32_t value;
+        uint8_t valueSize;
+        std::vector<Callback> callbacks;
+    };
+
+    typedef uint64_t Key;
+    static Key makeKey(uint8_t command, uint8_t setting, uint8_t index, int subindex);
+
+    // in the order they were last posted
+    std::vector<Command> m_commands;
+    std::map<Key, size_t> m_positions;
+    uint32_t m_coalescedCount;
+};
+
+#endif // COMMANDQUEUE_H
@@ -0,0 +1,124 @@
+#include "connectionmonitor.h"
+
+#include <cstdlib>
+
+// first retry delay, doubled on every failed attempt
+#define RECONNECT_BASE_MS 50
+// backoff ceilings while reconnecting and once the hub is considered lost
+#define RECONNECT_MAX_MS 1000
+#define RECONNECT_LOST_MAX_MS 5000
+// attempts before a hub is considered lost
+#define RECONNECT_LOST_AFTER 8
+// clean poll cycles before a degraded link counts as healthy again
+#define DEGRADED_CLEAN_CYCLES 10
+
+ConnectionMonitor::ConnectionMonitor() :
+    m_state(Connected),
+    m_lostAtMs(0),
+    m_nextAttemptMs(0),
+    m_cleanCycles(0),
+    m_attempts(0),
+    m_totalAttempts(0),
+    m_reconnects(0),
+    m_lastReconnectMs(-1)
+{
+    m_clock.start();
+}
+
+QString ConnectionMonitor::stateName(State state){
+    switch(state){
+    case Connected:     return "connected";
+    case Degraded:      return "degraded";
+    case Reconnecting:  return "reconnecting";
+    case Lost:          return "lost";
+    }
+    return "unknown";
+}
+
+void ConnectionMonitor::cycleFinished(int errors){
+    if(!isUp())
+        return;
+
+    if(errors > 0){
+        m_state = Degraded;
+        m_cleanCycles = 0;
+    }
+    else if(m_state == Degraded && ++m_cleanCycles >= DEGRADED_CLEAN_CYCLES){
+        m_state = Connected;
+    }
+}
+
+void ConnectionMonitor::linkLost(){
+    if(!isUp())
+        return;
+
+    m_state = Reconnecting;
+    m_lostAtMs = m_clock.elapsed();
+    m_nextAttemptMs = m_lostAtMs;
+    m_attempts = 0;
+}
+
+bool ConnectionMonitor::attemptDue() const {
+    return !isUp() && m_clock.elapsed() >= m_nextAttemptMs;
+}
+
+int ConnectionMonitor::msUntilNextAttempt() const {
+    qint64 wait = m_nextAttemptMs - m_clock.elapsed();
+    return wait > 0 ? (int)wait : 0;
+}
+
+void ConnectionMonitor::attemptFailed(){
+    m_attempts++;
+    m_totalAttempts++;
+    if(m_attempts >= RECONNECT_LOST_AFTER){
+        m_state = Lost;
+    }
+
+    // exponential backoff, then +/-25% jitter
+    qint64 ceiling = (m_state == Lost) ? RECONNECT_LOST_MAX_MS : RECONNECT_MAX_MS;
+    qint64 delay = RECONNECT_BASE_MS;
+    for(uint32_t i = 1; i < m_attempts && delay < ceiling; i++){
+        delay *= 2;
+    }
+    if(delay > ceiling) delay = ceiling;
+    delay += (delay * ((rand() % 51) - 25)) / 100;
+
+    m_nextAttemptMs = m_clock.elapsed() + delay;
+}
+
+void ConnectionMonitor::reconnected(){
+    if(isUp())
+        return;
+
+    m_attempts++;
+    m_totalAttempts++;
+    m_reconnects++;
+    m_lastReconnectMs = m_clock.elapsed() - m_lostAtMs;
+
+    // come back degraded until a few polls go through clean
+    m_state = Degraded;
+    m_cleanCycles = 0;
+}
+
+void ConnectionMonitor::retryNow(){
+    if(!isUp()){
+        m_nextAttemptMs = m_clock.elapsed();
+    }
+}
+
+qint64 ConnectionMonitor::outageMs() const {
+    return isUp() ? 0 : m_clock.elapsed() - m_lostAtMs;
+}
+
+QString ConnectionMonitor::summary() const {
+    QString line = QString("link: %1").arg(stateName(m_state));
+    if(!isUp()){
+        line += QString(" for %1ms, %2 attempt(s), next in %3ms")
+                .arg(outageMs()).arg(m_attempts).arg(msUntilNextAttempt());
+    }
+    if(m_reconnects > 0){
+        line += QString(" (%1 reconnect(s), last took %2ms, %3 attempt(s) total)")
+                .arg(m_reconnects).arg(m_lastReconnectMs).arg(m_totalAttempts);
+    }
+    return line;
+}
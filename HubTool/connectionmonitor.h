@@ -0,0 +1,67 @@
+#ifndef CONNECTIONMONITOR_H
+#define CONNECTIONMONITOR_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+// Tracks the health of the link to one hub and paces reconnect attempts.
+//
+//  Connected     polls are coming back clean
+//  Degraded      the link is up but recent polls had failed requests
+//  Reconnecting  the link dropped; attempts back off exponentially (with
+//                jitter, so a fleet of hubs doesn't retry in lock step)
+//  Lost          still gone after several attempts; keep trying, but only
+//                every few seconds
+//
+// The worker asks attemptDue() on each tick instead of reconnecting on every
+// one, and polls again as soon as an attempt succeeds.
+class ConnectionMonitor
+{
+public:
+    enum State {
+        Connected,
+        Degraded,
+        Reconnecting,
+        Lost,
+    };
+
+    ConnectionMonitor();
+
+    State state() const { return m_state; }
+    bool isUp() const { return m_state == Connected || m_state == Degraded; }
+    static QString stateName(State state);
+
+    // the link is up; errors is how many requests failed in the last poll cycle
+    void cycleFinished(int errors);
+
+    // the link dropped; the first attempt is due straight away
+    void linkLost();
+    bool attemptDue() const;
+    int msUntilNextAttempt() const;
+    void attemptFailed();
+    void reconnected();
+
+    // skip the rest of the backoff, e.g. when the hub is seen coming back
+    void retryNow();
+
+    // metrics
+    uint32_t attemptCount() const { return m_attempts; }            // this outage
+    uint32_t totalAttemptCount() const { return m_totalAttempts; }
+    uint32_t reconnectCount() const { return m_reconnects; }
+    qint64 lastReconnectMs() const { return m_lastReconnectMs; }    // outage length, -1 before the first
+    qint64 outageMs() const;                                        // current outage, 0 while up
+    QString summary() const;
+
+private:
+    State m_state;
+    QElapsedTimer m_clock;
+    qint64 m_lostAtMs;
+    qint64 m_nextAttemptMs;
+    int m_cleanCycles;
+    uint32_t m_attempts;
+    uint32_t m_totalAttempts;
+    uint32_t m_reconnects;
+    qint64 m_lastReconnectMs;
+};
+
+#endif // CONNECTIONMONITOR_H
@@ -0,0 +1,467 @@
+#include "controlserver.h"
+#include "connectionmonitor.h"
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonValue>
+
+// a line longer than this isn't a request
+#define CONTROL_MAX_LINE_BYTES 65536
+// a subscriber this far behind misses samples until it catches up
+#define CONTROL_MAX_BACKLOG_BYTES (1024*1024)
+// how long a socket that's already there gets to answer before it's taken over
+#define CONTROL_PROBE_MS 200
+// a worker that hasn't published for this long isn't reporting a live link
+#define CONTROL_STALE_MS 2000
+
+namespace {
+
+// commands that take a port and an on/off, straight onto a worker slot
+struct PortSwitch {
+    const char *name;
+    const char *slot;
+};
+
+const PortSwitch portSwitches[] = {
+    {"set_power",        "changeUSBPortPowerState"},
+    {"set_data",         "changeUSBPortDataState"},
+    {"set_data_hs",      "Slot_userChangedUSBDataState_HS"},
+    {"set_data_ss",      "Slot_userChangedUSBDataState_SS"},
+    {"set_port_enabled", "changeUSBPortEnableState"},
+    {"set_port_mode",    "changeUSBPortMode"},
+};
+
+QString formatSerial(uint32_t serial){
+    return "0x" + QString::number(serial, 16).toUpper().rightJustified(8, '0');
+}
+
+bool readUInt(const QJsonObject &command, const char *key, uint32_t max, uint32_t *value, QString *error){
+    QJsonValue field = command.value(key);
+    double number = field.toDouble(-1);
+    if(!field.isDouble() || number < 0 || number > max || number != (double)(uint32_t)number){
+        *error = QString("\"%1\" must be a whole number from 0 to %2").arg(key).arg(max);
+        return false;
+    }
+    *value = (uint32_t)number;
+    return true;
+}
+
+bool readBool(const QJsonObject &command, const char *key, bool *value, QString *error){
+    QJsonValue field = command.value(key);
+    if(!field.isBool()){
+        *error = QString("\"%1\" must be true or false").arg(key);
+        return false;
+    }
+    *value = field.toBool();
+    return true;
+}
+
+bool readString(const QJsonObject &command, const char *key, QString *value, QString *error){
+    QJsonValue field = command.value(key);
+    if(!field.isString()){
+        *error = QString("\"%1\" must be a string").arg(key);
+        return false;
+    }
+    *value = field.toString();
+    return true;
+}
+
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// ControlListener
+
+ControlListener::ControlListener(QObject *worker, ControlSampleQueue *samples, std::atomic<bool> *drainPending,
+                                 QObject *parent) :
+    QObject(parent),
+    m_worker(worker),
+    m_samples(samples),
+    m_drainPending(drainPending),
+    m_server(nullptr),
+    m_hasLatest(false)
+{
+}
+
+void ControlListener::listen(QString name){
+    close();
+    m_server = new QLocalServer(this);
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(m_server, SIGNAL(newConnection()), this, SLOT(acceptConnections()));
+
+    // a socket file left behind by a HubTool that didn't exit cleanly is
+    // removed, but one that something still answers on is left to its owner
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if(probe.waitForConnected(CONTROL_PROBE_MS)){
+        probe.abort();
+        emit logStringReady(QString("Error serving control API on %1: another program is already serving it").arg(name));
+        close();
+        return;
+    }
+    QLocalServer::removeServer(name);
+    if(!m_server->listen(name)){
+        emit logStringReady(QString("Error serving control API on %1: %2").arg(name).arg(m_server->errorString()));
+        close();
+        return;
+    }
+    emit logStringReady(QString("Serving control API on %1").arg(m_server->fullServerName()));
+}
+
+void ControlListener::close(){
+    for(Client *client: m_clients){
+        client->socket->disconnect(this);
+        client->socket->abort();
+        delete client->socket;
+        delete client;
+    }
+    m_clients.clear();
+
+    if(m_server){
+        m_server->close();
+        delete m_server;
+        m_server = nullptr;
+    }
+}
+
+void ControlListener::acceptConnections(){
+    while(m_server && m_server->hasPendingConnections()){
+        QLocalSocket *socket = m_server->nextPendingConnection();
+        Client *client = new Client;
+        client->socket = socket;
+        client->subscribed = false;
+        client->dropped = 0;
+        m_clients.append(client);
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequests()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(dropClient()));
+    }
+}
+
+void ControlListener::dropClient(){
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    Client *client = clientFor(socket);
+    if(!client)
+        return;
+    m_clients.removeOne(client);
+    socket->disconnect(this);
+    socket->deleteLater();
+    delete client;
+}
+
+ControlListener::Client *ControlListener::clientFor(QLocalSocket *socket){
+    for(Client *client: m_clients){
+        if(client->socket == socket)
+            return client;
+    }
+    return nullptr;
+}
+
+// Answers every complete line that has arrived. A client that pipelines a
+// burst of requests gets all their replies back in one write.
+void ControlListener::readRequests(){
+    Client *client = clientFor(qobject_cast<QLocalSocket*>(sender()));
+    if(!client)
+        return;
+
+    client->pending += client->socket->readAll();
+    QByteArray replies;
+    int start = 0;
+    int end;
+    while((end = client->pending.indexOf('\n', start)) >= 0){
+        QByteArray line = client->pending.mid(start, end - start).trimmed();
+        start = end + 1;
+        if(line.isEmpty())
+            continue;
+
+        QJsonParseError parseError;
+        QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+        QJsonObject reply;
+        if(!document.isObject()){
+            reply["ok"] = false;
+            reply["error"] = parseError.error != QJsonParseError::NoError ? parseError.errorString()
+                                                                          : QString("request must be an object");
+        }
+        else {
+            reply = handle(client, document.object());
+        }
+        replies += QJsonDocument(reply).toJson(QJsonDocument::Compact);
+        replies += '\n';
+    }
+    client->pending.remove(0, start);
+
+    if(!replies.isEmpty()){
+        client->socket->write(replies);
+    }
+    if(client->pending.size() > CONTROL_MAX_LINE_BYTES){
+        emit logStringReady("Control API client sent an overlong line, disconnecting it");
+        client->socket->abort();
+    }
+}
+
+QJsonObject ControlListener::handle(Client *client, const QJsonObject &request){
+    QJsonObject reply;
+    if(request.contains("id")){
+        reply["id"] = request.value("id");
+    }
+
+    QString cmd = request.value("cmd").toString();
+    QString error;
+    if(cmd == "get"){
+        if(!m_hasLatest){
+            error = "no readings yet";
+        }
+        else {
+            reply["hub"] = hubJson();
+        }
+    }
+    else if(cmd == "subscribe"){
+        client->subscribed = true;
+        client->dropped = 0;
+    }
+    else if(cmd == "unsubscribe"){
+        client->subscribed = false;
+    }
+    else if(cmd == "batch"){
+        // each command is checked and queued in turn; one that's wrong
+        // doesn't stop the rest
+        QJsonValue commands = request.value("commands");
+        if(!commands.isArray()){
+            error = "\"commands\" must be an array";
+        }
+        else {
+            QJsonArray results;
+            for(const QJsonValue &command: commands.toArray()){
+                QString commandError;
+                QJsonObject result;
+                if(command.isObject()){
+                    apply(command.toObject(), &commandError);
+                }
+                else {
+                    commandError = "command must be an object";
+                }
+                result["ok"] = commandError.isEmpty();
+                if(!commandError.isEmpty()){
+                    result["error"] = commandError;
+                }
+                results.append(result);
+            }
+            reply["results"] = results;
+        }
+    }
+    else {
+        apply(request, &error);
+    }
+
+    reply["ok"] = error.isEmpty();
+    if(!error.isEmpty()){
+        reply["error"] = error;
+    }
+    return reply;
+}
+
+// Checks a command and queues the matching call on the worker's thread,
+// where it's handled like the same change made from the window.
+void ControlListener::apply(const QJsonObject &command, QString *error){
+    QString cmd = command.value("cmd").toString();
+    int ports = m_hasLatest && m_latest.numUSB ? m_latest.numUSB : 8;
+    uint32_t port = 0;
+    bool enabled = false;
+    uint32_t number = 0;
+    QString text;
+
+    for(const PortSwitch &portSwitch: portSwitches){
+        if(cmd != portSwitch.name)
+            continue;
+        if(readUInt(command, "port", ports - 1, &port, error) && readBool(command, "enabled", &enabled, error)){
+            QMetaObject::invokeMethod(m_worker, portSwitch.slot, Qt::QueuedConnection,
+                                      Q_ARG(int, (int)port), Q_ARG(bool, enabled));
+        }
+        return;
+    }
+
+    if(cmd == "clear_error"){
+        if(readUInt(command, "port", ports - 1, &port, error)){
+            QMetaObject::invokeMethod(m_worker, "clearPortError", Qt::QueuedConnection, Q_ARG(int, (int)port));
+        }
+    }
+    else if(cmd == "set_current_limit"){
+        if(readUInt(command, "port", ports - 1, &port, error) && readUInt(command, "limit", 0xFFFFFFFF, &number, error)){
+            QMetaObject::invokeMethod(m_worker, "changeUSBPortCurrentLimit", Qt::QueuedConnection,
+                                      Q_ARG(int, (int)port), Q_ARG(uint32_t, number));
+        }
+    }
+    else if(cmd == "set_upstream"){
+        if(readUInt(command, "mode", 255, &number, error)){
+            QMetaObject::invokeMethod(m_worker, "changeUpstreamMode", Qt::QueuedConnection, Q_ARG(int, (int)number));
+        }
+    }
+    else if(cmd == "set_upstream_boost" || cmd == "set_downstream_boost"){
+        if(readUInt(command, "boost", 255, &number, error)){
+            QMetaObject::invokeMethod(m_worker, cmd == "set_upstream_boost" ? "changeUpstreamBoost" : "changeDownstreamBoost",
+                                      Qt::QueuedConnection, Q_ARG(uint8_t, (uint8_t)number));
+        }
+    }
+    else if(cmd == "set_enumeration_delay"){
+        if(readUInt(command, "ms", 0xFFFFFFFF, &number, error)){
+            QMetaObject::invokeMethod(m_worker, "changeEnumerationDelay", Qt::QueuedConnection, Q_ARG(uint32_t, number));
+        }
+    }
+    else if(cmd == "set_user_led"){
+        if(readBool(command, "enabled", &enabled, error)){
+            QMetaObject::invokeMethod(m_worker, "changeUserLed", Qt::QueuedConnection, Q_ARG(bool, enabled));
+        }
+    }
+    else if(cmd == "set_port_name"){
+        if(readUInt(command, "port", ports - 1, &port, error) && readString(command, "name", &text, error)){
+            QMetaObject::invokeMethod(m_worker, "changePortName", Qt::QueuedConnection,
+                                      Q_ARG(QString, text), Q_ARG(int, (int)port));
+        }
+    }
+    else if(cmd == "set_system_name"){
+        if(readString(command, "name", &text, error)){
+            QMetaObject::invokeMethod(m_worker, "changeSystemName", Qt::QueuedConnection, Q_ARG(QString, text));
+        }
+    }
+    else if(cmd == "save_state"){
+        QMetaObject::invokeMethod(m_worker, "saveState", Qt::QueuedConnection);
+    }
+    else if(cmd == "reset"){
+        QMetaObject::invokeMethod(m_worker, "resetDevice", Qt::QueuedConnection);
+    }
+    else {
+        *error = cmd.isEmpty() ? QString("missing \"cmd\"") : QString("unknown command \"%1\"").arg(cmd);
+    }
+}
+
+// every reading, in the hub's own units: uV, uA, micro degrees C, uWh, uAh
+QJsonObject ControlListener::hubJson() const {
+    const HubSnapshot &hub = m_latest;
+    QJsonObject json;
+    json["serial"] = formatSerial(hub.serialNumber);
+    json["model"] = formatModel(hub.model);
+    json["firmware"] = (double)hub.firmwareVersion;
+    // the worker publishes when its link drops, but that snapshot can be the
+    // one a full queue loses, so the last one's age counts too
+    bool fresh = QDateTime::currentMSecsSinceEpoch() - hub.timestampMs <= CONTROL_STALE_MS;
+    json["connected"] = fresh && hub.connectionState <= ConnectionMonitor::Degraded;
+    json["seq"] = (double)hub.sequence;
+    json["ts"] = (double)hub.timestampMs;
+    json["poll_rate"] = hub.achievedRate;
+    json["temperature"] = hub.temperature;
+    json["input_voltage"] = (double)hub.inputVoltage;
+    json["input_current"] = (double)hub.inputCurrent;
+    if(hub.hasUptime){
+        json["uptime_minutes"] = (double)hub.uptime;
+    }
+    json["hub_mode"] = (double)hub.hubMode;
+    json["user_led"] = hub.userLed != 0;
+    json["upstream_port"] = hub.upstreamPortState;
+    json["upstream_mode"] = hub.upstreamMode;
+    json["upstream_boost"] = hub.upstreamBoost;
+    json["downstream_boost"] = hub.downstreamBoost;
+    json["enumeration_delay"] = (double)hub.enumerationDelay;
+    json["energy"] = (double)hub.hubEnergy;
+    json["charge"] = (double)hub.hubCharge;
+
+    QJsonArray ports;
+    for(int port = 0; port < hub.numUSB && port < 8; port++){
+        QJsonObject portJson;
+        portJson["voltage"] = hub.portVoltage[port];
+        portJson["current"] = hub.portCurrent[port];
+        portJson["current_limit"] = (double)hub.currentLimit[port];
+        portJson["state"] = (double)hub.portState[port];
+        portJson["error"] = (double)hub.portError[port];
+        portJson["mode"] = hub.portMode[port];
+        portJson["energy"] = (double)hub.portEnergy[port];
+        portJson["charge"] = (double)hub.portCharge[port];
+        ports.append(portJson);
+    }
+    json["ports"] = ports;
+    return json;
+}
+
+// Keeps the newest snapshot for "get" and streams each new V/I reading to
+// the subscribers. One that isn't reading its socket has samples skipped,
+// and told how many, rather than being buffered without end.
+void ControlListener::drainSamples(){
+    m_drainPending->store(false, std::memory_order_release);
+
+    HubSnapshot snapshot;
+    while(m_samples->pop(snapshot)){
+        m_latest = snapshot;
+        m_hasLatest = true;
+        if(!(snapshot.changed & HubSnapshot::ChangedPortVoltageCurrent))
+            continue;
+
+        QJsonObject sample;
+        bool built = false;
+        for(Client *client: m_clients){
+            if(!client->subscribed)
+                continue;
+            if(client->socket->bytesToWrite() > CONTROL_MAX_BACKLOG_BYTES){
+                client->dropped++;
+                continue;
+            }
+            if(!built){
+                QJsonArray voltage, current;
+                for(int port = 0; port < snapshot.numUSB && port < 8; port++){
+                    voltage.append(snapshot.portVoltage[port]);
+                    current.append(snapshot.portCurrent[port]);
+                }
+                sample["event"] = "sample";
+                sample["seq"] = (double)snapshot.sequence;
+                sample["ts"] = (double)snapshot.timestampMs;
+                sample["voltage"] = voltage;
+                sample["current"] = current;
+                built = true;
+            }
+            if(client->dropped){
+                QJsonObject late = sample;
+                late["dropped"] = (double)client->dropped;
+                client->dropped = 0;
+                send(client, late);
+            }
+            else {
+                send(client, sample);
+            }
+        }
+    }
+}
+
+void ControlListener::send(Client *client, const QJsonObject &message){
+    QByteArray line = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    line += '\n';
+    client->socket->write(line);
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// ControlServer
+
+ControlServer::ControlServer(QObject *worker, QObject *parent) :
+    QObject(parent),
+    m_drainPending(false)
+{
+    m_listener = new ControlListener(worker, &m_samples, &m_drainPending);
+    m_listener->moveToThread(&m_thread);
+    connect(m_listener, SIGNAL(logStringReady(QString)), this, SIGNAL(logStringReady(QString)));
+    connect(&m_thread, SIGNAL(finished()), m_listener, SLOT(close()));
+    m_thread.start();
+}
+
+ControlServer::~ControlServer(){
+    m_thread.quit();
+    m_thread.wait();
+    delete m_listener;
+}
+
+void ControlServer::listen(const QString &name){
+    QMetaObject::invokeMethod(m_listener, "listen", Qt::QueuedConnection, Q_ARG(QString, name));
+}
+
+void ControlServer::publish(const HubSnapshot &snapshot){
+    if(!m_samples.push(snapshot))
+        return;
+    if(!m_drainPending.exchange(true, std::memory_order_acq_rel)){
+        QMetaObject::invokeMethod(m_listener, "drainSamples", Qt::QueuedConnection);
+    }
+}
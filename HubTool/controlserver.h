@@ -0,0 +1,120 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <QThread>
+#include <QString>
+#include <QList>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <atomic>
+
+#include "hubsnapshot.h"
+
+#define CONTROL_SAMPLE_QUEUE_SIZE 1024
+
+typedef SpscRing<HubSnapshot, CONTROL_SAMPLE_QUEUE_SIZE> ControlSampleQueue;
+
+// The socket side of the control API, on the server's own thread. Commands
+// are queued calls to the worker's slots, the same ones the GUI's controls
+// use, so they never wait on a poll and a poll never waits on them.
+class ControlListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    ControlListener(QObject *worker, ControlSampleQueue *samples, std::atomic<bool> *drainPending,
+                    QObject *parent = nullptr);
+
+signals:
+    void logStringReady(QString logLine);
+
+public slots:
+    void listen(QString name);
+    void close();
+    void drainSamples();
+
+private slots:
+    void acceptConnections();
+    void readRequests();
+    void dropClient();
+
+private:
+    struct Client {
+        QLocalSocket *socket;
+        QByteArray pending;         // a partial line
+        bool subscribed;
+        uint32_t dropped;           // samples skipped while the client was behind
+    };
+
+    Client *clientFor(QLocalSocket *socket);
+    QJsonObject handle(Client *client, const QJsonObject &request);
+    void apply(const QJsonObject &command, QString *error);
+    QJsonObject hubJson() const;
+    void send(Client *client, const QJsonObject &message);
+
+    QObject *m_worker;
+    ControlSampleQueue *m_samples;
+    std::atomic<bool> *m_drainPending;
+    QLocalServer *m_server;
+    QList<Client*> m_clients;
+
+    HubSnapshot m_latest;
+    bool m_hasLatest;
+};
+
+// Lets other programs on the same machine drive the hub HubTool is
+// connected to, instead of opening it themselves. The socket (a Unix domain
+// socket, or a named pipe on Windows) only lets in the user running HubTool.
+//
+// One JSON object per line each way. Every request may carry an "id", which
+// comes back in its reply:
+//   {"id":1, "cmd":"set_power", "port":2, "enabled":false}
+//   {"id":1, "ok":true}
+//   {"id":2, "cmd":"get"}
+//   {"id":2, "ok":true, "hub":{"serial":"0x...", ..., "ports":[{...}, ...]}}
+//   {"id":3, "cmd":"batch", "commands":[{"cmd":"set_power", ...}, ...]}
+//   {"id":3, "ok":true, "results":[{"ok":true}, ...]}
+//   {"id":4, "cmd":"subscribe"}      then {"event":"sample", ...} per poll
+//   {"id":5, "cmd":"unsubscribe"}
+//
+// Port commands take "port" and "enabled": set_power, set_data, set_data_hs,
+// set_data_ss, set_port_enabled, set_port_mode; also clear_error (port),
+// set_current_limit (port, "limit" in uA). Hub commands: set_upstream
+// ("mode"), set_upstream_boost, set_downstream_boost ("boost"),
+// set_enumeration_delay ("ms"), set_user_led ("enabled"), set_port_name
+// ("port", "name"), set_system_name ("name"), save_state, reset.
+//
+// "ok" means the command was handed to the worker; a write the hub refuses
+// shows up in the log and in the next reading. A batch's port writes reach
+// the worker together and go out on the link in one burst.
+class ControlServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ControlServer(QObject *worker, QObject *parent = nullptr);
+    ~ControlServer();
+
+    // a name is put in the system's temporary directory, a path is used as
+    // is; failures come back through logStringReady. A socket another
+    // program is still serving isn't taken over.
+    void listen(const QString &name);
+
+    // every snapshot, from the one thread draining the worker's queue;
+    // dropped if the server has fallen a whole queue behind
+    void publish(const HubSnapshot &snapshot);
+
+signals:
+    void logStringReady(QString logLine);
+
+private:
+    ControlSampleQueue m_samples;
+    std::atomic<bool> m_drainPending;
+    QThread m_thread;
+    ControlListener *m_listener;
+};
+
+#endif // CONTROLSERVER_H
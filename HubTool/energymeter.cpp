@@ -0,0 +1,258 @@
+#include "energymeter.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDateTime>
+
+#include <string.h>
+
+#define ENERGY_FILE_MAGIC "HUBNRG01"
+#define ENERGY_FILE_VERSION 1
+
+// 1 uWh = 3.6 mJ, 1 uAh = 3.6 mC
+#define FEMTOJOULES_PER_MICROWATT_HOUR 3600000000000LL
+#define PICOCOULOMBS_PER_MICROAMP_HOUR 3600000000LL
+
+namespace {
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t serialNumber;
+    uint32_t numPorts;
+    uint32_t reserved;
+};
+
+// whole units move up out of the remainder; either may be negative
+inline void carry(int64_t *remainder, int64_t *whole, int64_t unit){
+    int64_t units = *remainder/unit;
+    *whole += units;
+    *remainder -= units*unit;
+}
+
+}
+
+EnergyMeter::EnergyMeter() :
+    m_open(false),
+    m_serialNumber(0),
+    m_numPorts(0),
+    m_hasLast(false),
+    m_lastUs(0),
+    m_savedUs(0),
+    m_writePending(false),
+    m_stopWriting(false)
+{
+    memset(m_ports, 0, sizeof(m_ports));
+    memset(m_pendingPorts, 0, sizeof(m_pendingPorts));
+    memset(m_lastNanoWatts, 0, sizeof(m_lastNanoWatts));
+    memset(m_lastMicroAmps, 0, sizeof(m_lastMicroAmps));
+}
+
+EnergyMeter::~EnergyMeter(){
+    close();
+}
+
+bool EnergyMeter::open(const QString &path, uint32_t serialNumber, int numPorts){
+    close();
+    m_error.clear();
+    m_path = path;
+    m_serialNumber = serialNumber;
+    m_numPorts = qBound(1, numPorts, 8);
+    m_hasLast = false;
+
+    memset(m_ports, 0, sizeof(m_ports));
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for(int port = 0; port < 8; port++){
+        m_ports[port].sinceMs = now;
+    }
+
+    // a file for another hub, or one that's damaged, starts the totals over
+    if(QFile::exists(path) && !load()){
+        memset(m_ports, 0, sizeof(m_ports));
+        for(int port = 0; port < 8; port++){
+            m_ports[port].sinceMs = now;
+        }
+    }
+
+    m_open = true;
+    if(!save()){
+        m_open = false;
+        return false;
+    }
+
+    m_writePending = false;
+    m_stopWriting = false;
+    m_writer = std::thread(&EnergyMeter::writeLoop, this);
+    return true;
+}
+
+// a save still waiting on the writer is overtaken by the one made here
+void EnergyMeter::close(){
+    if(!m_open)
+        return;
+    stopWriter();
+    save();
+    m_open = false;
+    m_hasLast = false;
+}
+
+void EnergyMeter::stopWriter(){
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        m_stopWriting = true;
+    }
+    m_writeWake.notify_one();
+    if(m_writer.joinable()){
+        m_writer.join();
+    }
+}
+
+bool EnergyMeter::load(){
+    QFile file(m_path);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    FileHeader header;
+    if(file.read((char*)&header, sizeof(header)) != sizeof(header)
+       || memcmp(header.magic, ENERGY_FILE_MAGIC, sizeof(header.magic)) != 0
+       || header.version != ENERGY_FILE_VERSION
+       || header.serialNumber != m_serialNumber
+       || header.numPorts < 1 || header.numPorts > 8)
+        return false;
+
+    qint64 bytes = (qint64)(header.numPorts*sizeof(Port));
+    return file.read((char*)m_ports, bytes) == bytes;
+}
+
+bool EnergyMeter::save(){
+    if(!m_open)
+        return false;
+
+    return write(m_ports, &m_error);
+}
+
+// written aside and renamed over the old file, so a crash never leaves half of one
+bool EnergyMeter::write(const Port *ports, QString *error) const {
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ENERGY_FILE_MAGIC, sizeof(header.magic));
+    header.version = ENERGY_FILE_VERSION;
+    header.serialNumber = m_serialNumber;
+    header.numPorts = (uint32_t)m_numPorts;
+
+    QSaveFile file(m_path);
+    qint64 bytes = (qint64)(m_numPorts*sizeof(Port));
+    if(!file.open(QIODevice::WriteOnly)
+       || file.write((const char*)&header, sizeof(header)) != sizeof(header)
+       || file.write((const char*)ports, bytes) != bytes
+       || !file.commit()){
+        *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+void EnergyMeter::saveLater(){
+    if(!m_open)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        memcpy(m_pendingPorts, m_ports, sizeof(m_ports));
+        m_writePending = true;
+    }
+    m_writeWake.notify_one();
+}
+
+// a failed save is tried again with the next totals
+void EnergyMeter::writeLoop(){
+    Port ports[8];
+    QString error;
+
+    std::unique_lock<std::mutex> lock(m_writeLock);
+    while(true){
+        m_writeWake.wait(lock, [this]{ return m_writePending || m_stopWriting; });
+        if(m_stopWriting)
+            return;
+
+        memcpy(ports, m_pendingPorts, sizeof(ports));
+        m_writePending = false;
+
+        lock.unlock();
+        write(ports, &error);
+        lock.lock();
+    }
+}
+
+void EnergyMeter::addSample(int64_t timeUs, const int32_t *microVolts, const int32_t *microAmps){
+    if(!m_open)
+        return;
+
+    int64_t nanoWatts[8];
+    for(int port = 0; port < m_numPorts; port++){
+        nanoWatts[port] = (int64_t)microVolts[port]*microAmps[port]/1000;
+    }
+
+    int64_t spanUs = timeUs - m_lastUs;
+    if(m_hasLast && spanUs > 0 && spanUs <= MaxGapUs){
+        for(int port = 0; port < m_numPorts; port++){
+            // nW*us is fJ and uA*us is pC; neither gets near overflowing within MaxGapUs
+            Port &totals = m_ports[port];
+            totals.femtoJoules += (m_lastNanoWatts[port] + nanoWatts[port])*spanUs/2;
+            totals.picoCoulombs += ((int64_t)m_lastMicroAmps[port] + microAmps[port])*spanUs/2;
+            carry(&totals.femtoJoules, &totals.microWattHours, FEMTOJOULES_PER_MICROWATT_HOUR);
+            carry(&totals.picoCoulombs, &totals.microAmpHours, PICOCOULOMBS_PER_MICROAMP_HOUR);
+            totals.coveredUs += spanUs;
+        }
+    }
+
+    m_hasLast = true;
+    m_lastUs = timeUs;
+    memcpy(m_lastNanoWatts, nanoWatts, m_numPorts*sizeof(int64_t));
+    memcpy(m_lastMicroAmps, microAmps, m_numPorts*sizeof(int32_t));
+
+    if(timeUs - m_savedUs >= SaveIntervalUs){
+        m_savedUs = timeUs;
+        saveLater();
+    }
+}
+
+void EnergyMeter::reset(int port, int64_t nowMs){
+    for(int p = 0; p < m_numPorts; p++){
+        if(port < 0 || port == p){
+            memset(&m_ports[p], 0, sizeof(Port));
+            m_ports[p].sinceMs = nowMs;
+        }
+    }
+    saveLater();
+}
+
+EnergyMeter::Totals EnergyMeter::port(int port) const {
+    Totals totals = {0, 0, 0, 0};
+    if(port < 0 || port >= m_numPorts)
+        return totals;
+
+    totals.microWattHours = m_ports[port].microWattHours;
+    totals.microAmpHours = m_ports[port].microAmpHours;
+    totals.sinceMs = m_ports[port].sinceMs;
+    totals.coveredUs = m_ports[port].coveredUs;
+    return totals;
+}
+
+// the ports' remainders can make up whole units between them
+EnergyMeter::Totals EnergyMeter::hub() const {
+    Totals totals = {0, 0, 0, 0};
+    int64_t femtoJoules = 0;
+    int64_t picoCoulombs = 0;
+    for(int port = 0; port < m_numPorts; port++){
+        totals.microWattHours += m_ports[port].microWattHours;
+        totals.microAmpHours += m_ports[port].microAmpHours;
+        femtoJoules += m_ports[port].femtoJoules;
+        picoCoulombs += m_ports[port].picoCoulombs;
+        totals.sinceMs = port ? qMin(totals.sinceMs, m_ports[port].sinceMs) : m_ports[port].sinceMs;
+        totals.coveredUs = qMax(totals.coveredUs, m_ports[port].coveredUs);
+    }
+    carry(&femtoJoules, &totals.microWattHours, FEMTOJOULES_PER_MICROWATT_HOUR);
+    carry(&picoCoulombs, &totals.microAmpHours, PICOCOULOMBS_PER_MICROAMP_HOUR);
+    return totals;
+}
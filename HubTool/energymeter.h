@@ -0,0 +1,119 @@
+#ifndef ENERGYMETER_H
+#define ENERGYMETER_H
+
+#include <QString>
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Each port's energy and charge since it was last reset, worked out from the
+// voltage and current readings the worker polls anyway. Every pair of
+// readings adds the trapezoid between them, using the times they were read,
+// so an uneven poll rate doesn't skew the totals. A gap longer than MaxGapUs
+// (the link was lost, or the app wasn't running) isn't counted; the next
+// reading starts over from there.
+//
+// Sums are kept as integers, uWh and uAh plus what's left below one of
+// those in fJ and pC, so they don't drift however long they run.
+//
+// Totals belong to one hub and are saved to its file every SaveIntervalUs
+// and on close, then picked up again by open(), so they carry on across
+// reconnects and restarts. The periodic saves (and the one after a reset)
+// are handed to a thread of the meter's own, so the caller's thread never
+// waits on the disk; open() and close() save on the spot.
+//
+// File, little endian:
+//   char magic[8]          "HUBNRG01"
+//   uint32 version         1
+//   uint32 serialNumber
+//   uint32 numPorts
+//   uint32 reserved
+//   per port:
+//     int64 microWattHours
+//     int64 microAmpHours
+//     int64 femtoJoules    below one uWh
+//     int64 picoCoulombs   below one uAh
+//     int64 sinceMs        epoch time of the last reset
+//     int64 coveredUs      time the totals cover
+class EnergyMeter
+{
+public:
+    static const int64_t MaxGapUs = 5000000;
+    static const int64_t SaveIntervalUs = 10000000;
+
+    struct Totals {
+        int64_t microWattHours;
+        int64_t microAmpHours;
+        int64_t sinceMs;
+        int64_t coveredUs;
+    };
+
+    EnergyMeter();
+    ~EnergyMeter();
+
+    // carries on from the totals in path if it has them for this hub
+    bool open(const QString &path, uint32_t serialNumber, int numPorts);
+    void close();
+    bool save();
+    bool isOpen() const { return m_open; }
+    uint32_t serialNumber() const { return m_serialNumber; }
+    int numPorts() const { return m_numPorts; }
+    QString path() const { return m_path; }
+    QString errorString() const { return m_error; }
+
+    // timeUs only has to be monotonic; it isn't saved
+    void addSample(int64_t timeUs, const int32_t *microVolts, const int32_t *microAmps);
+
+    // the next reading starts over rather than joining up with the last
+    void restart() { m_hasLast = false; }
+
+    // port -1 for every port
+    void reset(int port, int64_t nowMs);
+
+    Totals port(int port) const;
+    Totals hub() const;
+
+private:
+    struct Port {
+        int64_t microWattHours;
+        int64_t microAmpHours;
+        int64_t femtoJoules;
+        int64_t picoCoulombs;
+        int64_t sinceMs;
+        int64_t coveredUs;
+    };
+
+    bool load();
+    bool write(const Port *ports, QString *error) const;
+    void saveLater();
+    void writeLoop();
+    void stopWriter();
+
+    QString m_path;
+    QString m_error;
+    bool m_open;
+    uint32_t m_serialNumber;
+    int m_numPorts;
+    Port m_ports[8];
+
+    // the previous reading, the start of the next trapezoid
+    bool m_hasLast;
+    int64_t m_lastUs;
+    int64_t m_lastNanoWatts[8];
+    int32_t m_lastMicroAmps[8];
+
+    int64_t m_savedUs;
+
+    // the latest totals waiting for the writer thread; a newer copy replaces
+    // one it hasn't got to yet
+    std::thread m_writer;
+    std::mutex m_writeLock;
+    std::condition_variable m_writeWake;
+    bool m_writePending;
+    bool m_stopWriting;
+    Port m_pendingPorts[8];
+};
+
+#endif // ENERGYMETER_H
@@ -0,0 +1,107 @@
+#include "energywindow.h"
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QDateTime>
+
+#define ENERGY_SINCE_FMT "yyyy.MM.dd HH:mm:ss"
+
+enum EnergyColumn {
+    columnPort = 0,
+    columnEnergy,
+    columnCharge,
+    columnSince,
+    columnTotal
+};
+
+EnergyWindow::EnergyWindow(QWidget *parent) :
+    QWidget(parent),
+    m_numPorts(0)
+{
+    setWindowTitle("Port energy");
+
+    m_table = new QTableWidget(0, columnTotal, this);
+    m_statusLabel = new QLabel("Waiting for the hub...", this);
+    m_resetButton = new QPushButton("Reset Selected", this);
+    m_resetAllButton = new QPushButton("Reset All", this);
+
+    QStringList headers;
+    headers << "Port" << "Energy (mWh)" << "Charge (mAh)" << "Since";
+    m_table->setHorizontalHeaderLabels(headers);
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->verticalHeader()->setVisible(false);
+    m_table->horizontalHeader()->setSectionResizeMode(columnSince, QHeaderView::Stretch);
+
+    QHBoxLayout *buttons = new QHBoxLayout();
+    buttons->addWidget(m_statusLabel, 1);
+    buttons->addWidget(m_resetButton);
+    buttons->addWidget(m_resetAllButton);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(m_table);
+    layout->addLayout(buttons);
+    setLayout(layout);
+    resize(600, 360);
+
+    connect(m_resetButton, SIGNAL(clicked()), this, SLOT(resetSelected()));
+    connect(m_resetAllButton, SIGNAL(clicked()), this, SLOT(resetAll()));
+}
+
+void EnergyWindow::setCell(int row, int column, const QString &text){
+    // reuse the items so a refresh doesn't allocate a new one per cell
+    QTableWidgetItem *item = m_table->item(row, column);
+    if(!item){
+        item = new QTableWidgetItem();
+        if(column == columnEnergy || column == columnCharge) item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        m_table->setItem(row, column, item);
+    }
+    if(item->text() != text){
+        item->setText(text);
+    }
+}
+
+// one row per port, then the hub's
+void EnergyWindow::showEnergy(const HubSnapshot &snapshot){
+    if(!isVisible())
+        return;
+
+    m_numPorts = snapshot.numUSB;
+    if(m_table->rowCount() != m_numPorts + 1){
+        m_table->setRowCount(m_numPorts + 1);
+    }
+
+    qint64 oldest = 0;
+    for(int port = 0; port < m_numPorts; port++){
+        setCell(port, columnPort, QString("Port %1").arg(port));
+        setCell(port, columnEnergy, QString::number(snapshot.portEnergy[port]/1000.0, 'f', 3));
+        setCell(port, columnCharge, QString::number(snapshot.portCharge[port]/1000.0, 'f', 3));
+        setCell(port, columnSince, QDateTime::fromMSecsSinceEpoch(snapshot.energySinceMs[port]).toString(ENERGY_SINCE_FMT));
+        if(port == 0 || snapshot.energySinceMs[port] < oldest){
+            oldest = snapshot.energySinceMs[port];
+        }
+    }
+
+    setCell(m_numPorts, columnPort, "Hub");
+    setCell(m_numPorts, columnEnergy, QString::number(snapshot.hubEnergy/1000.0, 'f', 3));
+    setCell(m_numPorts, columnCharge, QString::number(snapshot.hubCharge/1000.0, 'f', 3));
+    setCell(m_numPorts, columnSince, QDateTime::fromMSecsSinceEpoch(oldest).toString(ENERGY_SINCE_FMT));
+
+    m_statusLabel->setText(QString("Hub %1, updated %2")
+                           .arg(QString("%1").arg(snapshot.serialNumber, 8, 16, QChar('0')).toUpper())
+                           .arg(QTime::currentTime().toString("HH:mm:ss")));
+}
+
+// the hub row resets every port
+void EnergyWindow::resetSelected(){
+    QList<QTableWidgetSelectionRange> ranges = m_table->selectedRanges();
+    for(const QTableWidgetSelectionRange &range: ranges){
+        for(int row = range.topRow(); row <= range.bottomRow(); row++){
+            emit userResetEnergy(row >= m_numPorts ? -1 : row);
+        }
+    }
+}
+
+void EnergyWindow::resetAll(){
+    emit userResetEnergy(-1);
+}
@@ -0,0 +1,42 @@
+#ifndef ENERGYWINDOW_H
+#define ENERGYWINDOW_H
+
+#include <QWidget>
+#include <QTableWidget>
+#include <QLabel>
+#include <QPushButton>
+
+#include "hubsnapshot.h"
+
+// Each port's energy and charge since it was reset, and the hub's total,
+// from the worker's snapshots. Resetting goes to the worker, which keeps the
+// totals.
+class EnergyWindow : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit EnergyWindow(QWidget *parent = nullptr);
+
+    // only looked at while the window is showing
+    void showEnergy(const HubSnapshot &snapshot);
+
+signals:
+    // port -1 for every port
+    void userResetEnergy(int port);
+
+private slots:
+    void resetSelected();
+    void resetAll();
+
+private:
+    void setCell(int row, int column, const QString &text);
+
+    QTableWidget *m_table;
+    QLabel *m_statusLabel;
+    QPushButton *m_resetButton;
+    QPushButton *m_resetAllButton;
+    int m_numPorts;
+};
+
+#endif // ENERGYWINDOW_H
@@ -0,0 +1,89 @@
+#include "exportprogressdialog.h"
+#include "plotwindow.h"
+
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
+#include <QStandardPaths>
+#include <QDir>
+#include <QDateTime>
+
+#define EXPORT_CSV_FILTER "Comma Separated Value (*.csv)"
+#define EXPORT_BINARY_FILTER "HubTool binary export (*.hubexp)"
+
+void ExportProgressDialog::exportPorts(QWidget *parent, const QList<PlotWindow*> &windows, qint64 startMs){
+    QString defaultName = windows.size() == 1
+            ? QString("port%1-%2.csv").arg(windows.first()->port())
+            : QString("ports-%1.csv");
+    defaultName = defaultName.arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+
+    QString filter;
+    QString path = QFileDialog::getSaveFileName(parent, "Export samples to",
+                                                QDir(QStandardPaths::writableLocation(QStandardPaths::DesktopLocation)).filePath(defaultName),
+                                                EXPORT_CSV_FILTER ";;" EXPORT_BINARY_FILTER, &filter);
+    if(path.isEmpty())
+        return;
+
+    // picking the binary filter without typing the extension still means binary
+    SampleExporter::Format format = SampleExporter::formatForPath(path);
+    if(filter == EXPORT_BINARY_FILTER && QFileInfo(path).suffix().isEmpty()){
+        path += ".hubexp";
+        format = SampleExporter::Binary;
+    }
+
+    // the samples are copied now, so the plots can keep going while it writes
+    SampleExporter *exporter = new SampleExporter(path, format, startMs);
+    for(PlotWindow *window: windows){
+        exporter->addPort(window->exportSeries());
+    }
+
+    ExportProgressDialog *dialog = new ExportProgressDialog(exporter, parent);
+    dialog->show();
+}
+
+ExportProgressDialog::ExportProgressDialog(SampleExporter *exporter, QWidget *parent) :
+    QProgressDialog(parent),
+    m_exporter(exporter)
+{
+    setWindowTitle("Exporting samples");
+    setLabelText(QString("Exporting to %1").arg(QFileInfo(exporter->path()).fileName()));
+    setRange(0, 100);
+    setAutoClose(false);
+    setAutoReset(false);
+    setMinimumDuration(0);
+
+    m_exporter->moveToThread(&m_thread);
+    connect(&m_thread, SIGNAL(started()), m_exporter, SLOT(run()));
+    connect(m_exporter, SIGNAL(progress(int)), this, SLOT(setValue(int)), Qt::QueuedConnection);
+    connect(m_exporter, SIGNAL(finished(bool,QString)), this, SLOT(handleFinished(bool,QString)), Qt::QueuedConnection);
+    connect(this, SIGNAL(canceled()), this, SLOT(cancelExport()));
+    m_thread.start();
+}
+
+ExportProgressDialog::~ExportProgressDialog(){
+    if(m_exporter){
+        m_exporter->cancel();
+        m_thread.quit();
+        m_thread.wait();
+        delete m_exporter;
+    }
+}
+
+// the exporter is busy in run(), so this can't go through its thread's queue
+void ExportProgressDialog::cancelExport(){
+    setLabelText("Canceling...");
+    m_exporter->cancel();
+}
+
+void ExportProgressDialog::handleFinished(bool ok, QString message){
+    m_thread.quit();
+    m_thread.wait();
+    delete m_exporter;
+    m_exporter = nullptr;
+
+    if(!ok && !wasCanceled()){
+        QMessageBox::information(parentWidget(), "Error", message);
+    }
+    close();
+    deleteLater();
+}
@@ -0,0 +1,36 @@
+#ifndef EXPORTPROGRESSDIALOG_H
+#define EXPORTPROGRESSDIALOG_H
+
+#include <QProgressDialog>
+#include <QThread>
+#include <QList>
+
+#include "sampleexporter.h"
+
+class PlotWindow;
+
+// Runs a SampleExporter on a thread of its own and shows how far it's got.
+// Cancel stops the export and removes the half written file. The dialog
+// isn't modal and deletes itself once the export is done.
+class ExportProgressDialog : public QProgressDialog
+{
+    Q_OBJECT
+
+public:
+    // asks where to save, then exports every window's samples into that one file
+    static void exportPorts(QWidget *parent, const QList<PlotWindow*> &windows, qint64 startMs);
+
+    ~ExportProgressDialog();
+
+private slots:
+    void cancelExport();
+    void handleFinished(bool ok, QString message);
+
+private:
+    ExportProgressDialog(SampleExporter *exporter, QWidget *parent);
+
+    SampleExporter *m_exporter;
+    QThread m_thread;
+};
+
+#endif // EXPORTPROGRESSDIALOG_H
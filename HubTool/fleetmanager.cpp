@@ -0,0 +1,319 @@
+#include "fleetmanager.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <QDir>
+
+#include <list>
+#include <string.h>
+
+#define FLEET_DISPATCH_INTERVAL_MS 5
+
+// ////////////////////////////////////////////////////////////////////////////
+// FleetHub
+
+FleetHub::FleetHub(const linkSpec &spec, QObject *parent) :
+    QObject(parent),
+    busy(false),
+    started(false),
+    lastPollDoneMs(0),
+    nextPollDelayMs(0),
+    retiring(false),
+    m_spec(spec),
+    m_captureChanged(false)
+{
+    m_worker = new StemWorker(&m_spec);
+
+    m_summary.serialNumber = spec.serial_num;
+    m_summary.model = (spec.model == aMODULE_TYPE_USBHub2x4) ? "USBHub2x4" : "USBHub3+";
+    m_summary.firmwareVersion = 0;
+    m_summary.connected = false;
+    m_summary.updateRate = 0.0;
+    m_summary.inputVoltage = 0;
+    m_summary.inputCurrent = 0;
+    m_summary.numUSB = (spec.model == aMODULE_TYPE_USBHub2x4) ? 4 : 8;
+    m_summary.hubEnergy = 0;
+    m_summary.hubCharge = 0;
+    memset(&m_summary.snapshot, 0, sizeof(m_summary.snapshot));
+    for(int i = 0; i < 8; i++){
+        m_summary.portVoltage[i] = 0;
+        m_summary.portCurrent[i] = 0;
+        m_summary.portEnergy[i] = 0;
+        m_summary.portCharge[i] = 0;
+    }
+
+    // direct connections: the slots run on the pool thread that emitted them
+    connect(m_worker, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)), Qt::DirectConnection);
+}
+
+FleetHub::~FleetHub(){
+    delete m_worker;
+}
+
+FleetHubSummary FleetHub::summary(){
+    HubSnapshotQueue* queue = m_worker->snapshots();
+    HubSnapshot snapshot;
+
+    QMutexLocker locker(&m_summaryLock);
+    while(queue->pop(snapshot)){
+        if(snapshot.changed & HubSnapshot::ChangedPortVoltageCurrent){
+            for(int channel = 0; channel < snapshot.numUSB && channel < 8; channel++){
+                m_summary.portVoltage[channel] = snapshot.portVoltage[channel];
+                m_summary.portCurrent[channel] = snapshot.portCurrent[channel];
+            }
+        }
+        for(int channel = 0; channel < snapshot.numUSB && channel < 8; channel++){
+            if(snapshot.portStateChanged & (1 << channel)){
+                int8_t spd;
+                m_summary.portState[channel] = formatPortState(snapshot.portState[channel], &spd);
+            }
+        }
+        if(snapshot.changed & HubSnapshot::ChangedEnergy){
+            for(int channel = 0; channel < snapshot.numUSB && channel < 8; channel++){
+                m_summary.portEnergy[channel] = snapshot.portEnergy[channel];
+                m_summary.portCharge[channel] = snapshot.portCharge[channel];
+            }
+            m_summary.hubEnergy = snapshot.hubEnergy;
+            m_summary.hubCharge = snapshot.hubCharge;
+        }
+        if(snapshot.changed & HubSnapshot::ChangedTemperature){
+            m_summary.temperature = formatTemperature(snapshot);
+        }
+        if(snapshot.changed & (HubSnapshot::ChangedInputVoltage | HubSnapshot::ChangedInputVoltageCurrent)){
+            m_summary.inputVoltage = snapshot.inputVoltage;
+            m_summary.inputCurrent = snapshot.inputCurrent;
+        }
+        if(snapshot.changed & HubSnapshot::ChangedStemInfo){
+            m_summary.serialNumber = snapshot.serialNumber;
+            m_summary.model = formatModel(snapshot.model);
+            m_summary.firmwareVersion = snapshot.firmwareVersion;
+        }
+        m_summary.connected = snapshot.connectionState <= ConnectionMonitor::Degraded;
+        m_summary.numUSB = snapshot.numUSB;
+        m_summary.updateRate = snapshot.achievedRate;
+        m_summary.snapshot = snapshot;
+    }
+    return m_summary;
+}
+
+void FleetHub::setCapturePath(const QString &path){
+    QMutexLocker locker(&m_captureLock);
+    m_capturePath = path;
+    m_captureChanged = true;
+}
+
+bool FleetHub::takeCapturePath(QString *path){
+    QMutexLocker locker(&m_captureLock);
+    if(!m_captureChanged)
+        return false;
+    *path = m_capturePath;
+    m_captureChanged = false;
+    return true;
+}
+
+// the link state comes from the snapshots; the line is kept for the
+// dashboard and passed on for hubtoold's log
+void FleetHub::handleLogString(QString logLine){
+    {
+        QMutexLocker locker(&m_summaryLock);
+        m_summary.lastLogLine = logLine;
+    }
+    emit logStringReady(QString("0x%1").arg(m_spec.serial_num, 8, 16, QChar('0')).toUpper(), logLine);
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// FleetPollTask
+
+FleetPollTask::FleetPollTask(FleetHub *hub, const QElapsedTimer *clock) :
+    m_hub(hub),
+    m_clock(clock)
+{
+    // the same task is handed to the pool over and over
+    setAutoDelete(false);
+}
+
+void FleetPollTask::run(){
+    QString capturePath;
+    if(m_hub->takeCapturePath(&capturePath)){
+        m_hub->worker()->setPacketCapture(capturePath);
+    }
+
+    if(!m_hub->started.load()){
+        m_hub->worker()->start();
+        m_hub->started.store(true);
+    }
+    else {
+        m_hub->worker()->pollStemForChanges();
+    }
+
+    m_hub->nextPollDelayMs.store(m_hub->worker()->nextPollDelayMs());
+    m_hub->lastPollDoneMs.store(m_clock->elapsed());
+    m_hub->busy.store(false);
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// FleetManager
+
+FleetManager::FleetManager(int maxThreads, QObject *parent) :
+    QObject(parent),
+    m_targetRate(50.0)
+{
+    if(maxThreads > 0){
+        m_pool.setMaxThreadCount(maxThreads);
+    }
+
+    m_clock.start();
+
+    m_dispatchTimer.setTimerType(Qt::PreciseTimer);
+    m_dispatchTimer.setInterval(FLEET_DISPATCH_INTERVAL_MS);
+    connect(&m_dispatchTimer, SIGNAL(timeout()), this, SLOT(dispatchPolls()));
+
+    connect(&m_hotplug, SIGNAL(hubAttached(linkSpec)), this, SLOT(handleHubAttached(linkSpec)));
+    connect(&m_hotplug, SIGNAL(hubDetached(uint32_t)), this, SLOT(handleHubDetached(uint32_t)));
+    connect(&m_hotplug, SIGNAL(logStringReady(QString)), this, SIGNAL(logStringReady(QString)));
+}
+
+FleetManager::~FleetManager(){
+    m_dispatchTimer.stop();
+    m_pool.waitForDone();
+
+    qDeleteAll(m_tasks);
+    qDeleteAll(m_hubs);
+}
+
+void FleetManager::start(){
+    std::list<linkSpec> devicesDiscovered;
+    Link::sDiscover(USB, StemWorker::sFindAllHubs, &devicesDiscovered);
+
+    for (std::list<linkSpec>::iterator it=devicesDiscovered.begin(); it != devicesDiscovered.end(); ++it){
+        addHub(*it);
+    }
+
+    emit logStringReady(QString("Fleet: found %1 hub(s), polling with %2 thread(s)")
+                        .arg(m_hubs.size()).arg(m_pool.maxThreadCount()));
+    emit hubsChanged(m_hubs.size());
+
+    m_hotplug.start();
+    m_dispatchTimer.start();
+}
+
+void FleetManager::addHub(const linkSpec &spec){
+    FleetHub *hub = new FleetHub(spec);
+    // queued over from the pool threads
+    connect(hub, SIGNAL(logStringReady(QString,QString)), this, SIGNAL(hubLogStringReady(QString,QString)));
+    hub->worker()->setTargetRate(m_targetRate);
+    if(!m_captureDirectory.isEmpty()){
+        hub->setCapturePath(capturePathFor(spec.serial_num));
+    }
+    if(!m_sampleDirectory.isEmpty()){
+        hub->worker()->setSampleRecording(m_sampleDirectory);
+    }
+    if(!m_triggerRules.isEmpty()){
+        hub->worker()->setTriggerRules(m_triggerRules);
+    }
+    m_hubs.append(hub);
+    m_tasks.append(new FleetPollTask(hub, &m_clock));
+}
+
+// A spec that isn't a hub model makes the worker fall back to a simulated hub
+// with the spec's serial number.
+void FleetManager::addSimulatedHubs(int count){
+    for(int i = 0; i < count; i++){
+        linkSpec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.type = INVALID;
+        spec.serial_num = 0x5140A000 + m_hubs.size();
+        addHub(spec);
+    }
+}
+
+void FleetManager::setPacketCaptureDirectory(const QString &directory){
+    m_captureDirectory = directory;
+    for(FleetHub *hub: m_hubs){
+        hub->setCapturePath(directory.isEmpty() ? QString() : capturePathFor(hub->serialNumber()));
+    }
+}
+
+// the workers aren't polling yet, so their slots can be called from here
+void FleetManager::setSampleDirectory(const QString &directory){
+    m_sampleDirectory = directory;
+    for(FleetHub *hub: m_hubs){
+        hub->worker()->setSampleRecording(directory);
+    }
+}
+
+void FleetManager::setTriggerRules(const QString &path){
+    m_triggerRules = path;
+    for(FleetHub *hub: m_hubs){
+        hub->worker()->setTriggerRules(path);
+    }
+}
+
+QString FleetManager::capturePathFor(uint32_t serialNumber) const {
+    QString serial = QString("%1").arg(serialNumber, 8, 16, QChar('0')).toUpper();
+    return QDir(m_captureDirectory).filePath(QString("hub-%1.trace").arg(serial));
+}
+
+void FleetManager::handleHubAttached(const linkSpec &spec){
+    for(FleetHub *hub: m_hubs){
+        // still known, and its own reconnect will pick it up
+        if(hub->serialNumber() == spec.serial_num && !hub->retiring)
+            return;
+    }
+
+    addHub(spec);
+    emit logStringReady(QString("Fleet: hub 0x%1 attached").arg(spec.serial_num, 8, 16, QChar('0')));
+    emit hubsChanged(m_hubs.size());
+}
+
+void FleetManager::handleHubDetached(uint32_t serialNumber){
+    for(FleetHub *hub: m_hubs){
+        if(hub->serialNumber() == serialNumber && !hub->retiring){
+            // dispatchPolls deletes it once its last poll is done
+            hub->retiring = true;
+            emit logStringReady(QString("Fleet: hub 0x%1 detached").arg(serialNumber, 8, 16, QChar('0')));
+        }
+    }
+}
+
+void FleetManager::setTargetRate(double hz){
+    m_targetRate = hz;
+    for(FleetHub *hub: m_hubs){
+        hub->worker()->setTargetRate(hz);
+    }
+}
+
+QList<FleetHubSummary> FleetManager::summaries(){
+    QList<FleetHubSummary> list;
+    for(FleetHub *hub: m_hubs){
+        list.append(hub->summary());
+    }
+    return list;
+}
+
+// Hand every idle hub whose delay has passed to the pool. A hub is never
+// queued twice, so a slow hub only holds up its own polling, and with more
+// hubs than threads the pool queue round-robins them.
+void FleetManager::dispatchPolls(){
+    bool removed = false;
+    for(int i = m_hubs.size() - 1; i >= 0; i--){
+        FleetHub *hub = m_hubs[i];
+        if(hub->busy.load())
+            continue;
+
+        if(hub->retiring){
+            delete m_tasks.takeAt(i);
+            delete m_hubs.takeAt(i);
+            removed = true;
+            continue;
+        }
+        if(hub->started.load() && m_clock.elapsed() - hub->lastPollDoneMs.load() < hub->nextPollDelayMs.load())
+            continue;
+
+        hub->busy.store(true);
+        m_pool.start(m_tasks[i]);
+    }
+
+    if(removed){
+        emit hubsChanged(m_hubs.size());
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef FLEETMANAGER_H
+#define FLEETMANAGER_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+#include <QRunnable>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <atomic>
+
+#include "stemworker.h"
+#include "hotplugwatcher.h"
+
+// Latest values reported by one hub's worker, folded in from its snapshot
+// queue whenever the dashboard asks, so the GUI thread never sees per sample
+// events.
+struct FleetHubSummary {
+    uint32_t serialNumber;
+    QString model;
+    uint32_t firmwareVersion;
+    bool connected;
+    double updateRate;
+    QString temperature;
+    uint32_t inputVoltage;
+    uint32_t inputCurrent;
+    int numUSB;
+    int32_t portVoltage[8];
+    int32_t portCurrent[8];
+    QString portState[8];
+    int64_t portEnergy[8];          // uWh
+    int64_t portCharge[8];          // uAh
+    int64_t hubEnergy;
+    int64_t hubCharge;
+    QString lastLogLine;
+    HubSnapshot snapshot;           // the newest, with every field as last read
+};
+
+class FleetHub : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FleetHub(const linkSpec &spec, QObject *parent = nullptr);
+    ~FleetHub();
+
+    StemWorker* worker() { return m_worker; }
+    uint32_t serialNumber() const { return m_spec.serial_num; }
+    // drains the worker's snapshot queue; only call from one thread
+    FleetHubSummary summary();
+
+    // packet capture file to switch to (empty to stop); the worker picks it
+    // up on the pool thread before its next poll
+    void setCapturePath(const QString &path);
+    bool takeCapturePath(QString *path);
+
+    // set by the fleet manager before a poll is handed to the pool, cleared by the pool thread after
+    std::atomic<bool> busy;
+    std::atomic<bool> started;
+    std::atomic<qint64> lastPollDoneMs;
+    std::atomic<int> nextPollDelayMs;
+
+    // its hub was unplugged; deleted as soon as no poll is running. Only
+    // touched from the manager's thread.
+    bool retiring;
+
+signals:
+    // the worker's log lines, tagged with the hub they came from
+    void logStringReady(QString serial, QString logLine);
+
+public slots:
+    // these run on whichever pool thread is polling the hub
+    void handleLogString(QString logLine);
+
+private:
+    linkSpec m_spec;
+    StemWorker *m_worker;
+
+    QMutex m_summaryLock;
+    FleetHubSummary m_summary;
+
+    QMutex m_captureLock;
+    QString m_capturePath;
+    bool m_captureChanged;
+};
+
+// One poll (or the initial connect) of one hub, run on the fleet's thread pool.
+class FleetPollTask : public QRunnable
+{
+public:
+    FleetPollTask(FleetHub *hub, const QElapsedTimer *clock);
+    void run();
+
+private:
+    FleetHub *m_hub;
+    const QElapsedTimer *m_clock;
+};
+
+// Connects to every hub found on USB and polls them all from a fixed size
+// thread pool instead of one thread per hub. Each hub's own rate controller
+// decides when it is polled again, independent of the others. Hubs plugged in
+// later are picked up from udev, and unplugged ones are retired.
+class FleetManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FleetManager(int maxThreads = 0, QObject *parent = nullptr);
+    ~FleetManager();
+
+    int hubCount() const { return m_hubs.size(); }
+    QList<FleetHubSummary> summaries();
+    int threadCount() const { return m_pool.maxThreadCount(); }
+
+    // add hubs that are simulated rather than discovered, for load testing
+    // without hardware; call before start()
+    void addSimulatedHubs(int count);
+
+    // one packet capture ring per hub in directory, named by serial number;
+    // an empty directory stops them all
+    void setPacketCaptureDirectory(const QString &directory);
+
+    // record every hub's port samples into directory, one file per hub and
+    // run; call before start()
+    void setSampleDirectory(const QString &directory);
+
+    // check every hub's readings against the rules in path (see
+    // triggerengine.h); call before start()
+    void setTriggerRules(const QString &path);
+
+signals:
+    void hubsChanged(int count);
+    void logStringReady(QString logLine);
+    // every hub worker's log lines, on the manager's thread
+    void hubLogStringReady(QString serial, QString logLine);
+
+public slots:
+    void start();
+    void setTargetRate(double hz);
+
+private slots:
+    void dispatchPolls();
+    void handleHubAttached(const linkSpec &spec);
+    void handleHubDetached(uint32_t serialNumber);
+
+private:
+    QThreadPool m_pool;
+    QTimer m_dispatchTimer;
+    QElapsedTimer m_clock;
+    QList<FleetHub*> m_hubs;
+    QList<FleetPollTask*> m_tasks;
+    double m_targetRate;
+    HotplugWatcher m_hotplug;
+    QString m_captureDirectory;
+    QString m_sampleDirectory;
+    QString m_triggerRules;
+
+    void addHub(const linkSpec &spec);
+    QString capturePathFor(uint32_t serialNumber) const;
+};
+
+#endif // FLEETMANAGER_H
@@ -0,0 +1,108 @@
+#include "fleetwindow.h"
+#include <QVBoxLayout>
+#include <QHeaderView>
+
+#define FLEET_REFRESH_INTERVAL_MS 200
+
+enum FleetColumn {
+    columnSerial = 0,
+    columnModel,
+    columnStatus,
+    columnRate,
+    columnTemperature,
+    columnInput,
+    columnPort0,
+    columnLastMessage = columnPort0 + 8,
+    columnCount
+};
+
+FleetWindow::FleetWindow(FleetManager *fleet, QWidget *parent) :
+    QWidget(parent),
+    m_fleet(fleet)
+{
+    m_table = new QTableWidget(0, columnCount, this);
+    m_statusLabel = new QLabel(this);
+
+    QStringList headers;
+    headers << "Serial" << "Model" << "Status" << "Rate" << "Temperature" << "Input";
+    for(int i = 0; i < 8; i++){
+        headers << QString("Port %1").arg(i);
+    }
+    headers << "Last message";
+    m_table->setHorizontalHeaderLabels(headers);
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->verticalHeader()->setVisible(false);
+    m_table->horizontalHeader()->setStretchLastSection(true);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(m_table);
+    layout->addWidget(m_statusLabel);
+    setLayout(layout);
+    resize(1200, 400);
+
+    connect(m_fleet, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+    connect(m_fleet, SIGNAL(hubsChanged(int)), this, SLOT(handleHubsChanged(int)));
+    connect(&m_refreshTimer, SIGNAL(timeout()), this, SLOT(refreshTable()));
+    m_refreshTimer.start(FLEET_REFRESH_INTERVAL_MS);
+}
+
+void FleetWindow::handleLogString(QString logLine){
+    m_statusLabel->setText(logLine);
+}
+
+void FleetWindow::handleHubsChanged(int count){
+    m_table->setRowCount(count);
+}
+
+void FleetWindow::setCell(int row, int column, const QString &text){
+    // reuse the items so a refresh doesn't allocate a new one per cell
+    QTableWidgetItem *item = m_table->item(row, column);
+    if(!item){
+        item = new QTableWidgetItem();
+        m_table->setItem(row, column, item);
+    }
+    if(item->text() != text){
+        item->setText(text);
+    }
+}
+
+void FleetWindow::refreshTable(){
+    QList<FleetHubSummary> summaries = m_fleet->summaries();
+    if(m_table->rowCount() != summaries.size()){
+        m_table->setRowCount(summaries.size());
+    }
+
+    double totalRate = 0.0;
+    for(int row = 0; row < summaries.size(); row++){
+        const FleetHubSummary &hub = summaries[row];
+        totalRate += hub.updateRate;
+
+        setCell(row, columnSerial, QString("0x%1").arg(hub.serialNumber, 8, 16, QChar('0')).toUpper());
+        setCell(row, columnModel, hub.model);
+        setCell(row, columnStatus, hub.connected ? "Connected" : "Disconnected");
+        setCell(row, columnRate, QString("%1Hz").arg(hub.updateRate, 0, 'f', 1));
+        setCell(row, columnTemperature, hub.temperature);
+        setCell(row, columnInput, QString("%1V %2A")
+                .arg(hub.inputVoltage/1000000.0, 0, 'f', 2)
+                .arg(hub.inputCurrent/1000000.0, 0, 'f', 2));
+
+        for(int port = 0; port < 8; port++){
+            if(port < hub.numUSB){
+                setCell(row, columnPort0 + port, QString("%1V %2A")
+                        .arg(hub.portVoltage[port]/1000000.0, 0, 'f', 2)
+                        .arg(hub.portCurrent[port]/1000000.0, 0, 'f', 3));
+            }
+            else {
+                setCell(row, columnPort0 + port, "");
+            }
+        }
+
+        setCell(row, columnLastMessage, hub.lastLogLine);
+    }
+
+    setWindowTitle(QString("HubTool fleet: %1 hub(s), %2 thread(s), %3 polls/s")
+                   .arg(summaries.size())
+                   .arg(m_fleet->threadCount())
+                   .arg(totalRate, 0, 'f', 0));
+}
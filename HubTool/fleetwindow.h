@@ -0,0 +1,36 @@
+#ifndef FLEETWINDOW_H
+#define FLEETWINDOW_H
+
+#include <QWidget>
+#include <QTableWidget>
+#include <QLabel>
+#include <QTimer>
+
+#include "fleetmanager.h"
+
+// Read only dashboard for fleet mode: one row per hub, refreshed from the
+// fleet's summaries on its own timer rather than per sample.
+class FleetWindow : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FleetWindow(FleetManager *fleet, QWidget *parent = nullptr);
+
+public slots:
+    void handleLogString(QString logLine);
+    void handleHubsChanged(int count);
+
+private slots:
+    void refreshTable();
+
+private:
+    void setCell(int row, int column, const QString &text);
+
+    FleetManager *m_fleet;
+    QTableWidget *m_table;
+    QLabel *m_statusLabel;
+    QTimer m_refreshTimer;
+};
+
+#endif // FLEETWINDOW_H
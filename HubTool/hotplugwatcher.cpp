@@ -0,0 +1,141 @@
+#include "hotplugwatcher.h"
+#include "stemworker.h"
+
+#include <list>
+
+#if defined(__linux__)
+#include <libudev.h>
+#endif
+
+#define ACRONAME_VENDOR_ID "24ff"
+// how often, and how many times, to look again for a hub that was just added
+#define HOTPLUG_RESCAN_INTERVAL_MS 50
+#define HOTPLUG_RESCAN_ATTEMPTS 20
+
+HotplugWatcher::HotplugWatcher(QObject *parent) :
+    QObject(parent),
+    m_udev(nullptr),
+    m_monitor(nullptr),
+    m_notifier(nullptr),
+    m_rescansLeft(0)
+{
+    qRegisterMetaType<linkSpec>("linkSpec");
+
+    m_rescanTimer.setSingleShot(true);
+    m_rescanTimer.setInterval(HOTPLUG_RESCAN_INTERVAL_MS);
+    connect(&m_rescanTimer, SIGNAL(timeout()), this, SLOT(rescan()));
+}
+
+HotplugWatcher::~HotplugWatcher(){
+    delete m_notifier;
+#if defined(__linux__)
+    if(m_monitor) udev_monitor_unref(m_monitor);
+    if(m_udev) udev_unref(m_udev);
+#endif
+}
+
+bool HotplugWatcher::start(){
+#if defined(__linux__)
+    if(m_notifier)
+        return true;
+
+    m_udev = udev_new();
+    if(!m_udev){
+        emit logStringReady("Hotplug: couldn't open udev, falling back to polling");
+        return false;
+    }
+
+    m_monitor = udev_monitor_new_from_netlink(m_udev, "udev");
+    if(!m_monitor
+       || udev_monitor_filter_add_match_subsystem_devtype(m_monitor, "usb", "usb_device") < 0
+       || udev_monitor_enable_receiving(m_monitor) < 0)
+    {
+        emit logStringReady("Hotplug: couldn't start the udev monitor, falling back to polling");
+        if(m_monitor) udev_monitor_unref(m_monitor);
+        udev_unref(m_udev);
+        m_monitor = nullptr;
+        m_udev = nullptr;
+        return false;
+    }
+
+    // start from what's plugged in now, so only real changes are reported
+    std::list<linkSpec> devicesDiscovered;
+    Link::sDiscover(USB, StemWorker::sFindAllHubs, &devicesDiscovered);
+    for(const linkSpec &spec: devicesDiscovered){
+        m_present.insert(spec.serial_num);
+    }
+
+    m_notifier = new QSocketNotifier(udev_monitor_get_fd(m_monitor), QSocketNotifier::Read, this);
+    connect(m_notifier, SIGNAL(activated(int)), this, SLOT(handleUdevEvent()));
+    return true;
+#else
+    return false;
+#endif
+}
+
+void HotplugWatcher::handleUdevEvent(){
+#if defined(__linux__)
+    struct udev_device *device = udev_monitor_receive_device(m_monitor);
+    if(!device)
+        return;
+
+    // PRODUCT is "vendor/product/bcdDevice" in hex and survives into remove events
+    QString action = QString::fromLatin1(udev_device_get_action(device));
+    QString product = QString::fromLatin1(udev_device_get_property_value(device, "PRODUCT"));
+    QString devpath = QString::fromLatin1(udev_device_get_devpath(device));
+    udev_device_unref(device);
+
+    if(!product.startsWith(ACRONAME_VENDOR_ID "/"))
+        return;
+
+    if(action == "add"){
+        m_rescansLeft = HOTPLUG_RESCAN_ATTEMPTS;
+        m_pendingDevpath = devpath;
+        rescan();
+    }
+    else if(action == "remove"){
+        if(m_serialByDevpath.contains(devpath)){
+            uint32_t serial = m_serialByDevpath.take(devpath);
+            if(m_present.remove(serial)){
+                emit hubDetached(serial);
+            }
+        }
+        else {
+            diffWithPresent();
+        }
+    }
+#endif
+}
+
+void HotplugWatcher::rescan(){
+    int before = m_present.size();
+    diffWithPresent();
+
+    // keep looking until the new hub shows up or we run out of attempts
+    if(m_present.size() == before && --m_rescansLeft > 0){
+        m_rescanTimer.start();
+    }
+}
+
+void HotplugWatcher::diffWithPresent(){
+    std::list<linkSpec> devicesDiscovered;
+    Link::sDiscover(USB, StemWorker::sFindAllHubs, &devicesDiscovered);
+
+    QSet<uint32_t> found;
+    for(const linkSpec &spec: devicesDiscovered){
+        found.insert(spec.serial_num);
+        if(!m_present.contains(spec.serial_num)){
+            m_present.insert(spec.serial_num);
+            if(!m_pendingDevpath.isEmpty()){
+                m_serialByDevpath[m_pendingDevpath] = spec.serial_num;
+                m_pendingDevpath.clear();
+            }
+            emit hubAttached(spec);
+        }
+    }
+
+    for(uint32_t serial: QSet<uint32_t>(m_present).subtract(found)){
+        m_present.remove(serial);
+        emit hubDetached(serial);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef HOTPLUGWATCHER_H
+#define HOTPLUGWATCHER_H
+
+#include <QObject>
+#include <QMap>
+#include <QMetaType>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QString>
+#include <QTimer>
+
+#include "BrainStem2/BrainStem-all.h"
+
+Q_DECLARE_METATYPE(linkSpec)
+
+struct udev;
+struct udev_monitor;
+
+// Watches a udev monitor socket for Acroname USB devices coming and going,
+// so attach and detach are seen as they happen instead of by re-enumerating
+// or by a poll failing. An attach re-runs discovery to get the new hub's
+// linkSpec; a detach is matched to the serial number seen when the device was
+// added, falling back to a discovery diff when it wasn't.
+//
+// Without udev (macOS, Windows) start() returns false and nothing is ever
+// emitted; callers keep their existing discovery and reconnect paths.
+class HotplugWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HotplugWatcher(QObject *parent = nullptr);
+    ~HotplugWatcher();
+
+    // records the hubs already present, then starts listening
+    bool start();
+    bool isRunning() const { return m_notifier != nullptr; }
+
+signals:
+    void hubAttached(const linkSpec &spec);
+    void hubDetached(uint32_t serialNumber);
+    void logStringReady(QString logLine);
+
+private slots:
+    void handleUdevEvent();
+    void rescan();
+
+private:
+    // discover the hubs present now and report the differences
+    void diffWithPresent();
+
+    struct udev *m_udev;
+    struct udev_monitor *m_monitor;
+    QSocketNotifier *m_notifier;
+
+    QSet<uint32_t> m_present;
+    QMap<QString, uint32_t> m_serialByDevpath;
+    QString m_pendingDevpath;       // the add event the current rescan is for
+
+    // a freshly added device can take a moment before it answers discovery
+    QTimer m_rescanTimer;
+    int m_rescansLeft;
+};
+
+#endif // HOTPLUGWATCHER_H
@@ -0,0 +1,267 @@
+#include "stemworker.h"
+#include "latencyhistogram.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "BrainStem2/aVersion.h"
+
+// ////////////////////////////////////////////////////////////////////////////
+// allocation counting: every operator new in the process, on any thread
+
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(std::size_t size){
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size){
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept                  { std::free(p); }
+void operator delete[](void* p) noexcept                { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept     { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept   { std::free(p); }
+
+static QJsonObject histogramJson(const LatencyHistogram &histogram){
+    QJsonObject values;
+    values["p50"] = histogram.percentile(50);
+    values["p90"] = histogram.percentile(90);
+    values["p99"] = histogram.percentile(99);
+    values["max"] = histogram.max();
+    values["mean"] = histogram.mean();
+    values["count"] = (double)histogram.count();
+    return values;
+}
+
+// hubbench [--cycles N] [--warmup N] [--latency US] [--jitter US] [--loss P]
+//          [--model 2x4|3p] [--replay FILE] [--speed N] [--sequential] [--out FILE]
+//
+// Runs StemWorker's poll cycle back to back against a simulated hub, with no
+// timer in between, and writes one JSON object with the full cycle and per
+// entity latencies in microseconds, the request to reply latency of each UEI
+// call, the V/I samples per second for each port and the allocations per
+// cycle. The link options go to the simulated hub through
+// HUBTOOL_SIMULATION; anything not given keeps the value already in the
+// environment, or the simulator's default.
+//
+// --replay runs against a link recording instead (see linkrecording.h), at
+// --speed times the recorded timing, 0 for none. sample_digest is a hash of
+// every V/I value polled, so two runs over the same recording can be
+// compared for identical results.
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationName("hubbench");
+    a.setApplicationVersion(QString::fromUtf8(aVersion_GetString()));
+
+    int cycles = 2000;
+    int warmup = 100;
+    bool pipelined = true;
+    QString outPath;
+    QString replayPath;
+    QString replaySpeed = "0";
+    QStringList simulation;
+    QString existing = QString::fromLocal8Bit(qgetenv("HUBTOOL_SIMULATION"));
+    if(!existing.isEmpty()) simulation << existing;
+
+    QStringList args = a.arguments();
+    for(int i = 1; i < args.size(); i++){
+        bool hasValue = i + 1 < args.size();
+        if(args[i] == "--cycles" && hasValue)           { cycles = args[++i].toInt();                   }
+        else if(args[i] == "--warmup" && hasValue)      { warmup = args[++i].toInt();                   }
+        else if(args[i] == "--latency" && hasValue)     { simulation << "latency=" + args[++i];         }
+        else if(args[i] == "--jitter" && hasValue)      { simulation << "jitter=" + args[++i];          }
+        else if(args[i] == "--loss" && hasValue)        { simulation << "loss=" + args[++i];            }
+        else if(args[i] == "--model" && hasValue)       { simulation << "model=" + args[++i];           }
+        else if(args[i] == "--replay" && hasValue)      { replayPath = args[++i];                       }
+        else if(args[i] == "--speed" && hasValue)       { replaySpeed = args[++i];                      }
+        else if(args[i] == "--sequential")              { pipelined = false;                            }
+        else if(args[i] == "--out" && hasValue)         { outPath = args[++i];                          }
+        else {
+            fprintf(stderr, "usage: hubbench [--cycles N] [--warmup N] [--latency US] [--jitter US] [--loss P]\n"
+                            "                [--model 2x4|3p] [--replay FILE] [--speed N] [--sequential] [--out FILE]\n");
+            return 1;
+        }
+    }
+    if(cycles < 1) cycles = 1;
+    if(warmup < 0) warmup = 0;
+
+    // later options override earlier ones in fromString()
+    qputenv("HUBTOOL_SIMULATION", simulation.join(',').toLocal8Bit());
+    if(!replayPath.isEmpty()){
+        qputenv("HUBTOOL_REPLAY", replayPath.toLocal8Bit());
+        qputenv("HUBTOOL_REPLAY_SPEED", replaySpeed.toLocal8Bit());
+    }
+
+    // not a hub, so the worker starts the simulation or the replay
+    linkSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.type = INVALID;
+    spec.serial_num = 0x5140B000;
+
+    StemWorker worker(&spec);
+    uint32_t logErrors = 0;
+    QObject::connect(&worker, &StemWorker::logStringReady, [&logErrors](QString line){
+        if(line.startsWith("Error")) logErrors++;
+        fprintf(stderr, "%s\n", line.toLocal8Bit().constData());
+    });
+    worker.setPipelinedAcquisition(pipelined);
+    worker.start();
+
+    const SimulatedHub* hub = worker.simulation();
+    const LinkReplay* replay = worker.replay();
+    if(!hub && !replay){
+        fprintf(stderr, "hubbench: neither the simulated hub nor the replay started\n");
+        return 1;
+    }
+    uint8_t model = hub ? hub->config().model : replay->info().model;
+    int numPorts = (model == aMODULE_TYPE_USBHub2x4) ? 4 : 8;
+
+    QStringList entityNames = worker.pollEntityNames();
+    QVector<LatencyHistogram> entityLatency(entityNames.size());
+    bool measuring = false;
+    worker.setPollObserver([&entityLatency, &measuring](int id, qint64 elapsedNs){
+        if(measuring) entityLatency[id].record(elapsedNs/1000);
+    });
+
+    LatencyHistogram cycleLatency;
+    LatencyHistogram cycleAllocations;
+    uint64_t portSamples[8] = {0,0,0,0,0,0,0,0};
+    uint64_t sampleDigest = 14695981039346656037ULL;   // FNV-1a
+    uint32_t requestsAtStart = 0;
+    uint32_t droppedAtStart = 0;
+    HubSnapshot snapshot;
+    QElapsedTimer cycleTimer;
+    QElapsedTimer runTimer;
+
+    for(int cycle = 0; cycle < warmup + cycles; cycle++){
+        if(cycle == warmup){
+            measuring = true;
+            worker.setCallTimingEnabled(true);
+            requestsAtStart = hub ? hub->requestCount() : replay->matchedCount();
+            droppedAtStart = hub ? hub->droppedCount() : replay->unmatchedCount();
+            runTimer.start();
+        }
+
+        uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        cycleTimer.start();
+        worker.pollStemForChanges();
+        qint64 elapsedNs = cycleTimer.nsecsElapsed();
+        uint64_t allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+        // every port is read together, so a cycle either has a sample for
+        // all of them or for none
+        while(worker.snapshots()->pop(snapshot)){
+            if(measuring && (snapshot.changed & HubSnapshot::ChangedPortVoltageCurrent)){
+                for(int port = 0; port < numPorts; port++){
+                    portSamples[port]++;
+                    int32_t values[2] = {snapshot.portVoltage[port], snapshot.portCurrent[port]};
+                    const uint8_t *bytes = (const uint8_t*)values;
+                    for(size_t b = 0; b < sizeof(values); b++){
+                        sampleDigest = (sampleDigest ^ bytes[b])*1099511628211ULL;
+                    }
+                }
+            }
+        }
+
+        if(measuring){
+            cycleLatency.record(elapsedNs/1000);
+            cycleAllocations.record(allocations);
+        }
+    }
+    double runSeconds = runTimer.nsecsElapsed()/1e9;
+
+    QJsonObject config;
+    config["model"] = (numPorts == 4) ? "USBHub2x4" : "USBHub3+";
+    if(hub){
+        config["latency_us"] = hub->config().latencyUs;
+        config["jitter_us"] = hub->config().jitterUs;
+        config["loss_rate"] = hub->config().lossRate;
+    }
+    else {
+        config["replay"] = replayPath;
+        config["speed"] = replaySpeed.toDouble();
+    }
+    config["pipelined"] = pipelined;
+    config["cycles"] = cycles;
+    config["warmup"] = warmup;
+
+    QJsonObject entities;
+    for(int id = 0; id < entityNames.size(); id++){
+        if(entityLatency[id].count() == 0) continue;
+        entities[entityNames[id]] = histogramJson(entityLatency[id]);
+    }
+
+    QJsonObject calls;
+    for(const UEICallSummary &call: worker.callTimings()){
+        QJsonObject values;
+        values["count"] = (double)call.count;
+        values["p50"] = call.p50Us;
+        values["p99"] = call.p99Us;
+        values["max"] = call.maxUs;
+        values["mean"] = call.meanUs;
+        values["errors"] = (double)call.errors;
+        values["timeouts"] = (double)call.timeouts;
+        calls[call.name] = values;
+    }
+
+    QJsonArray samplesPerSecond;
+    for(int port = 0; port < numPorts; port++){
+        samplesPerSecond.append(runSeconds > 0 ? portSamples[port]/runSeconds : 0.0);
+    }
+
+    QJsonObject allocations;
+    allocations["mean"] = cycleAllocations.mean();
+    allocations["max"] = cycleAllocations.max();
+
+    QJsonObject simulator;
+    if(hub){
+        simulator["requests"] = (double)(hub->requestCount() - requestsAtStart);
+        simulator["dropped"] = (double)(hub->droppedCount() - droppedAtStart);
+    }
+    else {
+        simulator["matched"] = (double)(replay->matchedCount() - requestsAtStart);
+        simulator["unmatched"] = (double)(replay->unmatchedCount() - droppedAtStart);
+    }
+
+    QJsonObject result;
+    result["version"] = a.applicationVersion();
+    result["config"] = config;
+    result["seconds"] = runSeconds;
+    result["cycles_per_second"] = runSeconds > 0 ? cycles/runSeconds : 0.0;
+    result["cycle_us"] = histogramJson(cycleLatency);
+    result["entity_us"] = entities;
+    result["uei_call_us"] = calls;
+    result["samples_per_second"] = samplesPerSecond;
+    result["allocations_per_cycle"] = allocations;
+    result["simulator"] = simulator;
+    result["errors"] = (double)logErrors;
+    result["sample_digest"] = QString("%1").arg(sampleDigest, 16, 16, QChar('0'));
+
+    QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+    if(outPath.isEmpty()){
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+
+    QFile out(outPath);
+    if(!out.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        fprintf(stderr, "hubbench: can't write %s\n", outPath.toLocal8Bit().constData());
+        return 1;
+    }
+    out.write(json);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#-------------------------------------------------
+#
+# Poll-cycle benchmark: StemWorker against a simulated hub, results as JSON.
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = hubbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/lib/
+INCLUDEPATH += $$PWD/lib/BrainStem2/
+
+SOURCES += hubbench.cpp \
+           latencyhistogram.cpp \
+           stemworker.cpp \
+           pollscheduler.cpp \
+           ueirouter.cpp \
+           hubsnapshot.cpp \
+           ratecontroller.cpp \
+           commandqueue.cpp \
+           connectionmonitor.cpp \
+           hotplugwatcher.cpp \
+           simulatedhub.cpp \
+           ueicallstats.cpp \
+           packetcapture.cpp \
+           linkrecording.cpp \
+           samplerecorder.cpp \
+           energymeter.cpp \
+           triggerengine.cpp
+
+HEADERS  += latencyhistogram.h \
+            stemworker.h \
+            appnap.h \
+            pollscheduler.h \
+            ueirouter.h \
+            hubsnapshot.h \
+            spscring.h \
+            ratecontroller.h \
+            commandqueue.h \
+            connectionmonitor.h \
+            hotplugwatcher.h \
+            simulatedhub.h \
+            ueicallstats.h \
+            packetcapture.h \
+            linkrecording.h \
+            samplerecorder.h \
+            energymeter.h \
+            triggerengine.h
+
+CONFIG += c++11
+
+static { # Everything below takes effect with CONFIG += static
+    CONFIG += static
+    DEFINES += STATIC
+    message("Static build.")
+}
+
+LIBS += -L$$PWD/../lib/ -lBrainStem2 -ludev
+DEPENDPATH += $$PWD/../lib
+PRE_TARGETDEPS += $$PWD/../lib/libBrainStem2.a
+
+OBJECTIVE_SOURCES += \
+    appnap.mm
@@ -0,0 +1,121 @@
+#include "hubdaemon.h"
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <stdio.h>
+
+#define HUBDAEMON_DEFAULT_REPORT_MS 1000
+#define HUBDAEMON_METRICS_MS 250
+
+HubDaemon::HubDaemon(int maxThreads, QObject *parent) :
+    QObject(parent),
+    m_fleet(maxThreads),
+    m_captureDirectory("."),
+    m_capturing(false),
+    m_metrics(nullptr)
+{
+    m_stdout.open(stdout, QIODevice::WriteOnly);
+    m_out.setDevice(&m_stdout);
+
+    m_reportTimer.setInterval(HUBDAEMON_DEFAULT_REPORT_MS);
+    connect(&m_reportTimer, SIGNAL(timeout()), this, SLOT(report()));
+    connect(&m_fleet, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+    connect(&m_fleet, SIGNAL(hubLogStringReady(QString,QString)), this, SLOT(handleHubLogString(QString,QString)));
+}
+
+HubDaemon::~HubDaemon(){
+    delete m_metrics;
+}
+
+void HubDaemon::setReportInterval(int ms){
+    m_reportTimer.setInterval(ms > 0 ? ms : HUBDAEMON_DEFAULT_REPORT_MS);
+}
+
+void HubDaemon::start(){
+    m_fleet.start();
+    m_reportTimer.start();
+}
+
+void HubDaemon::setCapturing(bool capturing){
+    m_capturing = capturing;
+    m_fleet.setPacketCaptureDirectory(capturing ? m_captureDirectory : QString());
+    handleLogString(capturing ? QString("Packet capture on, to %1").arg(m_captureDirectory)
+                              : QString("Packet capture off"));
+}
+
+void HubDaemon::report(){
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    for(const FleetHubSummary &hub: m_fleet.summaries()){
+        QJsonObject line;
+        line["ts"] = (double)now;
+        line["serial"] = QString("0x%1").arg(hub.serialNumber, 8, 16, QChar('0')).toUpper();
+        line["model"] = hub.model;
+        line["connected"] = hub.connected;
+        line["rate"] = hub.updateRate;
+        line["temperature"] = hub.temperature;
+        line["inputVoltage"] = (double)hub.inputVoltage;
+        line["inputCurrent"] = (double)hub.inputCurrent;
+        line["energy"] = (double)hub.hubEnergy;
+        line["charge"] = (double)hub.hubCharge;
+
+        QJsonArray ports;
+        for(int port = 0; port < hub.numUSB && port < 8; port++){
+            QJsonObject values;
+            values["voltage"] = hub.portVoltage[port];
+            values["current"] = hub.portCurrent[port];
+            values["state"] = hub.portState[port];
+            values["energy"] = (double)hub.portEnergy[port];
+            values["charge"] = (double)hub.portCharge[port];
+            ports.append(values);
+        }
+        line["ports"] = ports;
+
+        m_out << QJsonDocument(line).toJson(QJsonDocument::Compact) << "\n";
+    }
+    m_out.flush();
+}
+
+void HubDaemon::startMetrics(const QString &address, quint16 port){
+    if(!m_metrics){
+        m_metrics = new MetricsServer();
+        connect(m_metrics, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+        m_metricsTimer.setInterval(HUBDAEMON_METRICS_MS);
+        connect(&m_metricsTimer, SIGNAL(timeout()), this, SLOT(publishMetrics()));
+        m_metricsTimer.start();
+    }
+    m_metrics->listen(address, port);
+}
+
+// A hub whose link is down stops publishing snapshots, so its last one
+// still says connected.
+void HubDaemon::publishMetrics(){
+    m_metricsHubs.clear();
+    for(const FleetHubSummary &hub: m_fleet.summaries()){
+        m_metricsHubs.push_back(hub.snapshot);
+        if(!hub.connected){
+            m_metricsHubs.back().connectionState = ConnectionMonitor::Lost;
+        }
+    }
+    m_metrics->publish(m_metricsHubs.data(), m_metricsHubs.size());
+}
+
+void HubDaemon::handleLogString(QString logLine){
+    QJsonObject line;
+    line["ts"] = (double)QDateTime::currentMSecsSinceEpoch();
+    line["log"] = logLine;
+    m_out << QJsonDocument(line).toJson(QJsonDocument::Compact) << "\n";
+    m_out.flush();
+}
+
+void HubDaemon::handleHubLogString(QString serial, QString logLine){
+    QJsonObject line;
+    line["ts"] = (double)QDateTime::currentMSecsSinceEpoch();
+    line["serial"] = serial;
+    line["log"] = logLine;
+    m_out << QJsonDocument(line).toJson(QJsonDocument::Compact) << "\n";
+    m_out.flush();
+}
@@ -0,0 +1,73 @@
+#ifndef HUBDAEMON_H
+#define HUBDAEMON_H
+
+#include <QObject>
+#include <QFile>
+#include <QTextStream>
+#include <QTimer>
+
+#include "fleetmanager.h"
+#include "metricsserver.h"
+
+// The headless side of fleet mode: polls every hub through a FleetManager and
+// writes the latest values as JSON lines instead of drawing them. Everything
+// here is QtCore, so hubtoold builds without widgets or a display.
+//
+// Each report is one line per hub:
+//   {"ts":..., "serial":"0x...", "model":"...", "connected":true, "rate":...,
+//    "temperature":"...", "inputVoltage":uV, "inputCurrent":uA,
+//    "energy":uWh, "charge":uAh,
+//    "ports":[{"voltage":uV, "current":uA, "state":"...", "energy":uWh, "charge":uAh}, ...]}
+// and log lines go out as {"ts":..., "log":"..."}, with the hub's "serial"
+// when they come from one hub's worker (read errors, reconnects, recording,
+// trigger actions).
+//
+// With startMetrics() the same values are also served for scraping, in
+// OpenMetrics text (see metricsserver.h), refreshed every few hundred ms
+// whatever the report interval.
+class HubDaemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HubDaemon(int maxThreads = 0, QObject *parent = nullptr);
+    ~HubDaemon();
+
+    FleetManager* fleet() { return &m_fleet; }
+
+    void setReportInterval(int ms);
+    void setTargetRate(double hz) { m_fleet.setTargetRate(hz); }
+
+    // where packet captures go, one ring file per hub; capture is off until
+    // setCapturing(true)
+    void setCaptureDirectory(const QString &directory) { m_captureDirectory = directory; }
+    bool isCapturing() const { return m_capturing; }
+
+    // serve every hub's values at http://address:port/metrics
+    void startMetrics(const QString &address, quint16 port);
+
+public slots:
+    void start();
+    void report();
+    void setCapturing(bool capturing);
+    void toggleCapturing() { setCapturing(!m_capturing); }
+
+private slots:
+    void handleLogString(QString logLine);
+    void handleHubLogString(QString serial, QString logLine);
+    void publishMetrics();
+
+private:
+    FleetManager m_fleet;
+    QTimer m_reportTimer;
+    QFile m_stdout;
+    QTextStream m_out;
+    QString m_captureDirectory;
+    bool m_capturing;
+
+    MetricsServer *m_metrics;
+    QTimer m_metricsTimer;
+    std::vector<HubSnapshot> m_metricsHubs;
+};
+
+#endif // HUBDAEMON_H
@@ -0,0 +1,87 @@
+#include "hubsnapshot.h"
+
+#include "BrainStem2/BrainStem-all.h"
+
+QString formatTemperature(const HubSnapshot &snapshot){
+    // never print something higher than 200C
+    int32_t maxTemperature = snapshot.maxTemperature/1.0e6 > 200 ? 200 : snapshot.maxTemperature;
+    int32_t temperature = snapshot.temperature/1.0e6 > 200 ? 200 : snapshot.temperature;
+
+    QString maxTempStr, tempStr;
+    maxTempStr.sprintf("%.1f", maxTemperature/1.0e6);
+    tempStr.sprintf("%.1f", temperature/1.0e6);
+    if(snapshot.hasMaxTemperature){
+        return QString("%1˚C (max: %2˚C)").arg(tempStr, maxTempStr);
+    }
+    return QString("%1˚C").arg(tempStr);
+}
+
+QString formatUptime(const HubSnapshot &snapshot){
+    if(!snapshot.hasUptime){
+        return QString("Not Supported");
+    }
+    return QString("%1h%2m").arg(snapshot.uptime/60).arg((int)(snapshot.uptime%60));
+}
+
+QString formatPortState(uint32_t portState, int8_t *speed){
+    const int usbDeviceAttached=_BIT(aUSBHUB3P_DEVICE_ATTACHED);
+    const int usbConstantCurrent=_BIT(aUSBHUB2X4_CONSTANT_CURRENT);
+    const int usbError=_BIT(aUSBHUB3P_USB_ERROR_FLAG);
+    const int usbHiSpeed=_BIT(aUSBHUB3P_USB_SPEED_USB2);
+    const int usbSSpeed=_BIT(aUSBHUB3P_USB_SPEED_USB3);
+
+    QString str = " ";
+    str += (portState & usbDeviceAttached) ? "ATT ": "";
+    str += (portState & usbConstantCurrent) ? "CC ": "";
+    str += (portState & usbError) ? "ERR ": "";
+
+    *speed = -1;
+    if (portState & usbDeviceAttached) {
+        if (portState & usbHiSpeed) {
+            *speed = usbDownstreamDataSpeed_hs;
+        }
+        if (portState & usbSSpeed) {
+            *speed = usbDownstreamDataSpeed_ss;
+        }
+    }
+    return str;
+}
+
+QString formatPortError(uint32_t portError){
+    // TODO: not sure why we're skipping nibbles
+    const int usb_error_over_ilim = _BIT(aUSBHUB3P_ERROR_VBUS_OVERCURRENT);
+    const int usb_error_back_volt = _BIT(aUSBHUB3P_ERROR_VBUS_BACKDRIVE);
+    const int usb_error_hub_power = _BIT(aUSBHUB3P_ERROR_HUB_POWER);
+    const int usb_error_discharge_err= _BIT(aUSBHub2X4_ERROR_DISCHARGE);
+
+    QString str;
+    str = (portError & usb_error_over_ilim)? "OVER_ILIM " : "";
+    str += (portError & usb_error_back_volt) ? "BACK_VOLT " : "";
+    str += (portError & usb_error_hub_power) ? "OVER_VOLT " : "";
+    str += (portError & usb_error_discharge_err) ? "DISCHARGE_ERR " : "";
+    return str;
+}
+
+QString formatUpstreamPort(uint8_t upstreamPortState){
+    switch(upstreamPortState){
+        case usbUpstreamStateNone:
+            return "None";
+        case usbUpstreamStatePort0:
+            return "Port 0";
+        case usbUpstreamStatePort1:
+            return "Port 1";
+        default:
+            return "Unknown";
+    } // case upstreamPortState
+}
+
+QString formatModel(uint8_t model){
+    switch(model){
+    case(aMODULE_TYPE_USBHub2x4):
+        return "USBHub2x4";
+    case(aMODULE_TYPE_USBHub3p):
+        return "USBHub3p";
+    default:
+        return "Unknown";
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef HUBSNAPSHOT_H
+#define HUBSNAPSHOT_H
+
+#include <stdint.h>
+#include <QString>
+
+#include "spscring.h"
+
+#define HUB_SNAPSHOT_QUEUE_SIZE 256
+
+// Everything a poll cycle knows about a hub, as raw values. The worker keeps
+// one up to date and publishes a copy at the end of every cycle. The changed
+// bits say which fields differ from the last published copy, so the consumer
+// only has to reformat those.
+struct HubSnapshot {
+    enum ChangedField {
+        ChangedPortVoltageCurrent   = 1 << 0,
+        ChangedHubMode              = 1 << 1,
+        ChangedPortState            = 1 << 2,
+        ChangedPortError            = 1 << 3,
+        ChangedCurrentLimit         = 1 << 4,
+        ChangedPortMode             = 1 << 5,
+        ChangedTemperature          = 1 << 6,
+        ChangedInputVoltage         = 1 << 7,   // USBHub2x4, voltage only
+        ChangedInputVoltageCurrent  = 1 << 8,   // USBHub3+
+        ChangedUserLed              = 1 << 9,
+        ChangedStemInfo             = 1 << 10,
+        ChangedUptime               = 1 << 11,
+        ChangedUpstreamPort         = 1 << 12,
+        ChangedUpstreamMode         = 1 << 13,
+        ChangedUpstreamBoost        = 1 << 14,
+        ChangedEnumerationDelay     = 1 << 15,
+        ChangedDownstreamBoost      = 1 << 16,
+        ChangedEnergy               = 1 << 17,
+    };
+
+    uint32_t sequence;
+    int64_t timestampMs;            // ms since epoch at the end of the cycle
+    uint32_t changed;               // ChangedField bits
+
+    // polling rates, sent every cycle
+    float achievedRate;             // Hz
+    float targetRate;               // Hz, 0 for as fast as possible
+    float allowedRate;              // Hz, 0 unless backing off
+
+    // link health, sent every cycle
+    uint8_t connectionState;        // ConnectionMonitor::State
+    uint32_t reconnectCount;
+    uint32_t reconnectAttempts;     // across every outage
+    int32_t lastReconnectMs;        // length of the last outage, -1 before the first
+
+    // which ports changed, bit n for port n
+    uint8_t portStateChanged;
+    uint8_t portErrorChanged;
+    uint8_t currentLimitChanged;
+    uint8_t portModeChanged;
+
+    // per port parts
+    uint8_t numUSB;
+    int32_t portVoltage[8];         // uV
+    int32_t portCurrent[8];         // uA
+    uint32_t hubMode;
+    uint32_t portState[8];
+    uint32_t portError[8];
+    uint32_t currentLimit[8];       // uA
+    uint8_t portMode[8];
+
+    // energy and charge since each port's last reset, from the V/I readings
+    int64_t portEnergy[8];          // uWh
+    int64_t portCharge[8];          // uAh
+    int64_t energySinceMs[8];       // epoch time of the port's last reset
+    int64_t hubEnergy;              // uWh, every port
+    int64_t hubCharge;              // uAh, every port
+
+    // system parts
+    int32_t temperature;            // micro degrees C
+    int32_t maxTemperature;
+    bool hasMaxTemperature;
+    uint32_t inputVoltage;          // uV
+    uint32_t inputCurrent;          // uA
+    uint8_t userLed;
+    uint32_t serialNumber;
+    uint8_t model;
+    uint32_t firmwareVersion;
+    bool hasUptime;
+    uint32_t uptime;                // minutes
+
+    // upstream parts
+    uint8_t upstreamPortState;
+    uint8_t upstreamMode;
+    uint8_t upstreamBoost;
+
+    // downstream parts
+    uint32_t enumerationDelay;      // ms
+    uint8_t downstreamBoost;
+};
+
+typedef SpscRing<HubSnapshot, HUB_SNAPSHOT_QUEUE_SIZE> HubSnapshotQueue;
+
+// display formatting, for the consumer side
+QString formatTemperature(const HubSnapshot &snapshot);
+QString formatUptime(const HubSnapshot &snapshot);
+QString formatPortState(uint32_t portState, int8_t *speed);
+QString formatPortError(uint32_t portError);
+QString formatUpstreamPort(uint8_t upstreamPortState);
+QString formatModel(uint8_t model);
+
+#endif // HUBSNAPSHOT_H
@@ -4,8 +4,16 @@
 #include <iostream>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <QInputDialog>
 #include <QMessageBox>
+#include <QMenu>
+#include <QActionGroup>
+#include <QFileDialog>
+#include <QStandardPaths>
+#include <QDir>
+
+#include "exportprogressdialog.h"
 #include <QTime>
 #include <QDebug>
 #include <QProcess>
@@ -15,9 +23,11 @@
 #define aVERSION_UNPACK_MINOR(pack) ((pack & 0xF000000) >> 24)
 #define aVERSION_UNPACK_PATCH(pack) ((pack) & 0xFFFFFF)
 
-#define updateRateAvgLength 5
-unsigned int pollingDelay = 20;
 #define plotUpdateDelay 100
+#define snapshotDrainDelay 33
+#define statisticsUpdateDelay 500
+#define metricsPublishDelay 250
+#define metricsStaleDelay 2000
 
 HubTool::HubTool(linkSpec* spec, QWidget *parent)
     : QMainWindow(parent),
@@ -28,6 +38,8 @@ HubTool::HubTool(linkSpec* spec, QWidget *parent)
     setWindowIcon(QIcon(":/icons/HubTool.icns"));
 
     m_startTimeMs = QDateTime(QDateTime::currentDateTime()).toMSecsSinceEpoch();
+    metricsServer = nullptr;
+    controlServer = nullptr;
 
     // Initialize the application (mostly gui stuff).
     init();
@@ -42,6 +54,7 @@ HubTool::HubTool(linkSpec* spec, QWidget *parent)
     qRegisterMetaType<uint32_t>("uint32_t");
     qRegisterMetaType<uint8_t>("uint8_t");
     qRegisterMetaType<int8_t>("int8_t");
+    qRegisterMetaType<QList<UEICallSummary> >("QList<UEICallSummary>");
 
     // ////////////////////////////////////////////////////
     // connect stem worker signals to UI handling slots
@@ -53,50 +66,77 @@ HubTool::HubTool(linkSpec* spec, QWidget *parent)
              this, SLOT(handleSelectStemFromList(QStringList)), Qt::QueuedConnection);
     connect (stemWorker, SIGNAL(requestMsgBox(QString)),
              this, SLOT(handleMsgBoxRequest(QString)));
-    connect (stemWorker, SIGNAL(finishedPolling()),
-             this, SLOT(handlePollingFinished()), Qt::QueuedConnection);
-
-    // per port parts
-    connect (stemWorker, SIGNAL(portVoltageCurrentChanged(int, int32_t, int32_t)),
-            this, SLOT(handlePortVoltageCurrent(int, int32_t, int32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(hubModeChanged(uint32_t)),
-             this, SLOT(handleHubMode(uint32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(hubStateChanged(int, QString, int8_t)),
-            this, SLOT(handleHubState(int, QString, int8_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(hubErrorStatusChanged(int, QString)),
-             this, SLOT(handleHubErrorStatus(int, QString)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(portCurrentLimitChanged(int, uint32_t)),
-             this, SLOT(handlePortCurrentLimit(int, uint32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(portModeChanged(int, uint8_t)),
-             this, SLOT(handlePortMode(int, uint8_t)), Qt::QueuedConnection);
-
-    // system parts
-    connect (stemWorker, SIGNAL(temperatureChanged(QString)),
-             this, SLOT(handleTemperature(QString)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(inputVoltageChanged(uint32_t)),
-             this, SLOT(handleInputVoltage(uint32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(inputVoltageCurrentChanged(uint32_t, uint32_t)),
-             this, SLOT(handleInputVoltageCurrent(uint32_t, uint32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(userLedChanged(uint8_t)),
-              this, SLOT(handleUserLed(uint8_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(stemInfoChanged(uint32_t, QString, uint32_t)),
-              this, SLOT(handleStemInfo(uint32_t, QString, uint32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(uptimeChanged(QString)),
-             this, SLOT(handleUptime(QString)));
-
-    // upstream parts
-    connect (stemWorker, SIGNAL(upstreamPortChanged(QString)),
-             this, SLOT(handleUpstreamPort(QString)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(upstreamModeChanged(uint8_t)),
-             this, SLOT(handleUpstreamMode(uint8_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(upstreamBoostChanged(uint8_t)),
-             this, SLOT(handleUpstreamBoost(uint8_t)), Qt::QueuedConnection);
-
-    // downstream parts
-    connect (stemWorker, SIGNAL(enumerationDelayChanged(uint32_t)),
-             this, SLOT(handleEnumerationDelay(uint32_t)), Qt::QueuedConnection);
-    connect (stemWorker, SIGNAL(downstreamBoostChanged(uint8_t)),
-             this, SLOT(handleDownstreamBoost(uint8_t)), Qt::QueuedConnection);
+    connect (stemWorker, SIGNAL(pollRatesChanged(QString)),
+             this, SLOT(handlePollRates(QString)), Qt::QueuedConnection);
+
+    // per UEI call timings, gathered only while their window is open
+    callTimingWindow = new CallTimingWindow();
+    connect (stemWorker, SIGNAL(callTimingsChanged(QList<UEICallSummary>)),
+             callTimingWindow, SLOT(handleCallTimings(QList<UEICallSummary>)), Qt::QueuedConnection);
+    connect (callTimingWindow, SIGNAL(timingEnabledChanged(bool)),
+             stemWorker, SLOT(setCallTimingEnabled(bool)));
+    // recordings play back through the same snapshot path as the hub
+    memset(&liveSnapshot, 0, sizeof(liveSnapshot));
+    playbackWindow = new PlaybackWindow();
+    connect(playbackWindow, SIGNAL(activeChanged(bool)), this, SLOT(handlePlaybackActive(bool)));
+    connect(playbackWindow, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+
+    QMenu *fileMenu = ui->menuBar->addMenu("File");
+    fileMenu->addAction("Play Back Recording...", this, SLOT(openRecording()));
+    fileMenu->addAction("Export All Ports...", this, SLOT(exportAllPorts()));
+    QMenu *diagnosticsMenu = ui->menuBar->addMenu("Diagnostics");
+    diagnosticsMenu->addAction("UEI Call Timings...", this, SLOT(showCallTimings()));
+
+    // per port energy and charge, counted by the worker
+    energyWindow = new EnergyWindow();
+    connect(energyWindow, SIGNAL(userResetEnergy(int)), stemWorker, SLOT(resetEnergy(int)));
+    diagnosticsMenu->addAction("Port Energy...", this, SLOT(showEnergy()));
+
+    // which window the rolling statistics beside the readouts cover
+    QMenu *statisticsMenu = ui->menuBar->addMenu("Statistics");
+    QActionGroup *statisticsGroup = new QActionGroup(this);
+    statisticsWindow = 1;
+    for(int window = 0; window < portStatistics[0].windowCount(); window++){
+        QAction *action = statisticsMenu->addAction(QString("Over %1").arg(PortStatistics::spanName(portStatistics[0].spanMs(window))));
+        action->setCheckable(true);
+        action->setChecked(window == statisticsWindow);
+        action->setData(window);
+        statisticsGroup->addAction(action);
+    }
+    connect(statisticsGroup, SIGNAL(triggered(QAction*)), this, SLOT(setStatisticsWindow(QAction*)));
+    connect(&statisticsTimer, SIGNAL(timeout()), this, SLOT(updateStatistics()));
+    statisticsTimer.setInterval(statisticsUpdateDelay);
+    statisticsTimer.start();
+
+    // packet capture into a ring file, on and off at any time
+    packetCaptureAction = diagnosticsMenu->addAction("Capture Packets...");
+    packetCaptureAction->setCheckable(true);
+    connect(packetCaptureAction, SIGNAL(toggled(bool)), this, SLOT(togglePacketCapture(bool)));
+    connect(this, SIGNAL(userChangedPacketCapture(QString)),
+            stemWorker, SLOT(setPacketCapture(QString)));
+
+    // rules the worker checks every reading against, acting on the ports itself
+    triggerRulesAction = diagnosticsMenu->addAction("Port Triggers...");
+    triggerRulesAction->setCheckable(true);
+    connect(triggerRulesAction, SIGNAL(toggled(bool)), this, SLOT(toggleTriggerRules(bool)));
+    connect(this, SIGNAL(userChangedTriggerRules(QString)),
+            stemWorker, SLOT(setTriggerRules(QString)));
+
+    // every port sample goes to disk from the worker's thread, on by default
+    sampleDirectory = defaultSampleDirectory();
+    sampleRecordingAction = diagnosticsMenu->addAction("Record Samples");
+    sampleRecordingAction->setCheckable(true);
+    sampleRecordingAction->setChecked(true);
+    sampleRecordingAction->setToolTip(sampleDirectory);
+    connect(sampleRecordingAction, SIGNAL(toggled(bool)), this, SLOT(toggleSampleRecording(bool)));
+    connect(this, SIGNAL(userChangedSampleRecording(QString)),
+            stemWorker, SLOT(setSampleRecording(QString)));
+    emit userChangedSampleRecording(sampleDirectory);
+
+    // hub values come through the worker's snapshot queue, drained at our own pace
+    connect(&snapshotTimer, SIGNAL(timeout()), this, SLOT(drainSnapshots()));
+    snapshotTimer.setInterval(snapshotDrainDelay);
+    snapshotTimer.start();
 
     // ////////////////////////////////////////////////////
     // connect UI signals to stem worker slots
@@ -235,17 +275,22 @@ HubTool::HubTool(linkSpec* spec, QWidget *parent)
             stemWorker, SLOT(changePortName(QString, int)));
     connect(this, SIGNAL(systemNameChanged(QString)),
             stemWorker, SLOT(changeSystemName(QString)));
+    connect(this, SIGNAL(userChangedPollingPeriod(double)),
+            stemWorker, SLOT(setTargetRate(double)), Qt::QueuedConnection);
 
 
-    // start the worker thread
-    stemWorkerThread.start();
+    // the worker paces its own polling; the spin box sets the target period
+    on_pollingDelaySpinBox_editingFinished();
 
+    // start the worker thread, then the polling once it's running
+    stemWorkerThread.start();
+    QMetaObject::invokeMethod(stemWorker, "startPolling", Qt::QueuedConnection);
 
-    // do a single shot in case the polling takes a long time so we don't
-    // overlap the updates
-    QTimer::singleShot(pollingDelay, stemWorker, SLOT(pollStemForChanges()));
-    // start polling timer to track how long the polling takes
-    pollingFireTime.start();
+    // tell the worker the moment its hub is unplugged or comes back
+    connect(&hotplug, SIGNAL(hubAttached(linkSpec)), stemWorker, SLOT(hubAttached(linkSpec)));
+    connect(&hotplug, SIGNAL(hubDetached(uint32_t)), stemWorker, SLOT(hubDetached(uint32_t)));
+    connect(&hotplug, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+    hotplug.start();
 
     // start a plot update timer
     connect(&plotUpdateTimer, SIGNAL(timeout()), this, SLOT(updatePlots()), Qt::DirectConnection);
@@ -295,11 +340,22 @@ HubTool::~HubTool()
     }
 
 
+    // the servers go first; the control server's thread queues calls to
+    // the worker's slots right up until it's stopped
+    metricsTimer.stop();
+    delete controlServer;
+    controlServer = nullptr;
+    delete metricsServer;
+    metricsServer = nullptr;
+
     // stop the worker thread and clean up
     qDebug() << "cleaning up from stem worker thread";
     stemWorkerThread.quit();
     stemWorkerThread.wait();
     delete stemWorker;
+    delete callTimingWindow;
+    delete playbackWindow;
+    delete energyWindow;
 
     qDebug() << "cleaning up plot windows";
     for(int port=0;port<8;port++){
@@ -355,6 +411,16 @@ void HubTool::init_gui()
         setupCurrentSparkline(currentSparkline[port]);
     }
 
+    // rolling statistics next to the readouts
+    QLabel* voltageReadouts[8] = {ui->labelVoltageUSB0, ui->labelVoltageUSB1, ui->labelVoltageUSB2, ui->labelVoltageUSB3,
+                                  ui->labelVoltageUSB4, ui->labelVoltageUSB5, ui->labelVoltageUSB6, ui->labelVoltageUSB7};
+    QLabel* currentReadouts[8] = {ui->labelCurrentUSB0, ui->labelCurrentUSB1, ui->labelCurrentUSB2, ui->labelCurrentUSB3,
+                                  ui->labelCurrentUSB4, ui->labelCurrentUSB5, ui->labelCurrentUSB6, ui->labelCurrentUSB7};
+    for(int port=0;port<8;port++){
+        voltageStatisticsLabel[port] = addStatisticsLabel(voltageReadouts[port]);
+        currentStatisticsLabel[port] = addStatisticsLabel(currentReadouts[port]);
+    }
+
     //SpinBox's - Current Limit
     ui->spinBox_USB0->setRange(0,4095);
     ui->spinBox_USB0->setValue(4095);
@@ -449,6 +515,7 @@ void HubTool::keyPressEvent(QKeyEvent *e) {
         for(int port=0; port<8; port++){
             if(VandIdataWindow[port]) VandIdataWindow[port]->close();
         }
+        callTimingWindow->close();
         HubTool::close();
     }
     else
@@ -466,29 +533,218 @@ void HubTool::handleResults(int channel, bool checked)
     qDebug() << "Handling result " << channel << " and " << checked;
 }
 
-void HubTool::handlePollingFinished(){
-    // calculate the update rate
-    static double historticalPollingTime[updateRateAvgLength];
-    double pollingTimeSum=0.0;
+void HubTool::showCallTimings(){
+    callTimingWindow->show();
+    callTimingWindow->raise();
+    callTimingWindow->activateWindow();
+}
+
+void HubTool::showEnergy(){
+    energyWindow->show();
+    energyWindow->raise();
+    energyWindow->activateWindow();
+}
+
+void HubTool::startPacketCapture(const QString &path){
+    // set the check without asking for a file
+    packetCaptureAction->blockSignals(true);
+    packetCaptureAction->setChecked(true);
+    packetCaptureAction->blockSignals(false);
+    emit userChangedPacketCapture(path);
+}
+
+void HubTool::togglePacketCapture(bool checked){
+    if(!checked){
+        emit userChangedPacketCapture(QString());
+        return;
+    }
+
+    QString defaultName = QString("hubtool-%1.trace").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+    QString path = QFileDialog::getSaveFileName(this, "Capture packets to", defaultName, "Packet traces (*.trace)");
+    if(path.isEmpty()){
+        packetCaptureAction->blockSignals(true);
+        packetCaptureAction->setChecked(false);
+        packetCaptureAction->blockSignals(false);
+        return;
+    }
+    emit userChangedPacketCapture(path);
+}
+
+void HubTool::loadTriggerRules(const QString &path){
+    triggerRulesAction->blockSignals(true);
+    triggerRulesAction->setChecked(true);
+    triggerRulesAction->blockSignals(false);
+    triggerRulesAction->setToolTip(path);
+    emit userChangedTriggerRules(path);
+}
+
+void HubTool::toggleTriggerRules(bool checked){
+    if(!checked){
+        emit userChangedTriggerRules(QString());
+        return;
+    }
+
+    QString path = QFileDialog::getOpenFileName(this, "Trigger rules", QString(), "Trigger rules (*.json)");
+    if(path.isEmpty()){
+        triggerRulesAction->blockSignals(true);
+        triggerRulesAction->setChecked(false);
+        triggerRulesAction->blockSignals(false);
+        return;
+    }
+    triggerRulesAction->setToolTip(path);
+    emit userChangedTriggerRules(path);
+}
+
+void HubTool::startMetrics(const QString &address, quint16 port){
+    if(!metricsServer){
+        metricsServer = new MetricsServer();
+        connect(metricsServer, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+    }
+    metricsServer->listen(address, port);
+
+    if(!metricsTimer.isActive()){
+        connect(&metricsTimer, SIGNAL(timeout()), this, SLOT(publishMetrics()));
+        metricsTimer.setInterval(metricsPublishDelay);
+        metricsTimer.start();
+    }
+}
+
+// Like hubtoold's: a hub whose link isn't up is published as lost, and so is
+// one the worker hasn't said anything about for a while.
+void HubTool::publishMetrics(){
+    HubSnapshot hub = liveSnapshot;
+    bool stale = !liveSnapshotAge.isValid() || liveSnapshotAge.elapsed() > metricsStaleDelay;
+    if(stale || hub.connectionState > ConnectionMonitor::Degraded){
+        hub.connectionState = ConnectionMonitor::Lost;
+    }
+    metricsServer->publish(&hub, 1);
+}
+
+void HubTool::startControl(const QString &name){
+    if(!controlServer){
+        controlServer = new ControlServer(stemWorker);
+        connect(controlServer, SIGNAL(logStringReady(QString)), this, SLOT(handleLogString(QString)));
+    }
+    controlServer->listen(name);
+}
+
+QString HubTool::defaultSampleDirectory(){
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("samples");
+}
 
-    for(int i=0; i<updateRateAvgLength-1; i++){
-        historticalPollingTime[i]=historticalPollingTime[i+1];
-        pollingTimeSum+=historticalPollingTime[i];
+void HubTool::setSampleDirectory(const QString &directory){
+    sampleDirectory = directory;
+    sampleRecordingAction->setToolTip(directory);
+    if(sampleRecordingAction->isChecked()){
+        emit userChangedSampleRecording(directory);
     }
-    historticalPollingTime[updateRateAvgLength-1]=pollingFireTime.elapsed()/1000.0;
-    pollingTimeSum += historticalPollingTime[updateRateAvgLength-1];
+}
 
-    double updateRate = pollingTimeSum/updateRateAvgLength > 0.0 ? 1.0/(pollingTimeSum/updateRateAvgLength) : 0.0;
-    ui->labelUpdateRate->setText(QString("%1Hz").arg(QString::number(updateRate, 'f', 1)));
+// turning it back on starts a new file
+void HubTool::toggleSampleRecording(bool checked){
+    emit userChangedSampleRecording(checked ? sampleDirectory : QString());
+}
 
-    // just refire the timer after a short period
-    // using this method ensures the polling is done, and then waits
-    // and then fires anothr polling
-    QTimer::singleShot(pollingDelay, stemWorker, SLOT(pollStemForChanges()));
+void HubTool::openRecording(){
+    playbackWindow->openRecording(sampleDirectory);
+}
 
+// The plots start over for each recording and again for the hub afterwards,
+// and the labels go back to the hub's last values.
+void HubTool::handlePlaybackActive(bool active){
+    clearPortPlots();
+    if(!active && liveSnapshot.changed){
+        applySnapshot(liveSnapshot);
+    }
+}
 
-    // reset the timer for update rate
-    pollingFireTime.restart();
+void HubTool::clearPortPlots(){
+    for(int channel = 0; channel < 8; channel++){
+        voltageSparkline[channel]->graph()->data()->clear();
+        currentSparkline[channel]->graph()->data()->clear();
+        VandIdataWindow[channel]->clearSamples();
+        portStatistics[channel].clear();
+    }
+}
+
+// in the readout's own grid, in the column after it
+QLabel* HubTool::addStatisticsLabel(QLabel *readout){
+    QLabel *label = new QLabel(readout->parentWidget());
+    QFont font = label->font();
+    font.setPointSizeF(font.pointSizeF()*0.85);
+    label->setFont(font);
+
+    for(QGridLayout *grid: readout->parentWidget()->findChildren<QGridLayout*>()){
+        int index = grid->indexOf(readout);
+        if(index < 0)
+            continue;
+        int row, column, rowSpan, columnSpan;
+        grid->getItemPosition(index, &row, &column, &rowSpan, &columnSpan);
+        grid->addWidget(label, row, column + columnSpan);
+        break;
+    }
+    return label;
+}
+
+void HubTool::setStatisticsWindow(QAction *action){
+    statisticsWindow = action->data().toInt();
+    updateStatistics();
+}
+
+static QString compactStatistics(const RollingStats::Result &result){
+    if(result.count == 0)
+        return QString();
+    return QString("avg %1 sd %2")
+            .arg(QString::number(result.mean/1000000.0, 'f', 3))
+            .arg(QString::number(result.stddev/1000000.0, 'f', 3));
+}
+
+// only for the ports that are showing, in the main window or their plot window
+void HubTool::updateStatistics(){
+    qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    for(int port = 0; port < 8; port++){
+        bool labelsShowing = voltageStatisticsLabel[port]->isVisible();
+        if(!labelsShowing && !VandIdataWindow[port]->isVisible())
+            continue;
+
+        QString span = PortStatistics::spanName(portStatistics[port].spanMs(statisticsWindow));
+        QString voltageTip = "Voltage (V)";
+        QString currentTip = "Current (A)";
+        RollingStats::Result voltage = portStatistics[port].voltage(statisticsWindow, nowMs);
+        RollingStats::Result current = portStatistics[port].current(statisticsWindow, nowMs);
+        if(labelsShowing){
+            for(int window = 0; window < portStatistics[port].windowCount(); window++){
+                QString name = PortStatistics::spanName(portStatistics[port].spanMs(window));
+                voltageTip += QString("\n%1: %2").arg(name).arg(PortStatistics::format(portStatistics[port].voltage(window, nowMs)));
+                currentTip += QString("\n%1: %2").arg(name).arg(PortStatistics::format(portStatistics[port].current(window, nowMs)));
+            }
+            voltageStatisticsLabel[port]->setText(compactStatistics(voltage));
+            voltageStatisticsLabel[port]->setToolTip(voltageTip);
+            currentStatisticsLabel[port]->setText(compactStatistics(current));
+            currentStatisticsLabel[port]->setToolTip(currentTip);
+        }
+
+        if(VandIdataWindow[port]->isVisible()){
+            VandIdataWindow[port]->showStatistics(span, voltage, current);
+        }
+    }
+}
+
+// every port's plotted samples, side by side in one file
+void HubTool::exportAllPorts(){
+    uint8_t model=0;
+    stemWorker->getConnectedModel(&model);
+    int numPorts = model == aMODULE_TYPE_USBHub2x4 ? 4 : 8;
+    QList<PlotWindow*> windows;
+    for(int port = 0; port < numPorts; port++){
+        windows << VandIdataWindow[port];
+    }
+    ExportProgressDialog::exportPorts(this, windows, m_startTimeMs);
+}
+
+void HubTool::handlePollRates(QString rateSummary){
+    // the per entity rates are too much for the label itself, so hover for them
+    ui->labelUpdateRate->setToolTip(rateSummary);
 }
 
 
@@ -519,20 +775,172 @@ void HubTool::handleMsgBoxRequest(QString message){
 
 
 
+// Takes everything the worker has published since the last frame. Every
+// snapshot's port samples go to the plots, but the labels are only formatted
+// once, from the newest snapshot, for the fields that changed in any of them.
+// While a recording plays back, the player's snapshots take the worker's
+// place and the hub's are only kept for when it ends.
+void HubTool::drainSnapshots(){
+    HubSnapshot latest;
+    bool playingBack = playbackWindow->isActive();
+
+    if(drainSnapshotQueue(stemWorker->snapshots(), !playingBack, true, &latest)){
+        keepLiveSnapshot(latest);
+        liveSnapshotAge.start();
+        if(!playingBack){
+            applySnapshot(latest);
+        }
+    }
+    if(playingBack && drainSnapshotQueue(playbackWindow->snapshots(), true, false, &latest)){
+        applySnapshot(latest);
+    }
+}
+
+// latest gets the newest snapshot with the changed bits of all of them; the
+// hub's own (live) ones each go on to the control API's subscribers too
+template <typename Queue>
+bool HubTool::drainSnapshotQueue(Queue *queue, bool plot, bool live, HubSnapshot *latest){
+    HubSnapshot snapshot;
+    bool gotSnapshot = false;
+    uint32_t changed = 0;
+    uint8_t portStateChanged = 0, portErrorChanged = 0, currentLimitChanged = 0, portModeChanged = 0;
+
+    while(queue->pop(snapshot)){
+        if(live && controlServer){
+            controlServer->publish(snapshot);
+        }
+        if(plot && (snapshot.changed & HubSnapshot::ChangedPortVoltageCurrent)){
+            for(int channel = 0; channel < snapshot.numUSB; channel++){
+                addPortSample(channel, snapshot.timestampMs, snapshot.portVoltage[channel], snapshot.portCurrent[channel]);
+            }
+        }
+
+        changed |= snapshot.changed;
+        portStateChanged |= snapshot.portStateChanged;
+        portErrorChanged |= snapshot.portErrorChanged;
+        currentLimitChanged |= snapshot.currentLimitChanged;
+        portModeChanged |= snapshot.portModeChanged;
+        *latest = snapshot;
+        gotSnapshot = true;
+    }
+
+    if(!gotSnapshot)
+        return false;
+
+    latest->changed = changed;
+    latest->portStateChanged = portStateChanged;
+    latest->portErrorChanged = portErrorChanged;
+    latest->currentLimitChanged = currentLimitChanged;
+    latest->portModeChanged = portModeChanged;
+    return true;
+}
+
+void HubTool::keepLiveSnapshot(const HubSnapshot &snapshot){
+    uint32_t changed = liveSnapshot.changed | snapshot.changed;
+    uint8_t portStateChanged = liveSnapshot.portStateChanged | snapshot.portStateChanged;
+    uint8_t portErrorChanged = liveSnapshot.portErrorChanged | snapshot.portErrorChanged;
+    uint8_t currentLimitChanged = liveSnapshot.currentLimitChanged | snapshot.currentLimitChanged;
+    uint8_t portModeChanged = liveSnapshot.portModeChanged | snapshot.portModeChanged;
+
+    liveSnapshot = snapshot;
+    liveSnapshot.changed = changed;
+    liveSnapshot.portStateChanged = portStateChanged;
+    liveSnapshot.portErrorChanged = portErrorChanged;
+    liveSnapshot.currentLimitChanged = currentLimitChanged;
+    liveSnapshot.portModeChanged = portModeChanged;
+}
+
+void HubTool::applySnapshot(const HubSnapshot &snapshot){
+    const uint32_t changed = snapshot.changed;
+
+    ui->labelUpdateRate->setText(QString("%1Hz").arg(QString::number(snapshot.achievedRate, 'f', 1)));
+
+    // per port parts
+    for(int channel = 0; channel < snapshot.numUSB; channel++){
+        const uint8_t bit = 1 << channel;
+
+        if(changed & HubSnapshot::ChangedPortVoltageCurrent){
+            handlePortVoltageCurrent(channel, snapshot.portVoltage[channel], snapshot.portCurrent[channel]);
+        }
+        if(snapshot.portStateChanged & bit){
+            int8_t spd;
+            QString stateStr = formatPortState(snapshot.portState[channel], &spd);
+            handleHubState(channel, stateStr, spd);
+        }
+        if(snapshot.portErrorChanged & bit){
+            handleHubErrorStatus(channel, formatPortError(snapshot.portError[channel]));
+        }
+        if(snapshot.currentLimitChanged & bit){
+            handlePortCurrentLimit(channel, snapshot.currentLimit[channel]);
+        }
+        if(snapshot.portModeChanged & bit){
+            handlePortMode(channel, snapshot.portMode[channel]);
+        }
+    }
+    if(changed & HubSnapshot::ChangedHubMode){
+        handleHubMode(snapshot.hubMode);
+    }
+    if(changed & HubSnapshot::ChangedEnergy){
+        energyWindow->showEnergy(snapshot);
+    }
+
+    // system parts
+    if(changed & HubSnapshot::ChangedTemperature){
+        handleTemperature(formatTemperature(snapshot));
+    }
+    if(changed & HubSnapshot::ChangedInputVoltage){
+        handleInputVoltage(snapshot.inputVoltage);
+    }
+    if(changed & HubSnapshot::ChangedInputVoltageCurrent){
+        handleInputVoltageCurrent(snapshot.inputVoltage, snapshot.inputCurrent);
+    }
+    if(changed & HubSnapshot::ChangedUserLed){
+        handleUserLed(snapshot.userLed);
+    }
+    if(changed & HubSnapshot::ChangedStemInfo){
+        handleStemInfo(snapshot.serialNumber, formatModel(snapshot.model), snapshot.firmwareVersion);
+    }
+    if(changed & HubSnapshot::ChangedUptime){
+        handleUptime(formatUptime(snapshot));
+    }
+
+    // upstream parts
+    if(changed & HubSnapshot::ChangedUpstreamPort){
+        handleUpstreamPort(formatUpstreamPort(snapshot.upstreamPortState));
+    }
+    if(changed & HubSnapshot::ChangedUpstreamMode){
+        handleUpstreamMode(snapshot.upstreamMode);
+    }
+    if(changed & HubSnapshot::ChangedUpstreamBoost){
+        handleUpstreamBoost(snapshot.upstreamBoost);
+    }
+
+    // downstream parts
+    if(changed & HubSnapshot::ChangedEnumerationDelay){
+        handleEnumerationDelay(snapshot.enumerationDelay);
+    }
+    if(changed & HubSnapshot::ChangedDownstreamBoost){
+        handleDownstreamBoost(snapshot.downstreamBoost);
+    }
+}
+
+
 // per port parts
-void HubTool::handlePortVoltageCurrent(int channel, int32_t microVolts, int32_t microAmps){
-    // add data to the plot and update the plot:
-    // add data to plot and update the plot
+void HubTool::addPortSample(int channel, qint64 timestampMs, int32_t microVolts, int32_t microAmps){
+    // add data to plot, keyed by when the worker read it
     const double range_size = 32;
-    double currentTimeKey = (QDateTime::currentMSecsSinceEpoch() - m_startTimeMs)/1000.0;
+    double timeKey = (timestampMs - m_startTimeMs)/1000.0;
 
-    voltageSparkline[channel]->graph()->addData(currentTimeKey, microVolts/1000000.0);
-    currentSparkline[channel]->graph()->addData(currentTimeKey, microAmps/1000000.0);
-    voltageSparkline[channel]->graph()->data()->removeBefore(currentTimeKey-range_size);
-    currentSparkline[channel]->graph()->data()->removeBefore(currentTimeKey-range_size);
+    voltageSparkline[channel]->graph()->addData(timeKey, microVolts/1000000.0);
+    currentSparkline[channel]->graph()->addData(timeKey, microAmps/1000000.0);
+    voltageSparkline[channel]->graph()->data()->removeBefore(timeKey-range_size);
+    currentSparkline[channel]->graph()->data()->removeBefore(timeKey-range_size);
 
-    VandIdataWindow[channel]->handlePortVoltageCurrent(channel, microVolts, microAmps);
+    VandIdataWindow[channel]->addSample(timestampMs, microVolts, microAmps);
+    portStatistics[channel].add(timestampMs, microVolts, microAmps);
+}
 
+void HubTool::handlePortVoltageCurrent(int channel, int32_t microVolts, int32_t microAmps){
     // update the text fields
     switch (channel){
         case 0:
@@ -864,7 +1272,9 @@ void HubTool::on_pollingDelaySpinBox_editingFinished()
         ui->pollingDelaySpinBox->setValue(0);
         pollingDelay_request = 0;
     }
-    pollingDelay = pollingDelay_request;
+
+    // a period of 0 polls as fast as the link allows
+    emit userChangedPollingPeriod(pollingDelay_request > 0 ? 1000.0/pollingDelay_request : 0.0);
 }
 
 
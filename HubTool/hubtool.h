@@ -13,13 +13,21 @@
 #include <QGroupBox>
 #include <QCheckBox>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QThread>
 #include <QComboBox>
 #include <QString>
 #include <QStringList>
 #include "qcustomplot.h"
 #include "stemworker.h"
+#include "hotplugwatcher.h"
 #include "plotwindow.h"
+#include "calltimingwindow.h"
+#include "playbackwindow.h"
+#include "energywindow.h"
+#include "rollingstats.h"
+#include "metricsserver.h"
+#include "controlserver.h"
 #include "clicktoeditlabel.h"
 
 #include "appnap.h"
@@ -36,6 +44,23 @@ public:
     explicit HubTool(linkSpec* spec = nullptr, QWidget *parent = nullptr);
     ~HubTool();
 
+    // capture the hub's packets into a ring file, as if picked from the menu
+    void startPacketCapture(const QString &path);
+
+    // check every reading against the rules in path, as if picked from the menu
+    void loadTriggerRules(const QString &path);
+
+    // serve the hub's values for Prometheus at http://address:port/metrics
+    void startMetrics(const QString &address, quint16 port);
+
+    // let other programs drive the hub through the local socket name
+    void startControl(const QString &name);
+
+    // port samples are always recorded, into this directory unless turned
+    // off from the menu; a week's worth is kept
+    void setSampleDirectory(const QString &directory);
+    static QString defaultSampleDirectory();
+
 signals:
     void userSelectedStemForConnection(QString serialNumber);
 
@@ -68,11 +93,20 @@ signals:
     void portNameChanged(QString name, int index);
     void systemNameChanged(QString name);
 
+    // polling
+    void userChangedPollingPeriod(double targetRateHz);
+
+    // diagnostics
+    void userChangedPacketCapture(QString path);
+    void userChangedSampleRecording(QString directory);
+    void userChangedTriggerRules(QString path);
+
 public slots:
     // slots for the stemWorker thread to send results tox
     void handleResults(int channel, bool checked); // test slot
     void handleLogString(QString logString);
-    void handlePollingFinished();
+    void handlePollRates(QString rateSummary);
+    void drainSnapshots();
 
     void handleSelectStemFromList(QStringList availableSerialNumbers);
     void handleMsgBoxRequest(QString message);
@@ -198,20 +232,58 @@ private slots:
     void on_checkBoxPortUSB7_clicked(bool checked);
 
     void plotClick();
+    void showCallTimings();
+    void showEnergy();
+    void togglePacketCapture(bool checked);
+    void toggleTriggerRules(bool checked);
+    void toggleSampleRecording(bool checked);
+    void exportAllPorts();
+    void openRecording();
+    void handlePlaybackActive(bool active);
+    void setStatisticsWindow(QAction *action);
+    void updateStatistics();
+    void publishMetrics();
 
 
 private:
     Ui::HubTool *ui;
     PlotWindow* VandIdataWindow[8];
+    CallTimingWindow* callTimingWindow;
+    PlaybackWindow* playbackWindow;
+    EnergyWindow* energyWindow;
+    MetricsServer* metricsServer;
+    ControlServer* controlServer;
+    QAction* packetCaptureAction;
+    QAction* triggerRulesAction;
+    QAction* sampleRecordingAction;
+    QString sampleDirectory;
 
 #ifdef __APPLE__
     AppNapSuspender napper;
 #endif
 
-    QTime pollingFireTime;
     QTimer plotUpdateTimer;
+    QTimer snapshotTimer;
+    QTimer statisticsTimer;
+
+    // the metrics go out on a timer of their own, so a worker that has
+    // stopped publishing shows as a lost link rather than its last values
+    QTimer metricsTimer;
+    QElapsedTimer liveSnapshotAge;
+
+    // rolling statistics of each port's readings, the selected window
+    // beside its readouts and every window in their tooltips
+    PortStatistics portStatistics[8];
+    QLabel* voltageStatisticsLabel[8];
+    QLabel* currentStatisticsLabel[8];
+    int statisticsWindow;
+
+    // the hub's last values, with every field it has ever sent marked
+    // changed, to put back when playback ends
+    HubSnapshot liveSnapshot;
     StemWorker *stemWorker;
     QThread stemWorkerThread;
+    HotplugWatcher hotplug;
 
     uint8_t numUSB;
     QCustomPlot* voltageSparkline[8];
@@ -235,6 +307,13 @@ private:
 
     static const uint32_t MICRO_TO_MILLI = 1000;
 
+    template <typename Queue> bool drainSnapshotQueue(Queue *queue, bool plot, bool live, HubSnapshot *latest);
+    void keepLiveSnapshot(const HubSnapshot &snapshot);
+    void applySnapshot(const HubSnapshot &snapshot);
+    void clearPortPlots();
+    void addPortSample(int channel, qint64 timestampMs, int32_t microVolts, int32_t microAmps);
+    QLabel* addStatisticsLabel(QLabel *readout);
+
     void setupVoltageSparkline(QCustomPlot *customPlot);
     void setupCurrentSparkline(QCustomPlot *customPlot);
 
@@ -0,0 +1,110 @@
+#include "hubdaemon.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTimer>
+
+#include <atomic>
+#include <signal.h>
+
+#include "BrainStem2/aVersion.h"
+
+// the handlers only set a flag; the main thread polls them, since nothing
+// Qt does is safe to call from a signal handler
+static std::atomic<bool> terminateRequested(false);
+static void handleTerminate(int){
+    terminateRequested.store(true);
+}
+
+static std::atomic<bool> captureToggleRequested(false);
+static void handleCaptureToggle(int){
+    captureToggleRequested.store(true);
+}
+
+// hubtoold [--threads N] [--rate HZ] [--interval MS] [--simulate N] [--capture DIR] [--samples DIR]
+//          [--triggers FILE] [--metrics [ADDR:]PORT]
+//
+// Polls every connected hub without a window and writes JSON lines to
+// stdout. --rate is the per hub target poll rate, 0 (the default) for as fast
+// as each hub answers; --interval is how often the values are reported.
+// --simulate adds N simulated hubs (see HUBTOOL_SIMULATION in stemworker.cpp).
+// --capture starts packet capture into DIR, one ring file per hub; SIGUSR1
+// turns capture on and off while running (into the current directory if
+// --capture wasn't given). --samples records every port sample into DIR,
+// one file per hub (see samplerecorder.h). --triggers checks every hub's
+// readings against the rules in FILE and acts on its ports (see
+// triggerengine.h). --metrics serves every hub's values for Prometheus at
+// http://ADDR:PORT/metrics, on the loopback address unless ADDR is given.
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationName("hubtoold");
+    a.setApplicationVersion(QString::fromUtf8(aVersion_GetString()));
+
+    int threads = 0;
+    double rate = 0.0;
+    int interval = 0;
+    int simulated = 0;
+    QString captureDirectory;
+    QString sampleDirectory;
+    QString triggerRules;
+    QString metrics;
+
+    QStringList args = a.arguments();
+    for(int i = 1; i < args.size(); i++){
+        bool hasValue = i + 1 < args.size();
+        if(args[i] == "--threads" && hasValue)          { threads = args[++i].toInt();      }
+        else if(args[i] == "--rate" && hasValue)        { rate = args[++i].toDouble();      }
+        else if(args[i] == "--interval" && hasValue)    { interval = args[++i].toInt();     }
+        else if(args[i] == "--simulate" && hasValue)    { simulated = args[++i].toInt();    }
+        else if(args[i] == "--capture" && hasValue)     { captureDirectory = args[++i];     }
+        else if(args[i] == "--samples" && hasValue)     { sampleDirectory = args[++i];      }
+        else if(args[i] == "--triggers" && hasValue)    { triggerRules = args[++i];         }
+        else if(args[i] == "--metrics" && hasValue)     { metrics = args[++i];              }
+        else {
+            fprintf(stderr, "usage: hubtoold [--threads N] [--rate HZ] [--interval MS] [--simulate N] [--capture DIR] [--samples DIR]\n"
+                            "                [--triggers FILE] [--metrics [ADDR:]PORT]\n");
+            return 1;
+        }
+    }
+
+    signal(SIGINT, handleTerminate);
+    signal(SIGTERM, handleTerminate);
+#ifdef SIGUSR1
+    signal(SIGUSR1, handleCaptureToggle);
+#endif
+
+    HubDaemon daemon(threads);
+    daemon.setTargetRate(rate);
+    daemon.setReportInterval(interval);
+    daemon.fleet()->setSampleDirectory(sampleDirectory);
+    daemon.fleet()->setTriggerRules(triggerRules);
+    daemon.fleet()->addSimulatedHubs(simulated);
+    if(!captureDirectory.isEmpty()){
+        daemon.setCaptureDirectory(captureDirectory);
+        daemon.setCapturing(true);
+    }
+    if(!metrics.isEmpty()){
+        QString address;
+        quint16 port;
+        if(!MetricsServer::parseAddress(metrics, &address, &port)){
+            fprintf(stderr, "hubtoold: --metrics wants [ADDR:]PORT, not %s\n", metrics.toLocal8Bit().constData());
+            return 1;
+        }
+        daemon.startMetrics(address, port);
+    }
+    daemon.start();
+
+    QTimer signalTimer;
+    QObject::connect(&signalTimer, &QTimer::timeout, [&daemon]{
+        if(terminateRequested.load()){
+            QCoreApplication::quit();
+            return;
+        }
+        if(captureToggleRequested.exchange(false)){
+            daemon.toggleCapturing();
+        }
+    });
+    signalTimer.start(100);
+
+    return a.exec();
+}
@@ -0,0 +1,77 @@
+#-------------------------------------------------
+#
+# Headless hub poller: the fleet polling from HubTool without any widgets.
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = hubtoold
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/lib/
+INCLUDEPATH += $$PWD/lib/BrainStem2/
+
+SOURCES += hubtoold.cpp \
+           hubdaemon.cpp \
+           fleetmanager.cpp \
+           stemworker.cpp \
+           pollscheduler.cpp \
+           ueirouter.cpp \
+           hubsnapshot.cpp \
+           ratecontroller.cpp \
+           commandqueue.cpp \
+           connectionmonitor.cpp \
+           hotplugwatcher.cpp \
+           simulatedhub.cpp \
+           latencyhistogram.cpp \
+           ueicallstats.cpp \
+           packetcapture.cpp \
+           linkrecording.cpp \
+           samplerecorder.cpp \
+           energymeter.cpp \
+           triggerengine.cpp \
+           openmetrics.cpp \
+           metricsserver.cpp
+
+HEADERS  += hubdaemon.h \
+            fleetmanager.h \
+            stemworker.h \
+            appnap.h \
+            pollscheduler.h \
+            ueirouter.h \
+            hubsnapshot.h \
+            spscring.h \
+            triplebuffer.h \
+            ratecontroller.h \
+            commandqueue.h \
+            connectionmonitor.h \
+            hotplugwatcher.h \
+            simulatedhub.h \
+            latencyhistogram.h \
+            ueicallstats.h \
+            packetcapture.h \
+            linkrecording.h \
+            samplerecorder.h \
+            energymeter.h \
+            triggerengine.h \
+            openmetrics.h \
+            metricsserver.h
+
+CONFIG += c++11
+
+static { # Everything below takes effect with CONFIG += static
+    CONFIG += static
+    DEFINES += STATIC
+    message("Static build.")
+}
+
+LIBS += -L$$PWD/../lib/ -lBrainStem2 -ludev
+DEPENDPATH += $$PWD/../lib
+PRE_TARGETDEPS += $$PWD/../lib/libBrainStem2.a
+
+OBJECTIVE_SOURCES += \
+    appnap.mm
@@ -0,0 +1,89 @@
+#include "latencyhistogram.h"
+
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram(){
+    reset();
+}
+
+void LatencyHistogram::reset(){
+    memset(m_buckets, 0, sizeof(m_buckets));
+    m_count = 0;
+    m_sum = 0;
+    m_min = 0;
+    m_max = 0;
+}
+
+// The first 16 buckets hold 0..15 exactly. After that the bucket is picked by
+// the position of the top bit (the magnitude) and the four bits below it.
+int LatencyHistogram::bucketFor(qint64 valueUs){
+    if(valueUs < SubBuckets)
+        return valueUs < 0 ? 0 : (int)valueUs;
+
+    int topBit = 0;
+    for(quint64 rest = (quint64)valueUs >> 1; rest; rest >>= 1){
+        topBit++;
+    }
+    int shift = topBit - 4;
+    int bucket = (shift + 1)*SubBuckets + (int)((valueUs >> shift) & (SubBuckets - 1));
+    return bucket < BucketCount ? bucket : BucketCount - 1;
+}
+
+qint64 LatencyHistogram::bucketUpper(int bucket){
+    if(bucket < SubBuckets)
+        return bucket;
+
+    int shift = bucket/SubBuckets - 1;
+    qint64 sub = bucket % SubBuckets;
+    return ((SubBuckets + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 valueUs){
+    if(valueUs < 0) valueUs = 0;
+
+    m_buckets[bucketFor(valueUs)]++;
+    if(m_count == 0 || valueUs < m_min) m_min = valueUs;
+    if(valueUs > m_max) m_max = valueUs;
+    m_sum += valueUs;
+    m_count++;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other){
+    if(other.m_count == 0)
+        return;
+
+    for(int i = 0; i < BucketCount; i++){
+        m_buckets[i] += other.m_buckets[i];
+    }
+    if(m_count == 0 || other.m_min < m_min) m_min = other.m_min;
+    if(other.m_max > m_max) m_max = other.m_max;
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+qint64 LatencyHistogram::percentile(double p) const {
+    if(m_count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(p/100.0*m_count + 0.5);
+    if(rank < 1) rank = 1;
+    if(rank > m_count) rank = m_count;
+
+    uint64_t seen = 0;
+    for(int i = 0; i < BucketCount; i++){
+        seen += m_buckets[i];
+        if(seen >= rank){
+            qint64 upper = bucketUpper(i);
+            return upper < m_max ? upper : m_max;
+        }
+    }
+    return m_max;
+}
+
+QString LatencyHistogram::summary() const {
+    return QString("p50 %1us, p99 %2us, max %3us (n=%4)")
+            .arg(percentile(50))
+            .arg(percentile(99))
+            .arg(max())
+            .arg(m_count);
+}
@@ -0,0 +1,50 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QString>
+#include <QtGlobal>
+
+#include <stdint.h>
+
+// Fixed size log-linear histogram of latencies in microseconds. Values below
+// 16us are counted exactly; above that each power of two is split into 16
+// buckets, so a percentile is within about 6% of the true value. Recording is
+// a couple of shifts and an increment, with no allocation, so it can sit in
+// the poll loop.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 valueUs);
+    void merge(const LatencyHistogram &other);
+    void reset();
+
+    uint64_t count() const { return m_count; }
+    qint64 min() const { return m_count ? m_min : 0; }
+    qint64 max() const { return m_max; }
+    double mean() const { return m_count ? (double)m_sum/m_count : 0.0; }
+
+    // upper edge of the bucket holding the p-th percentile (0..100), capped
+    // at the largest value recorded
+    qint64 percentile(double p) const;
+
+    // "p50 12us, p99 40us, max 80us (n=1000)"
+    QString summary() const;
+
+private:
+    static const int SubBuckets = 16;
+    static const int Magnitudes = 44;
+    static const int BucketCount = Magnitudes*SubBuckets;
+
+    static int bucketFor(qint64 valueUs);
+    static qint64 bucketUpper(int bucket);
+
+    uint64_t m_buckets[BucketCount];
+    uint64_t m_count;
+    qint64 m_sum;
+    qint64 m_min;
+    qint64 m_max;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,414 @@
+#include "linkrecording.h"
+
+#include <QDateTime>
+
+#include <string.h>
+
+#include "simulatedhub.h"
+
+#define LINK_RECORDING_MAGIC "HUBLINK1"
+#define LINK_RECORDING_VERSION 1
+#define LINK_RECORDING_HEADER_SIZE 32
+#define LINK_RECORDING_RECORD_SIZE 12
+
+// little endian, whatever the host
+static void putLE(uint8_t* out, uint64_t value, int size){
+    for(int i = 0; i < size; i++){
+        out[i] = (uint8_t)(value >> (8*i));
+    }
+}
+
+static uint64_t getLE(const uint8_t* in, int size){
+    uint64_t value = 0;
+    for(int i = size - 1; i >= 0; i--){
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static bool isHeartbeat(const std::vector<uint8_t> &bytes){
+    return bytes.size() >= 3 && bytes[2] == cmdHB;
+}
+
+LinkRecordingInfo::LinkRecordingInfo() :
+    model(aMODULE_TYPE_USBHub3p),
+    moduleAddress(0),
+    serialNumber(0),
+    startMs(0)
+{
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// LinkRecorder
+
+LinkRecorder::LinkRecorder() :
+    m_packets(0)
+{
+}
+
+LinkRecorder::~LinkRecorder(){
+    close();
+}
+
+aErr LinkRecorder::wrap(aStreamRef stream, const QString &path, const LinkRecordingInfo &info, aStreamRef *recorded){
+    close();
+    std::lock_guard<std::mutex> locker(m_lock);
+
+    m_file.setFileName(path);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        m_error = m_file.errorString();
+        return aErrIO;
+    }
+
+    uint8_t header[LINK_RECORDING_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, LINK_RECORDING_MAGIC, 8);
+    putLE(header + 8, LINK_RECORDING_VERSION, 4);
+    header[12] = info.model;
+    header[13] = info.moduleAddress;
+    putLE(header + 16, info.serialNumber, 4);
+    putLE(header + 24, info.startMs ? info.startMs : QDateTime::currentMSecsSinceEpoch(), 8);
+    m_file.write((const char*)header, sizeof(header));
+
+    m_framer[ToHub] = Framer();
+    m_framer[FromHub] = Framer();
+    m_packets.store(0);
+    m_clock.start();
+
+    // reads from the hub go to the upstream log, writes to it the downstream
+    // one; the logged stream owns both
+    aStreamRef fromHubLog = aStream_Create(sLogGet, sFromHubPut, sFromHubWrite, sLogDelete, this);
+    aStreamRef toHubLog = aStream_Create(sLogGet, sToHubPut, sToHubWrite, sLogDelete, this);
+    aErr err = aStream_CreateLogStream(stream, fromHubLog, toHubLog, recorded);
+    if(err != aErrNone){
+        m_error = QString("couldn't log the stream: %1").arg(err);
+        m_file.close();
+    }
+    return err;
+}
+
+void LinkRecorder::close(){
+    std::lock_guard<std::mutex> locker(m_lock);
+    if(m_file.isOpen()){
+        m_file.close();
+    }
+}
+
+aErr LinkRecorder::sLogGet(uint8_t*, void*){
+    return aErrNotReady;
+}
+
+aErr LinkRecorder::sToHubPut(const uint8_t* pData, void* ref){
+    LinkRecorder *recorder = (LinkRecorder*)ref;
+    std::lock_guard<std::mutex> locker(recorder->m_lock);
+    recorder->accept(ToHub, pData, 1);
+    return aErrNone;
+}
+
+aErr LinkRecorder::sToHubWrite(const uint8_t* pData, const size_t nSize, void* ref){
+    LinkRecorder *recorder = (LinkRecorder*)ref;
+    std::lock_guard<std::mutex> locker(recorder->m_lock);
+    recorder->accept(ToHub, pData, nSize);
+    return aErrNone;
+}
+
+aErr LinkRecorder::sFromHubPut(const uint8_t* pData, void* ref){
+    LinkRecorder *recorder = (LinkRecorder*)ref;
+    std::lock_guard<std::mutex> locker(recorder->m_lock);
+    recorder->accept(FromHub, pData, 1);
+    return aErrNone;
+}
+
+aErr LinkRecorder::sFromHubWrite(const uint8_t* pData, const size_t nSize, void* ref){
+    LinkRecorder *recorder = (LinkRecorder*)ref;
+    std::lock_guard<std::mutex> locker(recorder->m_lock);
+    recorder->accept(FromHub, pData, nSize);
+    return aErrNone;
+}
+
+aErr LinkRecorder::sLogDelete(void*){
+    return aErrNone;
+}
+
+// The stream carries [address, length, data...] per packet; each direction
+// is framed on its own and saved a whole packet at a time.
+void LinkRecorder::accept(Direction direction, const uint8_t* data, size_t size){
+    Framer &framer = m_framer[direction];
+    for(size_t i = 0; i < size; i++){
+        framer.bytes[framer.size++] = data[i];
+
+        if(framer.size >= 2 && framer.bytes[1] > aBRAINSTEM_MAXPACKETBYTES){
+            framer.size = 0;
+            continue;
+        }
+        if(framer.size >= 2 && framer.size == framer.bytes[1] + 2){
+            writePacket(direction, framer.bytes, framer.size);
+            framer.size = 0;
+        }
+    }
+}
+
+void LinkRecorder::writePacket(Direction direction, const uint8_t* bytes, uint16_t size){
+    if(!m_file.isOpen())
+        return;
+
+    uint8_t record[LINK_RECORDING_RECORD_SIZE];
+    putLE(record, m_clock.nsecsElapsed()/1000, 8);
+    record[8] = (uint8_t)direction;
+    record[9] = 0;
+    putLE(record + 10, size, 2);
+    m_file.write((const char*)record, sizeof(record));
+    m_file.write((const char*)bytes, size);
+    m_packets++;
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// LinkReplay
+
+LinkReplay::LinkReplay() :
+    m_speed(1.0),
+    m_cursor(0),
+    m_replyOffset(0),
+    m_packetSize(0),
+    m_streamOpen(false),
+    m_matched(0),
+    m_unmatched(0)
+{
+    m_clock.start();
+}
+
+LinkReplay::~LinkReplay(){
+}
+
+bool LinkReplay::load(const QString &path){
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)){
+        m_error = file.errorString();
+        return false;
+    }
+    QByteArray data = file.readAll();
+    const uint8_t *bytes = (const uint8_t*)data.constData();
+
+    if(data.size() < LINK_RECORDING_HEADER_SIZE
+       || memcmp(bytes, LINK_RECORDING_MAGIC, 8) != 0
+       || getLE(bytes + 8, 4) != LINK_RECORDING_VERSION){
+        m_error = "not a link recording";
+        return false;
+    }
+    m_info.model = bytes[12];
+    m_info.moduleAddress = bytes[13];
+    m_info.serialNumber = (uint32_t)getLE(bytes + 16, 4);
+    m_info.startMs = (qint64)getLE(bytes + 24, 8);
+
+    m_packets.clear();
+    int offset = LINK_RECORDING_HEADER_SIZE;
+    while(offset + LINK_RECORDING_RECORD_SIZE <= data.size()){
+        uint16_t size = (uint16_t)getLE(bytes + offset + 10, 2);
+        if(offset + LINK_RECORDING_RECORD_SIZE + size > data.size())
+            break;  // cut short while recording
+
+        Packet packet;
+        packet.timeUs = (qint64)getLE(bytes + offset, 8);
+        packet.fromHub = bytes[offset + 8] != 0;
+        packet.bytes.assign(bytes + offset + LINK_RECORDING_RECORD_SIZE,
+                            bytes + offset + LINK_RECORDING_RECORD_SIZE + size);
+        packet.reply = -1;
+        m_packets.push_back(packet);
+        offset += LINK_RECORDING_RECORD_SIZE + size;
+    }
+
+    pairReplies();
+    std::lock_guard<std::mutex> locker(m_lock);
+    m_cursor = 0;
+    return true;
+}
+
+void LinkReplay::setSpeed(double speed){
+    std::lock_guard<std::mutex> locker(m_lock);
+    m_speed = speed > 0.0 ? speed : 0.0;
+}
+
+// Matches each reply to the oldest request still waiting that it answers,
+// the way the router does.
+void LinkReplay::pairReplies(){
+    std::vector<int> waiting;
+    for(size_t i = 0; i < m_packets.size(); i++){
+        Packet &packet = m_packets[i];
+        if(isHeartbeat(packet.bytes))
+            continue;
+
+        if(!packet.fromHub){
+            waiting.push_back((int)i);
+            continue;
+        }
+        for(size_t w = 0; w < waiting.size(); w++){
+            if(isReplyTo(m_packets[waiting[w]], packet)){
+                m_packets[waiting[w]].reply = (int)i;
+                waiting.erase(waiting.begin() + w);
+                break;
+            }
+        }
+    }
+}
+
+bool LinkReplay::isReplyTo(const Packet &request, const Packet &reply){
+    if(request.bytes.size() < 5 || reply.bytes.size() < 5)
+        return false;
+
+    const uint8_t *asked = request.bytes.data() + 2;
+    const uint8_t *answered = reply.bytes.data() + 2;
+    uint8_t command = asked[0];
+    uint8_t option = asked[1] & ueiOPTION_MASK;
+    if(answered[0] != command
+       || (answered[1] & ueiOPTION_MASK) != option
+       || (answered[2] & ueiSPECIFIER_INDEX_MASK) != (asked[2] & ueiSPECIFIER_INDEX_MASK))
+        return false;
+
+    if(SimulatedHub::isPortOption(command, option)){
+        return request.bytes.size() >= 6 && reply.bytes.size() >= 6 && answered[3] == asked[3];
+    }
+    return true;
+}
+
+aStreamRef LinkReplay::createStream(){
+    std::lock_guard<std::mutex> locker(m_lock);
+    m_replies.clear();
+    m_replyOffset = 0;
+    m_packetSize = 0;
+    m_streamOpen = true;
+    return aStream_Create(sGet, sPut, sWrite, sDelete, this);
+}
+
+// stream callbacks, called from the link's thread
+
+aErr LinkReplay::sGet(uint8_t* pData, void* ref){
+    LinkReplay *replay = (LinkReplay*)ref;
+    std::lock_guard<std::mutex> locker(replay->m_lock);
+
+    if(replay->m_replies.empty())
+        return aErrNotReady;
+
+    Reply &reply = replay->m_replies.front();
+    if(replay->m_replyOffset == 0 && reply.dueUs > replay->m_clock.nsecsElapsed()/1000)
+        return aErrNotReady;
+
+    *pData = reply.bytes[replay->m_replyOffset++];
+    if(replay->m_replyOffset >= reply.bytes.size()){
+        replay->m_replies.pop_front();
+        replay->m_replyOffset = 0;
+    }
+    return aErrNone;
+}
+
+aErr LinkReplay::sPut(const uint8_t* pData, void* ref){
+    LinkReplay *replay = (LinkReplay*)ref;
+    std::lock_guard<std::mutex> locker(replay->m_lock);
+    replay->accept(*pData);
+    return aErrNone;
+}
+
+aErr LinkReplay::sWrite(const uint8_t* pData, const size_t nSize, void* ref){
+    LinkReplay *replay = (LinkReplay*)ref;
+    std::lock_guard<std::mutex> locker(replay->m_lock);
+    for(size_t i = 0; i < nSize; i++){
+        replay->accept(pData[i]);
+    }
+    return aErrNone;
+}
+
+aErr LinkReplay::sDelete(void* ref){
+    LinkReplay *replay = (LinkReplay*)ref;
+    std::lock_guard<std::mutex> locker(replay->m_lock);
+    replay->m_streamOpen = false;
+    replay->m_replies.clear();
+    replay->m_replyOffset = 0;
+    return aErrNone;
+}
+
+void LinkReplay::accept(uint8_t byte){
+    m_packet[m_packetSize++] = byte;
+
+    if(m_packetSize >= 2 && m_packet[1] > aBRAINSTEM_MAXPACKETBYTES){
+        m_packetSize = 0;
+        return;
+    }
+    if(m_packetSize >= 2 && m_packetSize == m_packet[1] + 2){
+        handlePacket(m_packet, m_packetSize);
+        m_packetSize = 0;
+    }
+}
+
+void LinkReplay::handlePacket(const uint8_t* bytes, size_t size){
+    if(size < 3)
+        return;
+    const uint8_t *data = bytes + 2;
+
+    // heartbeats are answered in kind
+    if(data[0] == cmdHB){
+        if(size >= 4 && (data[1] == val_HB_H2S_UP || data[1] == val_HB_H2S_DOWN)){
+            uint8_t beat[4] = {bytes[0], 2, cmdHB, (uint8_t)(data[1] == val_HB_H2S_UP ? val_HB_S2H_UP : val_HB_S2H_DOWN)};
+            queueReply(beat, sizeof(beat), 0);
+        }
+        return;
+    }
+
+    int request = findRequest(bytes, size);
+    if(request >= 0){
+        m_matched++;
+        const Packet &asked = m_packets[request];
+        if(asked.reply < 0)
+            return;     // lost in the recording too
+
+        const Packet &answered = m_packets[asked.reply];
+        qint64 delayUs = 0;
+        if(m_speed > 0.0){
+            delayUs = (qint64)((answered.timeUs - asked.timeUs)/m_speed);
+        }
+        queueReply(answered.bytes.data(), answered.bytes.size(), delayUs);
+        return;
+    }
+
+    // not in the recording: an error reply, so the caller isn't left waiting
+    m_unmatched++;
+    if(size < 5)
+        return;
+    uint8_t headerSize = SimulatedHub::isPortOption(data[0], data[1] & ueiOPTION_MASK) && size >= 6 ? 4 : 3;
+    uint8_t reply[2 + 5];
+    reply[0] = bytes[0];
+    reply[1] = headerSize + 1;
+    memcpy(reply + 2, data, headerSize);
+    reply[4] = (uint8_t)(ueiSPECIFIER_RETURN_HOST | ueiREPLY_ERROR | (data[2] & ueiSPECIFIER_INDEX_MASK));
+    reply[2 + headerSize] = (uint8_t)aErrNotFound;
+    queueReply(reply, 2 + headerSize + 1, 0);
+}
+
+// the next recorded request with the same bytes, carrying on from the last
+// one and wrapping at the end of the recording
+int LinkReplay::findRequest(const uint8_t* bytes, size_t size){
+    size_t count = m_packets.size();
+    for(size_t n = 0; n < count; n++){
+        size_t i = (m_cursor + n) % count;
+        const Packet &packet = m_packets[i];
+        if(packet.fromHub || packet.bytes.size() != size)
+            continue;
+        if(memcmp(packet.bytes.data(), bytes, size) == 0){
+            m_cursor = i + 1;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void LinkReplay::queueReply(const uint8_t* bytes, size_t size, qint64 delayUs){
+    if(!m_streamOpen)
+        return;
+
+    Reply reply;
+    reply.dueUs = m_clock.nsecsElapsed()/1000 + delayUs;
+    // a serial link doesn't reorder
+    if(!m_replies.empty() && m_replies.back().dueUs > reply.dueUs){
+        reply.dueUs = m_replies.back().dueUs;
+    }
+    reply.bytes.assign(bytes, bytes + size);
+    m_replies.push_back(reply);
+}
@@ -0,0 +1,166 @@
+#ifndef LINKRECORDING_H
+#define LINKRECORDING_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "BrainStem2/BrainStem-all.h"
+#include "BrainStem2/aStream.h"
+
+// Record and replay of everything on a hub's link.
+//
+// LinkRecorder wraps the hub's stream with aStream_CreateLogStream and saves
+// every packet in both directions, with the time it crossed the stream.
+// LinkReplay loads such a recording and stands in for the hub behind a
+// stream of its own. Each request the link writes is matched to the same
+// request in the recording, and the reply recorded for it comes back after
+// the recorded delay divided by the speed. A speed of 0 sends every reply at
+// once.
+//
+// Replies come from the request sequence and not the wall clock, so the same
+// polling against the same recording gets the same bytes back every run.
+// Heartbeats are answered in kind rather than replayed, since their timing is
+// up to the link. A request that isn't in the recording gets an aErrNotFound
+// error reply. A recorded request that never got a reply gets none in the
+// replay either.
+//
+// File layout, little endian:
+//   header, 32 bytes:
+//     char magic[8]        "HUBLINK1"
+//     uint32 version       1
+//     uint8 model          aMODULE_TYPE_*
+//     uint8 moduleAddress
+//     uint16 reserved
+//     uint32 serialNumber
+//     uint32 reserved
+//     uint64 startMs       ms since the epoch
+//   then one record per packet:
+//     uint64 timeUs        since the recording started
+//     uint8 direction      0 host to hub, 1 hub to host
+//     uint8 reserved
+//     uint16 size          of the packet bytes
+//     uint8 packet[size]   address, length, data as on the wire
+struct LinkRecordingInfo {
+    LinkRecordingInfo();
+
+    uint8_t model;
+    uint8_t moduleAddress;
+    uint32_t serialNumber;
+    qint64 startMs;
+};
+
+class LinkRecorder
+{
+public:
+    LinkRecorder();
+    ~LinkRecorder();
+
+    // hands back a stream that passes everything through to stream and
+    // records it to path; the link takes ownership of the returned stream,
+    // and the recorder has to outlive the link
+    aErr wrap(aStreamRef stream, const QString &path, const LinkRecordingInfo &info, aStreamRef *recorded);
+    void close();
+
+    QString errorString() const { return m_error; }
+    uint64_t packetCount() const { return m_packets.load(); }
+
+private:
+    enum Direction { ToHub = 0, FromHub = 1 };
+
+    struct Framer {
+        Framer() : size(0) {}
+        uint8_t bytes[2 + aBRAINSTEM_MAXPACKETBYTES];
+        uint8_t size;
+    };
+
+    static aErr sLogGet(uint8_t* pData, void* ref);
+    static aErr sToHubPut(const uint8_t* pData, void* ref);
+    static aErr sToHubWrite(const uint8_t* pData, const size_t nSize, void* ref);
+    static aErr sFromHubPut(const uint8_t* pData, void* ref);
+    static aErr sFromHubWrite(const uint8_t* pData, const size_t nSize, void* ref);
+    static aErr sLogDelete(void* ref);
+
+    // with m_lock held
+    void accept(Direction direction, const uint8_t* data, size_t size);
+    void writePacket(Direction direction, const uint8_t* bytes, uint16_t size);
+
+    std::mutex m_lock;
+    QFile m_file;
+    QString m_error;
+    QElapsedTimer m_clock;
+    Framer m_framer[2];
+    std::atomic<uint64_t> m_packets;
+};
+
+class LinkReplay
+{
+public:
+    LinkReplay();
+    ~LinkReplay();
+
+    bool load(const QString &path);
+    QString errorString() const { return m_error; }
+    const LinkRecordingInfo& info() const { return m_info; }
+
+    // 1 for the recorded timing, 4 for four times as fast, 0 for no delay
+    void setSpeed(double speed);
+
+    // the link takes ownership of the stream; the replay has to outlive the link
+    aStreamRef createStream();
+
+    // counters, safe to read from any thread
+    uint32_t matchedCount() const { return m_matched.load(); }
+    uint32_t unmatchedCount() const { return m_unmatched.load(); }
+
+private:
+    struct Packet {
+        qint64 timeUs;
+        bool fromHub;
+        std::vector<uint8_t> bytes;     // address, length, data
+        int reply;                      // requests only: the packet that answered it, -1 for none
+    };
+
+    struct Reply {
+        qint64 dueUs;
+        std::vector<uint8_t> bytes;
+    };
+
+    static aErr sGet(uint8_t* pData, void* ref);
+    static aErr sPut(const uint8_t* pData, void* ref);
+    static aErr sWrite(const uint8_t* pData, const size_t nSize, void* ref);
+    static aErr sDelete(void* ref);
+
+    void pairReplies();
+    static bool isReplyTo(const Packet &request, const Packet &reply);
+
+    // with m_lock held
+    void accept(uint8_t byte);
+    void handlePacket(const uint8_t* bytes, size_t size);
+    int findRequest(const uint8_t* bytes, size_t size);
+    void queueReply(const uint8_t* bytes, size_t size, qint64 delayUs);
+
+    LinkRecordingInfo m_info;
+    QString m_error;
+    std::vector<Packet> m_packets;
+
+    std::mutex m_lock;
+    double m_speed;
+    size_t m_cursor;                    // where the next request is looked for
+    QElapsedTimer m_clock;
+    std::deque<Reply> m_replies;
+    size_t m_replyOffset;
+    uint8_t m_packet[2 + aBRAINSTEM_MAXPACKETBYTES];
+    uint8_t m_packetSize;
+    bool m_streamOpen;
+
+    std::atomic<uint32_t> m_matched;
+    std::atomic<uint32_t> m_unmatched;
+};
+
+#endif // LINKRECORDING_H
@@ -1,7 +1,11 @@
 #include "hubtool.h"
+#include "fleetmanager.h"
+#include "fleetwindow.h"
 #include <QApplication>
 #include <QFontDatabase>
 
+#include <stdio.h>
+
 #include "BrainStem2/aVersion.h"
 
 int main(int argc, char *argv[])
@@ -12,9 +16,68 @@ int main(int argc, char *argv[])
     QString title = "HubTool: v";
     title += QString::fromUtf8(aVersion_GetString());
 
-    HubTool w;
-    w.setWindowTitle(title);
-    w.show();
+    // --fleet [threads] polls every connected hub from a shared thread pool
+    // and shows a dashboard instead of the single hub window
+    QStringList args = a.arguments();
+    int fleetIndex = args.indexOf("--fleet");
+    HubTool *w = nullptr;
+    FleetManager *fleet = nullptr;
+    FleetWindow *fleetWindow = nullptr;
+
+    if(fleetIndex >= 0){
+        int threads = 0;
+        if(fleetIndex + 1 < args.size()){
+            threads = args[fleetIndex + 1].toInt();
+        }
+        fleet = new FleetManager(threads);
+        fleet->setSampleDirectory(HubTool::defaultSampleDirectory());
+        fleetWindow = new FleetWindow(fleet);
+        fleetWindow->show();
+        fleet->start();
+    }
+    else {
+        w = new HubTool();
+        w->setWindowTitle(title);
+        w->show();
+
+        // --capture file starts with packet capture on
+        int captureIndex = args.indexOf("--capture");
+        if(captureIndex >= 0 && captureIndex + 1 < args.size()){
+            w->startPacketCapture(args[captureIndex + 1]);
+        }
+
+        // --samples dir records port samples somewhere other than the default
+        int samplesIndex = args.indexOf("--samples");
+        if(samplesIndex >= 0 && samplesIndex + 1 < args.size()){
+            w->setSampleDirectory(args[samplesIndex + 1]);
+        }
+
+        // --triggers file checks every reading against the rules in file
+        int triggersIndex = args.indexOf("--triggers");
+        if(triggersIndex >= 0 && triggersIndex + 1 < args.size()){
+            w->loadTriggerRules(args[triggersIndex + 1]);
+        }
+
+        // --metrics [addr:]port serves the hub's values for Prometheus
+        int metricsIndex = args.indexOf("--metrics");
+        if(metricsIndex >= 0){
+            QString metrics = (metricsIndex + 1 < args.size()) ? args[metricsIndex + 1] : QString();
+            QString metricsAddress;
+            quint16 metricsPort;
+            if(!MetricsServer::parseAddress(metrics, &metricsAddress, &metricsPort)){
+                fprintf(stderr, "HubTool: --metrics wants [ADDR:]PORT, not %s\n", metrics.toLocal8Bit().constData());
+                delete w;
+                return 1;
+            }
+            w->startMetrics(metricsAddress, metricsPort);
+        }
+
+        // --control name lets other programs drive the hub over a local socket
+        int controlIndex = args.indexOf("--control");
+        if(controlIndex >= 0 && controlIndex + 1 < args.size()){
+            w->startControl(args[controlIndex + 1]);
+        }
+    }
 
 #if !defined(_WIN32) && !defined(__APPLE__)
     QString fontPath = ":/fonts/TitilliumWeb-Regular.ttf";
@@ -31,5 +94,11 @@ int main(int argc, char *argv[])
 #endif
 
 
-    return a.exec();
+    int result = a.exec();
+
+    delete fleetWindow;
+    delete fleet;
+    delete w;
+
+    return result;
 }
@@ -0,0 +1,145 @@
+#include "metricsserver.h"
+#include "openmetrics.h"
+
+#include <QHostAddress>
+
+#include <string.h>
+
+// a request bigger than this isn't a scrape
+#define METRICS_MAX_REQUEST_BYTES 8192
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+// ////////////////////////////////////////////////////////////////////////////
+// MetricsListener
+
+MetricsListener::MetricsListener(MetricsHubs *hubs, QObject *parent) :
+    QObject(parent),
+    m_hubs(hubs),
+    m_server(nullptr)
+{
+}
+
+void MetricsListener::listen(QString address, int port){
+    close();
+    m_server = new QTcpServer(this);
+    connect(m_server, SIGNAL(newConnection()), this, SLOT(acceptConnections()));
+
+    if(!m_server->listen(QHostAddress(address), (quint16)port)){
+        emit logStringReady(QString("Error serving metrics on %1:%2: %3").arg(address).arg(port).arg(m_server->errorString()));
+        close();
+        return;
+    }
+    emit logStringReady(QString("Serving metrics on http://%1:%2/metrics").arg(address).arg(port));
+}
+
+void MetricsListener::close(){
+    if(m_server){
+        m_server->close();
+        delete m_server;
+        m_server = nullptr;
+    }
+}
+
+void MetricsListener::acceptConnections(){
+    while(m_server && m_server->hasPendingConnections()){
+        QTcpSocket *socket = m_server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+// Only the request line matters, but the whole header is read before
+// answering so the client isn't reset while it's still sending.
+void MetricsListener::readRequest(){
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if(!socket)
+        return;
+
+    QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+    if(!request.contains("\r\n\r\n") && !request.contains("\n\n")){
+        if(request.size() > METRICS_MAX_REQUEST_BYTES){
+            socket->abort();
+            return;
+        }
+        socket->setProperty("request", request);
+        return;
+    }
+    socket->setProperty("request", QVariant());
+    disconnect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+
+    QList<QByteArray> requestLine = request.left(request.indexOf('\n')).trimmed().split(' ');
+    QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+    if(path.contains('?')) path.truncate(path.indexOf('?'));
+
+    if(method != "GET" && method != "HEAD"){
+        const char *body = "Only GET\n";
+        respond(socket, "405 Method Not Allowed", "text/plain", body, strlen(body));
+    }
+    else if(path != "/metrics"){
+        const char *body = "Not found, try /metrics\n";
+        respond(socket, "404 Not Found", "text/plain", body, strlen(body));
+    }
+    else {
+        renderOpenMetrics(m_hubs->latest(), &m_page);
+        respond(socket, "200 OK", METRICS_CONTENT_TYPE, method == "HEAD" ? "" : m_page.data(), m_page.size());
+    }
+}
+
+// one request per connection
+void MetricsListener::respond(QTcpSocket *socket, const char *status, const char *contentType, const char *body, size_t length){
+    QByteArray header = QByteArray("HTTP/1.1 ") + status + "\r\n"
+            + "Content-Type: " + contentType + "\r\n"
+            + "Content-Length: " + QByteArray::number((qulonglong)length) + "\r\n"
+            + "Connection: close\r\n\r\n";
+    socket->write(header);
+    if(*body){
+        socket->write(body, (qint64)length);
+    }
+    socket->disconnectFromHost();
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// MetricsServer
+
+MetricsServer::MetricsServer(QObject *parent) :
+    QObject(parent)
+{
+    m_listener = new MetricsListener(&m_hubs);
+    m_listener->moveToThread(&m_thread);
+    connect(m_listener, SIGNAL(logStringReady(QString)), this, SIGNAL(logStringReady(QString)));
+    connect(&m_thread, SIGNAL(finished()), m_listener, SLOT(close()));
+    m_thread.start();
+}
+
+MetricsServer::~MetricsServer(){
+    m_thread.quit();
+    m_thread.wait();
+    delete m_listener;
+}
+
+bool MetricsServer::parseAddress(const QString &spec, QString *address, quint16 *port){
+    int colon = spec.lastIndexOf(':');
+    *address = colon < 0 ? QString("127.0.0.1") : spec.left(colon);
+    if(address->startsWith('[') && address->endsWith(']')){
+        *address = address->mid(1, address->size() - 2);
+    }
+
+    bool ok = false;
+    uint number = spec.mid(colon + 1).toUInt(&ok);
+    if(!ok || number == 0 || number > 65535 || QHostAddress(*address).isNull())
+        return false;
+    *port = (quint16)number;
+    return true;
+}
+
+void MetricsServer::listen(const QString &address, quint16 port){
+    QMetaObject::invokeMethod(m_listener, "listen", Qt::QueuedConnection,
+                              Q_ARG(QString, address), Q_ARG(int, port));
+}
+
+void MetricsServer::publish(const HubSnapshot *hubs, size_t count){
+    std::vector<HubSnapshot> &back = m_hubs.back();
+    back.assign(hubs, hubs + count);
+    m_hubs.publish();
+}
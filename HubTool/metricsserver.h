@@ -0,0 +1,81 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QObject>
+#include <QThread>
+#include <QString>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <string>
+#include <vector>
+
+#include "hubsnapshot.h"
+#include "triplebuffer.h"
+
+typedef TripleBuffer<std::vector<HubSnapshot> > MetricsHubs;
+
+// The listening side, on the server's own thread. Each scrape renders the
+// last published hubs there, so the threads polling the hubs, or the one
+// publishing, never wait on it.
+class MetricsListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsListener(MetricsHubs *hubs, QObject *parent = nullptr);
+
+signals:
+    void logStringReady(QString logLine);
+
+public slots:
+    void listen(QString address, int port);
+    void close();
+
+private slots:
+    void acceptConnections();
+    void readRequest();
+
+private:
+    void respond(QTcpSocket *socket, const char *status, const char *contentType, const char *body, size_t length);
+
+    MetricsHubs *m_hubs;
+    QTcpServer *m_server;
+    std::string m_page;
+};
+
+// Serves the hubs' values for Prometheus and the like, in OpenMetrics text
+// (see openmetrics.h), at /metrics over plain HTTP:
+//
+//   curl http://127.0.0.1:9464/metrics
+//
+// The owner hands over each hub's latest snapshot with publish(); a scrape
+// picks up whatever was published last.
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsServer(QObject *parent = nullptr);
+    ~MetricsServer();
+
+    // "[address:]port", the loopback address if there's no address
+    static bool parseAddress(const QString &spec, QString *address, quint16 *port);
+
+    // starts listening on the server's thread; failures come back through
+    // logStringReady
+    void listen(const QString &address, quint16 port);
+
+    // one thread only; copies the snapshots and never waits for a scrape
+    void publish(const HubSnapshot *hubs, size_t count);
+
+signals:
+    void logStringReady(QString logLine);
+
+private:
+    MetricsHubs m_hubs;
+    QThread m_thread;
+    MetricsListener *m_listener;
+};
+
+#endif // METRICSSERVER_H
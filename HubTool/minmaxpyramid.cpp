@@ -0,0 +1,123 @@
+#include "minmaxpyramid.h"
+
+#include <algorithm>
+
+MinMaxPyramid::MinMaxPyramid(int lowestLevel) :
+    m_lowestLevel(std::max(1, std::min(lowestLevel, (int)Levels))),
+    m_count(0)
+{
+    for(int level = 0; level < Levels; level++){
+        m_levelBase[level] = 0;
+    }
+}
+
+uint64_t MinMaxPyramid::span(int level){
+    uint64_t samples = 1;
+    for(int i = 0; i < level; i++){
+        samples *= Fanout;
+    }
+    return samples;
+}
+
+void MinMaxPyramid::append(double key, double value){
+    uint64_t index = m_count++;
+
+    uint64_t bucketSpan = span(m_lowestLevel - 1);
+    for(int level = m_lowestLevel - 1; level < Levels; level++){
+        bucketSpan *= Fanout;
+        uint64_t bucketIndex = index/bucketSpan;
+        std::deque<Bucket> &buckets = m_levels[level];
+
+        if(buckets.empty() || m_levelBase[level] + buckets.size() <= bucketIndex){
+            if(buckets.empty()){
+                m_levelBase[level] = bucketIndex;
+            }
+            Bucket bucket = {key, key, value, value, value, 1};
+            buckets.push_back(bucket);
+            continue;
+        }
+
+        Bucket &last = buckets.back();
+        last.lastKey = key;
+        last.min = std::min(last.min, value);
+        last.max = std::max(last.max, value);
+        last.sum += value;
+        last.count++;
+    }
+}
+
+void MinMaxPyramid::clear(){
+    m_count = 0;
+    for(int level = 0; level < Levels; level++){
+        m_levels[level].clear();
+        m_levelBase[level] = 0;
+    }
+}
+
+void MinMaxPyramid::removeBefore(uint64_t index){
+    uint64_t bucketSpan = span(m_lowestLevel - 1);
+    for(int level = m_lowestLevel - 1; level < Levels; level++){
+        bucketSpan *= Fanout;
+        std::deque<Bucket> &buckets = m_levels[level];
+        while(!buckets.empty() && (m_levelBase[level] + 1)*bucketSpan <= index){
+            buckets.pop_front();
+            m_levelBase[level]++;
+        }
+    }
+}
+
+size_t MinMaxPyramid::memoryBytes() const {
+    size_t buckets = 0;
+    for(int level = 0; level < Levels; level++){
+        buckets += m_levels[level].size();
+    }
+    return buckets*sizeof(Bucket);
+}
+
+int MinMaxPyramid::levelFor(size_t samples, int pixels){
+    size_t perLevel = samples;
+    size_t wanted = (size_t)std::max(pixels, 1);
+    int level = 0;
+    while(level < Levels && perLevel/Fanout >= wanted){
+        perLevel /= Fanout;
+        level++;
+    }
+    return level;
+}
+
+void MinMaxPyramid::envelope(int level, uint64_t first, uint64_t end, std::vector<Point> *points) const {
+    points->clear();
+    if(level < m_lowestLevel || level > Levels || first >= end)
+        return;
+
+    const std::deque<Bucket> &buckets = m_levels[level - 1];
+    uint64_t base = m_levelBase[level - 1];
+    uint64_t bucketSpan = span(level);
+    uint64_t firstBucket = std::max(first/bucketSpan, base);
+    uint64_t lastBucket = (end - 1)/bucketSpan;
+    if(lastBucket < firstBucket)
+        return;
+    points->reserve(2*(lastBucket - firstBucket + 1));
+
+    // a bucket is narrower than a pixel, so which end its min and max go at doesn't show
+    for(uint64_t bucket = firstBucket; bucket <= lastBucket && bucket - base < buckets.size(); bucket++){
+        const Bucket &b = buckets[bucket - base];
+        Point low = {b.firstKey, b.min};
+        Point high = {b.lastKey, b.max};
+        points->push_back(low);
+        points->push_back(high);
+    }
+}
+
+void MinMaxPyramid::buckets(int level, double from, double to, std::vector<Bucket> *out) const {
+    out->clear();
+    if(level < m_lowestLevel || level > Levels)
+        return;
+
+    const std::deque<Bucket> &buckets = m_levels[level - 1];
+    std::deque<Bucket>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), from,
+                                                             [](const Bucket &bucket, double k){ return bucket.lastKey < k; });
+    for(; it != buckets.end() && it->firstKey <= to; ++it){
+        out->push_back(*it);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef MINMAXPYRAMID_H
+#define MINMAXPYRAMID_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+// Coarse copies of a series of (key, value) samples, for drawing. Each level
+// holds one bucket with the min, max and mean of every Fanout buckets of the
+// level below, starting from the samples themselves. Adding a sample updates
+// the last bucket of every level, so the pyramid is always current and never
+// has to be rebuilt.
+//
+// The samples themselves aren't kept here, and neither are the levels below
+// lowestLevel; whoever owns the samples draws those from the samples. With
+// the lowest levels left out the pyramid costs a byte or so per sample.
+//
+// Samples are numbered from 0 in the order they're added, and keys have to
+// be added in increasing order.
+class MinMaxPyramid
+{
+public:
+    static const int Fanout = 4;
+    static const int Levels = 12;           // level 12 buckets cover 4^12 samples
+
+    struct Point {
+        double key;
+        double value;
+    };
+
+    struct Bucket {
+        double firstKey;
+        double lastKey;
+        double min;
+        double max;
+        double sum;
+        uint32_t count;
+
+        double mean() const { return count ? sum/count : 0.0; }
+    };
+
+    explicit MinMaxPyramid(int lowestLevel = 1);
+
+    void append(double key, double value);
+    void clear();
+
+    // the first samples up to (not including) sample number index are gone;
+    // buckets go once all their samples have, so the oldest bucket of a level
+    // may still count a few of them
+    void removeBefore(uint64_t index);
+
+    int lowestLevel() const { return m_lowestLevel; }
+    uint64_t count() const { return m_count; }
+    size_t memoryBytes() const;
+
+    // the level to draw this many samples across this many pixels at, 0 for
+    // the samples themselves
+    static int levelFor(size_t samples, int pixels);
+    static uint64_t span(int level);
+
+    // each bucket's min and max for samples [first, end) at level, which has
+    // to be lowestLevel() or above
+    void envelope(int level, uint64_t first, uint64_t end, std::vector<Point> *points) const;
+
+    // buckets of level overlapping keys [from, to]
+    void buckets(int level, double from, double to, std::vector<Bucket> *out) const;
+
+private:
+    int m_lowestLevel;
+    uint64_t m_count;                       // samples added
+    std::deque<Bucket> m_levels[Levels];    // index 0 is level 1
+    uint64_t m_levelBase[Levels];           // buckets removed from the front of each level
+};
+
+#endif // MINMAXPYRAMID_H
@@ -0,0 +1,188 @@
+#include "openmetrics.h"
+#include "connectionmonitor.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// 1 uWh = 3600 uJ, 1 uAh = 3600 uC
+#define MICRO_PER_MICRO_HOUR 3600
+
+namespace {
+
+// values are either whole numbers or millionths of the unit
+enum Scale {
+    Whole,
+    Micro
+};
+
+struct HubMetric {
+    const char *name;
+    const char *type;
+    const char *unit;
+    const char *help;
+    Scale scale;
+    int64_t (*value)(const HubSnapshot &hub);
+};
+
+struct PortMetric {
+    const char *name;
+    const char *type;
+    const char *unit;
+    const char *help;
+    Scale scale;
+    int64_t (*value)(const HubSnapshot &hub, int port);
+};
+
+const HubMetric hubMetrics[] = {
+    {"hubtool_hub_connected", "gauge", "", "1 while the link to the hub is up", Whole,
+     [](const HubSnapshot &hub) -> int64_t { return hub.connectionState <= ConnectionMonitor::Degraded ? 1 : 0; }},
+    {"hubtool_hub_poll_rate_hertz", "gauge", "hertz", "Poll cycles completed per second", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return llround(hub.achievedRate*1000.0)*1000; }},
+    {"hubtool_hub_reconnects", "counter", "", "Times the link was lost and came back", Whole,
+     [](const HubSnapshot &hub) -> int64_t { return hub.reconnectCount; }},
+    {"hubtool_hub_temperature_celsius", "gauge", "celsius", "Hub temperature", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return hub.temperature; }},
+    {"hubtool_hub_input_voltage_volts", "gauge", "volts", "Hub supply voltage", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return hub.inputVoltage; }},
+    {"hubtool_hub_input_current_amperes", "gauge", "amperes", "Hub supply current", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return hub.inputCurrent; }},
+    {"hubtool_hub_uptime_seconds", "gauge", "seconds", "Time since the hub was powered or reset", Whole,
+     [](const HubSnapshot &hub) -> int64_t { return (int64_t)hub.uptime*60; }},
+    {"hubtool_hub_energy_joules", "counter", "joules", "Energy through every port since their last reset", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return hub.hubEnergy*MICRO_PER_MICRO_HOUR; }},
+    {"hubtool_hub_charge_coulombs", "counter", "coulombs", "Charge through every port since their last reset", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return hub.hubCharge*MICRO_PER_MICRO_HOUR; }},
+    {"hubtool_hub_last_update_timestamp_seconds", "gauge", "seconds", "When the hub's values were last read", Micro,
+     [](const HubSnapshot &hub) -> int64_t { return hub.timestampMs*1000; }},
+};
+
+const PortMetric portMetrics[] = {
+    {"hubtool_port_voltage_volts", "gauge", "volts", "Port output voltage", Micro,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.portVoltage[port]; }},
+    {"hubtool_port_current_amperes", "gauge", "amperes", "Port output current", Micro,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.portCurrent[port]; }},
+    {"hubtool_port_current_limit_amperes", "gauge", "amperes", "Port current limit", Micro,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.currentLimit[port]; }},
+    {"hubtool_port_state", "gauge", "", "Port state bits, as read from the hub", Whole,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.portState[port]; }},
+    {"hubtool_port_error", "gauge", "", "Port error bits, as read from the hub", Whole,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.portError[port]; }},
+    {"hubtool_port_energy_joules", "counter", "joules", "Energy through the port since its last reset", Micro,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.portEnergy[port]*MICRO_PER_MICRO_HOUR; }},
+    {"hubtool_port_charge_coulombs", "counter", "coulombs", "Charge through the port since its last reset", Micro,
+     [](const HubSnapshot &hub, int port) -> int64_t { return hub.portCharge[port]*MICRO_PER_MICRO_HOUR; }},
+};
+
+inline void appendText(std::string *out, const char *text){
+    out->append(text, strlen(text));
+}
+
+inline void appendInteger(std::string *out, uint64_t value){
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while(value);
+    while(n) out->push_back(digits[--n]);
+}
+
+inline void appendValue(std::string *out, int64_t value, Scale scale){
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    if(value < 0) out->push_back('-');
+    if(scale == Whole){
+        appendInteger(out, magnitude);
+        return;
+    }
+
+    appendInteger(out, magnitude/1000000);
+    uint32_t fraction = (uint32_t)(magnitude % 1000000);
+    if(fraction == 0)
+        return;
+
+    char digits[7] = {'.', '0', '0', '0', '0', '0', '0'};
+    int length = 7;
+    for(int i = 6; i > 0; i--){
+        digits[i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    while(digits[length - 1] == '0') length--;
+    out->append(digits, length);
+}
+
+inline void appendSerial(std::string *out, uint32_t serial){
+    static const char hex[] = "0123456789ABCDEF";
+    char text[10] = {'0', 'x'};
+    for(int i = 0; i < 8; i++){
+        text[2 + i] = hex[(serial >> (28 - 4*i)) & 0xF];
+    }
+    out->append(text, sizeof(text));
+}
+
+void appendFamily(std::string *out, const char *name, const char *type, const char *unit, const char *help){
+    appendText(out, "# TYPE "); appendText(out, name); out->push_back(' '); appendText(out, type); out->push_back('\n');
+    if(*unit){
+        appendText(out, "# UNIT "); appendText(out, name); out->push_back(' '); appendText(out, unit); out->push_back('\n');
+    }
+    appendText(out, "# HELP "); appendText(out, name); out->push_back(' '); appendText(out, help); out->push_back('\n');
+}
+
+inline void appendName(std::string *out, const char *name, const char *type){
+    appendText(out, name);
+    if(type[0] == 'c') appendText(out, "_total");
+}
+
+inline bool known(const HubSnapshot &hub){
+    return hub.serialNumber != 0 && hub.serialNumber != 0xFFFFFFFF;
+}
+
+}
+
+// Every sample of a family has to come together, so the families are the
+// outer loop and the hubs the inner.
+void renderOpenMetrics(const std::vector<HubSnapshot> &hubs, std::string *out){
+    out->clear();
+
+    appendFamily(out, "hubtool_hub", "info", "", "Hubs being polled");
+    for(const HubSnapshot &hub: hubs){
+        if(!known(hub)) continue;
+        appendText(out, "hubtool_hub_info{serial=\"");
+        appendSerial(out, hub.serialNumber);
+        appendText(out, "\",model=\"");
+        appendText(out, formatModel(hub.model).toLatin1().constData());
+        appendText(out, "\"} 1\n");
+    }
+
+    for(const HubMetric &metric: hubMetrics){
+        appendFamily(out, metric.name, metric.type, metric.unit, metric.help);
+        for(const HubSnapshot &hub: hubs){
+            if(!known(hub)) continue;
+            appendName(out, metric.name, metric.type);
+            appendText(out, "{serial=\"");
+            appendSerial(out, hub.serialNumber);
+            appendText(out, "\"} ");
+            appendValue(out, metric.value(hub), metric.scale);
+            out->push_back('\n');
+        }
+    }
+
+    for(const PortMetric &metric: portMetrics){
+        appendFamily(out, metric.name, metric.type, metric.unit, metric.help);
+        for(const HubSnapshot &hub: hubs){
+            if(!known(hub)) continue;
+            for(int port = 0; port < hub.numUSB && port < 8; port++){
+                appendName(out, metric.name, metric.type);
+                appendText(out, "{serial=\"");
+                appendSerial(out, hub.serialNumber);
+                appendText(out, "\",port=\"");
+                appendInteger(out, (uint64_t)port);
+                appendText(out, "\"} ");
+                appendValue(out, metric.value(hub, port), metric.scale);
+                out->push_back('\n');
+            }
+        }
+    }
+
+    appendText(out, "# EOF\n");
+}
@@ -0,0 +1,20 @@
+#ifndef OPENMETRICS_H
+#define OPENMETRICS_H
+
+#include <string>
+#include <vector>
+
+#include "hubsnapshot.h"
+
+// Writes the hubs' last snapshots as OpenMetrics text: one family per
+// reading, hub metrics labelled by serial number and port metrics by serial
+// number and port, values in base units (volts, amperes, degrees Celsius,
+// seconds, joules, coulombs). Hubs whose serial number isn't known yet are
+// left out.
+//
+// Numbers are formatted by hand straight into out, which keeps its capacity
+// from one call to the next, so a page for hundreds of ports takes well
+// under a millisecond.
+void renderOpenMetrics(const std::vector<HubSnapshot> &hubs, std::string *out);
+
+#endif // OPENMETRICS_H
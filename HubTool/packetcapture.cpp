@@ -0,0 +1,240 @@
+#include "packetcapture.h"
+
+#include <QDateTime>
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "BrainStem2/aTime.h"
+
+#define PACKET_CAPTURE_MAGIC "HUBTRACE"
+#define PACKET_CAPTURE_VERSION 1
+#define PACKET_CAPTURE_ALIGN 8
+#define PACKET_CAPTURE_MIN_CAPACITY (64*1024)
+
+// the link keeps this much log between drains
+#define PACKET_CAPTURE_LINK_LOG_BYTES (256*1024)
+#define PACKET_CAPTURE_DRAIN_INTERVAL_MS 5
+
+#define PACKET_CAPTURE_PAD 0
+
+PacketCapture::PacketCapture() :
+    m_map(nullptr),
+    m_header(nullptr),
+    m_records(nullptr),
+    m_link(0),
+    m_draining(false),
+    m_captured(0),
+    m_dropped(0),
+    m_clockStartUs(0)
+{
+}
+
+PacketCapture::~PacketCapture(){
+    close();
+}
+
+bool PacketCapture::open(const QString &path, qint64 capacity){
+    close();
+    m_error.clear();
+
+    capacity = qMax(capacity, (qint64)PACKET_CAPTURE_MIN_CAPACITY);
+    capacity -= capacity % PACKET_CAPTURE_ALIGN;
+
+    m_file.setFileName(path);
+    if(!m_file.open(QIODevice::ReadWrite)){
+        m_error = m_file.errorString();
+        return false;
+    }
+
+    // carry on with a ring of the same shape, otherwise start over
+    Header existing;
+    memset(&existing, 0, sizeof(existing));
+    bool reuse = m_file.size() == (qint64)sizeof(Header) + capacity
+                 && m_file.read((char*)&existing, sizeof(existing)) == sizeof(existing)
+                 && memcmp(existing.magic, PACKET_CAPTURE_MAGIC, sizeof(existing.magic)) == 0
+                 && existing.version == PACKET_CAPTURE_VERSION
+                 && existing.headerSize == sizeof(Header)
+                 && existing.capacity == (uint64_t)capacity
+                 && existing.head < existing.capacity
+                 && existing.tail < existing.capacity;
+
+    if(!reuse && !m_file.resize(sizeof(Header) + capacity)){
+        m_error = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    m_map = m_file.map(0, sizeof(Header) + capacity);
+    if(!m_map){
+        m_error = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    m_header = (Header*)m_map;
+    m_records = m_map + sizeof(Header);
+
+    if(!reuse){
+        memset(m_header, 0, sizeof(Header));
+        memcpy(m_header->magic, PACKET_CAPTURE_MAGIC, sizeof(m_header->magic));
+        m_header->version = PACKET_CAPTURE_VERSION;
+        m_header->headerSize = sizeof(Header);
+        m_header->capacity = capacity;
+    }
+
+    m_captured.store(0);
+    m_dropped.store(0);
+    m_clock.start();
+    m_clockStartUs = QDateTime::currentMSecsSinceEpoch()*1000;
+
+    startDraining();
+    return true;
+}
+
+void PacketCapture::close(){
+    stopDraining();
+
+    if(m_map){
+        m_file.unmap(m_map);
+        m_map = nullptr;
+        m_header = nullptr;
+        m_records = nullptr;
+    }
+    if(m_file.isOpen()){
+        m_file.close();
+    }
+}
+
+void PacketCapture::attachLink(aLinkRef link){
+    detachLink();
+    m_link = link;
+    startDraining();
+}
+
+void PacketCapture::detachLink(){
+    stopDraining();
+    m_link = 0;
+}
+
+void PacketCapture::startDraining(){
+    if(m_draining.load() || !m_link || !m_map)
+        return;
+
+    aLink_PacketDebug_SetLogSize(m_link, PACKET_CAPTURE_LINK_LOG_BYTES);
+    if(aLink_PacketDebug_Enable(m_link) != aErrNone)
+        return;
+
+    m_draining.store(true);
+    m_thread = std::thread(&PacketCapture::drainLoop, this);
+}
+
+// the link's log is turned off again once what's left in it is saved
+void PacketCapture::stopDraining(){
+    if(!m_draining.load())
+        return;
+
+    m_draining.store(false);
+    m_thread.join();
+    drain();
+    aLink_PacketDebug_Disable(m_link);
+}
+
+void PacketCapture::drainLoop(){
+    while(m_draining.load()){
+        if(drain() == 0){
+            aTime_MSSleep(PACKET_CAPTURE_DRAIN_INTERVAL_MS);
+        }
+    }
+}
+
+int PacketCapture::drain(){
+    uint8_t data[256];
+    int count = 0;
+
+    while(true){
+        packetLogType type = PACKET_LOG_UNKNOWN_TYPE;
+        uint32_t length = sizeof(data);
+        aErr err = aLink_PacketDebug_Read(m_link, &type, &length, data);
+        if(err == aErrOverrun){
+            // the entry stays in the log until it's read, so take it once
+            // with room for all of it; append() counts it as dropped if it's
+            // too long to keep
+            std::vector<uint8_t> large(std::max<uint32_t>(length, 2*sizeof(data)));
+            length = (uint32_t)large.size();
+            err = aLink_PacketDebug_Read(m_link, &type, &length, large.data());
+            if(err != aErrNone){
+                m_dropped++;
+                break;
+            }
+            append((uint8_t)type, large.data(), length);
+            count++;
+            continue;
+        }
+        if(err != aErrNone)
+            break;
+
+        append((uint8_t)type, data, length);
+        count++;
+    }
+    return count;
+}
+
+// Frees [head, end) by dropping whatever old records are in the way.
+void PacketCapture::dropOldestBefore(uint64_t end){
+    while(m_header->records > 0 && m_header->tail >= m_header->head && m_header->tail < end){
+        RecordHeader *oldest = recordAt(m_header->tail);
+        m_header->tail += oldest->size;
+        m_header->records--;
+
+        // a pad, or the end of the ring, sends the tail back to the start
+        if(m_header->tail >= m_header->capacity || recordAt(m_header->tail)->type == PACKET_CAPTURE_PAD){
+            m_header->tail = 0;
+        }
+    }
+}
+
+void PacketCapture::append(uint8_t type, const uint8_t *data, uint32_t length){
+    if(length > 0xFF){
+        m_dropped++;
+        return;
+    }
+
+    uint64_t size = sizeof(RecordHeader) + length;
+    size = (size + PACKET_CAPTURE_ALIGN - 1) & ~(uint64_t)(PACKET_CAPTURE_ALIGN - 1);
+
+    // doesn't fit before the end, so pad out the rest and wrap
+    if(m_header->head + size > m_header->capacity){
+        dropOldestBefore(m_header->capacity);
+        if(m_header->head < m_header->capacity){
+            RecordHeader *pad = recordAt(m_header->head);
+            pad->size = (uint16_t)qMin(m_header->capacity - m_header->head, (uint64_t)0xFFFF);
+            pad->type = PACKET_CAPTURE_PAD;
+            pad->length = 0;
+        }
+        if(m_header->records == 0){
+            m_header->tail = 0;
+        }
+        m_header->head = 0;
+    }
+    dropOldestBefore(m_header->head + size);
+
+    RecordHeader *record = recordAt(m_header->head);
+    record->size = (uint16_t)size;
+    record->type = type ? type : PACKET_LOG_UNKNOWN_TYPE;
+    record->length = (uint8_t)length;
+    record->sequence = (uint32_t)m_header->sequence;
+    record->timestampUs = m_clockStartUs + m_clock.nsecsElapsed()/1000;
+    memcpy(record + 1, data, length);
+
+    if(m_header->records == 0){
+        m_header->tail = m_header->head;
+    }
+    m_header->head += size;
+    if(m_header->head >= m_header->capacity){
+        m_header->head = 0;
+    }
+    m_header->records++;
+    m_header->sequence++;
+    m_captured++;
+}
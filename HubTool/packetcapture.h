@@ -0,0 +1,112 @@
+#ifndef PACKETCAPTURE_H
+#define PACKETCAPTURE_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <thread>
+
+#include "BrainStem2/BrainStem-all.h"
+#include "BrainStem2/aLink.h"
+
+// Copies a link's packet debug log (aLink_PacketDebug_*) into a fixed size,
+// memory mapped ring file, so a capture can run for days without growing.
+// Once the ring is full the oldest records are overwritten.
+//
+// Capturing only happens while a file is open and a link is attached. A
+// background thread drains the link's log every few ms. With no file open
+// the link's packet debug is off and there's no thread, so an idle capture
+// costs nothing.
+//
+// File layout, little endian:
+//   header, 64 bytes:
+//     char magic[8]        "HUBTRACE"
+//     uint32 version       1
+//     uint32 headerSize    64
+//     uint64 capacity      bytes of record space after the header
+//     uint64 head          offset the next record goes to
+//     uint64 tail          offset of the oldest record
+//     uint64 records       records in the ring
+//     uint64 sequence      records written since the file was created
+//     uint64 reserved
+//   records, 8 byte aligned, from tail around to head:
+//     uint16 size          of the whole record, padding included
+//     uint8 type           packetLogType; 0 pads out the rest of the ring
+//     uint8 length         of the packet bytes
+//     uint32 sequence      low 32 bits
+//     uint64 timestampUs   since the epoch, taken when the record is drained
+//     uint8 data[length]   address, length, payload as on the wire
+class PacketCapture
+{
+public:
+    static const qint64 DefaultCapacity = 64*1024*1024;
+
+    PacketCapture();
+    ~PacketCapture();
+
+    // opening a file already in this format with the same capacity carries
+    // on where it left off; anything else is overwritten
+    bool open(const QString &path, qint64 capacity = DefaultCapacity);
+    void close();
+    bool isOpen() const { return m_map != nullptr; }
+    QString path() const { return m_file.fileName(); }
+    QString errorString() const { return m_error; }
+
+    // the link has to stay valid until detachLink()
+    void attachLink(aLinkRef link);
+    void detachLink();
+
+    // safe to read from any thread
+    uint64_t capturedCount() const { return m_captured.load(); }
+    uint64_t droppedCount() const { return m_dropped.load(); }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t capacity;
+        uint64_t head;
+        uint64_t tail;
+        uint64_t records;
+        uint64_t sequence;
+        uint64_t reserved;
+    };
+
+    struct RecordHeader {
+        uint16_t size;
+        uint8_t type;
+        uint8_t length;
+        uint32_t sequence;
+        uint64_t timestampUs;
+    };
+
+    void startDraining();
+    void stopDraining();
+    void drainLoop();
+    int drain();
+
+    // everything below is only used by whichever thread is draining
+    void append(uint8_t type, const uint8_t *data, uint32_t length);
+    void dropOldestBefore(uint64_t end);
+    RecordHeader* recordAt(uint64_t offset) { return (RecordHeader*)(m_records + offset); }
+
+    QFile m_file;
+    QString m_error;
+    uchar *m_map;
+    Header *m_header;
+    uchar *m_records;
+
+    aLinkRef m_link;
+    std::thread m_thread;
+    std::atomic<bool> m_draining;
+    std::atomic<uint64_t> m_captured;
+    std::atomic<uint64_t> m_dropped;
+
+    QElapsedTimer m_clock;
+    qint64 m_clockStartUs;       // epoch time when m_clock started
+};
+
+#endif // PACKETCAPTURE_H
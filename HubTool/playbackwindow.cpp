@@ -0,0 +1,181 @@
+#include "playbackwindow.h"
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
+#include <QDateTime>
+
+#include <limits.h>
+
+#define PLAYBACK_FILTER "Sample recordings (*.hubts)"
+#define PLAYBACK_TIME_FMT "yyyy.MM.dd HH:mm:ss.zzz"
+
+PlaybackWindow::PlaybackWindow(QWidget *parent) :
+    QWidget(parent),
+    m_active(false),
+    m_playing(false),
+    m_updatingSlider(false),
+    m_firstUs(0),
+    m_lastUs(0),
+    m_sliderStepUs(1000)
+{
+    setWindowTitle("Play back recording");
+
+    m_fileLabel = new QLabel("No recording open", this);
+    m_positionLabel = new QLabel(this);
+    m_playButton = new QPushButton("Play", this);
+    m_playButton->setEnabled(false);
+    m_slider = new QSlider(Qt::Horizontal, this);
+    m_slider->setEnabled(false);
+    m_speedBox = new QComboBox(this);
+
+    const int speeds[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, SamplePlayer::MaxSpeed};
+    for(int speed: speeds){
+        m_speedBox->addItem(QString("%1x").arg(speed), speed);
+    }
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    controls->addWidget(m_playButton);
+    controls->addWidget(m_slider, 1);
+    controls->addWidget(m_speedBox);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(m_fileLabel);
+    layout->addLayout(controls);
+    layout->addWidget(m_positionLabel);
+    setLayout(layout);
+    resize(600, 120);
+
+    m_player = new SamplePlayer();
+    m_player->moveToThread(&m_thread);
+    connect(this, SIGNAL(userOpenedRecording(QString)), m_player, SLOT(open(QString)));
+    connect(this, SIGNAL(userClosedRecording()), m_player, SLOT(close()));
+    connect(this, SIGNAL(userPressedPlay()), m_player, SLOT(play()));
+    connect(this, SIGNAL(userPressedPause()), m_player, SLOT(pause()));
+    connect(this, SIGNAL(userSeeked(qint64)), m_player, SLOT(seek(qint64)));
+    connect(this, SIGNAL(userChangedSpeed(int)), m_player, SLOT(setSpeed(int)));
+    connect(m_player, SIGNAL(opened(bool,QString,qint64,qint64)),
+            this, SLOT(handleOpened(bool,QString,qint64,qint64)), Qt::QueuedConnection);
+    connect(m_player, SIGNAL(positionChanged(qint64)), this, SLOT(handlePosition(qint64)), Qt::QueuedConnection);
+    connect(m_player, SIGNAL(playingChanged(bool)), this, SLOT(handlePlaying(bool)), Qt::QueuedConnection);
+    connect(m_player, SIGNAL(logStringReady(QString)), this, SIGNAL(logStringReady(QString)), Qt::QueuedConnection);
+
+    connect(m_playButton, SIGNAL(clicked()), this, SLOT(togglePlaying()));
+    connect(m_slider, SIGNAL(sliderReleased()), this, SLOT(seekToSlider()));
+    connect(m_slider, SIGNAL(valueChanged(int)), this, SLOT(handleSliderValue(int)));
+    connect(m_speedBox, SIGNAL(currentIndexChanged(int)), this, SLOT(handleSpeed(int)));
+    m_thread.start();
+}
+
+PlaybackWindow::~PlaybackWindow(){
+    m_thread.quit();
+    m_thread.wait();
+    delete m_player;
+}
+
+void PlaybackWindow::openRecording(const QString &directory){
+    QString path = QFileDialog::getOpenFileName(this, "Play back recording", directory, PLAYBACK_FILTER);
+    if(path.isEmpty())
+        return;
+
+    m_fileLabel->setText(QString("Opening %1...").arg(QFileInfo(path).fileName()));
+    emit userOpenedRecording(path);
+    show();
+    raise();
+    activateWindow();
+}
+
+// closing the window goes back to the live hub
+void PlaybackWindow::hideEvent(QHideEvent *e){
+    if(m_active){
+        emit userClosedRecording();
+        m_active = false;
+        m_playButton->setEnabled(false);
+        m_slider->setEnabled(false);
+        emit activeChanged(false);
+    }
+    QWidget::hideEvent(e);
+}
+
+void PlaybackWindow::handleOpened(bool ok, QString message, qint64 firstUs, qint64 lastUs){
+    if(!ok){
+        m_fileLabel->setText("No recording open");
+        QMessageBox::information(this, "Error", message);
+        if(m_active){
+            m_active = false;
+            emit activeChanged(false);
+        }
+        return;
+    }
+
+    m_fileLabel->setText(message);
+    m_firstUs = firstUs;
+    m_lastUs = lastUs;
+
+    // ms steps, unless the recording is too long for an int of them
+    qint64 spanUs = qMax(lastUs - firstUs, (qint64)1);
+    m_sliderStepUs = qMax((qint64)1000, spanUs/INT_MAX + 1);
+    m_updatingSlider = true;
+    m_slider->setRange(0, (int)(spanUs/m_sliderStepUs));
+    m_slider->setPageStep(qMax(1, m_slider->maximum()/20));
+    m_slider->setValue(0);
+    m_updatingSlider = false;
+
+    m_playButton->setEnabled(true);
+    m_slider->setEnabled(true);
+    emit userChangedSpeed(m_speedBox->currentData().toInt());
+
+    // again for each recording, so the plots start over
+    m_active = true;
+    emit activeChanged(true);
+}
+
+void PlaybackWindow::handlePosition(qint64 timeUs){
+    m_positionLabel->setText(QString("%1 of %2").arg(formatTime(timeUs)).arg(formatTime(m_lastUs)));
+
+    // leave it alone while it's being dragged
+    if(m_slider->isSliderDown())
+        return;
+    m_updatingSlider = true;
+    m_slider->setValue((int)((timeUs - m_firstUs)/m_sliderStepUs));
+    m_updatingSlider = false;
+}
+
+void PlaybackWindow::handlePlaying(bool playing){
+    m_playing = playing;
+    m_playButton->setText(playing ? "Pause" : "Play");
+}
+
+void PlaybackWindow::togglePlaying(){
+    if(m_playing){
+        emit userPressedPause();
+    }
+    else {
+        emit userPressedPlay();
+    }
+}
+
+void PlaybackWindow::seekToSlider(){
+    emit userSeeked(m_firstUs + (qint64)m_slider->value()*m_sliderStepUs);
+}
+
+// clicks on the groove and the arrow keys; drags seek once they're let go
+void PlaybackWindow::handleSliderValue(int value){
+    if(m_updatingSlider)
+        return;
+    if(m_slider->isSliderDown()){
+        m_positionLabel->setText(QString("%1 of %2").arg(formatTime(m_firstUs + (qint64)value*m_sliderStepUs))
+                                 .arg(formatTime(m_lastUs)));
+        return;
+    }
+    seekToSlider();
+}
+
+void PlaybackWindow::handleSpeed(int index){
+    emit userChangedSpeed(m_speedBox->itemData(index).toInt());
+}
+
+QString PlaybackWindow::formatTime(qint64 timeUs) const {
+    return QDateTime::fromMSecsSinceEpoch(timeUs/1000).toString(PLAYBACK_TIME_FMT);
+}
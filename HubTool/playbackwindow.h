@@ -0,0 +1,77 @@
+#ifndef PLAYBACKWINDOW_H
+#define PLAYBACKWINDOW_H
+
+#include <QWidget>
+#include <QLabel>
+#include <QPushButton>
+#include <QSlider>
+#include <QComboBox>
+#include <QThread>
+
+#include "sampleplayer.h"
+
+// Controls for playing a sample recording back through the main window:
+// play/pause, a position slider to seek with and the speed. The player runs
+// on a thread this owns. Playback is active from when a recording opens
+// until the window is closed, and the main window shows the recording
+// instead of the hub for that long.
+class PlaybackWindow : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit PlaybackWindow(QWidget *parent = nullptr);
+    ~PlaybackWindow();
+
+    // asks which recording, then opens it and shows the window
+    void openRecording(const QString &directory);
+
+    bool isActive() const { return m_active; }
+    PlaybackQueue* snapshots() { return m_player->snapshots(); }
+
+signals:
+    // true again each time another recording opens
+    void activeChanged(bool active);
+    void logStringReady(QString logString);
+
+    // to the player, on its thread
+    void userOpenedRecording(QString path);
+    void userClosedRecording();
+    void userPressedPlay();
+    void userPressedPause();
+    void userSeeked(qint64 timeUs);
+    void userChangedSpeed(int speed);
+
+protected:
+    void hideEvent(QHideEvent *e);
+
+private slots:
+    void handleOpened(bool ok, QString message, qint64 firstUs, qint64 lastUs);
+    void handlePosition(qint64 timeUs);
+    void handlePlaying(bool playing);
+    void togglePlaying();
+    void seekToSlider();
+    void handleSliderValue(int value);
+    void handleSpeed(int index);
+
+private:
+    QString formatTime(qint64 timeUs) const;
+
+    SamplePlayer *m_player;
+    QThread m_thread;
+
+    QLabel *m_fileLabel;
+    QLabel *m_positionLabel;
+    QPushButton *m_playButton;
+    QSlider *m_slider;
+    QComboBox *m_speedBox;
+
+    bool m_active;
+    bool m_playing;
+    bool m_updatingSlider;
+    qint64 m_firstUs;
+    qint64 m_lastUs;
+    qint64 m_sliderStepUs;                  // recorded time per slider step
+};
+
+#endif // PLAYBACKWINDOW_H
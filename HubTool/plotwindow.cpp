@@ -1,8 +1,9 @@
 #include "plotwindow.h"
 #include "ui_plotwindow.h"
+#include "exportprogressdialog.h"
 #include <QTime>
-#include <QFile>
-#include <QTextStream>
+
+#include <math.h>
 
 PlotWindow::PlotWindow(int port, qint64 appStartTime, QWidget *parent) :
     QDialog(parent),
@@ -12,6 +13,10 @@ PlotWindow::PlotWindow(int port, qint64 appStartTime, QWidget *parent) :
     m_startTimeMs = appStartTime;
 
     ui->setupUi(this);
+
+    m_statisticsLabel = new QLabel(this);
+    m_statisticsLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    ui->verticalLayout->insertWidget(1, m_statisticsLabel);
 }
 
 PlotWindow::~PlotWindow()
@@ -130,9 +135,37 @@ void PlotWindow::handlePortVoltageCurrent(int port, int32_t microVolts, int32_t
     // ignore signals inteneded for other port's windows
     if(port != m_port)
         return;
-    double currentTimeKey = (QDateTime::currentMSecsSinceEpoch() - m_startTimeMs)/1000.0;
-    m_voltageGraph->addData(currentTimeKey, microVolts/1000000.0);
-    m_currentGraph->addData(currentTimeKey, microAmps/1000000.0);
+    addSample(QDateTime::currentMSecsSinceEpoch(), microVolts, microAmps);
+}
+
+void PlotWindow::addSample(qint64 timestampMs, int32_t microVolts, int32_t microAmps){
+    m_samples.append(timestampMs, microVolts, microAmps);
+}
+
+void PlotWindow::clearSamples(){
+    m_samples.clear();
+    m_voltageGraph->data()->clear();
+    m_currentGraph->data()->clear();
+}
+
+// Hands the graphs only the range being shown, at about one point per pixel,
+// so a replot costs the same however long the log runs.
+void PlotWindow::setGraphData(const QCPRange &range, int width){
+    int64_t from = m_startTimeMs + (int64_t)floor(range.lower*1000.0);
+    int64_t to = m_startTimeMs + (int64_t)ceil(range.upper*1000.0);
+    m_samples.envelope(from, to, width, &m_voltageEnvelope, &m_currentEnvelope);
+
+    setGraphData(m_voltageGraph, m_voltageEnvelope);
+    setGraphData(m_currentGraph, m_currentEnvelope);
+}
+
+void PlotWindow::setGraphData(QCPGraph *graph, const std::vector<MinMaxPyramid::Point> &envelope){
+    m_plotData.resize((int)envelope.size());
+    for(size_t i = 0; i < envelope.size(); i++){
+        m_plotData[(int)i].key = (envelope[i].key - m_startTimeMs)/1000.0;
+        m_plotData[(int)i].value = envelope[i].value/1000000.0;
+    }
+    graph->data()->set(m_plotData, true);
 }
 
 
@@ -142,8 +175,7 @@ void PlotWindow::updatePlots(){
 
     // if we're autoscrolling, truncate the date
     if(ui->logDataCheckBox->checkState() != Qt::Checked){
-        m_voltageGraph->data()->removeBefore(currentTimeKey-range_size);
-        m_currentGraph->data()->removeBefore(currentTimeKey-range_size);
+        m_samples.removeBefore(m_startTimeMs + (int64_t)((currentTimeKey-range_size)*1000.0));
 
         if(this->isVisible()) {
             ui->plotWidget->axisRect(0)->axis(QCPAxis::atBottom)->setRange(currentTimeKey+0.25, range_size, Qt::AlignRight);
@@ -151,18 +183,31 @@ void PlotWindow::updatePlots(){
         }
     }
     else {
-        if(this->isVisible()) {
-            ui->plotWidget->axisRect(0)->axis(QCPAxis::atBottom)->rescale();
-            ui->plotWidget->axisRect(1)->axis(QCPAxis::atBottom)->rescale();
+        if(this->isVisible() && !m_samples.isEmpty()) {
+            QCPRange logged((m_samples.firstTime() - m_startTimeMs)/1000.0, (m_samples.lastTime() - m_startTimeMs)/1000.0);
+            ui->plotWidget->axisRect(0)->axis(QCPAxis::atBottom)->setRange(logged);
+            ui->plotWidget->axisRect(1)->axis(QCPAxis::atBottom)->setRange(logged);
         }
     }
 
     if(this->isVisible()) {
+        QCPAxis *timeAxis = ui->plotWidget->axisRect(1)->axis(QCPAxis::atBottom);
+        int width = ui->plotWidget->axisRect(1)->width();
+        setGraphData(timeAxis->range(), width);
+
         ui->plotWidget->replot(QCustomPlot::rpQueuedReplot);
-        ui->sampleCountLabel->setText(QString("%1 samples").arg(m_voltageGraph->dataCount()));
+        ui->sampleCountLabel->setText(QString("%1 samples (%2 MB)").arg(m_samples.size())
+                                      .arg(m_samples.memoryBytes()/(1024.0*1024.0), 0, 'f', 1));
     }
 }
 
+void PlotWindow::showStatistics(const QString &span, const RollingStats::Result &voltage, const RollingStats::Result &current){
+    m_statisticsLabel->setText(QString("Voltage over %1 (V): %2\nCurrent over %1 (A): %3")
+                               .arg(span)
+                               .arg(PortStatistics::format(voltage))
+                               .arg(PortStatistics::format(current)));
+}
+
 void PlotWindow::handleAxisDoubleClicked(QCPAxis* axis,QCPAxis::SelectablePart,QMouseEvent*){
     QCPAxis* currentGraphVerticalAxis = ui->plotWidget->axisRect(1)->axis(QCPAxis::atLeft);
     if(axis == currentGraphVerticalAxis){
@@ -235,45 +280,15 @@ void PlotWindow::handleVoltageAxisRangeChange(QCPRange,QCPRange){
     ui->plotWidget->axisRect(0)->axis(QCPAxis::atLeft)->setRange(axisRange);
 }
 
+SampleExporter::PortSeries PlotWindow::exportSeries() const {
+    SampleExporter::PortSeries series;
+    series.port = m_port;
+    series.samples = m_samples;
+    return series;
+}
+
+// the export runs on its own thread, so a long log doesn't hold up the plots
 void PlotWindow::on_saveCsvButton_clicked()
 {
-    QString csvFileName = QFileDialog::getSaveFileName(this, tr("Save file as:"),
-                                                       QStandardPaths::writableLocation(QStandardPaths::DesktopLocation),
-                                                       "Comma Separated Value (*.csv);;All files (*.*)" );
-    //QMessageBox::information(this, tr("File name is"), csvFileName);
-
-    QFile csvFile(csvFileName);
-
-    if(csvFileName.isEmpty()){
-        // no file was spec'd or the user canceled the save so bail
-        return;
-    }
-
-    csvFile.open(QIODevice::WriteOnly | QIODevice::Text);
-    if(!csvFile.isOpen()){
-        QMessageBox::information(this, tr("Error"), QString("Couldn't open %1").arg(csvFileName));
-        return;
-    }
-
-    QTextStream csvFileStream(&csvFile);
-
-    // write the header
-    csvFileStream << "Time (s)," \
-                  << "Port " << QString::number(m_port) \
-                  << " Voltage (V),"
-                  << "Port " << QString::number(m_port) \
-                  << " Current (A)" << endl;
-
-    // write the data
-    for(int i=0; i < m_voltageGraph->dataCount(); i++){
-        //fprintf(csvFile, "%.3f,%.6f,%.6f\r\n");
-        csvFileStream << QString::number(m_voltageGraph->data()->at(i)->key, 'f', 3) << ",";
-        csvFileStream << QString::number(m_voltageGraph->data()->at(i)->value, 'f', 3) << ",";
-        csvFileStream << QString::number(m_currentGraph->data()->at(i)->value, 'f', 3) << endl;
-    }
-
-    // close the file
-    csvFileStream.flush();
-    csvFile.close();
-
+    ExportProgressDialog::exportPorts(this, QList<PlotWindow*>() << this, m_startTimeMs);
 }
@@ -2,8 +2,12 @@
 #define PLOTWINDOW_H
 
 #include <QDialog>
+#include <QLabel>
 #include "stemworker.h"
 #include "qcustomplot.h"
+#include "samplestore.h"
+#include "sampleexporter.h"
+#include "rollingstats.h"
 
 
 namespace Ui {
@@ -24,6 +28,15 @@ public slots:
 public:
     explicit PlotWindow(int port, qint64 appStartTime, QWidget *parent = nullptr);
     void setupVandIplots(int port);
+    void addSample(qint64 timestampMs, int32_t microVolts, int32_t microAmps);
+    void clearSamples();
+
+    // the port's rolling statistics over one window, under the plots
+    void showStatistics(const QString &span, const RollingStats::Result &voltage, const RollingStats::Result &current);
+    int port() const { return m_port; }
+
+    // a copy of every sample held, for exporting off the GUI thread
+    SampleExporter::PortSeries exportSeries() const;
     ~PlotWindow();
 
 protected:
@@ -37,7 +50,17 @@ private:
     int m_port;
     QCPGraph *m_voltageGraph;
     QCPGraph *m_currentGraph;
+
+    // every sample lives here, compressed and keyed by ms since the epoch;
+    // the graphs only get what's drawn
+    SampleStore m_samples;
+    std::vector<MinMaxPyramid::Point> m_voltageEnvelope;
+    std::vector<MinMaxPyramid::Point> m_currentEnvelope;
+    QVector<QCPGraphData> m_plotData;
+    void setGraphData(const QCPRange &range, int width);
+    void setGraphData(QCPGraph *graph, const std::vector<MinMaxPyramid::Point> &envelope);
     QFileDialog *m_fileSaveDialog;
+    QLabel *m_statisticsLabel;
     qint64 m_startTimeMs;
 };
 
@@ -0,0 +1,163 @@
+#include "pollscheduler.h"
+#include <QStringList>
+
+PollScheduler::PollScheduler() :
+    m_lastPassMask(0)
+{
+    m_clock.start();
+}
+
+int PollScheduler::addEntity(const QString &name, Task task, int periodMs, Priority priority){
+    Entry entry;
+    entry.name = name;
+    entry.task = task;
+    entry.periodMs = periodMs;
+    entry.priority = priority;
+    entry.deadline = -1;
+    entry.lastRunMs = -1;
+    entry.rate = 0.0;
+    m_entries.append(entry);
+
+    int id = m_entries.size() - 1;
+    if(periodMs >= 0){
+        schedule(id, m_clock.elapsed());
+    }
+    return id;
+}
+
+int PollScheduler::period(int id) const {
+    if(id < 0 || id >= m_entries.size())
+        return OnDemand;
+    return m_entries[id].periodMs;
+}
+
+void PollScheduler::requestRun(int id){
+    if(id < 0 || id >= m_entries.size())
+        return;
+    schedule(id, m_clock.elapsed());
+}
+
+void PollScheduler::requestRunAll(){
+    qint64 now = m_clock.elapsed();
+    for(int id = 0; id < m_entries.size(); id++){
+        schedule(id, now);
+    }
+}
+
+void PollScheduler::schedule(int id, qint64 deadline){
+    Entry &entry = m_entries[id];
+
+    // already queued to run sooner, nothing to do
+    if(entry.deadline >= 0 && entry.deadline <= deadline)
+        return;
+
+    // any older queue item for this entity is now stale and gets skipped when popped
+    entry.deadline = deadline;
+    QueueItem item;
+    item.deadline = deadline;
+    item.priority = entry.priority;
+    item.id = id;
+    m_runQueue.push(item);
+}
+
+int PollScheduler::runDue(){
+    qint64 passStart = m_clock.elapsed();
+    QVector<int> &due = m_due;
+    due.clear();
+
+    // pull everything that is due off the queue first so entities that run
+    // every pass are only rescheduled once the pass is finished
+    while(!m_runQueue.empty() && m_runQueue.top().deadline <= passStart){
+        QueueItem item = m_runQueue.top();
+        m_runQueue.pop();
+
+        if(m_entries[item.id].deadline != item.deadline)
+            continue; // stale
+
+        m_entries[item.id].deadline = -1;
+        due.append(item.id);
+    }
+
+    m_lastPassMask = 0;
+    for(int id: due){
+        if(id < 64) m_lastPassMask |= (uint64_t)1 << id;
+    }
+
+    for(int id: due){
+        Entry &entry = m_entries[id];
+        qint64 now = m_clock.elapsed();
+
+        if(entry.lastRunMs >= 0 && now > entry.lastRunMs){
+            double instantRate = 1000.0/(now - entry.lastRunMs);
+            entry.rate = entry.rate > 0.0 ? 0.8*entry.rate + 0.2*instantRate : instantRate;
+        }
+        entry.lastRunMs = now;
+
+        if(m_observer){
+            qint64 startNs = m_clock.nsecsElapsed();
+            entry.task();
+            m_observer(id, m_clock.nsecsElapsed() - startNs);
+        }
+        else {
+            entry.task();
+        }
+    }
+
+    // queue the next run of the periodic entities
+    for(int id: due){
+        Entry &entry = m_entries[id];
+        if(entry.periodMs < 0)
+            continue;
+
+        // stay on the original cadence unless we've fallen a whole period behind
+        qint64 next = entry.lastRunMs + entry.periodMs;
+        if(next < passStart)
+            next = passStart;
+        schedule(id, next);
+    }
+
+    return due.size();
+}
+
+qint64 PollScheduler::msUntilNextDeadline(){
+    // discard stale items so they don't make us wake early
+    while(!m_runQueue.empty() && m_entries[m_runQueue.top().id].deadline != m_runQueue.top().deadline){
+        m_runQueue.pop();
+    }
+
+    if(m_runQueue.empty())
+        return -1;
+
+    qint64 wait = m_runQueue.top().deadline - m_clock.elapsed();
+    return wait > 0 ? wait : 0;
+}
+
+double PollScheduler::effectiveRate(int id) const {
+    if(id < 0 || id >= m_entries.size())
+        return 0.0;
+
+    // an entity that has gone quiet shouldn't keep reporting its old rate
+    const Entry &entry = m_entries[id];
+    if(entry.lastRunMs < 0)
+        return 0.0;
+    qint64 sinceLast = m_clock.elapsed() - entry.lastRunMs;
+    if(entry.rate > 0.0 && sinceLast > 2000.0/entry.rate)
+        return 1000.0/sinceLast;
+    return entry.rate;
+}
+
+QString PollScheduler::rateSummary() const {
+    QStringList lines;
+    for(int id = 0; id < m_entries.size(); id++){
+        QString target;
+        if(m_entries[id].periodMs == EveryPass)     target = "max";
+        else if(m_entries[id].periodMs < 0)         target = "on demand";
+        else                                         target = QString("%1Hz").arg(1000.0/m_entries[id].periodMs, 0, 'f', 1);
+
+        lines << QString("%1: %2Hz (target %3)")
+                 .arg(m_entries[id].name)
+                 .arg(effectiveRate(id), 0, 'f', 1)
+                 .arg(target);
+    }
+    return lines.join("\n");
+}
@@ -0,0 +1,94 @@
+#ifndef POLLSCHEDULER_H
+#define POLLSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+#include <stdint.h>
+
+#include <functional>
+#include <queue>
+#include <vector>
+
+// Runs each registered entity update at its own period from a deadline
+// ordered run queue. A period of 0 runs the entity on every pass (as fast as
+// the link allows); a negative period only runs it when requested.
+class PollScheduler
+{
+public:
+    typedef std::function<void()> Task;
+    typedef std::function<void(int id, qint64 elapsedNs)> RunObserver;
+
+    enum Priority {
+        PriorityHigh = 0,
+        PriorityNormal = 1,
+        PriorityLow = 2,
+    };
+
+    static const int EveryPass = 0;
+    static const int OnDemand = -1;
+
+    PollScheduler();
+
+    int addEntity(const QString &name, Task task, int periodMs, Priority priority);
+    int period(int id) const;
+
+    // schedule an entity (or everything) to run on the next pass
+    void requestRun(int id);
+    void requestRunAll();
+
+    // run every entity whose deadline has passed; returns how many ran
+    int runDue();
+
+    // which entities the last runDue() ran, bit n for entity n (the first 64)
+    uint64_t lastPassMask() const { return m_lastPassMask; }
+
+    // milliseconds until the earliest deadline (0 if something is due now)
+    qint64 msUntilNextDeadline();
+
+    // measured runs per second for an entity
+    double effectiveRate(int id) const;
+    QString rateSummary() const;
+
+    int count() const { return m_entries.size(); }
+    QString name(int id) const { return m_entries[id].name; }
+
+    // called after every entity run with how long it took, for benchmarks
+    // and instrumentation; costs nothing when unset
+    void setRunObserver(RunObserver observer) { m_observer = observer; }
+
+private:
+    struct Entry {
+        QString name;
+        Task task;
+        int periodMs;
+        Priority priority;
+        qint64 deadline;      // -1 when not queued
+        qint64 lastRunMs;     // -1 before the first run
+        double rate;          // smoothed runs per second
+    };
+
+    struct QueueItem {
+        qint64 deadline;
+        int priority;
+        int id;
+        // std::priority_queue is a max-heap, so "less" means "runs later"
+        bool operator<(const QueueItem &other) const {
+            if(deadline != other.deadline) return deadline > other.deadline;
+            if(priority != other.priority) return priority > other.priority;
+            return id > other.id;
+        }
+    };
+
+    void schedule(int id, qint64 deadline);
+
+    QVector<Entry> m_entries;
+    QVector<int> m_due;             // reused by runDue() so a pass doesn't allocate
+    uint64_t m_lastPassMask;
+    RunObserver m_observer;
+    std::priority_queue<QueueItem, std::vector<QueueItem> > m_runQueue;
+    QElapsedTimer m_clock;
+};
+
+#endif // POLLSCHEDULER_H
@@ -0,0 +1,125 @@
+#include "ratecontroller.h"
+
+// never back off below this
+#define RATE_MIN_HZ 1.0
+// a cycle this many times slower than the best case means the link is saturated
+#define RATE_SATURATION_FACTOR 2.0
+// ...as long as it's also this much slower; below that it's scheduling noise
+#define RATE_SATURATION_MIN_EXCESS_MS 0.5
+// sets of reads remembered; the scheduler only makes a handful
+#define RATE_MAX_PROFILES 64
+// how much of the distance back to the target is recovered per clean cycle
+#define RATE_RECOVERY_STEP 0.05
+
+RateController::RateController() :
+    m_targetRate(0.0),
+    m_cycleStartNs(-1),
+    m_lastCycleStartNs(-1),
+    m_cycleMs(0.0),
+    m_achievedRate(0.0),
+    m_allowedRate(0.0)
+{
+    m_clock.start();
+}
+
+void RateController::setTargetRate(double hz){
+    m_targetRate.store(hz > 0.0 ? hz : 0.0);
+}
+
+void RateController::cycleStarted(){
+    qint64 now = m_clock.nsecsElapsed();
+
+    if(m_lastCycleStartNs >= 0 && now > m_lastCycleStartNs){
+        double instantRate = 1e9/(now - m_lastCycleStartNs);
+        m_achievedRate = m_achievedRate > 0.0 ? 0.8*m_achievedRate + 0.2*instantRate : instantRate;
+    }
+    m_lastCycleStartNs = now;
+    m_cycleStartNs = now;
+}
+
+void RateController::cycleFinished(int errors, uint64_t work){
+    if(m_cycleStartNs < 0)
+        return;
+
+    double duration = (m_clock.nsecsElapsed() - m_cycleStartNs)/1e6;
+    m_cycleMs = m_cycleMs > 0.0 ? 0.8*m_cycleMs + 0.2*duration : duration;
+
+    if(m_profiles.size() >= RATE_MAX_PROFILES && !m_profiles.count(work)){
+        m_profiles.clear();
+    }
+    auto found = m_profiles.find(work);
+    bool saturated = false;
+    if(found == m_profiles.end()){
+        CycleProfile profile;
+        profile.cycleMs = duration;
+        profile.bestMs = duration;
+        m_profiles[work] = profile;
+    }
+    else {
+        CycleProfile &profile = found->second;
+        profile.cycleMs = 0.8*profile.cycleMs + 0.2*duration;
+
+        // track the best case, letting it drift up so one lucky cycle
+        // doesn't pin it forever
+        if(duration < profile.bestMs)   profile.bestMs = duration;
+        else                            profile.bestMs *= 1.001;
+
+        saturated = profile.cycleMs > RATE_SATURATION_FACTOR*profile.bestMs
+                    && profile.cycleMs - profile.bestMs > RATE_SATURATION_MIN_EXCESS_MS;
+    }
+
+    if(errors > 0 || saturated){
+        // multiplicative decrease from wherever we are now
+        double from = m_allowedRate > 0.0 ? m_allowedRate : m_achievedRate;
+        if(from <= 0.0) from = effectiveRate();
+        m_allowedRate = from/2.0 < RATE_MIN_HZ ? RATE_MIN_HZ : from/2.0;
+    }
+    else if(m_allowedRate > 0.0){
+        // creep back up, and stop backing off once we're at the target
+        double ceiling = targetRate() > 0.0 ? targetRate() : (m_cycleMs > 0.0 ? 1000.0/m_cycleMs : 0.0);
+        m_allowedRate += (ceiling - m_allowedRate)*RATE_RECOVERY_STEP + 0.1;
+        if(ceiling <= 0.0 || m_allowedRate >= ceiling){
+            m_allowedRate = 0.0;
+        }
+    }
+}
+
+double RateController::effectiveRate() const {
+    double target = targetRate();
+    if(m_allowedRate > 0.0 && (target <= 0.0 || m_allowedRate < target))
+        return m_allowedRate;
+    return target;
+}
+
+int RateController::nextDelayMs() const {
+    double rate = effectiveRate();
+    if(rate <= 0.0 || m_cycleStartNs < 0)
+        return 0;
+
+    // wait out whatever is left of this cycle's period
+    double sinceStartMs = (m_clock.nsecsElapsed() - m_cycleStartNs)/1e6;
+    double delay = 1000.0/rate - sinceStartMs;
+    return delay > 0.0 ? (int)(delay + 0.5) : 0;
+}
+
+double RateController::achievedRate() const {
+    // an idle controller shouldn't keep reporting its old rate
+    if(m_lastCycleStartNs < 0)
+        return 0.0;
+    double sinceLastMs = (m_clock.nsecsElapsed() - m_lastCycleStartNs)/1e6;
+    if(m_achievedRate > 0.0 && sinceLastMs > 2000.0/m_achievedRate)
+        return 1000.0/sinceLastMs;
+    return m_achievedRate;
+}
+
+QString RateController::summary() const {
+    QString target = targetRate() > 0.0 ? QString("%1Hz").arg(targetRate(), 0, 'f', 1) : QString("max");
+    QString line = QString("poll: %1Hz (target %2, cycle %3ms)")
+            .arg(achievedRate(), 0, 'f', 1)
+            .arg(target)
+            .arg(m_cycleMs, 0, 'f', 1);
+    if(isBackingOff()){
+        line += QString(", backing off to %1Hz").arg(m_allowedRate, 0, 'f', 1);
+    }
+    return line;
+}
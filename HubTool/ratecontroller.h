@@ -0,0 +1,62 @@
+#ifndef RATECONTROLLER_H
+#define RATECONTROLLER_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+
+// Decides when the next poll cycle starts. It holds the configured target
+// rate when the link keeps up, and backs off on its own when cycles come back
+// with errors or take much longer than the link's best case (a saturated
+// link). The backoff halves the allowed rate and then creeps back up towards
+// the target while cycles stay clean.
+//
+// Cycles don't all do the same reads (the config entities only run once a
+// second, say), so the best case is kept per set of reads, and a cycle is
+// only compared with cycles that did the same ones.
+class RateController
+{
+public:
+    RateController();
+
+    // 0 polls as fast as the link allows; safe to call from any thread
+    void setTargetRate(double hz);
+    double targetRate() const { return m_targetRate.load(); }
+
+    // bracket each poll cycle; errors is how many requests failed in it, and
+    // work says which reads it did (any value, equal for the same reads)
+    void cycleStarted();
+    void cycleFinished(int errors, uint64_t work);
+
+    // how long to wait after the cycle that just finished
+    int nextDelayMs() const;
+
+    double achievedRate() const;
+    double allowedRate() const { return m_allowedRate; }    // 0 when not backing off
+    double cycleTimeMs() const { return m_cycleMs; }
+    bool isBackingOff() const { return m_allowedRate > 0.0; }
+    QString summary() const;
+
+private:
+    double effectiveRate() const;
+
+    // cycles that did the same reads
+    struct CycleProfile {
+        double cycleMs;         // smoothed duration
+        double bestMs;          // slowly forgotten fastest, the link's best case
+    };
+
+    std::atomic<double> m_targetRate;
+    QElapsedTimer m_clock;
+    qint64 m_cycleStartNs;
+    qint64 m_lastCycleStartNs;
+    double m_cycleMs;           // smoothed cycle duration, whatever the reads
+    std::map<uint64_t, CycleProfile> m_profiles;
+    double m_achievedRate;      // smoothed cycles per second
+    double m_allowedRate;       // backoff ceiling, 0 when not backing off
+};
+
+#endif // RATECONTROLLER_H
@@ -0,0 +1,315 @@
+#include "rollingstats.h"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ROLLING_STATS_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ROLLING_STATS_NEON
+#endif
+
+namespace {
+
+inline int64_t floorDiv(int64_t value, int64_t divisor){
+    return value >= 0 ? value/divisor : -((-value + divisor - 1)/divisor);
+}
+
+}
+
+RollingStats::RollingStats(int64_t spanMs, int32_t binWidth) :
+    m_spanMs(std::max(spanMs, (int64_t)Panes)),
+    m_paneMs(m_spanMs/Panes),
+    m_binWidth(std::max(binWidth, 1)),
+    m_openIndex(INT64_MIN)
+{
+}
+
+void RollingStats::clear(){
+    m_panes.clear();
+    m_bins.clear();
+    m_openIndex = INT64_MIN;
+    m_open.clear();
+    m_openBins.clear();
+}
+
+int32_t RollingStats::binFor(int32_t value) const {
+    return (int32_t)floorDiv(value, m_binWidth);
+}
+
+void RollingStats::add(int64_t timeMs, int32_t value){
+    advance(floorDiv(timeMs, m_paneMs));
+    m_open.push_back(value);
+    m_openBins[binFor(value)]++;
+}
+
+// moves the open pane on to paneIndex, closing the old one, and lets go of
+// the panes that have left the span
+void RollingStats::advance(int64_t paneIndex){
+    if(paneIndex > m_openIndex){
+        closePane();
+        m_openIndex = paneIndex;
+    }
+
+    while(!m_panes.empty() && m_panes.front().index <= m_openIndex - Panes){
+        for(const Bin &bin: m_panes.front().bins){
+            std::map<int32_t, uint32_t>::iterator it = m_bins.find(bin.bin);
+            if(it != m_bins.end() && (it->second -= bin.count) == 0){
+                m_bins.erase(it);
+            }
+        }
+        m_panes.pop_front();
+    }
+}
+
+void RollingStats::closePane(){
+    if(m_open.empty())
+        return;
+
+    // deviations from the first sample, so the squares stay small
+    Reduction reduction;
+    double reference = m_open.front();
+    reduce(m_open.data(), m_open.size(), reference, &reduction);
+
+    Pane pane;
+    pane.index = m_openIndex;
+    pane.count = reduction.count;
+    pane.min = reduction.min;
+    pane.max = reduction.max;
+    pane.mean = reference + reduction.sum/reduction.count;
+    pane.m2 = std::max(0.0, reduction.sumSquares - reduction.sum*reduction.sum/reduction.count);
+    pane.bins.reserve(m_openBins.size());
+    for(const std::pair<const int32_t, uint32_t> &bin: m_openBins){
+        Bin b = {bin.first, bin.second};
+        pane.bins.push_back(b);
+        m_bins[bin.first] += bin.second;
+    }
+    m_panes.push_back(std::move(pane));
+
+    m_open.clear();
+    m_openBins.clear();
+}
+
+// Panes are merged with Chan's pairwise update, which keeps the variance
+// accurate when the mean is large next to the spread.
+RollingStats::Result RollingStats::result(int64_t nowMs){
+    advance(floorDiv(nowMs, m_paneMs));
+
+    Result result = {0, 0, 0, 0.0, 0.0, 0.0, 0, 0};
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    Pane open;
+    open.count = 0;
+    if(!m_open.empty()){
+        Reduction reduction;
+        double reference = m_open.front();
+        reduce(m_open.data(), m_open.size(), reference, &reduction);
+        open.count = reduction.count;
+        open.min = reduction.min;
+        open.max = reduction.max;
+        open.mean = reference + reduction.sum/reduction.count;
+        open.m2 = std::max(0.0, reduction.sumSquares - reduction.sum*reduction.sum/reduction.count);
+    }
+
+    size_t paneCount = m_panes.size() + (open.count ? 1 : 0);
+    for(size_t i = 0; i < paneCount; i++){
+        const Pane &pane = (i < m_panes.size()) ? m_panes[i] : open;
+        if(result.count == 0){
+            result.min = pane.min;
+            result.max = pane.max;
+        }
+        else {
+            result.min = std::min(result.min, pane.min);
+            result.max = std::max(result.max, pane.max);
+        }
+
+        double count = (double)(result.count + pane.count);
+        double delta = pane.mean - mean;
+        m2 += pane.m2 + delta*delta*result.count*pane.count/count;
+        mean += delta*pane.count/count;
+        result.count += pane.count;
+    }
+    if(result.count == 0)
+        return result;
+
+    result.mean = mean;
+    result.stddev = sqrt(m2/result.count);
+    result.rms = sqrt(mean*mean + m2/result.count);
+
+    // the two histograms walked together, lowest bin first
+    uint64_t rank95 = (uint64_t)ceil(0.95*result.count);
+    uint64_t rank99 = (uint64_t)ceil(0.99*result.count);
+    uint64_t seen = 0;
+    bool have95 = false;
+    std::map<int32_t, uint32_t>::const_iterator closed = m_bins.begin();
+    std::map<int32_t, uint32_t>::const_iterator opened = m_openBins.begin();
+    while(closed != m_bins.end() || opened != m_openBins.end()){
+        int32_t bin;
+        if(opened == m_openBins.end() || (closed != m_bins.end() && closed->first < opened->first)){
+            bin = closed->first;
+            seen += (closed++)->second;
+        }
+        else if(closed == m_bins.end() || opened->first < closed->first){
+            bin = opened->first;
+            seen += (opened++)->second;
+        }
+        else {
+            bin = closed->first;
+            seen += (closed++)->second + (opened++)->second;
+        }
+
+        int64_t middle = (int64_t)bin*m_binWidth + m_binWidth/2;
+        int32_t value = (int32_t)std::max((int64_t)result.min, std::min((int64_t)result.max, middle));
+        if(!have95 && seen >= rank95){
+            result.p95 = value;
+            have95 = true;
+        }
+        if(seen >= rank99){
+            result.p99 = value;
+            break;
+        }
+    }
+    return result;
+}
+
+// Four samples a step with SSE2 or NEON; the sums are doubles, which hold
+// the deviations of a pane's worth of samples exactly enough.
+void RollingStats::reduce(const int32_t *values, size_t count, double reference, Reduction *out){
+    out->count = count;
+    out->min = count ? values[0] : 0;
+    out->max = out->min;
+    out->sum = 0.0;
+    out->sumSquares = 0.0;
+
+    size_t i = 0;
+#if defined(ROLLING_STATS_SSE2)
+    if(count >= 4){
+        __m128i minimum = _mm_loadu_si128((const __m128i*)values);
+        __m128i maximum = minimum;
+        __m128d ref = _mm_set1_pd(reference);
+        __m128d sumLow = _mm_setzero_pd(), sumHigh = _mm_setzero_pd();
+        __m128d squaresLow = _mm_setzero_pd(), squaresHigh = _mm_setzero_pd();
+        for(; i + 4 <= count; i += 4){
+            __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+
+            // no 32 bit min/max before SSE4.1, so pick with the compare masks
+            __m128i less = _mm_cmplt_epi32(v, minimum);
+            minimum = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, minimum));
+            __m128i greater = _mm_cmpgt_epi32(v, maximum);
+            maximum = _mm_or_si128(_mm_and_si128(greater, v), _mm_andnot_si128(greater, maximum));
+
+            __m128d low = _mm_sub_pd(_mm_cvtepi32_pd(v), ref);
+            __m128d high = _mm_sub_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), ref);
+            sumLow = _mm_add_pd(sumLow, low);
+            sumHigh = _mm_add_pd(sumHigh, high);
+            squaresLow = _mm_add_pd(squaresLow, _mm_mul_pd(low, low));
+            squaresHigh = _mm_add_pd(squaresHigh, _mm_mul_pd(high, high));
+        }
+
+        int32_t minimums[4], maximums[4];
+        double sums[2], squares[2];
+        _mm_storeu_si128((__m128i*)minimums, minimum);
+        _mm_storeu_si128((__m128i*)maximums, maximum);
+        _mm_storeu_pd(sums, _mm_add_pd(sumLow, sumHigh));
+        _mm_storeu_pd(squares, _mm_add_pd(squaresLow, squaresHigh));
+        for(int lane = 0; lane < 4; lane++){
+            out->min = std::min(out->min, minimums[lane]);
+            out->max = std::max(out->max, maximums[lane]);
+        }
+        out->sum = sums[0] + sums[1];
+        out->sumSquares = squares[0] + squares[1];
+    }
+#elif defined(ROLLING_STATS_NEON)
+    if(count >= 4){
+        int32x4_t minimum = vld1q_s32(values);
+        int32x4_t maximum = minimum;
+        float64x2_t ref = vdupq_n_f64(reference);
+        float64x2_t sumLow = vdupq_n_f64(0.0), sumHigh = vdupq_n_f64(0.0);
+        float64x2_t squaresLow = vdupq_n_f64(0.0), squaresHigh = vdupq_n_f64(0.0);
+        for(; i + 4 <= count; i += 4){
+            int32x4_t v = vld1q_s32(values + i);
+            minimum = vminq_s32(minimum, v);
+            maximum = vmaxq_s32(maximum, v);
+
+            float64x2_t low = vsubq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(v))), ref);
+            float64x2_t high = vsubq_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(v))), ref);
+            sumLow = vaddq_f64(sumLow, low);
+            sumHigh = vaddq_f64(sumHigh, high);
+            squaresLow = vfmaq_f64(squaresLow, low, low);
+            squaresHigh = vfmaq_f64(squaresHigh, high, high);
+        }
+
+        out->min = std::min(out->min, vminvq_s32(minimum));
+        out->max = std::max(out->max, vmaxvq_s32(maximum));
+        out->sum = vaddvq_f64(vaddq_f64(sumLow, sumHigh));
+        out->sumSquares = vaddvq_f64(vaddq_f64(squaresLow, squaresHigh));
+    }
+#endif
+
+    for(; i < count; i++){
+        out->min = std::min(out->min, values[i]);
+        out->max = std::max(out->max, values[i]);
+        double deviation = values[i] - reference;
+        out->sum += deviation;
+        out->sumSquares += deviation*deviation;
+    }
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// PortStatistics
+
+PortStatistics::PortStatistics(const std::vector<int64_t> &spansMs){
+    for(int64_t span: spansMs){
+        m_voltage.push_back(RollingStats(span));
+        m_current.push_back(RollingStats(span));
+    }
+}
+
+std::vector<int64_t> PortStatistics::defaultSpans(){
+    std::vector<int64_t> spans;
+    spans.push_back(1000);
+    spans.push_back(60*1000);
+    spans.push_back(60*60*1000);
+    return spans;
+}
+
+void PortStatistics::add(int64_t timeMs, int32_t microVolts, int32_t microAmps){
+    for(size_t window = 0; window < m_voltage.size(); window++){
+        m_voltage[window].add(timeMs, microVolts);
+        m_current[window].add(timeMs, microAmps);
+    }
+}
+
+void PortStatistics::clear(){
+    for(size_t window = 0; window < m_voltage.size(); window++){
+        m_voltage[window].clear();
+        m_current[window].clear();
+    }
+}
+
+QString PortStatistics::spanName(int64_t spanMs){
+    if(spanMs % (60*60*1000) == 0)
+        return QString("%1 h").arg(spanMs/(60*60*1000));
+    if(spanMs % (60*1000) == 0)
+        return QString("%1 min").arg(spanMs/(60*1000));
+    if(spanMs % 1000 == 0)
+        return QString("%1 s").arg(spanMs/1000);
+    return QString("%1 ms").arg(spanMs);
+}
+
+QString PortStatistics::format(const RollingStats::Result &result){
+    if(result.count == 0)
+        return QString("no samples");
+
+    return QString("min %1 max %2 mean %3 rms %4 sd %5 p95 %6 p99 %7")
+            .arg(QString::number(result.min/1000000.0, 'f', 3))
+            .arg(QString::number(result.max/1000000.0, 'f', 3))
+            .arg(QString::number(result.mean/1000000.0, 'f', 3))
+            .arg(QString::number(result.rms/1000000.0, 'f', 3))
+            .arg(QString::number(result.stddev/1000000.0, 'f', 3))
+            .arg(QString::number(result.p95/1000000.0, 'f', 3))
+            .arg(QString::number(result.p99/1000000.0, 'f', 3));
+}
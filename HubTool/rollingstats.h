@@ -0,0 +1,125 @@
+#ifndef ROLLINGSTATS_H
+#define ROLLINGSTATS_H
+
+#include <QString>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+// Min, max, mean, RMS, standard deviation and p95/p99 of a series over the
+// last spanMs, kept up to date as samples arrive.
+//
+// The span is split into Panes panes by time. Samples go into the open
+// pane's buffer as they come; when time moves on to the next pane the buffer
+// is reduced, in one pass with SIMD where the CPU has it, to the pane's
+// count, min, max, mean and sum of squared deviations, and the samples are
+// dropped. A result combines the panes still in the span with the open one,
+// so the window slides a pane (2% of the span) at a time, and asking costs
+// the same however many samples it covers.
+//
+// Percentiles come from a histogram of the whole span with bins binWidth
+// wide, added to as panes close and taken from as they leave the span.
+// They're the middle of the bin, so within binWidth/2 of the true value.
+class RollingStats
+{
+public:
+    static const int Panes = 50;
+
+    struct Result {
+        uint64_t count;
+        int32_t min;
+        int32_t max;
+        double mean;
+        double rms;
+        double stddev;
+        int32_t p95;
+        int32_t p99;
+    };
+
+    // min and max, and the sum and sum of squares of (value - reference)
+    struct Reduction {
+        uint64_t count;
+        int32_t min;
+        int32_t max;
+        double sum;
+        double sumSquares;
+    };
+
+    // spanMs has to be at least Panes
+    explicit RollingStats(int64_t spanMs, int32_t binWidth = 1000);
+
+    // times have to be in increasing order
+    void add(int64_t timeMs, int32_t value);
+    void clear();
+
+    // the last spanMs up to nowMs
+    Result result(int64_t nowMs);
+    int64_t spanMs() const { return m_spanMs; }
+
+    static void reduce(const int32_t *values, size_t count, double reference, Reduction *out);
+
+private:
+    struct Bin {
+        int32_t bin;
+        uint32_t count;
+    };
+
+    struct Pane {
+        int64_t index;
+        uint64_t count;
+        int32_t min;
+        int32_t max;
+        double mean;
+        double m2;                          // sum of squared deviations from the mean
+        std::vector<Bin> bins;
+    };
+
+    void advance(int64_t paneIndex);
+    void closePane();
+    int32_t binFor(int32_t value) const;
+
+    int64_t m_spanMs;
+    int64_t m_paneMs;
+    int32_t m_binWidth;
+
+    std::deque<Pane> m_panes;               // closed, oldest first
+    std::map<int32_t, uint32_t> m_bins;     // of every closed pane in m_panes
+
+    int64_t m_openIndex;
+    std::vector<int32_t> m_open;
+    std::map<int32_t, uint32_t> m_openBins;
+};
+
+// One port's voltage and current statistics over each of its windows, by
+// default 1 s, 1 min and 1 h.
+class PortStatistics
+{
+public:
+    explicit PortStatistics(const std::vector<int64_t> &spansMs = defaultSpans());
+
+    static std::vector<int64_t> defaultSpans();
+
+    void add(int64_t timeMs, int32_t microVolts, int32_t microAmps);
+    void clear();
+
+    int windowCount() const { return (int)m_voltage.size(); }
+    int64_t spanMs(int window) const { return m_voltage[window].spanMs(); }
+    RollingStats::Result voltage(int window, int64_t nowMs) { return m_voltage[window].result(nowMs); }
+    RollingStats::Result current(int window, int64_t nowMs) { return m_current[window].result(nowMs); }
+
+    // "1 s", "1 min", "1 h"
+    static QString spanName(int64_t spanMs);
+
+    // "min 5.012 max 5.020 mean 5.015 rms 5.015 sd 0.002 p95 5.019 p99 5.020", from
+    // uV or uA in V or A
+    static QString format(const RollingStats::Result &result);
+
+private:
+    std::vector<RollingStats> m_voltage;
+    std::vector<RollingStats> m_current;
+};
+
+#endif // ROLLINGSTATS_H
@@ -0,0 +1,229 @@
+#include "sampleexporter.h"
+
+#include <QFile>
+
+#include <string.h>
+
+#define SAMPLE_EXPORT_MAGIC "HUBEXP01"
+#define SAMPLE_EXPORT_VERSION 1
+#define SAMPLE_EXPORT_MISSING INT32_MIN
+
+// rows are built up in memory and written this many bytes at a time
+#define SAMPLE_EXPORT_BUFFER_BYTES (1024*1024)
+// how often the cancel flag and progress are looked at
+#define SAMPLE_EXPORT_BATCH_ROWS 4096
+
+namespace {
+
+struct BinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t ports;
+    uint8_t port[8];
+    uint64_t rows;
+    int64_t startUs;
+};
+
+// value/10^decimals with exactly that many decimals, without going through
+// a double or the locale
+char* writeFixed(char *out, int64_t value, int decimals){
+    if(value < 0){
+        *out++ = '-';
+        value = -value;
+    }
+
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = '0' + (char)(value % 10);
+        value /= 10;
+    } while(value != 0 || count <= decimals);
+
+    for(int i = count - 1; i >= 0; i--){
+        *out++ = digits[i];
+        if(i == decimals && decimals > 0){
+            *out++ = '.';
+        }
+    }
+    return out;
+}
+
+}
+
+SampleExporter::SampleExporter(const QString &path, Format format, qint64 startMs, QObject *parent) :
+    QObject(parent),
+    m_path(path),
+    m_format(format),
+    m_startMs(startMs),
+    m_canceled(false)
+{
+}
+
+void SampleExporter::addPort(PortSeries &&series){
+    if(m_ports.size() < 8){
+        m_ports.push_back(std::move(series));
+    }
+}
+
+SampleExporter::Format SampleExporter::formatForPath(const QString &path){
+    return path.endsWith(".hubexp", Qt::CaseInsensitive) ? Binary : Csv;
+}
+
+void SampleExporter::run(){
+    QString error;
+    bool ok = write(&error);
+
+    if(m_canceled.load()){
+        QFile::remove(m_path);
+        emit finished(false, QString("Export to %1 canceled").arg(m_path));
+        return;
+    }
+    emit finished(ok, ok ? QString("Exported to %1").arg(m_path) : error);
+}
+
+// Walks every port's samples together, oldest first, taking one row per
+// distinct time.
+bool SampleExporter::write(QString *error){
+    QFile file(m_path);
+    QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Truncate;
+    if(m_format == Csv){
+        mode |= QIODevice::Text;
+    }
+    if(!file.open(mode)){
+        *error = QString("Couldn't open %1: %2").arg(m_path).arg(file.errorString());
+        return false;
+    }
+
+    size_t portCount = m_ports.size();
+    uint64_t totalSamples = 0;
+    std::vector<SampleStore::Reader> readers;
+    for(const PortSeries &series: m_ports){
+        totalSamples += series.samples.size();
+        readers.push_back(SampleStore::Reader(series.samples));
+    }
+
+    std::vector<char> buffer(SAMPLE_EXPORT_BUFFER_BYTES + 1024);
+    char *out = buffer.data();
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    if(m_format == Binary){
+        memcpy(header.magic, SAMPLE_EXPORT_MAGIC, sizeof(header.magic));
+        header.version = SAMPLE_EXPORT_VERSION;
+        header.ports = (uint32_t)portCount;
+        for(size_t p = 0; p < portCount; p++){
+            header.port[p] = (uint8_t)m_ports[p].port;
+        }
+        header.startUs = m_startMs*1000;
+        memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+    }
+    else {
+        QByteArray titles("Time (s)");
+        for(const PortSeries &series: m_ports){
+            titles += QString(",Port %1 Voltage (V),Port %1 Current (A)").arg(series.port).toLatin1();
+        }
+        titles += '\n';
+        memcpy(out, titles.constData(), titles.size());
+        out += titles.size();
+    }
+
+    // each port's next sample, if it has one left
+    std::vector<SampleStore::Sample> next(portCount);
+    std::vector<bool> pending(portCount);
+    for(size_t p = 0; p < portCount; p++){
+        pending[p] = readers[p].next(&next[p]);
+    }
+
+    uint64_t rows = 0;
+    uint64_t written = 0;
+    int lastPercent = -1;
+
+    while(true){
+        // the earliest time any port still has
+        bool any = false;
+        int64_t time = 0;
+        for(size_t p = 0; p < portCount; p++){
+            if(pending[p] && (!any || next[p].time < time)){
+                time = next[p].time;
+                any = true;
+            }
+        }
+        if(!any)
+            break;
+
+        if(m_format == Binary){
+            int64_t timeUs = (time - m_startMs)*1000;
+            memcpy(out, &timeUs, sizeof(timeUs));
+            out += sizeof(timeUs);
+        }
+        else {
+            out = writeFixed(out, time - m_startMs, 3);
+        }
+
+        for(size_t p = 0; p < portCount; p++){
+            bool has = pending[p] && next[p].time == time;
+            int32_t microVolts = has ? next[p].microVolts : SAMPLE_EXPORT_MISSING;
+            int32_t microAmps = has ? next[p].microAmps : SAMPLE_EXPORT_MISSING;
+            if(has){
+                pending[p] = readers[p].next(&next[p]);
+                written++;
+            }
+
+            if(m_format == Binary){
+                // voltages first, then currents
+                memcpy(out + p*sizeof(int32_t), &microVolts, sizeof(int32_t));
+                memcpy(out + (portCount + p)*sizeof(int32_t), &microAmps, sizeof(int32_t));
+            }
+            else {
+                *out++ = ',';
+                if(has) out = writeFixed(out, microVolts, 6);
+                *out++ = ',';
+                if(has) out = writeFixed(out, microAmps, 6);
+            }
+        }
+        if(m_format == Binary){
+            out += 2*portCount*sizeof(int32_t);
+        }
+        else {
+            *out++ = '\n';
+        }
+        rows++;
+
+        if(out - buffer.data() >= SAMPLE_EXPORT_BUFFER_BYTES){
+            if(file.write(buffer.data(), out - buffer.data()) != out - buffer.data()){
+                *error = QString("Error writing %1: %2").arg(m_path).arg(file.errorString());
+                return false;
+            }
+            out = buffer.data();
+        }
+
+        if(rows % SAMPLE_EXPORT_BATCH_ROWS == 0){
+            if(m_canceled.load())
+                return false;
+            int percent = (int)(written*100/totalSamples);
+            if(percent != lastPercent){
+                lastPercent = percent;
+                emit progress(percent);
+            }
+        }
+    }
+
+    if(file.write(buffer.data(), out - buffer.data()) != out - buffer.data()){
+        *error = QString("Error writing %1: %2").arg(m_path).arg(file.errorString());
+        return false;
+    }
+
+    // the row count is only known now
+    if(m_format == Binary){
+        header.rows = rows;
+        if(!file.seek(0) || file.write((const char*)&header, sizeof(header)) != sizeof(header)){
+            *error = QString("Error writing %1: %2").arg(m_path).arg(file.errorString());
+            return false;
+        }
+    }
+
+    file.close();
+    emit progress(100);
+    return true;
+}
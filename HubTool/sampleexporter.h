@@ -0,0 +1,76 @@
+#ifndef SAMPLEEXPORTER_H
+#define SAMPLEEXPORTER_H
+
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+#include "samplestore.h"
+
+// Writes the plotted samples of one or more ports to a single file, one row
+// per point in time with every port's voltage and current side by side. Meant
+// to be moved to a thread of its own and run(); it works from its own copy of
+// the (compressed) samples, decoding them a block at a time as it writes, so
+// the plots carry on meanwhile.
+//
+// CSV rows are "time,v0,i0,v1,i1,..." in seconds, volts and amps, with empty
+// fields where a port has no sample at that time.
+//
+// Binary files, little endian:
+//   header, 40 bytes:
+//     char magic[8]        "HUBEXP01"
+//     uint32 version       1
+//     uint32 ports
+//     uint8 port[8]        port number of each column pair
+//     uint64 rows
+//     int64 startUs        since the epoch, what the row times count from
+//   rows:
+//     int64 timeUs         since startUs
+//     int32 microVolts[ports], int32 microAmps[ports]
+//                          INT32_MIN where a port has no sample
+class SampleExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format { Csv, Binary };
+
+    struct PortSeries {
+        int port;
+        SampleStore samples;                // timed in ms since the epoch
+    };
+
+    SampleExporter(const QString &path, Format format, qint64 startMs, QObject *parent = nullptr);
+
+    // call before run()
+    void addPort(PortSeries &&series);
+
+    // safe from any thread; run() stops at the next row batch and removes the file
+    void cancel() { m_canceled.store(true); }
+
+    QString path() const { return m_path; }
+
+    // .hubexp is binary, anything else CSV
+    static Format formatForPath(const QString &path);
+
+signals:
+    void progress(int percent);
+    void finished(bool ok, QString message);
+
+public slots:
+    void run();
+
+private:
+    bool write(QString *error);
+
+    QString m_path;
+    Format m_format;
+    qint64 m_startMs;
+    std::vector<PortSeries> m_ports;
+    std::atomic<bool> m_canceled;
+};
+
+#endif // SAMPLEEXPORTER_H
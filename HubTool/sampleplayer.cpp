@@ -0,0 +1,267 @@
+#include "sampleplayer.h"
+
+#include <QDateTime>
+
+#include <string.h>
+
+#include "BrainStem2/aProtocoldefs.h"
+
+#define PLAYER_TICK_MS 10
+#define PLAYER_POSITION_INTERVAL_US 100000
+
+SamplePlayer::SamplePlayer(QObject *parent) :
+    QObject(parent),
+    m_timer(nullptr),
+    m_isOpen(false),
+    m_playing(false),
+    m_speed(1),
+    m_chunk(0),
+    m_next(0),
+    m_chunkRate(0),
+    m_clockEpochMs(0),
+    m_anchorUs(0),
+    m_anchorClockUs(0),
+    m_positionUs(0),
+    m_positionSentUs(0),
+    m_sendEverything(true)
+{
+    memset(&m_snapshot, 0, sizeof(m_snapshot));
+}
+
+void SamplePlayer::open(QString path){
+    close();
+
+    // made here so it belongs to the player's thread
+    if(!m_timer){
+        m_timer = new QTimer(this);
+        m_timer->setInterval(PLAYER_TICK_MS);
+        connect(m_timer, SIGNAL(timeout()), this, SLOT(tick()));
+    }
+    if(!m_clock.isValid()){
+        m_clock.start();
+        m_clockEpochMs = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    if(!m_file.open(path)){
+        emit opened(false, QString("Error opening %1: %2").arg(path).arg(m_file.errorString()), 0, 0);
+        return;
+    }
+    if(m_file.chunks().empty()){
+        m_file.close();
+        emit opened(false, QString("%1 has no samples in it").arg(path), 0, 0);
+        return;
+    }
+
+    memset(&m_snapshot, 0, sizeof(m_snapshot));
+    m_snapshot.serialNumber = m_file.serialNumber();
+    m_snapshot.model = m_file.model();
+    m_snapshot.numUSB = (uint8_t)m_file.numPorts();
+    m_snapshot.connectionState = 0;                 // ConnectionMonitor::Connected
+    m_snapshot.lastReconnectMs = -1;
+    m_isOpen = true;
+
+    qint64 firstUs = m_file.chunks().front().firstUs;
+    qint64 lastUs = m_file.chunks().back().lastUs;
+    QString serial = QString("%1").arg(m_file.serialNumber(), 8, 16, QChar('0')).toUpper();
+    emit opened(true, QString("Playing back %1, %2 samples from hub %3").arg(path).arg(m_file.sampleCount()).arg(serial),
+                firstUs, lastUs);
+    seek(firstUs);
+}
+
+void SamplePlayer::close(){
+    pause();
+    m_isOpen = false;
+    m_samples.clear();
+    m_file.close();
+}
+
+void SamplePlayer::play(){
+    if(!m_isOpen || m_playing)
+        return;
+
+    // played to the end, so start again
+    if(m_next >= m_samples.size() && m_chunk + 1 >= m_file.chunks().size()){
+        seek(m_file.chunks().front().firstUs);
+    }
+
+    m_playing = true;
+    anchor();
+    m_timer->start();
+    emit playingChanged(true);
+}
+
+void SamplePlayer::pause(){
+    if(!m_playing)
+        return;
+
+    m_playing = false;
+    m_timer->stop();
+    emit playingChanged(false);
+    emit positionChanged(m_positionUs);
+}
+
+// The index finds the chunk; only that one is read. When paused, the sample
+// at the new position is sent on its own so the labels show it.
+void SamplePlayer::seek(qint64 timeUs){
+    if(!m_isOpen)
+        return;
+
+    size_t chunk = m_file.findChunk(timeUs);
+    if(chunk >= m_file.chunks().size()){
+        chunk = m_file.chunks().size() - 1;
+    }
+    if(!loadChunk(chunk)){
+        pause();
+        return;
+    }
+    while(m_next < m_samples.size() && m_samples[m_next].timestampUs < timeUs){
+        m_next++;
+    }
+
+    // the playback clock starts from the first sample there is at or after timeUs
+    m_positionUs = (m_next < m_samples.size()) ? m_samples[m_next].timestampUs : m_samples.back().timestampUs;
+    m_sendEverything = true;
+    anchor();
+
+    if(!m_playing && m_next < m_samples.size() && publish(m_samples[m_next])){
+        m_next++;
+    }
+    emit positionChanged(m_positionUs);
+}
+
+void SamplePlayer::setSpeed(int speed){
+    m_speed = qBound(1, speed, (int)MaxSpeed);
+    anchor();
+}
+
+// the playback clock carries on from where it is, at the current speed
+void SamplePlayer::anchor(){
+    m_anchorUs = m_positionUs;
+    m_anchorClockUs = clockUs();
+}
+
+// Sends every sample whose time has come round, reading on through the
+// chunks as it goes.
+void SamplePlayer::tick(){
+    if(!m_playing)
+        return;
+
+    qint64 nowUs = clockUs();
+    qint64 targetUs = m_anchorUs + (nowUs - m_anchorClockUs)*m_speed;
+    bool caughtUp = true;
+
+    while(true){
+        if(m_next >= m_samples.size()){
+            if(!loadChunk(m_chunk + 1)){
+                m_positionUs = m_file.chunks().back().lastUs;
+                pause();
+                return;
+            }
+            continue;
+        }
+
+        const PortSample &sample = m_samples[m_next];
+        if(sample.timestampUs > targetUs)
+            break;
+        if(!publish(sample)){
+            caughtUp = false;
+            break;
+        }
+        m_positionUs = sample.timestampUs;
+        m_next++;
+    }
+
+    if(caughtUp){
+        m_positionUs = targetUs;
+    }
+    else {
+        // wait for the UI rather than skip what it hasn't taken yet
+        anchor();
+    }
+
+    if(nowUs - m_positionSentUs >= PLAYER_POSITION_INTERVAL_US){
+        m_positionSentUs = nowUs;
+        emit positionChanged(m_positionUs);
+    }
+}
+
+// damaged chunks are skipped; false once there are none left
+bool SamplePlayer::loadChunk(size_t chunk){
+    for(; chunk < m_file.chunks().size(); chunk++){
+        if(m_file.readChunk(chunk, &m_samples) && !m_samples.empty()){
+            m_chunk = chunk;
+            m_next = 0;
+
+            const SampleFile::Chunk &info = m_file.chunks()[chunk];
+            m_chunkRate = (info.lastUs > info.firstUs) ? (float)((m_samples.size() - 1)*1000000.0/(info.lastUs - info.firstUs)) : 0;
+            return true;
+        }
+        emit logStringReady(QString("Error playing back: %1, skipping it").arg(m_file.errorString()));
+    }
+
+    m_chunk = m_file.chunks().size();
+    m_samples.clear();
+    m_next = 0;
+    return false;
+}
+
+// Builds the snapshot the worker would have sent for sample, with the
+// changed bits worked out against the last one sent. Nothing changes when
+// the queue is full, so the same sample can be tried again.
+bool SamplePlayer::publish(const PortSample &sample){
+    HubSnapshot snapshot = m_snapshot;
+    int numPorts = m_file.numPorts();
+
+    snapshot.sequence = sample.sequence;
+    snapshot.timestampMs = m_clockEpochMs + (m_anchorClockUs + (sample.timestampUs - m_anchorUs)/m_speed)/1000;
+    snapshot.achievedRate = m_chunkRate;
+    snapshot.changed = HubSnapshot::ChangedPortVoltageCurrent;
+    snapshot.portStateChanged = 0;
+    snapshot.portErrorChanged = 0;
+    snapshot.currentLimitChanged = 0;
+    snapshot.portModeChanged = 0;
+
+    for(int port = 0; port < numPorts; port++){
+        snapshot.portVoltage[port] = sample.voltage[port];
+        snapshot.portCurrent[port] = sample.current[port];
+        if(m_sendEverything || snapshot.portState[port] != sample.state[port]){
+            snapshot.portState[port] = sample.state[port];
+            snapshot.portStateChanged |= 1 << port;
+        }
+        if(m_sendEverything || snapshot.portError[port] != sample.error[port]){
+            snapshot.portError[port] = sample.error[port];
+            snapshot.portErrorChanged |= 1 << port;
+        }
+    }
+    if(snapshot.portStateChanged){
+        snapshot.changed |= HubSnapshot::ChangedPortState;
+    }
+    if(snapshot.portErrorChanged){
+        snapshot.changed |= HubSnapshot::ChangedPortError;
+    }
+
+    if(m_sendEverything || snapshot.hubMode != sample.hubMode){
+        snapshot.hubMode = sample.hubMode;
+        snapshot.changed |= HubSnapshot::ChangedHubMode;
+    }
+    if(m_sendEverything || snapshot.temperature != sample.temperature){
+        snapshot.temperature = sample.temperature;
+        snapshot.changed |= HubSnapshot::ChangedTemperature;
+    }
+    if(m_sendEverything || snapshot.inputVoltage != sample.inputVoltage || snapshot.inputCurrent != sample.inputCurrent){
+        snapshot.inputVoltage = sample.inputVoltage;
+        snapshot.inputCurrent = sample.inputCurrent;
+        snapshot.changed |= (m_file.model() == aMODULE_TYPE_USBHub2x4) ? HubSnapshot::ChangedInputVoltage
+                                                                      : HubSnapshot::ChangedInputVoltageCurrent;
+    }
+    if(m_sendEverything){
+        snapshot.changed |= HubSnapshot::ChangedStemInfo;
+    }
+
+    if(!m_queue.push(snapshot))
+        return false;
+
+    m_snapshot = snapshot;
+    m_sendEverything = false;
+    return true;
+}
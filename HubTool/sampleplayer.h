@@ -0,0 +1,94 @@
+#ifndef SAMPLEPLAYER_H
+#define SAMPLEPLAYER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QString>
+#include <QElapsedTimer>
+
+#include <vector>
+
+#include "hubsnapshot.h"
+#include "samplerecorder.h"
+
+// a few ticks' worth at the top speed, so the UI can drain it at its own pace
+#define SAMPLE_PLAYER_QUEUE_SIZE 8192
+
+typedef SpscRing<HubSnapshot, SAMPLE_PLAYER_QUEUE_SIZE> PlaybackQueue;
+
+// Plays a file written by SampleRecorder back as the HubSnapshots the worker
+// published while it was recording, so the UI takes them through the same
+// path as live ones. Runs on a thread of its own, like the worker; the UI
+// drains snapshots() in place of the worker's queue while playing back.
+//
+// The recorded times are replayed at speed times their real spacing, and
+// each snapshot's timestampMs is when that comes round on the local clock, so
+// the plots scroll as if it were live. Seeking goes through the file's time
+// index to the one chunk it needs, however long the recording.
+//
+// When the UI falls behind and the queue fills, the playback clock waits for
+// it rather than skipping samples, so very high speeds play out slower than
+// asked for.
+class SamplePlayer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int MaxSpeed = 1000;
+
+    explicit SamplePlayer(QObject *parent = nullptr);
+
+    // the consumer side belongs to the UI thread
+    PlaybackQueue* snapshots() { return &m_queue; }
+
+public slots:
+    void open(QString path);
+    void close();
+    void play();
+    void pause();
+    void seek(qint64 timeUs);
+    void setSpeed(int speed);
+
+signals:
+    void opened(bool ok, QString message, qint64 firstUs, qint64 lastUs);
+    void positionChanged(qint64 timeUs);
+    void playingChanged(bool playing);
+    void logStringReady(QString logString);
+
+private slots:
+    void tick();
+
+private:
+    bool loadChunk(size_t chunk);
+    bool publish(const PortSample &sample);
+    void anchor();
+    qint64 clockUs() const { return m_clock.nsecsElapsed()/1000; }
+
+    QTimer *m_timer;
+    SampleFile m_file;
+    bool m_isOpen;
+    bool m_playing;
+    int m_speed;
+
+    // the chunk being played and the next sample of it
+    size_t m_chunk;
+    std::vector<PortSample> m_samples;
+    size_t m_next;
+    float m_chunkRate;                      // Hz, as recorded
+
+    // recorded time m_anchorUs plays at m_anchorClockUs on m_clock
+    QElapsedTimer m_clock;
+    qint64 m_clockEpochMs;                  // epoch time when m_clock started
+    qint64 m_anchorUs;
+    qint64 m_anchorClockUs;
+    qint64 m_positionUs;
+    qint64 m_positionSentUs;                // m_clock time positionChanged was last sent
+
+    // the last snapshot published; the next one's changed bits are against it
+    HubSnapshot m_snapshot;
+    bool m_sendEverything;
+
+    PlaybackQueue m_queue;
+};
+
+#endif // SAMPLEPLAYER_H
@@ -0,0 +1,454 @@
+#include "samplerecorder.h"
+
+#include <QDateTime>
+
+#include <string.h>
+
+#include "BrainStem2/aTime.h"
+
+#define SAMPLE_FILE_MAGIC "HUBTS001"
+#define SAMPLE_FILE_VERSION 1
+#define SAMPLE_CHUNK_MAGIC "CHNK"
+#define SAMPLE_CHUNK_PLAIN 0
+
+// a chunk goes out when it's this full, or this old
+#define SAMPLE_CHUNK_SAMPLES 1024
+#define SAMPLE_CHUNK_MAX_AGE_MS 1000
+#define SAMPLE_WRITE_INTERVAL_MS 50
+
+namespace {
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t serialNumber;
+    uint8_t model;
+    uint8_t numPorts;
+    uint16_t reserved0;
+    uint32_t reserved1;
+    int64_t startUs;
+};
+
+struct ChunkHeader {
+    char magic[4];
+    uint16_t encoding;
+    uint16_t reserved;
+    uint32_t samples;
+    uint32_t payloadBytes;
+    int64_t firstUs;
+    int64_t lastUs;
+};
+
+struct IndexEntry {
+    int64_t firstUs;
+    int64_t lastUs;
+    uint64_t offset;
+    uint32_t samples;
+    uint32_t reserved;
+};
+
+size_t rowSize(int numPorts){
+    return sizeof(int64_t) + 5*sizeof(uint32_t) + numPorts*(2*sizeof(uint32_t) + 2*sizeof(int32_t));
+}
+
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// SampleRecorder
+
+SampleRecorder::SampleRecorder() :
+    m_numPorts(0),
+    m_clockStartUs(0),
+    m_recording(false),
+    m_failed(false),
+    m_recorded(0),
+    m_dropped(0),
+    m_written(0),
+    m_chunkStartedMs(0)
+{
+}
+
+SampleRecorder::~SampleRecorder(){
+    close();
+}
+
+bool SampleRecorder::open(const QString &path, uint32_t serialNumber, uint8_t model, int numPorts){
+    close();
+    m_error.clear();
+    m_path = path;
+    m_numPorts = qBound(1, numPorts, 8);
+
+    m_file.setFileName(path);
+    m_index.setFileName(path + ".idx");
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        m_error = m_file.errorString();
+        return false;
+    }
+    if(!m_index.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        m_error = m_index.errorString();
+        m_file.close();
+        return false;
+    }
+
+    m_clock.start();
+    m_clockStartUs = QDateTime::currentMSecsSinceEpoch()*1000;
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAMPLE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SAMPLE_FILE_VERSION;
+    header.serialNumber = serialNumber;
+    header.model = model;
+    header.numPorts = (uint8_t)m_numPorts;
+    header.startUs = m_clockStartUs;
+    if(m_file.write((const char*)&header, sizeof(header)) != sizeof(header) || !m_file.flush()){
+        m_error = m_file.errorString();
+        m_file.close();
+        m_index.close();
+        return false;
+    }
+
+    // anything left over from a previous file
+    PortSample stale;
+    while(m_queue.pop(stale)) {}
+
+    m_chunk.clear();
+    m_chunk.reserve(SAMPLE_CHUNK_SAMPLES);
+    m_buffer.reserve(sizeof(ChunkHeader) + SAMPLE_CHUNK_SAMPLES*rowSize(m_numPorts));
+    m_recorded.store(0);
+    m_dropped.store(0);
+    m_written.store(sizeof(header));
+    m_failed.store(false);
+
+    m_recording.store(true);
+    m_thread = std::thread(&SampleRecorder::writeLoop, this);
+    return true;
+}
+
+// whatever is still queued is written before the file is closed
+void SampleRecorder::close(){
+    if(!m_recording.load())
+        return;
+
+    m_recording.store(false);
+    m_thread.join();
+
+    m_file.close();
+    m_index.close();
+}
+
+bool SampleRecorder::record(const HubSnapshot &snapshot){
+    if(!m_recording.load())
+        return false;
+
+    PortSample sample;
+    sample.timestampUs = m_clockStartUs + m_clock.nsecsElapsed()/1000;
+    sample.sequence = snapshot.sequence;
+    sample.numPorts = m_numPorts;
+    memcpy(sample.voltage, snapshot.portVoltage, sizeof(sample.voltage));
+    memcpy(sample.current, snapshot.portCurrent, sizeof(sample.current));
+    memcpy(sample.state, snapshot.portState, sizeof(sample.state));
+    memcpy(sample.error, snapshot.portError, sizeof(sample.error));
+    sample.hubMode = snapshot.hubMode;
+    sample.temperature = snapshot.temperature;
+    sample.inputVoltage = snapshot.inputVoltage;
+    sample.inputCurrent = snapshot.inputCurrent;
+
+    if(!m_queue.push(sample)){
+        m_dropped++;
+        return false;
+    }
+    return true;
+}
+
+void SampleRecorder::writeLoop(){
+    while(m_recording.load()){
+        drain();
+        aTime_MSSleep(SAMPLE_WRITE_INTERVAL_MS);
+    }
+    drain();
+    if(!m_chunk.empty()){
+        writeChunk();
+    }
+}
+
+void SampleRecorder::drain(){
+    PortSample sample;
+    while(m_queue.pop(sample)){
+        if(m_chunk.empty()){
+            m_chunkStartedMs = m_clock.elapsed();
+        }
+        m_chunk.push_back(sample);
+        if(m_chunk.size() >= SAMPLE_CHUNK_SAMPLES){
+            writeChunk();
+        }
+    }
+
+    if(!m_chunk.empty() && m_clock.elapsed() - m_chunkStartedMs >= SAMPLE_CHUNK_MAX_AGE_MS){
+        writeChunk();
+    }
+}
+
+// One write for the chunk, then one for its index entry. A chunk that only
+// partly made it to disk is cut off again, so the file always ends on a
+// whole chunk.
+bool SampleRecorder::writeChunk(){
+    uint32_t samples = (uint32_t)m_chunk.size();
+    if(m_failed.load()){
+        m_dropped += samples;
+        m_chunk.clear();
+        return false;
+    }
+
+    size_t row = rowSize(m_numPorts);
+    m_buffer.resize(sizeof(ChunkHeader) + samples*row);
+
+    ChunkHeader *header = (ChunkHeader*)m_buffer.data();
+    memset(header, 0, sizeof(ChunkHeader));
+    memcpy(header->magic, SAMPLE_CHUNK_MAGIC, sizeof(header->magic));
+    header->encoding = SAMPLE_CHUNK_PLAIN;
+    header->samples = samples;
+    header->payloadBytes = (uint32_t)(samples*row);
+    header->firstUs = m_chunk.front().timestampUs;
+    header->lastUs = m_chunk.back().timestampUs;
+
+    char *out = m_buffer.data() + sizeof(ChunkHeader);
+    for(const PortSample &sample: m_chunk){
+        memcpy(out, &sample.timestampUs, sizeof(sample.timestampUs));
+        out += sizeof(sample.timestampUs);
+        memcpy(out, &sample.sequence, sizeof(sample.sequence));
+        out += sizeof(sample.sequence);
+        memcpy(out, &sample.hubMode, sizeof(sample.hubMode));
+        out += sizeof(sample.hubMode);
+        memcpy(out, &sample.temperature, sizeof(sample.temperature));
+        out += sizeof(sample.temperature);
+        memcpy(out, &sample.inputVoltage, sizeof(sample.inputVoltage));
+        out += sizeof(sample.inputVoltage);
+        memcpy(out, &sample.inputCurrent, sizeof(sample.inputCurrent));
+        out += sizeof(sample.inputCurrent);
+        memcpy(out, sample.state, m_numPorts*sizeof(uint32_t));
+        out += m_numPorts*sizeof(uint32_t);
+        memcpy(out, sample.error, m_numPorts*sizeof(uint32_t));
+        out += m_numPorts*sizeof(uint32_t);
+        memcpy(out, sample.voltage, m_numPorts*sizeof(int32_t));
+        out += m_numPorts*sizeof(int32_t);
+        memcpy(out, sample.current, m_numPorts*sizeof(int32_t));
+        out += m_numPorts*sizeof(int32_t);
+    }
+
+    IndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.firstUs = header->firstUs;
+    entry.lastUs = header->lastUs;
+    entry.offset = (uint64_t)m_file.pos();
+    entry.samples = samples;
+
+    qint64 size = (qint64)m_buffer.size();
+    if(m_file.write(m_buffer.data(), size) != size || !m_file.flush()){
+        m_file.resize(entry.offset);
+        m_failed.store(true);
+        m_dropped += samples;
+        m_chunk.clear();
+        return false;
+    }
+
+    // the data file is still good without it, readers walk the chunks
+    if(m_index.isOpen() && (m_index.write((const char*)&entry, sizeof(entry)) != sizeof(entry) || !m_index.flush())){
+        m_index.close();
+    }
+
+    m_written += size;
+    m_recorded += samples;
+    m_chunk.clear();
+    return true;
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// SampleFile
+
+SampleFile::SampleFile() :
+    m_serialNumber(0),
+    m_model(0),
+    m_numPorts(0),
+    m_startUs(0)
+{
+}
+
+bool SampleFile::open(const QString &path){
+    close();
+    m_error.clear();
+
+    m_file.setFileName(path);
+    if(!m_file.open(QIODevice::ReadOnly)){
+        m_error = m_file.errorString();
+        return false;
+    }
+
+    FileHeader header;
+    if(m_file.read((char*)&header, sizeof(header)) != sizeof(header)
+       || memcmp(header.magic, SAMPLE_FILE_MAGIC, sizeof(header.magic)) != 0
+       || header.version != SAMPLE_FILE_VERSION
+       || header.numPorts < 1 || header.numPorts > 8){
+        m_error = QString("%1 isn't a sample recording").arg(path);
+        m_file.close();
+        return false;
+    }
+    m_serialNumber = header.serialNumber;
+    m_model = header.model;
+    m_numPorts = header.numPorts;
+    m_startUs = header.startUs;
+
+    uint64_t next = sizeof(FileHeader);
+    if(loadIndex(path + ".idx") && !m_chunks.empty()){
+        // carry on walking from the end of the last indexed chunk
+        const Chunk &last = m_chunks.back();
+        ChunkHeader chunk;
+        if(m_file.seek(last.offset) && m_file.read((char*)&chunk, sizeof(chunk)) == sizeof(chunk)){
+            next = last.offset + sizeof(chunk) + chunk.payloadBytes;
+        }
+        else {
+            m_chunks.clear();
+        }
+    }
+    scanChunks(next);
+    return true;
+}
+
+void SampleFile::close(){
+    m_chunks.clear();
+    if(m_file.isOpen()){
+        m_file.close();
+    }
+}
+
+uint64_t SampleFile::sampleCount() const {
+    uint64_t count = 0;
+    for(const Chunk &chunk: m_chunks){
+        count += chunk.samples;
+    }
+    return count;
+}
+
+// entries are only trusted up to the first one that doesn't fit the data file
+bool SampleFile::loadIndex(const QString &indexPath){
+    QFile index(indexPath);
+    if(!index.open(QIODevice::ReadOnly))
+        return false;
+
+    uint64_t fileSize = (uint64_t)m_file.size();
+    uint64_t previous = 0;
+    IndexEntry entry;
+    while(index.read((char*)&entry, sizeof(entry)) == sizeof(entry)){
+        if(entry.offset < sizeof(FileHeader) || entry.offset + sizeof(ChunkHeader) > fileSize
+           || (!m_chunks.empty() && entry.offset <= previous))
+            break;
+
+        Chunk chunk;
+        chunk.firstUs = entry.firstUs;
+        chunk.lastUs = entry.lastUs;
+        chunk.offset = entry.offset;
+        chunk.samples = entry.samples;
+        m_chunks.push_back(chunk);
+        previous = entry.offset;
+    }
+    return true;
+}
+
+void SampleFile::scanChunks(uint64_t from){
+    uint64_t fileSize = (uint64_t)m_file.size();
+    uint64_t offset = from;
+    ChunkHeader header;
+
+    while(offset + sizeof(header) <= fileSize){
+        if(!m_file.seek(offset) || m_file.read((char*)&header, sizeof(header)) != sizeof(header))
+            break;
+        if(memcmp(header.magic, SAMPLE_CHUNK_MAGIC, sizeof(header.magic)) != 0)
+            break;
+        // cut short by a crash
+        if(offset + sizeof(header) + header.payloadBytes > fileSize)
+            break;
+
+        Chunk chunk;
+        chunk.firstUs = header.firstUs;
+        chunk.lastUs = header.lastUs;
+        chunk.offset = offset;
+        chunk.samples = header.samples;
+        m_chunks.push_back(chunk);
+        offset += sizeof(header) + header.payloadBytes;
+    }
+}
+
+size_t SampleFile::findChunk(int64_t timeUs) const {
+    size_t low = 0;
+    size_t high = m_chunks.size();
+    while(low < high){
+        size_t middle = (low + high)/2;
+        if(m_chunks[middle].lastUs < timeUs){
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool SampleFile::readChunk(size_t chunk, std::vector<PortSample> *samples){
+    samples->clear();
+    if(chunk >= m_chunks.size()){
+        m_error = QString("no chunk %1").arg(chunk);
+        return false;
+    }
+
+    ChunkHeader header;
+    if(!m_file.seek(m_chunks[chunk].offset)
+       || m_file.read((char*)&header, sizeof(header)) != sizeof(header)
+       || memcmp(header.magic, SAMPLE_CHUNK_MAGIC, sizeof(header.magic)) != 0){
+        m_error = QString("chunk %1 is damaged").arg(chunk);
+        return false;
+    }
+    if(header.encoding != SAMPLE_CHUNK_PLAIN){
+        m_error = QString("chunk %1 has unknown encoding %2").arg(chunk).arg(header.encoding);
+        return false;
+    }
+
+    size_t row = rowSize(m_numPorts);
+    if(header.payloadBytes != header.samples*row){
+        m_error = QString("chunk %1 is damaged").arg(chunk);
+        return false;
+    }
+
+    QByteArray payload = m_file.read(header.payloadBytes);
+    if((uint32_t)payload.size() != header.payloadBytes){
+        m_error = QString("chunk %1 is cut short").arg(chunk);
+        return false;
+    }
+
+    samples->resize(header.samples);
+    const char *in = payload.constData();
+    for(PortSample &sample: *samples){
+        memset(&sample, 0, sizeof(sample));
+        sample.numPorts = m_numPorts;
+        memcpy(&sample.timestampUs, in, sizeof(sample.timestampUs));
+        in += sizeof(sample.timestampUs);
+        memcpy(&sample.sequence, in, sizeof(sample.sequence));
+        in += sizeof(sample.sequence);
+        memcpy(&sample.hubMode, in, sizeof(sample.hubMode));
+        in += sizeof(sample.hubMode);
+        memcpy(&sample.temperature, in, sizeof(sample.temperature));
+        in += sizeof(sample.temperature);
+        memcpy(&sample.inputVoltage, in, sizeof(sample.inputVoltage));
+        in += sizeof(sample.inputVoltage);
+        memcpy(&sample.inputCurrent, in, sizeof(sample.inputCurrent));
+        in += sizeof(sample.inputCurrent);
+        memcpy(sample.state, in, m_numPorts*sizeof(uint32_t));
+        in += m_numPorts*sizeof(uint32_t);
+        memcpy(sample.error, in, m_numPorts*sizeof(uint32_t));
+        in += m_numPorts*sizeof(uint32_t);
+        memcpy(sample.voltage, in, m_numPorts*sizeof(int32_t));
+        in += m_numPorts*sizeof(int32_t);
+        memcpy(sample.current, in, m_numPorts*sizeof(int32_t));
+        in += m_numPorts*sizeof(int32_t);
+    }
+    return true;
+}
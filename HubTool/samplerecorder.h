@@ -0,0 +1,177 @@
+#ifndef SAMPLERECORDER_H
+#define SAMPLERECORDER_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "hubsnapshot.h"
+#include "spscring.h"
+
+#define SAMPLE_RECORDER_QUEUE_SIZE 4096
+
+// One poll cycle's measurements, as recorded.
+struct PortSample {
+    int64_t timestampUs;            // since the epoch
+    uint32_t sequence;              // HubSnapshot::sequence
+    uint32_t numPorts;
+    int32_t voltage[8];             // uV
+    int32_t current[8];             // uA
+    uint32_t state[8];              // port state bits
+    uint32_t error[8];              // port error bits
+    uint32_t hubMode;
+    int32_t temperature;            // micro degrees C
+    uint32_t inputVoltage;          // uV
+    uint32_t inputCurrent;          // uA
+};
+
+// Records every port's voltage, current, state and error, and the hub's
+// mode, temperature and input, to an append only file,
+// for as long as it's open. The poll thread only copies each sample into a
+// fixed size queue; a thread of the recorder's own batches them into chunks
+// and writes those out, so memory stays bounded however long it runs. If the
+// disk can't keep up the queue fills and samples are dropped (and counted)
+// rather than the polling stalling.
+//
+// Chunks go out at most a second apart, so a crash loses at most that much.
+// Offsets are 64 bit, so a file can hold weeks of samples.
+//
+// Data file, little endian:
+//   header, 32 bytes:
+//     char magic[8]        "HUBTS001"
+//     uint32 version       1
+//     uint32 serialNumber
+//     uint8 model
+//     uint8 numPorts
+//     uint16 reserved
+//     uint32 reserved
+//     int64 startUs        since the epoch
+//   chunks, back to back:
+//     char magic[4]        "CHNK"
+//     uint16 encoding      0 for plain rows
+//     uint16 reserved
+//     uint32 samples
+//     uint32 payloadBytes
+//     int64 firstUs
+//     int64 lastUs
+//     payload, one row per sample:
+//       int64 timestampUs
+//       uint32 sequence
+//       uint32 hubMode
+//       int32 temperature
+//       uint32 inputVoltage
+//       uint32 inputCurrent
+//       uint32 state[numPorts]
+//       uint32 error[numPorts]
+//       int32 voltage[numPorts]
+//       int32 current[numPorts]
+//
+// Time index, the data file's path plus ".idx", one 32 byte entry appended
+// per chunk once the chunk is written:
+//     int64 firstUs
+//     int64 lastUs
+//     uint64 offset        of the chunk header in the data file
+//     uint32 samples
+//     uint32 reserved
+class SampleRecorder
+{
+public:
+    SampleRecorder();
+    ~SampleRecorder();
+
+    // always starts a new file
+    bool open(const QString &path, uint32_t serialNumber, uint8_t model, int numPorts);
+    void close();
+    bool isOpen() const { return m_recording.load(); }
+    QString path() const { return m_path; }
+    QString errorString() const { return m_error; }
+
+    // the owner's thread; false when the sample had to be dropped
+    bool record(const HubSnapshot &snapshot);
+
+    // set by the writer thread when the disk stops taking writes; the file
+    // is left as it was after the last good chunk
+    bool failed() const { return m_failed.load(); }
+
+    // safe to read from any thread
+    uint64_t recordedCount() const { return m_recorded.load(); }
+    uint64_t droppedCount() const { return m_dropped.load(); }
+    uint64_t bytesWritten() const { return m_written.load(); }
+
+private:
+    void writeLoop();
+    void drain();
+    bool writeChunk();
+
+    QString m_path;
+    QString m_error;
+    int m_numPorts;
+
+    QElapsedTimer m_clock;
+    qint64 m_clockStartUs;          // epoch time when m_clock started
+
+    SpscRing<PortSample, SAMPLE_RECORDER_QUEUE_SIZE> m_queue;
+    std::thread m_thread;
+    std::atomic<bool> m_recording;
+    std::atomic<bool> m_failed;
+    std::atomic<uint64_t> m_recorded;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_written;
+
+    // everything below is only used by the writer thread while recording
+    QFile m_file;
+    QFile m_index;
+    std::vector<PortSample> m_chunk;
+    std::vector<char> m_buffer;
+    qint64 m_chunkStartedMs;
+};
+
+// Reads a file written by SampleRecorder. The time index is used as far as
+// it goes; chunks after its last entry (a crash between writing a chunk and
+// indexing it) are found by walking the data file.
+class SampleFile
+{
+public:
+    struct Chunk {
+        int64_t firstUs;
+        int64_t lastUs;
+        uint64_t offset;
+        uint32_t samples;
+    };
+
+    SampleFile();
+
+    bool open(const QString &path);
+    void close();
+    QString errorString() const { return m_error; }
+
+    uint32_t serialNumber() const { return m_serialNumber; }
+    uint8_t model() const { return m_model; }
+    int numPorts() const { return m_numPorts; }
+    int64_t startUs() const { return m_startUs; }
+
+    const std::vector<Chunk>& chunks() const { return m_chunks; }
+    uint64_t sampleCount() const;
+
+    // first chunk with samples at or after timeUs, chunks().size() if none
+    size_t findChunk(int64_t timeUs) const;
+    bool readChunk(size_t chunk, std::vector<PortSample> *samples);
+
+private:
+    bool loadIndex(const QString &indexPath);
+    void scanChunks(uint64_t from);
+
+    QFile m_file;
+    QString m_error;
+    uint32_t m_serialNumber;
+    uint8_t m_model;
+    int m_numPorts;
+    int64_t m_startUs;
+    std::vector<Chunk> m_chunks;
+};
+
+#endif // SAMPLERECORDER_H
@@ -0,0 +1,264 @@
+#include "samplestore.h"
+
+#include <algorithm>
+
+// a block's bytes are reserved at this much per sample, then trimmed once it's full
+#define SAMPLE_STORE_RESERVE_PER_SAMPLE 5
+
+namespace {
+
+inline uint64_t zigzag(int64_t value){
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value){
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline void putVarint(std::vector<uint8_t> &bytes, uint64_t value){
+    while(value >= 0x80){
+        bytes.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back((uint8_t)value);
+}
+
+inline uint64_t getVarint(const uint8_t *&in){
+    uint64_t value = 0;
+    int shift = 0;
+    while(*in & 0x80){
+        value |= (uint64_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (uint64_t)(*in++) << shift;
+    return value;
+}
+
+}
+
+SampleStore::SampleStore() :
+    m_count(0),
+    m_removed(0),
+    m_firstTime(0),
+    m_lastTime(0),
+    m_lastSpacing(0),
+    m_lastVolts(0),
+    m_lastAmps(0),
+    m_voltagePyramid(PyramidLowestLevel),
+    m_currentPyramid(PyramidLowestLevel)
+{
+}
+
+void SampleStore::append(int64_t time, int32_t microVolts, int32_t microAmps){
+    if(isEmpty()){
+        m_firstTime = time;
+    }
+
+    // each block starts from a whole sample, so it can be decoded on its own
+    if(m_blocks.empty() || m_blocks.back().count == BlockSamples){
+        if(!m_blocks.empty()){
+            m_blocks.back().bytes.shrink_to_fit();
+        }
+        Block block;
+        block.firstTime = time;
+        block.lastTime = time;
+        block.firstIndex = m_count;
+        block.count = 0;
+        m_blocks.push_back(block);
+
+        std::vector<uint8_t> &bytes = m_blocks.back().bytes;
+        bytes.reserve(BlockSamples*SAMPLE_STORE_RESERVE_PER_SAMPLE);
+        putVarint(bytes, zigzag(time));
+        putVarint(bytes, zigzag(microVolts));
+        putVarint(bytes, zigzag(microAmps));
+        m_lastSpacing = 0;
+    }
+    else {
+        std::vector<uint8_t> &bytes = m_blocks.back().bytes;
+        int64_t spacing = time - m_lastTime;
+        putVarint(bytes, zigzag(spacing - m_lastSpacing));
+        putVarint(bytes, zigzag((int64_t)microVolts - m_lastVolts));
+        putVarint(bytes, zigzag((int64_t)microAmps - m_lastAmps));
+        m_lastSpacing = spacing;
+    }
+
+    Block &block = m_blocks.back();
+    block.lastTime = time;
+    block.count++;
+
+    m_lastTime = time;
+    m_lastVolts = microVolts;
+    m_lastAmps = microAmps;
+    m_count++;
+
+    m_voltagePyramid.append((double)time, microVolts);
+    m_currentPyramid.append((double)time, microAmps);
+}
+
+void SampleStore::clear(){
+    m_blocks.clear();
+    m_count = 0;
+    m_removed = 0;
+    m_firstTime = 0;
+    m_lastTime = 0;
+    m_lastSpacing = 0;
+    m_voltagePyramid.clear();
+    m_currentPyramid.clear();
+}
+
+void SampleStore::removeBefore(int64_t time){
+    uint64_t removed = m_removed;
+    while(!m_blocks.empty() && m_blocks.front().lastTime < time){
+        m_removed = m_blocks.front().firstIndex + m_blocks.front().count;
+        m_blocks.pop_front();
+    }
+
+    // part of the oldest block, which stays until all of it goes
+    if(!m_blocks.empty() && m_blocks.front().firstTime < time && m_firstTime < time){
+        std::vector<Sample> front;
+        decode(m_blocks.front(), &front);
+        size_t older = 0;
+        while(older < front.size() && front[older].time < time){
+            older++;
+        }
+        m_removed += older;
+        m_firstTime = front[older].time;
+    }
+    else if(!m_blocks.empty() && m_removed != removed){
+        m_firstTime = m_blocks.front().firstTime;
+    }
+
+    m_voltagePyramid.removeBefore(m_removed);
+    m_currentPyramid.removeBefore(m_removed);
+}
+
+size_t SampleStore::memoryBytes() const {
+    size_t bytes = m_voltagePyramid.memoryBytes() + m_currentPyramid.memoryBytes();
+    for(const Block &block: m_blocks){
+        bytes += sizeof(Block) + block.bytes.capacity();
+    }
+    return bytes;
+}
+
+void SampleStore::decode(const Block &block, std::vector<Sample> *out) const {
+    const uint8_t *in = block.bytes.data();
+    int64_t time = unzigzag(getVarint(in));
+    int64_t microVolts = unzigzag(getVarint(in));
+    int64_t microAmps = unzigzag(getVarint(in));
+    int64_t spacing = 0;
+
+    uint64_t index = block.firstIndex;
+    for(uint32_t i = 0; i < block.count; i++, index++){
+        if(i > 0){
+            spacing += unzigzag(getVarint(in));
+            time += spacing;
+            microVolts += unzigzag(getVarint(in));
+            microAmps += unzigzag(getVarint(in));
+        }
+        if(index >= m_removed){
+            Sample sample = {time, (int32_t)microVolts, (int32_t)microAmps};
+            out->push_back(sample);
+        }
+    }
+}
+
+void SampleStore::blockRange(int64_t from, int64_t to, size_t *first, size_t *end) const {
+    std::deque<Block>::const_iterator begin = std::lower_bound(m_blocks.begin(), m_blocks.end(), from,
+                                                               [](const Block &block, int64_t t){ return block.lastTime < t; });
+    std::deque<Block>::const_iterator stop = std::upper_bound(begin, m_blocks.end(), to,
+                                                              [](int64_t t, const Block &block){ return t < block.firstTime; });
+    *first = begin - m_blocks.begin();
+    *end = stop - m_blocks.begin();
+    if(*first > 0){
+        (*first)--;
+    }
+}
+
+void SampleStore::samples(int64_t from, int64_t to, std::vector<Sample> *out) const {
+    out->clear();
+    size_t first, end;
+    blockRange(from, to, &first, &end);
+    for(size_t block = first; block < end; block++){
+        decode(m_blocks[block], out);
+    }
+}
+
+void SampleStore::envelope(int64_t from, int64_t to, int width,
+                           std::vector<MinMaxPyramid::Point> *volts, std::vector<MinMaxPyramid::Point> *amps) const {
+    volts->clear();
+    amps->clear();
+
+    size_t first, end;
+    blockRange(from, to, &first, &end);
+    if(first >= end)
+        return;
+
+    uint64_t firstIndex = std::max(m_blocks[first].firstIndex, m_removed);
+    uint64_t endIndex = m_blocks[end - 1].firstIndex + m_blocks[end - 1].count;
+    int level = MinMaxPyramid::levelFor(endIndex - firstIndex, width);
+    if(level >= PyramidLowestLevel){
+        m_voltagePyramid.envelope(level, firstIndex, endIndex, volts);
+        m_currentPyramid.envelope(level, firstIndex, endIndex, amps);
+        return;
+    }
+
+    std::vector<Sample> decoded;
+    decoded.reserve(endIndex - firstIndex);
+    for(size_t block = first; block < end; block++){
+        decode(m_blocks[block], &decoded);
+    }
+
+    // the levels the pyramids don't keep, worked out from the samples
+    size_t group = (size_t)MinMaxPyramid::span(level);
+    volts->reserve(level ? 2*(decoded.size()/group + 1) : decoded.size());
+    amps->reserve(volts->capacity());
+    for(size_t start = 0; start < decoded.size(); start += group){
+        size_t stop = std::min(start + group, decoded.size());
+        if(level == 0){
+            MinMaxPyramid::Point volt = {(double)decoded[start].time, (double)decoded[start].microVolts};
+            MinMaxPyramid::Point amp = {(double)decoded[start].time, (double)decoded[start].microAmps};
+            volts->push_back(volt);
+            amps->push_back(amp);
+            continue;
+        }
+
+        int32_t minVolts = decoded[start].microVolts, maxVolts = minVolts;
+        int32_t minAmps = decoded[start].microAmps, maxAmps = minAmps;
+        for(size_t i = start + 1; i < stop; i++){
+            minVolts = std::min(minVolts, decoded[i].microVolts);
+            maxVolts = std::max(maxVolts, decoded[i].microVolts);
+            minAmps = std::min(minAmps, decoded[i].microAmps);
+            maxAmps = std::max(maxAmps, decoded[i].microAmps);
+        }
+        double firstKey = (double)decoded[start].time;
+        double lastKey = (double)decoded[stop - 1].time;
+        MinMaxPyramid::Point points[4] = {{firstKey, (double)minVolts}, {lastKey, (double)maxVolts},
+                                          {firstKey, (double)minAmps}, {lastKey, (double)maxAmps}};
+        volts->push_back(points[0]);
+        volts->push_back(points[1]);
+        amps->push_back(points[2]);
+        amps->push_back(points[3]);
+    }
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// SampleStore::Reader
+
+SampleStore::Reader::Reader(const SampleStore &store) :
+    m_store(store),
+    m_block(0),
+    m_next(0)
+{
+}
+
+bool SampleStore::Reader::next(Sample *sample){
+    while(m_next >= m_samples.size()){
+        if(m_block >= m_store.m_blocks.size())
+            return false;
+        m_samples.clear();
+        m_store.decode(m_store.m_blocks[m_block++], &m_samples);
+        m_next = 0;
+    }
+    *sample = m_samples[m_next++];
+    return true;
+}
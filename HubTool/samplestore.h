@@ -0,0 +1,102 @@
+#ifndef SAMPLESTORE_H
+#define SAMPLESTORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+#include "minmaxpyramid.h"
+
+// A port's voltage and current history as the raw readings, compressed.
+// Samples go into blocks of BlockSamples; within a block the times are
+// stored as the change in their spacing (delta of delta) and the readings
+// as the change from the one before, each as a zigzag varint. A steady poll
+// rate makes the time a single byte and the readings two or so, against
+// 16 bytes per value as doubles. Deltas rather than XOR, since the readings
+// are integers and neighbours differ by a little either side.
+//
+// Only blocks that overlap the range being drawn are decoded. Wider ranges
+// are drawn from min/max pyramids of both values, kept as samples arrive,
+// from level PyramidLowestLevel up; below that the min/max is worked out
+// from the decoded samples.
+//
+// Times have to be added in increasing order; the unit is the caller's.
+class SampleStore
+{
+public:
+    static const int BlockSamples = 1024;
+    static const int PyramidLowestLevel = 3;
+
+    struct Sample {
+        int64_t time;
+        int32_t microVolts;
+        int32_t microAmps;
+    };
+
+    SampleStore();
+
+    void append(int64_t time, int32_t microVolts, int32_t microAmps);
+    void clear();
+    void removeBefore(int64_t time);
+
+    uint64_t size() const { return m_count - m_removed; }
+    bool isEmpty() const { return size() == 0; }
+    int64_t firstTime() const { return m_firstTime; }
+    int64_t lastTime() const { return m_lastTime; }
+
+    // what the samples and pyramids take up
+    size_t memoryBytes() const;
+
+    // every sample of the blocks overlapping [from, to], plus the block
+    // before, so a line through them runs off both edges
+    void samples(int64_t from, int64_t to, std::vector<Sample> *out) const;
+
+    // [from, to] at about one min and max per pixel (or the samples
+    // themselves, when there are few enough), keyed by time, in uV and uA
+    void envelope(int64_t from, int64_t to, int width,
+                  std::vector<MinMaxPyramid::Point> *volts, std::vector<MinMaxPyramid::Point> *amps) const;
+
+    // every sample from oldest to newest, a block at a time; the store
+    // can't change while it's being read
+    class Reader
+    {
+    public:
+        explicit Reader(const SampleStore &store);
+        bool next(Sample *sample);
+
+    private:
+        const SampleStore &m_store;
+        size_t m_block;
+        std::vector<Sample> m_samples;
+        size_t m_next;
+    };
+
+private:
+    struct Block {
+        int64_t firstTime;
+        int64_t lastTime;
+        uint64_t firstIndex;                // number of its first sample
+        uint32_t count;
+        std::vector<uint8_t> bytes;
+    };
+
+    void decode(const Block &block, std::vector<Sample> *out) const;
+    void blockRange(int64_t from, int64_t to, size_t *first, size_t *end) const;
+
+    std::deque<Block> m_blocks;
+    uint64_t m_count;                       // samples added
+    uint64_t m_removed;                     // samples removed from the front
+    int64_t m_firstTime;
+
+    // the last sample, which the next one is encoded against
+    int64_t m_lastTime;
+    int64_t m_lastSpacing;
+    int32_t m_lastVolts;
+    int32_t m_lastAmps;
+
+    MinMaxPyramid m_voltagePyramid;
+    MinMaxPyramid m_currentPyramid;
+};
+
+#endif // SAMPLESTORE_H
@@ -0,0 +1,441 @@
+#include "simulatedhub.h"
+
+#include <QStringList>
+
+#include <cmath>
+#include <string.h>
+
+#include "BrainStem2/aUSBHub3p.h"
+#include "BrainStem2/aUSBHub2x4.h"
+
+// ////////////////////////////////////////////////////////////////////////////
+// Config
+
+SimulatedHub::Config::Config() :
+    model(aMODULE_TYPE_USBHub3p),
+    serialNumber(0xDEAD0123),
+    latencyUs(0),
+    jitterUs(0),
+    lossRate(0.0)
+{
+}
+
+SimulatedHub::Config SimulatedHub::Config::fromString(const QString &options, const Config &defaults){
+    Config config = defaults;
+    for(const QString &option: options.split(',', QString::SkipEmptyParts)){
+        QString key = option.section('=', 0, 0).trimmed();
+        QString value = option.section('=', 1).trimmed();
+
+        if(key == "latency")        config.latencyUs = value.toInt();
+        else if(key == "jitter")    config.jitterUs = value.toInt();
+        else if(key == "loss")      config.lossRate = value.toDouble();
+        else if(key == "serial")    config.serialNumber = value.toUInt(nullptr, 0);
+        else if(key == "model")     config.model = (value == "2x4") ? aMODULE_TYPE_USBHub2x4 : aMODULE_TYPE_USBHub3p;
+    }
+    return config;
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// SimulatedHub
+
+SimulatedHub::SimulatedHub(const Config &config) :
+    m_config(config),
+    m_moduleAddress(config.model == aMODULE_TYPE_USBHub2x4 ? aUSBHUB2X4_MODULE : aUSBHUB3P_MODULE),
+    m_numPorts(config.model == aMODULE_TYPE_USBHub2x4 ? 4 : 8),
+    m_random(config.serialNumber),
+    m_replyOffset(0),
+    m_packetSize(0),
+    m_streamOpen(false),
+    m_requests(0),
+    m_dropped(0),
+    m_led(0),
+    m_upstreamMode(usbUpstreamModeAuto),
+    m_upstreamBoost(usbBoostMode_0),
+    m_downstreamBoost(usbBoostMode_0),
+    m_enumerationDelay(0)
+{
+    for(int port = 0; port < 8; port++){
+        m_power[port] = true;
+        m_hiSpeed[port] = true;
+        m_superSpeed[port] = (config.model == aMODULE_TYPE_USBHub3p);
+        m_currentLimit[port] = 2500000;
+        m_portMode[port] = usbPortMode_sdp;
+        m_portError[port] = 0;
+        // a different load on each port so the plots can be told apart
+        m_loadCurrent[port] = 100000 + 60000*port;
+    }
+    m_clock.start();
+}
+
+SimulatedHub::~SimulatedHub(){
+}
+
+aStreamRef SimulatedHub::createStream(){
+    std::lock_guard<std::mutex> locker(m_lock);
+    m_replies.clear();
+    m_replyOffset = 0;
+    m_packetSize = 0;
+    m_streamOpen = true;
+    return aStream_Create(sGet, sPut, sWrite, sDelete, this);
+}
+
+void SimulatedHub::setLatency(int latencyUs, int jitterUs){
+    std::lock_guard<std::mutex> locker(m_lock);
+    m_config.latencyUs = latencyUs;
+    m_config.jitterUs = jitterUs;
+}
+
+void SimulatedHub::setLossRate(double lossRate){
+    std::lock_guard<std::mutex> locker(m_lock);
+    m_config.lossRate = lossRate;
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// stream callbacks, called from the link's thread
+
+aErr SimulatedHub::sGet(uint8_t* pData, void* ref){
+    SimulatedHub *hub = (SimulatedHub*)ref;
+    std::lock_guard<std::mutex> locker(hub->m_lock);
+
+    if(hub->m_replies.empty())
+        return aErrNotReady;
+
+    Reply &reply = hub->m_replies.front();
+    if(hub->m_replyOffset == 0 && reply.dueUs > hub->m_clock.nsecsElapsed()/1000)
+        return aErrNotReady;
+
+    *pData = reply.bytes[hub->m_replyOffset++];
+    if(hub->m_replyOffset >= reply.bytes.size()){
+        hub->m_replies.pop_front();
+        hub->m_replyOffset = 0;
+    }
+    return aErrNone;
+}
+
+aErr SimulatedHub::sPut(const uint8_t* pData, void* ref){
+    SimulatedHub *hub = (SimulatedHub*)ref;
+    std::lock_guard<std::mutex> locker(hub->m_lock);
+    hub->accept(*pData);
+    return aErrNone;
+}
+
+aErr SimulatedHub::sWrite(const uint8_t* pData, const size_t nSize, void* ref){
+    SimulatedHub *hub = (SimulatedHub*)ref;
+    std::lock_guard<std::mutex> locker(hub->m_lock);
+    for(size_t i = 0; i < nSize; i++){
+        hub->accept(pData[i]);
+    }
+    return aErrNone;
+}
+
+aErr SimulatedHub::sDelete(void* ref){
+    SimulatedHub *hub = (SimulatedHub*)ref;
+    std::lock_guard<std::mutex> locker(hub->m_lock);
+    hub->m_streamOpen = false;
+    hub->m_replies.clear();
+    hub->m_replyOffset = 0;
+    return aErrNone;
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// packets
+
+// The stream carries [address, length, data...] per packet.
+void SimulatedHub::accept(uint8_t byte){
+    m_packet[m_packetSize++] = byte;
+
+    if(m_packetSize >= 2 && m_packet[1] > aBRAINSTEM_MAXPACKETBYTES){
+        // not a packet we understand, start over on the next byte
+        m_packetSize = 0;
+        return;
+    }
+    if(m_packetSize >= 2 && m_packetSize == m_packet[1] + 2){
+        handlePacket(m_packet + 2, m_packet[1]);
+        m_packetSize = 0;
+    }
+}
+
+void SimulatedHub::handlePacket(const uint8_t* data, uint8_t size){
+    if(size == 0)
+        return;
+
+    m_requests++;
+
+    // heartbeats are answered in kind
+    if(data[0] == cmdHB){
+        if(size >= 2 && (data[1] == val_HB_H2S_UP || data[1] == val_HB_H2S_DOWN)){
+            uint8_t beat[2] = {cmdHB, (uint8_t)(data[1] == val_HB_H2S_UP ? val_HB_S2H_UP : val_HB_S2H_DOWN)};
+            queueReply(beat, sizeof(beat));
+        }
+        return;
+    }
+
+    if(size < 3)
+        return;
+
+    uint8_t command = data[0];
+    uint8_t operation = data[1] & ueiOPTION_OP_MASK;
+    uint8_t option = data[1] & ueiOPTION_MASK;
+    uint8_t index = data[2] & ueiSPECIFIER_INDEX_MASK;
+
+    uint8_t headerSize = 3;
+    int subindex = -1;
+    if(isPortOption(command, option) && size >= 4){
+        subindex = data[3];
+        headerSize = 4;
+    }
+
+    uint8_t reply[aBRAINSTEM_MAXPACKETBYTES];
+    memcpy(reply, data, headerSize);
+    reply[2] = (uint8_t)(ueiSPECIFIER_RETURN_HOST | index);
+    uint8_t replySize = headerSize;
+
+    aErr err = aErrNone;
+    if(operation == ueiOPTION_GET){
+        uint32_t value = 0;
+        uint8_t valueSize = 4;
+        err = handleGet(command, option, index, subindex, &value, &valueSize);
+        if(err == aErrNone){
+            reply[1] = (uint8_t)(ueiOPTION_VAL | option);
+            for(int shift = (valueSize - 1)*8; shift >= 0; shift -= 8){
+                reply[replySize++] = (uint8_t)(value >> shift);
+            }
+        }
+    }
+    else if(operation == ueiOPTION_SET){
+        uint32_t value = 0;
+        for(uint8_t i = headerSize; i < size && i < headerSize + 4; i++){
+            value = (value << 8) | data[i];
+        }
+        err = handleSet(command, option, index, subindex, value);
+        if(err == aErrNone){
+            reply[1] = (uint8_t)(ueiOPTION_ACK | option);
+        }
+    }
+    else {
+        // values and acks only ever come from the device
+        return;
+    }
+
+    if(err != aErrNone){
+        reply[2] |= ueiREPLY_ERROR;
+        reply[replySize++] = (uint8_t)err;
+    }
+    queueReply(reply, replySize);
+}
+
+void SimulatedHub::queueReply(const uint8_t* data, uint8_t size){
+    if(!m_streamOpen)
+        return;
+
+    if(m_config.lossRate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_random) < m_config.lossRate){
+        m_dropped++;
+        return;
+    }
+
+    qint64 delay = m_config.latencyUs;
+    if(m_config.jitterUs > 0){
+        delay += std::uniform_int_distribution<int>(0, m_config.jitterUs)(m_random);
+    }
+
+    Reply reply;
+    reply.dueUs = m_clock.nsecsElapsed()/1000 + delay;
+    // a serial link doesn't reorder, so jitter can only hold a reply back
+    if(!m_replies.empty() && m_replies.back().dueUs > reply.dueUs){
+        reply.dueUs = m_replies.back().dueUs;
+    }
+    reply.bytes.reserve(size + 2);
+    reply.bytes.push_back(m_moduleAddress);
+    reply.bytes.push_back(size);
+    reply.bytes.insert(reply.bytes.end(), data, data + size);
+    m_replies.push_back(reply);
+}
+
+bool SimulatedHub::isPortOption(uint8_t command, uint8_t option){
+    if(command != cmdUSB)
+        return false;
+
+    switch(option){
+    case usbPortEnable:
+    case usbPortDisable:
+    case usbDataEnable:
+    case usbDataDisable:
+    case usbPowerEnable:
+    case usbPowerDisable:
+    case usbPortCurrent:
+    case usbPortVoltage:
+    case usbPortClearErrorStatus:
+    case usbPortCurrentLimit:
+    case usbPortMode:
+    case usbHiSpeedDataEnable:
+    case usbHiSpeedDataDisable:
+    case usbSuperSpeedDataEnable:
+    case usbSuperSpeedDataDisable:
+    case usbPortState:
+    case usbPortError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ////////////////////////////////////////////////////////////////////////////
+// the modelled hub
+
+int32_t SimulatedHub::portVoltage(int port){
+    if(!m_power[port])
+        return std::uniform_int_distribution<int32_t>(0, 20000)(m_random);
+    return 5050000 + std::uniform_int_distribution<int32_t>(-15000, 15000)(m_random);
+}
+
+int32_t SimulatedHub::portCurrent(int port){
+    if(!m_power[port])
+        return 0;
+
+    // a slow swing plus noise, held to the limit
+    double seconds = m_clock.elapsed()/1000.0;
+    int32_t load = (int32_t)(m_loadCurrent[port]*(1.0 + 0.3*std::sin(seconds*(0.5 + 0.1*port))));
+    load += std::uniform_int_distribution<int32_t>(-2000, 2000)(m_random);
+    if(load < 0) load = 0;
+    if((uint32_t)load > m_currentLimit[port]) load = (int32_t)m_currentLimit[port];
+    return load;
+}
+
+uint32_t SimulatedHub::portState(int port) const {
+    uint32_t state = 0;
+    if(m_power[port]){
+        state |= _BIT(aUSBHUB3P_USB_VBUS_ENABLED);
+    }
+    if(m_power[port] && (m_hiSpeed[port] || m_superSpeed[port])){
+        state |= _BIT(aUSBHUB3P_DEVICE_ATTACHED);
+        if(m_hiSpeed[port])     state |= _BIT(aUSBHUB3P_USB_SPEED_USB2);
+        if(m_superSpeed[port])  state |= _BIT(aUSBHUB3P_USB_SPEED_USB3);
+    }
+    if(m_portError[port]){
+        state |= _BIT(aUSBHUB3P_USB_ERROR_FLAG);
+    }
+    return state;
+}
+
+// HS and power bits two per port from bit 0, SS bits two per port from bit 16
+uint32_t SimulatedHub::hubMode() const {
+    uint32_t mode = 0;
+    for(int port = 0; port < m_numPorts; port++){
+        if(m_hiSpeed[port])                         mode |= 1u << (port*2);
+        if(m_power[port])                           mode |= 1u << (port*2 + 1);
+        if(m_superSpeed[port] && port < 8)          mode |= 1u << (16 + port*2);
+    }
+    return mode;
+}
+
+aErr SimulatedHub::handleGet(uint8_t command, uint8_t option, uint8_t index, int subindex,
+                             uint32_t* value, uint8_t* valueSize){
+    if(index != 0)
+        return aErrIndexRange;
+
+    if(command == cmdSYSTEM){
+        switch(option){
+        case systemModule:          *value = m_moduleAddress; *valueSize = 1; return aErrNone;
+        case systemModel:           *value = m_config.model; *valueSize = 1; return aErrNone;
+        case systemSerialNumber:    *value = m_config.serialNumber; return aErrNone;
+        case systemVersion:         *value = 0x28000000; return aErrNone;     // new enough for everything HubTool reads
+        case systemLED:             *value = m_led; *valueSize = 1; return aErrNone;
+        case systemInputVoltage:    *value = 12000000 + std::uniform_int_distribution<int>(-20000, 20000)(m_random); return aErrNone;
+        case systemInputCurrent: {
+            uint32_t total = 150000;    // the hub itself
+            for(int port = 0; port < m_numPorts; port++) total += (uint32_t)portCurrent(port)*5/12;
+            *value = total;
+            return aErrNone;
+        }
+        case systemUptime:          *value = (uint32_t)(m_clock.elapsed()/60000); return aErrNone;
+        case systemMaxTemperature:  *value = 41000000; return aErrNone;
+        default:                    return aErrUnimplemented;
+        }
+    }
+
+    if(command == cmdTEMPERATURE){
+        if(option != temperatureMicroCelsius)
+            return aErrUnimplemented;
+        double seconds = m_clock.elapsed()/1000.0;
+        *value = (uint32_t)(int32_t)(36000000 + 1500000*std::sin(seconds/60.0)
+                                     + std::uniform_int_distribution<int>(-50000, 50000)(m_random));
+        return aErrNone;
+    }
+
+    if(command != cmdUSB)
+        return aErrUnimplemented;
+
+    if(isPortOption(command, option) && (subindex < 0 || subindex >= m_numPorts))
+        return aErrIndexRange;
+
+    switch(option){
+    case usbPortVoltage:            *value = (uint32_t)portVoltage(subindex); return aErrNone;
+    case usbPortCurrent:            *value = (uint32_t)portCurrent(subindex); return aErrNone;
+    case usbPortCurrentLimit:       *value = m_currentLimit[subindex]; return aErrNone;
+    case usbPortMode:               *value = m_portMode[subindex]; return aErrNone;
+    case usbPortState:              *value = portState(subindex); return aErrNone;
+    case usbPortError:              *value = m_portError[subindex]; return aErrNone;
+    case usbHubMode:                *value = hubMode(); return aErrNone;
+    case usbUpstreamState:          *value = usbUpstreamStatePort0; *valueSize = 1; return aErrNone;
+    case usbUpstreamMode:           *value = m_upstreamMode; *valueSize = 1; return aErrNone;
+    case usbUpstreamBoostMode:      *value = m_upstreamBoost; *valueSize = 1; return aErrNone;
+    case usbDownstreamBoostMode:    *value = m_downstreamBoost; *valueSize = 1; return aErrNone;
+    case usbHubEnumerationDelay:    *value = m_enumerationDelay; return aErrNone;
+    default:                        return aErrUnimplemented;
+    }
+}
+
+aErr SimulatedHub::handleSet(uint8_t command, uint8_t option, uint8_t index, int subindex, uint32_t value){
+    if(index != 0)
+        return aErrIndexRange;
+
+    if(command == cmdSYSTEM){
+        switch(option){
+        case systemLED:     m_led = value ? 1 : 0; return aErrNone;
+        case systemSave:    return aErrNone;
+        case systemReset:   return aErrNone;
+        default:            return aErrUnimplemented;
+        }
+    }
+
+    if(command != cmdUSB)
+        return aErrUnimplemented;
+
+    if(isPortOption(command, option) && (subindex < 0 || subindex >= m_numPorts))
+        return aErrIndexRange;
+
+    bool superSpeed = (m_config.model == aMODULE_TYPE_USBHub3p);
+    switch(option){
+    case usbPortEnable:
+        m_power[subindex] = m_hiSpeed[subindex] = true;
+        m_superSpeed[subindex] = superSpeed;
+        return aErrNone;
+    case usbPortDisable:
+        m_power[subindex] = m_hiSpeed[subindex] = m_superSpeed[subindex] = false;
+        return aErrNone;
+    case usbDataEnable:
+        m_hiSpeed[subindex] = true;
+        m_superSpeed[subindex] = superSpeed;
+        return aErrNone;
+    case usbDataDisable:
+        m_hiSpeed[subindex] = m_superSpeed[subindex] = false;
+        return aErrNone;
+    case usbPowerEnable:            m_power[subindex] = true; return aErrNone;
+    case usbPowerDisable:           m_power[subindex] = false; return aErrNone;
+    case usbHiSpeedDataEnable:      m_hiSpeed[subindex] = true; return aErrNone;
+    case usbHiSpeedDataDisable:     m_hiSpeed[subindex] = false; return aErrNone;
+    case usbSuperSpeedDataEnable:
+        if(!superSpeed) return aErrUnimplemented;
+        m_superSpeed[subindex] = true;
+        return aErrNone;
+    case usbSuperSpeedDataDisable:  m_superSpeed[subindex] = false; return aErrNone;
+    case usbPortClearErrorStatus:   m_portError[subindex] = 0; return aErrNone;
+    case usbPortCurrentLimit:       m_currentLimit[subindex] = value; return aErrNone;
+    case usbPortMode:               m_portMode[subindex] = value; return aErrNone;
+    case usbUpstreamMode:           m_upstreamMode = (uint8_t)value; return aErrNone;
+    case usbUpstreamBoostMode:      m_upstreamBoost = (uint8_t)value; return aErrNone;
+    case usbDownstreamBoostMode:    m_downstreamBoost = (uint8_t)value; return aErrNone;
+    case usbHubEnumerationDelay:    m_enumerationDelay = value; return aErrNone;
+    default:                        return aErrUnimplemented;
+    }
+}
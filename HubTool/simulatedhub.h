@@ -0,0 +1,117 @@
+#ifndef SIMULATEDHUB_H
+#define SIMULATEDHUB_H
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "BrainStem2/BrainStem-all.h"
+#include "BrainStem2/aStream.h"
+
+// A USBHub3+ or USBHub2x4 that lives behind an aStream instead of a USB
+// cable. It decodes the BrainStem packets the link writes to the stream,
+// answers UEI gets and sets (and heartbeats) from its own model of the hub,
+// and queues the replies to be read back after a configurable latency, with
+// jitter and packet loss. A link made with aLink_Create(createStream())
+// carries real packets, so the router, the polling and the command paths
+// all run unchanged against it.
+//
+// Only what HubTool polls and sets is modelled: port power/data/enable,
+// voltage, current, state, error, current limit and mode, the hub mode, the
+// system info, input power, temperature, uptime, LED, upstream and downstream
+// settings. Anything else gets an aErrUnimplemented error reply.
+class SimulatedHub
+{
+public:
+    struct Config {
+        Config();
+
+        uint8_t model;          // aMODULE_TYPE_USBHub3p or aMODULE_TYPE_USBHub2x4
+        uint32_t serialNumber;
+        int latencyUs;          // from the request to its reply
+        int jitterUs;           // uniform, added on top of latencyUs
+        double lossRate;        // 0..1, fraction of replies that never arrive
+
+        // "latency=200,jitter=50,loss=0.01", any subset; unknown keys are ignored
+        static Config fromString(const QString &options, const Config &defaults = Config());
+    };
+
+    explicit SimulatedHub(const Config &config = Config());
+    ~SimulatedHub();
+
+    // the link takes ownership of the stream; the hub has to outlive the link
+    aStreamRef createStream();
+
+    uint8_t moduleAddress() const { return m_moduleAddress; }
+    const Config& config() const { return m_config; }
+
+    void setLatency(int latencyUs, int jitterUs);
+    void setLossRate(double lossRate);
+
+    // counters, safe to read from any thread
+    uint32_t requestCount() const { return m_requests.load(); }
+    uint32_t droppedCount() const { return m_dropped.load(); }
+
+    // whether a UEI option on command carries a subindex (a port number)
+    static bool isPortOption(uint8_t command, uint8_t option);
+
+private:
+    static aErr sGet(uint8_t* pData, void* ref);
+    static aErr sPut(const uint8_t* pData, void* ref);
+    static aErr sWrite(const uint8_t* pData, const size_t nSize, void* ref);
+    static aErr sDelete(void* ref);
+
+    // everything below runs on the link's thread with m_lock held
+    void accept(uint8_t byte);
+    void handlePacket(const uint8_t* data, uint8_t size);
+    aErr handleGet(uint8_t command, uint8_t option, uint8_t index, int subindex, uint32_t* value, uint8_t* valueSize);
+    aErr handleSet(uint8_t command, uint8_t option, uint8_t index, int subindex, uint32_t value);
+    void queueReply(const uint8_t* data, uint8_t size);
+
+    int32_t portVoltage(int port);
+    int32_t portCurrent(int port);
+    uint32_t portState(int port) const;
+    uint32_t hubMode() const;
+
+    struct Reply {
+        qint64 dueUs;
+        std::vector<uint8_t> bytes;
+    };
+
+    Config m_config;
+    uint8_t m_moduleAddress;
+    int m_numPorts;
+
+    std::mutex m_lock;
+    QElapsedTimer m_clock;
+    std::mt19937 m_random;
+    std::deque<Reply> m_replies;
+    size_t m_replyOffset;           // bytes of the front reply already read
+    uint8_t m_packet[2 + aBRAINSTEM_MAXPACKETBYTES];
+    uint8_t m_packetSize;
+    bool m_streamOpen;
+
+    std::atomic<uint32_t> m_requests;
+    std::atomic<uint32_t> m_dropped;
+
+    // the modelled hub
+    bool m_power[8];
+    bool m_hiSpeed[8];
+    bool m_superSpeed[8];
+    uint32_t m_currentLimit[8];     // uA
+    uint32_t m_portMode[8];
+    uint32_t m_portError[8];
+    uint32_t m_loadCurrent[8];      // uA drawn by the simulated device on each port
+    uint8_t m_led;
+    uint8_t m_upstreamMode;
+    uint8_t m_upstreamBoost;
+    uint8_t m_downstreamBoost;
+    uint32_t m_enumerationDelay;    // ms
+};
+
+#endif // SIMULATEDHUB_H
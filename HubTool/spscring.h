@@ -0,0 +1,58 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed size single producer / single consumer queue. push() may only be
+// called from one thread at a time and pop() from one other thread; neither
+// locks or allocates. Capacity has to be a power of two.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : m_head(0), m_tail(0) {}
+
+    // producer side; false when the consumer has fallen a whole ring behind
+    bool push(const T &item){
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head - m_tail.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        m_items[head & (Capacity - 1)] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side; false when there's nothing queued
+    bool pop(T &item){
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail == m_head.load(std::memory_order_acquire))
+            return false;
+
+        item = m_items[tail & (Capacity - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only a hint when called from the other side
+    size_t size() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    static size_t capacity() { return Capacity; }
+
+private:
+    // keep the two indices on separate cache lines so the threads don't share one
+    std::atomic<size_t> m_head;
+    char m_headPad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;
+    char m_tailPad[64 - sizeof(std::atomic<size_t>)];
+
+    T m_items[Capacity];
+};
+
+#endif // SPSCRING_H
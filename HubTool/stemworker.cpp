@@ -1,5 +1,10 @@
 #include "stemworker.h"
 #include <QDebug>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <string.h>
 
 #include "BrainStem2/aUSBHub3p.h"
 #include "BrainStem2/aUSBHub2x4.h"
@@ -7,12 +12,24 @@
 #define DEMO_AS_USBHUB3P 1
 #define SLOT_FOR_NAMES 10
 
+// a sample recording starts a new file once a day, and a hub's old files go
+// once they're a week old or there's more than this much of them
+#define SAMPLE_FILE_ROTATE_MS (24*60*60*1000LL)
+#define SAMPLE_RETENTION_DAYS 7
+#define SAMPLE_RETENTION_BYTES (2LL*1024*1024*1024)
+
 StemWorker::StemWorker(linkSpec* spec) :
     module(0),
+    pollTimer(nullptr),
+    callTimingEnabled(false),
+    simulatedHub(nullptr),
+    linkRecorder(nullptr),
+    linkReplay(nullptr),
+    commandFlushPending(false),
+    namesWritePending(false),
     numUSB(0),
     connectedModel(0),
     firmwareVersion(0),
-    connectRetryCount(0),
     firstPollingEvent(true),
     hubMode(0xFFFFFFFF),
     portState{0,0,0,0,0,0,0,0},
@@ -34,13 +51,84 @@ StemWorker::StemWorker(linkSpec* spec) :
     boostUpstream(0xFF),
     enumDelay(0xFFFFFFFF),
     boostDownstream(0xFF),
-    uptime(0)
+    uptime(0),
+    pipelinedAcquisition(true)
 {
 
     if(spec) {
         stemToolSpec = *spec;
     }
     else { stemToolSpec.serial_num = 0; }
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    energyDirectory = defaultEnergyDirectory();
+    energyClock.start();
+    triggerClock.start();
+    for(int channel = 0; channel < 8; channel++){
+        repowerDueUs[channel] = -1;
+    }
+
+    router.setPacketCapture(&packetCapture);
+    setupPollScheduler();
+}
+
+// Static and configuration entities don't need to be read as often as the
+// port measurements, so each update gets its own period:
+//  - port voltage/current runs every pass, as fast as the link allows
+//  - port/hub state and errors run at 10Hz
+//  - temperature, uptime and configuration run at 1Hz, and immediately
+//    after the user changes one of them
+//  - the stem info only runs on (re)connect
+void StemWorker::setupPollScheduler(){
+    scheduler.addEntity("stemInfo", [this]{ updateStemInfo(); getPortNames(); },
+                        PollScheduler::OnDemand, PollScheduler::PriorityHigh);
+    scheduler.addEntity("portVoltageCurrent", [this]{ updatePortVoltageAndCurrent(); },
+                        PollScheduler::EveryPass, PollScheduler::PriorityHigh);
+
+    scheduler.addEntity("hubState", [this]{ updatedHubState(); },
+                        100, PollScheduler::PriorityNormal);
+    scheduler.addEntity("hubErrorStatus", [this]{ updateHubErrorStatus(); },
+                        100, PollScheduler::PriorityNormal);
+    scheduler.addEntity("hubMode", [this]{ updateHubMode(); },
+                        100, PollScheduler::PriorityNormal);
+    scheduler.addEntity("upstreamPort", [this]{ updateUpstreamPort(); },
+                        100, PollScheduler::PriorityNormal);
+    scheduler.addEntity("inputVoltage", [this]{
+                            if(connectedModel == aMODULE_TYPE_USBHub2x4)
+                                updateInputVoltage();
+                            else
+                                updateInputVoltageCurrent();
+                        }, 100, PollScheduler::PriorityNormal);
+
+    scheduler.addEntity("temperature", [this]{ updateTemperature(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("uptime", [this]{ updateUptime(); },
+                        1000, PollScheduler::PriorityLow);
+
+    scheduler.addEntity("currentLimit", [this]{ updateCurrentLimit(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("portMode", [this]{ updatePortMode(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("userLed", [this]{ updateUserLed(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("upstreamMode", [this]{ updateUpstreamMode(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("upstreamBoost", [this]{ updateUpstreamBoost(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("enumerationDelay", [this]{ updateEnumerationDelay(); },
+                        1000, PollScheduler::PriorityLow);
+    scheduler.addEntity("downstreamBoost", [this]{ updateDownstreamBoost(); },
+                        1000, PollScheduler::PriorityLow);
+
+    pollRatesReportTimer.start();
+}
+
+QStringList StemWorker::pollEntityNames() const {
+    QStringList names;
+    for(int id = 0; id < scheduler.count(); id++){
+        names.append(scheduler.name(id));
+    }
+    return names;
 }
 
 void StemWorker::start(){
@@ -57,11 +145,15 @@ StemWorker::~StemWorker() {
     #endif
     qDebug() << "cleanin up from stemworker";
 
-    // Disconnect from the module
+    // Disconnect from the module; the simulated hub has to outlive its link
+    router.detach();
     module.disconnect();
+    delete simulatedHub;
+    delete linkRecorder;
+    delete linkReplay;
 }
 
-static bContinueSearch sFindAllHubs(const linkSpec* spec, bool* bSuccess, void* vpCBRef) {
+bContinueSearch StemWorker::sFindAllHubs(const linkSpec* spec, bool* bSuccess, void* vpCBRef) {
 
     list<linkSpec>* pSpecs = (std::list<linkSpec>*)vpCBRef;
     if (spec->model == aMODULE_TYPE_USBHub2x4 || spec->model == aMODULE_TYPE_USBHub3p) {
@@ -81,7 +173,12 @@ void StemWorker::connectStemWithDialog() {
 
     switch (devicesDiscovered.size()){
     case 0:
-        emit(requestMsgBox(QString("No devices found.\nRunning in demo mode.")));
+        // nothing to talk to, so poll a simulated hub instead
+        emit(requestMsgBox(QString("No devices found.\nRunning against a simulated hub.")));
+        spec.type = INVALID;
+        spec.serial_num = 0;
+        spec.model = 0;
+        initializeStem(&spec);
         break;
     case 1:
         // One device found. Connect to it.
@@ -120,15 +217,20 @@ void StemWorker::initializeStem(linkSpec* spec) {
     default:
         //Not a hub
         if(DEMO_AS_USBHUB3P){
-            emit logStringReady("No link found. Running in demo mode as USBHub3+.");
             connectedModel = aMODULE_TYPE_USBHub3p;
             numUSB = 8;
         }
         else{
-            emit logStringReady("No link found. Running in demo mode as USBHub2x4+.");
             connectedModel = aMODULE_TYPE_USBHub2x4;
             numUSB = 4;
         }
+        if(!qgetenv("HUBTOOL_REPLAY").isEmpty())   { startReplay();            }
+        else                                        { startSimulation(spec);    }
+        return;
+    }
+
+    if(spec->type == USB && !qgetenv("HUBTOOL_RECORD").isEmpty()){
+        startRecording(spec);
         return;
     }
 
@@ -155,6 +257,143 @@ void StemWorker::initializeStem(linkSpec* spec) {
     usb.init(&module, 0);
     temp.init(&module, 0);
 
+    err = router.attach(*spec, module.getModuleAddress());
+    if (err != aErrNone){
+        emit logStringReady(QString("Error attaching UEI router: %1").arg(err));
+    }
+}
+
+// Demo mode: poll a simulated hub over a stream instead of making values up.
+// HUBTOOL_SIMULATION takes SimulatedHub::Config options, for example
+// "latency=300,jitter=100,loss=0.01,model=2x4".
+void StemWorker::startSimulation(linkSpec* spec){
+    SimulatedHub::Config defaults;
+    defaults.model = connectedModel;
+    if(spec && spec->serial_num != 0){
+        defaults.serialNumber = spec->serial_num;
+    }
+    SimulatedHub::Config config = SimulatedHub::Config::fromString(QString::fromLocal8Bit(qgetenv("HUBTOOL_SIMULATION")), defaults);
+
+    connectedModel = config.model;
+    numUSB = (connectedModel == aMODULE_TYPE_USBHub2x4) ? 4 : 8;
+    QString modelName = (connectedModel == aMODULE_TYPE_USBHub2x4) ? "USBHub2x4" : "USBHub3+";
+
+    // the entities only supply their indexes to the router here
+    system.init(&module, 0);
+    store[0].init(&module, storeInternalStore);
+    store[1].init(&module, storeRAMStore);
+    usb.init(&module, 0);
+    temp.init(&module, 0);
+
+    simulatedHub = new SimulatedHub(config);
+    aErr err = router.attachStream(simulatedHub->createStream(), simulatedHub->moduleAddress());
+    if (err != aErrNone){
+        emit logStringReady(QString("No link found, and the simulated %1 didn't start: %2. Nothing will be polled.").arg(modelName).arg(err));
+        delete simulatedHub;
+        simulatedHub = nullptr;
+        return;
+    }
+
+    emit logStringReady(QString("No link found. Running against a simulated %1 (latency %2us, jitter %3us, loss %4%).")
+                        .arg(modelName)
+                        .arg(config.latencyUs)
+                        .arg(config.jitterUs)
+                        .arg(config.lossRate*100.0));
+}
+
+// HUBTOOL_RECORD names the recording, or a directory to put
+// hub-<serial>.hublink in. The Module isn't connected, since the USB device
+// can only be opened once, so the store backed features (names, event logs)
+// and reconnects aren't available while recording.
+void StemWorker::startRecording(linkSpec* spec){
+    QString path = QString::fromLocal8Bit(qgetenv("HUBTOOL_RECORD"));
+    QString serial = QString("%1").arg(spec->serial_num, 8, 16, QChar('0')).toUpper();
+    if(QFileInfo(path).isDir()){
+        path = QDir(path).filePath(QString("hub-%1.hublink").arg(serial));
+    }
+
+    aStreamRef usbStream = nullptr;
+    aErr err = aStream_CreateUSB(spec->serial_num, &usbStream);
+    if (err != aErrNone){
+        emit logStringReady(QString("Error connecting to device: %1").arg(err));
+        return;
+    }
+
+    LinkRecordingInfo info;
+    info.model = connectedModel;
+    info.moduleAddress = module.getModuleAddress();
+    info.serialNumber = spec->serial_num;
+
+    aStreamRef recorded = nullptr;
+    linkRecorder = new LinkRecorder();
+    err = linkRecorder->wrap(usbStream, path, info, &recorded);
+    if (err != aErrNone){
+        emit logStringReady(QString("Error recording to %1: %2").arg(path).arg(linkRecorder->errorString()));
+        aStream_Destroy(&usbStream);
+        delete linkRecorder;
+        linkRecorder = nullptr;
+        return;
+    }
+
+    // the entities only supply their indexes to the router here
+    system.init(&module, 0);
+    store[0].init(&module, storeInternalStore);
+    store[1].init(&module, storeRAMStore);
+    usb.init(&module, 0);
+    temp.init(&module, 0);
+
+    err = router.attachStream(recorded, info.moduleAddress);
+    if (err != aErrNone){
+        emit logStringReady(QString("Error connecting to device: %1").arg(err));
+        return;
+    }
+
+    emit logStringReady(QString("Connected to 0x%1, recording the link to %2").arg(serial).arg(path));
+    emit Sig_Secondary_GUI_Init();
+}
+
+// HUBTOOL_REPLAY names a recording made with HUBTOOL_RECORD, and
+// HUBTOOL_REPLAY_SPEED how fast to play it back: 1 (the default) for the
+// recorded timing, 0 for no delay at all.
+void StemWorker::startReplay(){
+    QString path = QString::fromLocal8Bit(qgetenv("HUBTOOL_REPLAY"));
+    bool speedOk = false;
+    double speed = QString::fromLocal8Bit(qgetenv("HUBTOOL_REPLAY_SPEED")).toDouble(&speedOk);
+
+    linkReplay = new LinkReplay();
+    if(!linkReplay->load(path)){
+        emit logStringReady(QString("Error loading the recording %1: %2").arg(path).arg(linkReplay->errorString()));
+        delete linkReplay;
+        linkReplay = nullptr;
+        return;
+    }
+    linkReplay->setSpeed(speedOk ? speed : 1.0);
+
+    const LinkRecordingInfo &info = linkReplay->info();
+    connectedModel = info.model;
+    numUSB = (connectedModel == aMODULE_TYPE_USBHub2x4) ? 4 : 8;
+
+    // the entities only supply their indexes to the router here
+    system.init(&module, 0);
+    store[0].init(&module, storeInternalStore);
+    store[1].init(&module, storeRAMStore);
+    usb.init(&module, 0);
+    temp.init(&module, 0);
+
+    aErr err = router.attachStream(linkReplay->createStream(), info.moduleAddress);
+    if (err != aErrNone){
+        emit logStringReady(QString("Error starting the replay of %1: %2").arg(path).arg(err));
+        return;
+    }
+
+    emit logStringReady(QString("Replaying 0x%1 from %2 at %3x")
+                        .arg(info.serialNumber, 8, 16, QChar('0'))
+                        .arg(path)
+                        .arg(speedOk ? speed : 1.0));
+}
+
+bool StemWorker::hubLinked() const {
+    return module.isConnected() || ((simulatedHub || linkRecorder || linkReplay) && router.linkUp());
 }
 
 void StemWorker::connectUserChosenStem(QString stemSerialNumber) {
@@ -168,9 +407,157 @@ void StemWorker::connectUserChosenStem(QString stemSerialNumber) {
     }
 }
 
+// Polling re-arms itself from the worker's own thread, so the cadence doesn't
+// depend on how busy the GUI is. Call once the worker is on its thread.
+void StemWorker::startPolling(){
+    // the timer has to be created here so it lives on the worker's thread
+    if(!pollTimer){
+        pollTimer = new QTimer(this);
+        pollTimer->setSingleShot(true);
+        pollTimer->setTimerType(Qt::PreciseTimer);
+        connect(pollTimer, SIGNAL(timeout()), this, SLOT(pollStemForChanges()));
+    }
+    pollTimer->start(0);
+}
+
+void StemWorker::setTargetRate(double hz){
+    rateController.setTargetRate(hz);
+}
+
+int StemWorker::nextPollDelayMs() const {
+    // while the link is down the reconnect backoff sets the pace
+    if(!connection.isUp())
+        return connection.msUntilNextAttempt();
+    return rateController.nextDelayMs();
+}
+
+bool StemWorker::isOwnHub(uint32_t serial) const {
+    return serial != 0 && (serial == stemToolSpec.serial_num || serial == serialNumber);
+}
+
+// The hub is back, so skip whatever is left of the reconnect backoff.
+void StemWorker::hubAttached(const linkSpec &spec){
+    if(!isOwnHub(spec.serial_num) || connection.isUp())
+        return;
+
+    connection.retryNow();
+    if(pollTimer){
+        pollTimer->start(0);
+    }
+}
+
+// Poll straight away so the drop is noticed now rather than on the next tick.
+void StemWorker::hubDetached(uint32_t serialNumber){
+    if(!isOwnHub(serialNumber) || !connection.isUp())
+        return;
+
+    if(pollTimer){
+        pollTimer->start(0);
+    }
+}
+
+void StemWorker::finishPollCycle(){
+    emit finishedPolling();
+
+    if(pollTimer){
+        pollTimer->start(nextPollDelayMs());
+    }
+}
+
+// Runs on the poll ticks while the link is down. The old link is torn down
+// once, when the drop is first seen, and after that a reconnect is only tried
+// when the backoff says so rather than on every tick.
+void StemWorker::reconnectStem(const linkSpec &spec){
+    if(connection.isUp()){
+        connection.linkLost();
+        emit logStringReady(QString("Lost link. Trying to reconnect."));
+
+        // the outage isn't counted as energy, or as a condition holding
+        energyMeter.restart();
+        triggers.restart();
+
+        // nothing outstanding is going to be answered
+        router.detach();
+        commands.clear(aErrConnection);
+        module.disconnect();
+
+        // the readings stay as they were, but the consumers see the link is down
+        updateConnectionFields();
+        publishSnapshot();
+    }
+
+    if(connection.attemptDue()){
+        module.reconnect();
+
+        // without the router's link nothing could be polled, so that's a
+        // failed attempt too
+        aErr err = aErrConnection;
+        if(module.isConnected()){
+            err = router.attach(spec, module.getModuleAddress());
+            if(err != aErrNone){
+                emit logStringReady(QString("Error attaching UEI router: %1").arg(err));
+                module.disconnect();
+            }
+        }
+
+        if(err == aErrNone){
+            connection.reconnected();
+            emit logStringReady(QString("Reconnected to %1 after %2ms, %3 attempt(s)")
+                                .arg(QString("0x%1").arg(spec.serial_num, 8, 16, QChar('0')).toUpper())
+                                .arg(connection.lastReconnectMs())
+                                .arg(connection.attemptCount()));
+            emit Sig_Secondary_GUI_Init();
+            requestRunAfterReconnect(spec.serial_num);
+        }
+        else {
+            ConnectionMonitor::State before = connection.state();
+            connection.attemptFailed();
+            if(before != ConnectionMonitor::Lost && connection.state() == ConnectionMonitor::Lost){
+                emit logStringReady(QString("Hub still missing after %1 attempts, retrying less often.")
+                                    .arg(connection.attemptCount()));
+            }
+            updateConnectionFields();
+            publishSnapshot();
+        }
+    }
+
+    if(pollRatesReportTimer.elapsed() >= 1000){
+        pollRatesReportTimer.restart();
+        emit pollRatesChanged(connection.summary());
+    }
+
+    finishPollCycle();
+}
+
+// The stem info and port names are only worth reading again if they might
+// have changed while the hub was away: a different hub on the same link, an
+// earlier read that never completed, or new firmware (a firmware update
+// resets the hub). The firmware check is a single request.
+bool StemWorker::staticInfoStillValid(uint32_t serial){
+    if(serial != serialNumber || firmwareVersion == 0xFFFFFFFF)
+        return false;
+
+    uint32_t version = 0;
+    if(router.get(cmdSYSTEM, systemVersion, system.getIndex(), UEIRouter::NoSubindex, &version) != aErrNone)
+        return false;
+    return version == firmwareVersion;
+}
+
+void StemWorker::requestRunAfterReconnect(uint32_t serial){
+    // everything dynamic may have moved while the hub was away
+    for(int id = 0; id < scheduler.count(); id++){
+        if(id != pollStemInfo) scheduler.requestRun(id);
+    }
+
+    if(!staticInfoStillValid(serial)){
+        scheduler.requestRun(pollStemInfo);
+    }
+}
+
 void StemWorker::pollStemForChanges(){
     linkSpec currentLinkSpec;
     aErr err = aErrNone;
+
     err = module.getLinkSpecifier(&currentLinkSpec);
 
     //check if we're connected to the stem and reconnect if we aren't
@@ -180,67 +567,92 @@ void StemWorker::pollStemForChanges(){
        && currentLinkSpec.type != INVALID
        && !module.isConnected() )
     {
-        if(connectRetryCount == 0){
-            // periodically print a reconnect message using the roll over of the int8
-            emit logStringReady(QString("Lost link. Trying to reconnect."));
-        }
-
-        // tear down the old link to be sure we're clean
-        module.disconnect();
-
-        // try to reconnect to the stem
-        module.reconnect();
+        // outages don't count against the polling rate
+        reconnectStem(currentLinkSpec);
+        return;
+    }
 
-        if(module.isConnected()){
-            firstPollingEvent = true;
-            emit logStringReady(QString("Reconnected to %1").arg(QString("0x%1").arg(currentLinkSpec.serial_num, 8, 16, QChar('0')).toUpper()));
-            emit Sig_Secondary_GUI_Init();
+    // no hub and nothing standing in for one; say so once rather than
+    // publishing readings nobody took
+    if(!hubLinked()){
+        commands.clear(aErrConnection);
+        if(snapshot.connectionState != ConnectionMonitor::Lost){
+            updateConnectionFields();
+            snapshot.connectionState = ConnectionMonitor::Lost;
+            publishSnapshot();
         }
-
-        //QThread::msleep(100);
-        connectRetryCount++;
-        emit finishedPolling();
+        finishPollCycle();
         return;
     }
 
-    // reset the reconnection and clean up
-    connectRetryCount = 0;
+    // anything the user changed since the last cycle goes out first, and
+    // doesn't count against the polling
+    repowerDuePorts();
+    flushCommands();
+    rateController.cycleStarted();
+    uint32_t errorsAtStart = router.errorCount();
 
-    // system parts
+    // a fresh connection needs everything read, starting with the stem info
     if(firstPollingEvent){
-        updateStemInfo();
-        // try to read the port names
-        getPortNames();
+        scheduler.requestRunAll();
         firstPollingEvent = false;
     }
-    updateTemperature();
-    if(connectedModel == aMODULE_TYPE_USBHub2x4)
-        updateInputVoltage();
-    else
-        updateInputVoltageCurrent();
-    updateUserLed();
-
-    // per port parts
-    updatePortVoltageAndCurrent();
-    updateHubMode();
-    updatedHubState();
-    updateHubErrorStatus();
-    updateCurrentLimit();
-    updatePortMode();
-
-    // upstream parts
-    updateUpstreamPort();
-    updateUpstreamMode();
-    updateUpstreamBoost();
-
-    // downstream parts
-    updateEnumerationDelay();
-    updateDownstreamBoost();
-
-    //uptime
-    updateUptime();
 
-    emit finishedPolling();
+    scheduler.runDue();
+
+    // the rates go out in the snapshot, so close the cycle out first; the
+    // timer is only re-armed once everything else is done
+    uint32_t cycleErrors = router.errorCount() - errorsAtStart;
+    rateController.cycleFinished(cycleErrors, scheduler.lastPassMask());
+    connection.cycleFinished(cycleErrors);
+    updateConnectionFields();
+    publishSnapshot();
+
+    if(pollRatesReportTimer.elapsed() >= 1000){
+        pollRatesReportTimer.restart();
+        QString rates = connection.summary() + "\n" + rateController.summary() + "\n" + scheduler.rateSummary();
+        QString triggerSummary = triggers.summary();
+        if(!triggerSummary.isEmpty()){
+            rates += "\n" + triggerSummary;
+        }
+        emit pollRatesChanged(rates);
+        if(callTimingEnabled){
+            emit callTimingsChanged(callStats.summaries());
+        }
+    }
+
+    finishPollCycle();
+}
+
+
+void StemWorker::updateConnectionFields(){
+    snapshot.achievedRate = rateController.achievedRate();
+    snapshot.targetRate = rateController.targetRate();
+    snapshot.allowedRate = rateController.allowedRate();
+    snapshot.connectionState = connection.state();
+    snapshot.reconnectCount = connection.reconnectCount();
+    snapshot.reconnectAttempts = connection.totalAttemptCount();
+    snapshot.lastReconnectMs = (int32_t)connection.lastReconnectMs();
+}
+
+// Hands this cycle's snapshot to the UI. If the UI has fallen a whole queue
+// behind, the changed bits are kept and go out with the next cycle instead.
+void StemWorker::publishSnapshot(){
+    snapshot.sequence++;
+    snapshot.timestampMs = QDateTime::currentMSecsSinceEpoch();
+    snapshot.numUSB = numUSB;
+
+    if(!sampleDirectory.isEmpty()){
+        recordSamples();
+    }
+
+    if(snapshotQueue.push(snapshot)){
+        snapshot.changed = 0;
+        snapshot.portStateChanged = 0;
+        snapshot.portErrorChanged = 0;
+        snapshot.currentLimitChanged = 0;
+        snapshot.portModeChanged = 0;
+    }
 }
 
 
@@ -250,40 +662,95 @@ void StemWorker::pollStemForChanges(){
 void StemWorker::updatePortVoltageAndCurrent(){
     aErr err = aErrNone;
 
-    // check for connnection
-    bool stemConnected = module.isConnected();
+    // without a link there's nothing to read, so nothing is published
+    bool stemConnected = hubLinked();
+    if(!stemConnected)
+        return;
+
+    int32_t newVoltage[8] = {0,0,0,0,0,0,0,0};
+    int32_t newAmps[8] = {0,0,0,0,0,0,0,0};
+
+    if(stemConnected && pipelinedAcquisition){
+        err = acquirePortVoltageAndCurrentPipelined(newVoltage, newAmps);
+        if (err != aErrNone){
+            emit logStringReady(QString("Error updating port voltage and current. Err: %1").arg(err));
+            return;
+        }
+    }
+    else {
+        // read each port's voltage
+        for (uint8_t channel = 0; channel < numUSB; channel++){
+            if(stemConnected){
+                err = router.get(cmdUSB, usbPortVoltage, usb.getIndex(), channel, (uint32_t*)&newVoltage[channel]);
+                if (err != aErrNone){
+                    emit logStringReady(QString("Error updating port voltage %1. Err: %2").arg(channel).arg(err));
+                    return;
+                } // aErrNone
+
+                err = router.get(cmdUSB, usbPortCurrent, usb.getIndex(), channel, (uint32_t*)&newAmps[channel]);
+                //qDebug("amps: %d, channel: %d", newAmps, channel);
+                if (err != aErrNone){
+                    emit logStringReady(QString("Error updating port current %1. Err: %2").arg(channel).arg(err));
+                    return;
+                } // aErrNone
+
+            } // stem connected
+        } // for channel
+    }
 
+    // the rules see the readings before anything else does
+    int64_t values[8];
+    for (uint8_t channel = 0; channel < numUSB; channel++) values[channel] = newVoltage[channel];
+    checkTriggers(TriggerEngine::PortVoltage, values, numUSB);
+    for (uint8_t channel = 0; channel < numUSB; channel++) values[channel] = newAmps[channel];
+    checkTriggers(TriggerEngine::PortCurrent, values, numUSB);
 
-    // read each port's voltage
+    // always publish so the plots are smooth as can be
     for (uint8_t channel = 0; channel < numUSB; channel++){
-        int32_t newVoltage = 0;
-        int32_t newAmps = 0;
-        if(stemConnected){
-            // To make sure things stay in sync, drain any UEI packets of this request
-            usb.drainUEI(usbPortVoltage);
-            err = usb.getPortVoltage(channel, &newVoltage);
-            if (err != aErrNone){
-                emit logStringReady(QString("Error updating port voltage %1. Err: %2").arg(channel).arg(err));
-                return;
-            } // aErrNone
+        snapshot.portVoltage[channel] = newVoltage[channel];
+        snapshot.portCurrent[channel] = newAmps[channel];
+    }
+    snapshot.changed |= HubSnapshot::ChangedPortVoltageCurrent;
 
-            usb.drainUEI(usbPortCurrent);
-            err = usb.getPortCurrent(channel, &newAmps);
-            //qDebug("amps: %d, channel: %d", newAmps, channel);
-            if (err != aErrNone){
-                emit logStringReady(QString("Error updating port current %1. Err: %2").arg(channel).arg(err));
-                return;
-            } // aErrNone
+    accountEnergy(newVoltage, newAmps);
+}
 
-        } // stem connected
-        else {
-            newVoltage = rand() % 1000000 + 4500000;
-            newAmps = rand() % 2900000;
-        }
+// Puts every port voltage and current request on the link before waiting for
+// any of the replies. The router hands each reply to its port as it arrives,
+// so a full read costs about one link round trip instead of one per request.
+aErr StemWorker::acquirePortVoltageAndCurrentPipelined(int32_t* voltages, int32_t* currents){
+    aErr firstErr = aErrNone;
 
-        // always emit so the plots are smooth as can be
-        emit portVoltageCurrentChanged(channel, newVoltage, newAmps);
-    } // for channel
+    submitPortGets(usbPortVoltage, (uint32_t*)voltages, &firstErr);
+    submitPortGets(usbPortCurrent, (uint32_t*)currents, &firstErr);
+
+    aErr err = router.awaitAll();
+    return (firstErr != aErrNone) ? firstErr : err;
+}
+
+// Reads one per port UEI for every port with all of the requests outstanding at once.
+aErr StemWorker::acquirePortValues(uint8_t option, uint32_t* values){
+    aErr firstErr = aErrNone;
+
+    submitPortGets(option, values, &firstErr);
+
+    aErr err = router.awaitAll();
+    return (firstErr != aErrNone) ? firstErr : err;
+}
+
+// Queues a get of option for every port; the replies land in values[channel]
+// and the first error in firstErr. Both have to outlive the router.awaitAll()
+// that collects them.
+void StemWorker::submitPortGets(uint8_t option, uint32_t* values, aErr* firstErr){
+    for (uint8_t channel = 0; channel < numUSB; channel++){
+        router.submitGet(cmdUSB, option, usb.getIndex(), channel, [=](aErr err, uint32_t value){
+            if (err != aErrNone){
+                if (*firstErr == aErrNone) *firstErr = err;
+                return;
+            }
+            values[channel] = value;
+        });
+    }
 }
 
 void StemWorker::updateHubMode(){
@@ -292,24 +759,23 @@ void StemWorker::updateHubMode(){
 
     // if we have a link, then get the data from the connected module
 
-    if(module.isConnected()){
-        // To make sure things stay in sync, drain any UEI packets of this request
-        usb.drainUEI(usbHubMode);
-        err = usb.getHubMode(&newMode);
+    if(hubLinked()){
+        err = router.get(cmdUSB, usbHubMode, usb.getIndex(), UEIRouter::NoSubindex, &newMode);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating hub mode %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newMode = rand() % 0xFFFFFFFF;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newMode != hubMode){
         hubMode = newMode;
-        emit hubModeChanged(newMode);
+        snapshot.hubMode = newMode;
+        snapshot.changed |= HubSnapshot::ChangedHubMode;
     }
 }
 
@@ -319,7 +785,7 @@ void StemWorker::updatedHubState(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
+    if(hubLinked()){
         if(firmwareVersion <  0x25000000){
             if(firmwareUpdateMessageFlag_HubState){
                 emit logStringReady(QString("getPortState is deprecated. Firmware update available."));
@@ -327,51 +793,25 @@ void StemWorker::updatedHubState(){
             firmwareUpdateMessageFlag_HubState = false;
         }
         else {
-            // To make sure things stay in sync, drain any UEI packets of this request.
-            usb.drainUEI(usbPortState);
-            for (uint8_t i = 0; i < numUSB; i++) {
-                err = usb.getPortState(i, &newPortState[i]);
-                if (err != aErrNone){
-                    emit logStringReady(QString("Error updating port status port %1 %2").arg(i).arg(err));
-                    return;
-                }
+            err = acquirePortValues(usbPortState, newPortState);
+            if (err != aErrNone){
+                emit logStringReady(QString("Error updating port status %1").arg(err));
+                return;
             }
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        for (uint8_t i=0; i < numUSB; i++) {
-            newPortState[i] = rand() % 0xFFFFFFFF;
-        }
+        return;
     }
 
-    const int usbDeviceAttached=_BIT(aUSBHUB3P_DEVICE_ATTACHED);
-    const int usbConstantCurrent=_BIT(aUSBHUB2X4_CONSTANT_CURRENT);
-    const int usbError=_BIT(aUSBHUB3P_USB_ERROR_FLAG);
-    const int usbHiSpeed=_BIT(aUSBHUB3P_USB_SPEED_USB2);
-    const int usbSSpeed=_BIT(aUSBHUB3P_USB_SPEED_USB3);
-
+    // the state field is decoded by whoever consumes the snapshot
     for (int channel = 0; channel < numUSB; channel++){
-        // decode the resulting state field
-        QString str;
-        int8_t spd;
-        str = " ";
         if (portState[channel] != newPortState[channel]) {
             portState[channel] = newPortState[channel];
-            str += (portState[channel] & usbDeviceAttached) ? "ATT ": "";
-            str += (portState[channel] & usbConstantCurrent) ? "CC ": "";
-            str += (portState[channel] & usbError) ? "ERR ": "";
-            if (portState[channel] & usbDeviceAttached) {
-                if (portState[channel] & usbHiSpeed) {
-                    spd = usbDownstreamDataSpeed_hs;
-                }
-                if (portState[channel] & usbSSpeed) {
-                    spd = usbDownstreamDataSpeed_ss;
-                }
-            } else {
-                spd = -1;
-            }
-            emit hubStateChanged(channel, str, spd);
+            snapshot.portState[channel] = newPortState[channel];
+            snapshot.portStateChanged |= (1 << channel);
+            snapshot.changed |= HubSnapshot::ChangedPortState;
         }
     } // for channel
 }
@@ -385,7 +825,7 @@ void StemWorker::updateHubErrorStatus(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
+    if(hubLinked()){
         if(firmwareVersion <  0x25000000){
             if(firmwareUpdateMessageFlag_HubError){
                 emit logStringReady(QString("getPortError is deprecated. Firmware update available."));
@@ -393,34 +833,24 @@ void StemWorker::updateHubErrorStatus(){
             firmwareUpdateMessageFlag_HubError = false;
         }
         else {
-            // To make sure things stay in sync, drain any UEI packets of this request.
-            usb.drainUEI(usbPortError);
-            for (uint8_t i = 0; i < numUSB; i++) {
-                err = usb.getPortError(i, &newPortError[i]);
-                if (err != aErrNone){
-                    emit logStringReady(QString("Error updating port errors for port %1 %2").arg(i).arg(err));
-                    return;
-                }
+            err = acquirePortValues(usbPortError, newPortError);
+            if (err != aErrNone){
+                emit logStringReady(QString("Error updating port errors %1").arg(err));
+                return;
             }
+
+            int64_t values[8];
+            for (int channel = 0; channel < numUSB; channel++) values[channel] = newPortError[channel];
+            checkTriggers(TriggerEngine::PortError, values, numUSB);
         }
     }
 
-    // TODO: not sure why we're skipping nibbles
-    const int usb_error_over_ilim = _BIT(aUSBHUB3P_ERROR_VBUS_OVERCURRENT);
-    const int usb_error_back_volt = _BIT(aUSBHUB3P_ERROR_VBUS_BACKDRIVE);
-    const int usb_error_hub_power = _BIT(aUSBHUB3P_ERROR_HUB_POWER);
-    const int usb_error_discharge_err= _BIT(aUSBHub2X4_ERROR_DISCHARGE);
-
     for (int channel = 0; channel < numUSB; channel++){
-        // decode the resulting state field
-        QString str;
         if (portError[channel] != newPortError[channel]) {
             portError[channel] = newPortError[channel];
-            str = (portError[channel] & usb_error_over_ilim)? "OVER_ILIM " : "";
-            str += (portError[channel] & usb_error_back_volt) ? "BACK_VOLT " : "";
-            str += (portError[channel] & usb_error_hub_power) ? "OVER_VOLT " : "";
-            str += (portError[channel] & usb_error_discharge_err) ? "DISCHARGE_ERR " : "";
-            emit hubErrorStatusChanged(channel, str);
+            snapshot.portError[channel] = newPortError[channel];
+            snapshot.portErrorChanged |= (1 << channel);
+            snapshot.changed |= HubSnapshot::ChangedPortError;
         }
     } // for channel
 }
@@ -430,29 +860,27 @@ void StemWorker::updateCurrentLimit(){
     bool stemConnected = false;
     aErr err = aErrNone;
 
-    // if we have a link, then get the data from the connected module
-    stemConnected = module.isConnected();
+    // without a link there's nothing to read, so nothing is published
+    stemConnected = hubLinked();
+    if(!stemConnected)
+        return;
 
     for (int channel=0; channel < numUSB; channel++){
         if(stemConnected){
-            // To make sure things stay in sync, drain any UEI packets of this request
-            usb.drainUEI(usbPortCurrentLimit);
             // Get the port current limit
-            err = usb.getPortCurrentLimit(channel, &newCurrentLimit);
+            err = router.get(cmdUSB, usbPortCurrentLimit, usb.getIndex(), channel, &newCurrentLimit);
 
             if (err != aErrNone){
                 emit logStringReady(QString("Error getting ch%1 port current limit %2").arg(channel).arg(err));
             }
         } // stem connected
-        // otherwise, just show the max current limit
-        else {
-            newCurrentLimit = rand() % 2500000;
-        }
 
-        // if the value changed, store it and emit update signal
+        // if the value changed, store it and mark it in the snapshot
         if(newCurrentLimit != currentLimit[channel]){
             currentLimit[channel] = newCurrentLimit;
-            emit portCurrentLimitChanged(channel, newCurrentLimit);
+            snapshot.currentLimit[channel] = newCurrentLimit;
+            snapshot.currentLimitChanged |= (1 << channel);
+            snapshot.changed |= HubSnapshot::ChangedCurrentLimit;
         }
         //emit logStringReady(QString("CurrentLimit port %1 %2").arg(channel).arg(newCurrentLimit));
     } // for channel
@@ -463,29 +891,27 @@ void StemWorker::updatePortMode(){
     bool stemConnected = false;
     aErr err = aErrNone;
 
-    // if we have a link, then get the data from the connected module
-    stemConnected = module.isConnected();
+    // without a link there's nothing to read, so nothing is published
+    stemConnected = hubLinked();
+    if(!stemConnected)
+        return;
 
     for (int channel=0; channel < numUSB; channel++){
         if(stemConnected){
-            // To make sure things stay in sync, drain any UEI packets of this request
-            usb.drainUEI(usbHubMode);
-            // Get the port current limit
-            err = usb.getPortMode(channel, &newMode);
+            // Get the port mode
+            err = router.get(cmdUSB, usbPortMode, usb.getIndex(), channel, &newMode);
 
             if (err != aErrNone){
                 emit logStringReady(QString("Error getting port Mode %1").arg(err));
             }
         } // stem connected
-        // otherwise, just show random toggles
-        else {
-           newMode = rand() % 2;
-        }
 
-        // if the value changed, store it and emit update signal
+        // if the value changed, store it and mark it in the snapshot
         if(newMode != portMode[channel]){
             portMode[channel] = newMode;
-            emit portModeChanged(channel, newMode);
+            snapshot.portMode[channel] = newMode;
+            snapshot.portModeChanged |= (1 << channel);
+            snapshot.changed |= HubSnapshot::ChangedPortMode;
         }
     } // for channel
 }
@@ -500,10 +926,10 @@ void StemWorker::updateTemperature(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
+    if(hubLinked()){
         if(firmwareVersion >=  0x25000000){
 //            err = temp.getTemperature(&newTemperature);
-            err = temp.getValue(&newTemperature);
+            err = routerGet(cmdTEMPERATURE, temperatureMicroCelsius, temp.getIndex(), &newTemperature);
         }
         else {
             if(firmwareUpdateMessageFlag_Temperature){
@@ -515,40 +941,34 @@ void StemWorker::updateTemperature(){
             emit logStringReady(QString("Error updating temperature %1").arg(err));
             return;
         }
+        if(firmwareVersion >=  0x25000000){
+            int64_t value = newTemperature;
+            checkTriggers(TriggerEngine::Temperature, &value, 1);
+        }
 
         // if the FW version supports maxTemp, query for it
         if(firmwareVersion >=  0x25000000 && connectedModel == aMODULE_TYPE_USBHub3p){
-            err = system.getMaximumTemperature(&newMaxTemperature);
+            err = routerGet(cmdSYSTEM, systemMaxTemperature, system.getIndex(), &newMaxTemperature);
             if (err != aErrNone){
                 emit logStringReady(QString("Error updating max temperature %1").arg(err));
                 return;
             }
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newTemperature = rand() % 150000000;
-        newMaxTemperature = 150000000;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newTemperature != temperature || newMaxTemperature != maxTemperature){
         temperature = newTemperature;
         maxTemperature = newMaxTemperature;
 
-        // never print something higher than 200C
-        maxTemperature = maxTemperature/1.0e6 > 200 ? 200 : maxTemperature;
-        temperature = temperature/1.0e6 > 200 ? 200 : temperature;
-
-        QString maxTempStr, tempStr;
-        maxTempStr.sprintf("%.1f", maxTemperature/1.0e6);
-        tempStr.sprintf("%.1f", temperature/1.0e6);
-        if(firmwareVersion >=  0x25000000 && connectedModel == aMODULE_TYPE_USBHub3p){
-            emit temperatureChanged(QString("%1˚C (max: %2˚C)").arg(tempStr, maxTempStr));
-        }
-        else {
-            emit temperatureChanged(QString("%1˚C").arg(tempStr));
-        }
+        snapshot.temperature = newTemperature;
+        snapshot.maxTemperature = newMaxTemperature;
+        snapshot.hasMaxTemperature = (firmwareVersion >=  0x25000000 && connectedModel == aMODULE_TYPE_USBHub3p);
+        snapshot.changed |= HubSnapshot::ChangedTemperature;
     }
 }
 
@@ -557,22 +977,23 @@ void StemWorker::updateInputVoltage(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = system.getInputVoltage(&newVoltage);
+    if(hubLinked()){
+        err = routerGet(cmdSYSTEM, systemInputVoltage, system.getIndex(), &newVoltage);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating system input voltage %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newVoltage = rand() % 24000000;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newVoltage != voltage){
         voltage = newVoltage;
-        emit inputVoltageChanged(newVoltage);
+        snapshot.inputVoltage = newVoltage;
+        snapshot.changed |= HubSnapshot::ChangedInputVoltage;
     }
 }
 
@@ -583,29 +1004,30 @@ void StemWorker::updateInputVoltageCurrent(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = system.getInputCurrent(&newCurrent);
+    if(hubLinked()){
+        err = routerGet(cmdSYSTEM, systemInputCurrent, system.getIndex(), &newCurrent);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating system input current %1").arg(err));
             return;
         }
-        err = system.getInputVoltage(&newVoltage);
+        err = routerGet(cmdSYSTEM, systemInputVoltage, system.getIndex(), &newVoltage);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating system input voltage %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newCurrent = rand() % 10000000;
-        newVoltage = rand() % 24000000;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newCurrent != current || newVoltage != voltage){
         current = newCurrent;
         voltage = newVoltage;
-        emit inputVoltageCurrentChanged(newVoltage, newCurrent);
+        snapshot.inputVoltage = newVoltage;
+        snapshot.inputCurrent = newCurrent;
+        snapshot.changed |= HubSnapshot::ChangedInputVoltageCurrent;
     }
 }
 
@@ -614,22 +1036,23 @@ void StemWorker::updateUserLed(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = system.getLED(&newLedState);
+    if(hubLinked()){
+        err = routerGet(cmdSYSTEM, systemLED, system.getIndex(), &newLedState);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating user LED state %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newLedState = rand() % 2;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newLedState != ledState){
         ledState = newLedState;
-        emit userLedChanged(newLedState);
+        snapshot.userLed = newLedState;
+        snapshot.changed |= HubSnapshot::ChangedUserLed;
     }
 }
 
@@ -642,26 +1065,26 @@ void StemWorker::updateStemInfo(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = system.getSerialNumber(&newSerialNumber);
+    if(hubLinked()){
+        err = routerGet(cmdSYSTEM, systemSerialNumber, system.getIndex(), &newSerialNumber);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating BrainStem info: serial number %1").arg(err));
             return;
         }
 
-        err = system.getModel(&newModel);
+        err = routerGet(cmdSYSTEM, systemModel, system.getIndex(), &newModel);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating BrainStem info: model %1").arg(err));
             return;
         }
 
-        err = system.getVersion(&newFirmwareVersion);
+        err = routerGet(cmdSYSTEM, systemVersion, system.getIndex(), &newFirmwareVersion);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating BrainStem info: firmware version %1").arg(err));
             return;
         }
 
-        err = system.getModule(&newModuleAddr);
+        err = routerGet(cmdSYSTEM, systemModule, system.getIndex(), &newModuleAddr);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating BrainStem info: system address %1").arg(err));
             return;
@@ -669,15 +1092,12 @@ void StemWorker::updateStemInfo(){
 
     } // if module connected
 
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newSerialNumber = 0xDEAD0123;
-        newModel = 255;
-        newFirmwareVersion = 0xABCD1234;
-        newModuleAddr = 0;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(   newSerialNumber != serialNumber
        || newModel != model
        || newFirmwareVersion != firmwareVersion
@@ -688,18 +1108,10 @@ void StemWorker::updateStemInfo(){
         firmwareVersion = newFirmwareVersion;
         moduleAddr = newModuleAddr;
 
-        // look up the model string
-        QString modelStr = "";
-        switch(newModel){
-        case(aMODULE_TYPE_USBHub2x4):
-            modelStr="USBHub2x4"; break;
-        case(aMODULE_TYPE_USBHub3p):
-            modelStr="USBHub3p"; break;
-        default:
-            modelStr = "Unknown"; break;
-        }
-
-        emit stemInfoChanged(newSerialNumber, modelStr, newFirmwareVersion);
+        snapshot.serialNumber = newSerialNumber;
+        snapshot.model = newModel;
+        snapshot.firmwareVersion = newFirmwareVersion;
+        snapshot.changed |= HubSnapshot::ChangedStemInfo;
     } // if something changed
 }
 
@@ -712,38 +1124,23 @@ void StemWorker::updateUpstreamPort(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = usb.getUpstreamState(&newUpstreamPortState);
+    if(hubLinked()){
+        err = routerGet(cmdUSB, usbUpstreamState, usb.getIndex(), &newUpstreamPortState);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating upstream state %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newUpstreamPortState = rand() % 2;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newUpstreamPortState != upstreamPortState){
         upstreamPortState = newUpstreamPortState;
-
-        QString newUpstreamPortStateStr = "";
-        switch(newUpstreamPortState){
-            case usbUpstreamStateNone:
-                newUpstreamPortStateStr = "None";
-                break;
-            case usbUpstreamStatePort0:
-                newUpstreamPortStateStr = "Port 0";
-                break;
-            case usbUpstreamStatePort1:
-                newUpstreamPortStateStr = "Port 1";
-                break;
-            default:
-                newUpstreamPortStateStr = "Unknown";
-        } // case upstreamPortState
-
-        emit upstreamPortChanged(newUpstreamPortStateStr);
+        snapshot.upstreamPortState = newUpstreamPortState;
+        snapshot.changed |= HubSnapshot::ChangedUpstreamPort;
     }
 }
 
@@ -752,39 +1149,23 @@ void StemWorker::updateUpstreamMode(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = usb.getUpstreamMode(&newUpstreamPortMode);
+    if(hubLinked()){
+        err = routerGet(cmdUSB, usbUpstreamMode, usb.getIndex(), &newUpstreamPortMode);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating upstream mode %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newUpstreamPortMode = rand() % 2;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newUpstreamPortMode != upstreamPortMode){
         upstreamPortMode = newUpstreamPortMode;
-
-        QString newUpstreamPortModeStr = "";
-        switch(newUpstreamPortMode){
-            case usbUpstreamModeAuto:
-                newUpstreamPortModeStr = "Auto";
-                break;
-            case usbUpstreamModePort0:
-                newUpstreamPortModeStr = "Port 0";
-                break;
-            case usbUpstreamModePort1:
-                newUpstreamPortModeStr = "Port 1";
-                break;
-            default:
-                newUpstreamPortModeStr = "Unknown";
-        } // case upstreamPortState
-
-        //emit logStringReady(QString("Hub upstream mode changed to %1").arg(newUpstreamPortModeStr));
-        emit upstreamModeChanged(newUpstreamPortMode);
+        snapshot.upstreamMode = newUpstreamPortMode;
+        snapshot.changed |= HubSnapshot::ChangedUpstreamMode;
     }
 }
 
@@ -793,23 +1174,23 @@ void StemWorker::updateUpstreamBoost(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = usb.getUpstreamBoostMode(&newBoost);
+    if(hubLinked()){
+        err = routerGet(cmdUSB, usbUpstreamBoostMode, usb.getIndex(), &newBoost);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating upstream boost %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newBoost = (rand() % 3);
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newBoost != boostUpstream){
         boostUpstream = newBoost;
-
-        emit upstreamBoostChanged(newBoost);
+        snapshot.upstreamBoost = newBoost;
+        snapshot.changed |= HubSnapshot::ChangedUpstreamBoost;
     }
 }
 
@@ -822,23 +1203,23 @@ void StemWorker::updateEnumerationDelay(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = usb.getEnumerationDelay(&newEnumDelay);
+    if(hubLinked()){
+        err = routerGet(cmdUSB, usbHubEnumerationDelay, usb.getIndex(), &newEnumDelay);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating enumeration delay %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newEnumDelay = (rand() % 10) * 100;
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newEnumDelay != enumDelay){
         enumDelay = newEnumDelay;
-
-        emit enumerationDelayChanged(newEnumDelay);
+        snapshot.enumerationDelay = newEnumDelay;
+        snapshot.changed |= HubSnapshot::ChangedEnumerationDelay;
     }
 }
 
@@ -847,23 +1228,23 @@ void StemWorker::updateDownstreamBoost(){
     aErr err = aErrNone;
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = usb.getDownstreamBoostMode(&newBoost);
+    if(hubLinked()){
+        err = routerGet(cmdUSB, usbDownstreamBoostMode, usb.getIndex(), &newBoost);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating downstream boost %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newBoost = (rand() % 3);
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newBoost != boostDownstream){
         boostDownstream = newBoost;
-
-        emit downstreamBoostChanged(newBoost);
+        snapshot.downstreamBoost = newBoost;
+        snapshot.changed |= HubSnapshot::ChangedDownstreamBoost;
     }
 }
 
@@ -872,30 +1253,34 @@ void StemWorker::updateUptime(){
     uint32_t newUptime=0;
 
     if(firmwareVersion <  0x25000000 || connectedModel != aMODULE_TYPE_USBHub3p){
-        // uptime isn't support, so bail
-        emit uptimeChanged(QString("Not Supported"));
+        // uptime isn't support, so say so once and bail
+        if(uptime != 0xFFFFFFFF){
+            uptime = 0xFFFFFFFF;
+            snapshot.hasUptime = false;
+            snapshot.changed |= HubSnapshot::ChangedUptime;
+        }
         return;
     }
 
     // if we have a link, then get the data from the connected module
-    if(module.isConnected()){
-        err = system.getUptime(&newUptime);
+    if(hubLinked()){
+        err = routerGet(cmdSYSTEM, systemUptime, system.getIndex(), &newUptime);
         if (err != aErrNone){
             emit logStringReady(QString("Error updating uptime %1").arg(err));
             return;
         }
     }
-    // if we don't have a link, fake it
+    // without a link there's nothing to read, so nothing is published
     else {
-        newUptime = (rand() % 60);
+        return;
     }
 
-    // if the value changed, store it and emit update signal
+    // if the value changed, store it and mark it in the snapshot
     if(newUptime != uptime){
         uptime = newUptime;
-
-        // format the string for display
-        emit uptimeChanged(QString("%1h%2m").arg(uptime/60).arg((int)(uptime%60)));
+        snapshot.hasUptime = true;
+        snapshot.uptime = newUptime;
+        snapshot.changed |= HubSnapshot::ChangedUptime;
     }
 }
 
@@ -908,46 +1293,39 @@ void StemWorker::updateUptime(){
 // ///////////////////////////////////////////////////////////////////////////////////
 // system parts
 void StemWorker::changeUserLed(bool enabled){
-    aErr err = aErrNone;
     qDebug("changeUserLed");
-    if(module.isConnected()){
-        err = system.setLED(enabled);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing user LED state: %1").arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postHubCommand(cmdSYSTEM, systemLED, system.getIndex(), enabled ? 1 : 0, 1,
+                       "user LED state", pollUserLed);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollUserLed);
 }
 
 void StemWorker::saveState(void){
-    aErr err = aErrNone;
     qDebug("saveState");
-    if(module.isConnected()){
-        err = system.save();
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error saving system state: %1").arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postHubCommand(cmdSYSTEM, systemSave, system.getIndex(), 0, 0,
+                       "saved system state", -1);
     } // if connected
 }
 
 void StemWorker::resetDevice(void){
-    aErr err = aErrNone;
-    qDebug("saveState");
-    if(module.isConnected()){
-        err = system.reset();
-
-        if (err == aErrTimeout){
-           emit logStringReady(QString("Successful reset (timeout received)"));
-        }
-        else {
-            emit logStringReady(QString("Error resetting hub: %1").arg(err));
-            return;
-        } // if err
+    qDebug("resetDevice");
+    if(hubLinked()){
+        // a hub that resets before it answers is a hub that reset
+        commands.post(cmdSYSTEM, systemReset, systemReset, system.getIndex(), UEIRouter::NoSubindex, 0, 0,
+                      [this](aErr err, uint32_t){
+            if (err == aErrNone || err == aErrTimeout){
+                emit logStringReady(QString("Successful reset"));
+            }
+            else {
+                emit logStringReady(QString("Error resetting hub: %1").arg(err));
+            } // if err
+        });
+        scheduleCommandFlush();
     } // if connected
-
 }
 
 void StemWorker::showEventLogs(void){
@@ -1030,138 +1408,480 @@ void StemWorker::showEventLogs(void){
 }
 
 // per port parts
-void StemWorker::changeUSBPortDataState(int channel, bool checked){
-    aErr err = aErrNone;
-    qDebug("changeUSBPortDataState");
-    if(module.isConnected()){
-        if(checked)
-            err = usb.setDataEnable(channel);
-        else
-            err = usb.setDataDisable(channel);
 
+// Queues a write to one port. The slots below used to make a blocking round
+// trip each, so a burst of edits stalled the polling; now they only land in
+// the command queue and a burst goes out together once the worker's event
+// queue is empty (or at the start of the next poll, whichever is first).
+// Writes to the same setting on the same port replace each other.
+//
+// A worker without a poll timer is polled by someone else (the fleet's pool
+// threads) and its event queue runs on a thread that doesn't own the router,
+// so its writes wait for the next poll.
+void StemWorker::postPortCommand(uint8_t setting, uint8_t option, int channel, uint32_t value, uint8_t valueSize,
+                                 QString what, int readbackEntity){
+    commands.post(cmdUSB, setting, option, usb.getIndex(), channel, value, valueSize,
+                  [this, channel, what, readbackEntity](aErr err, uint32_t){
+        if (err != aErrNone){
+            emit logStringReady(QString("Error changing port %1 %2: %3").arg(channel).arg(what).arg(err));
+            return;
+        } // if err
+
+        // read it back right away rather than waiting for the next config poll
+        scheduler.requestRun(readbackEntity);
+    });
+    scheduleCommandFlush();
+}
+
+// The hub wide settings go through the same queue as the port writes, so
+// they never make a round trip of their own on the caller's thread. A
+// readbackEntity below zero means there's nothing to read back.
+void StemWorker::postHubCommand(uint8_t command, uint8_t option, uint8_t index, uint32_t value, uint8_t valueSize,
+                                QString what, int readbackEntity){
+    commands.post(command, option, option, index, UEIRouter::NoSubindex, value, valueSize,
+                  [this, what, readbackEntity](aErr err, uint32_t){
         if (err != aErrNone){
-            emit logStringReady(QString("Error changing port %1 data: %2").arg(channel).arg(err));
+            emit logStringReady(QString("Error changing %1: %2").arg(what).arg(err));
             return;
         } // if err
+
+        if(readbackEntity >= 0){
+            scheduler.requestRun(readbackEntity);
+        }
+    });
+    scheduleCommandFlush();
+}
+
+void StemWorker::scheduleCommandFlush(){
+    if(pollTimer && !commandFlushPending){
+        commandFlushPending = true;
+        QTimer::singleShot(0, this, SLOT(flushCommands()));
+    }
+}
+
+void StemWorker::flushCommands(){
+    commandFlushPending = false;
+    if(namesWritePending){
+        namesWritePending = false;
+        setPortAndSystemNames();
+    }
+    if(commands.isEmpty())
+        return;
+
+    if(!hubLinked()){
+        commands.clear(aErrConnection);
+        return;
+    }
+    commands.flush(router);
+}
+
+void StemWorker::changeUSBPortDataState(int channel, bool checked){
+    qDebug("changeUSBPortDataState");
+    if(hubLinked()){
+        postPortCommand(usbDataEnable, checked ? usbDataEnable : usbDataDisable, channel, 0, 0,
+                        "data", pollHubMode);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollHubMode);
 }
 
 void StemWorker::Slot_userChangedUSBDataState_SS(int channel, bool checked){
-    aErr err = aErrNone;
     uint8_t model;
     getConnectedModel(&model);
 
     qDebug("changeUSBPortDataStateSS");
-    if(module.isConnected() && (model == aMODULE_TYPE_USBHub3p)){
-        if(checked) {
-            err = usb.setSuperSpeedDataEnable(channel);
-            emit Sig_HandleDataSpeed(channel, 2);
-        }
-        else {
-            err = usb.setSuperSpeedDataDisable(channel);
-            emit Sig_HandleDataSpeed(channel, 1);
-        }
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing port %1 Super Speed data : %2").arg(channel).arg(err));
-            return;
-        } // if err
+    if(hubLinked() && (model == aMODULE_TYPE_USBHub3p)){
+        postPortCommand(usbSuperSpeedDataEnable, checked ? usbSuperSpeedDataEnable : usbSuperSpeedDataDisable,
+                        channel, 0, 0, "Super Speed data", pollHubMode);
+        emit Sig_HandleDataSpeed(channel, checked ? 2 : 1);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollHubMode);
 }
 
 void StemWorker::Slot_userChangedUSBDataState_HS(int channel, bool checked){
-    aErr err = aErrNone;
     uint8_t model=0;
     getConnectedModel(&model);
 
     qDebug("changeUSBPortDataStateHS");
-    if(module.isConnected() && (model == aMODULE_TYPE_USBHub3p)){
-        if(checked) {
-            err = usb.setHiSpeedDataEnable(channel);
-            emit Sig_HandleDataSpeed(channel, 2);
-        }
-        else {
-            err = usb.setHiSpeedDataDisable(channel);
-            emit Sig_HandleDataSpeed(channel, 1);
-        }
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing port %1 High Speed data : %2").arg(channel).arg(err));
-            return;
-        } // if err
+    if(hubLinked() && (model == aMODULE_TYPE_USBHub3p)){
+        postPortCommand(usbHiSpeedDataEnable, checked ? usbHiSpeedDataEnable : usbHiSpeedDataDisable,
+                        channel, 0, 0, "High Speed data", pollHubMode);
+        emit Sig_HandleDataSpeed(channel, checked ? 2 : 1);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollHubMode);
 }
 
 void StemWorker::changeUSBPortPowerState(int channel, bool checked){
-    aErr err = aErrNone;
     qDebug("changeUSBPortPowerState");
-    if(module.isConnected()){
-        if(checked)
-            err = usb.setPowerEnable(channel);
-        else
-            err = usb.setPowerDisable(channel);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing port %1 power: %2").arg(channel).arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postPortCommand(usbPowerEnable, checked ? usbPowerEnable : usbPowerDisable, channel, 0, 0,
+                        "power", pollHubMode);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollHubMode);
 }
 
 void StemWorker::clearPortError(int channel){
-    aErr err = aErrNone;
     qDebug("clearPortError");
-    if(module.isConnected()){
-        err = usb.clearPortErrorStatus(channel);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing port %1 power: %2").arg(channel).arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postPortCommand(usbPortClearErrorStatus, usbPortClearErrorStatus, channel, 0, 0,
+                        "error status", pollHubErrorStatus);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollHubErrorStatus);
 }
 
 void StemWorker::changeUSBPortCurrentLimit(int channel, uint32_t limit){
-    aErr err = aErrNone;
     qDebug("changeUSBPortCurrentLimit");
     currentLimit[channel] = limit;
-    if(module.isConnected()){
-        err = usb.setPortCurrentLimit(channel, limit);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing port %1 current limit: %2").arg(channel).arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        // a scrolled spin box sends one of these per step; only the last one goes out
+        postPortCommand(usbPortCurrentLimit, usbPortCurrentLimit, channel, limit, 4,
+                        "current limit", pollCurrentLimit);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollCurrentLimit);
 }
 
 void StemWorker::changeUSBPortMode(int channel, bool enabled) {
-    aErr err = aErrNone;
     qDebug("changeUSBPortMode");
-    if(module.isConnected()) {
-        err = usb.setPortMode(channel, (enabled)? usbPortMode_cdp: usbPortMode_sdp);
-        if (err != aErrNone) {
-            emit logStringReady(QString("Error changing port %1 port mode: %2").arg(channel).arg(err));
+    if(hubLinked()) {
+        postPortCommand(usbPortMode, usbPortMode, channel, (enabled)? usbPortMode_cdp: usbPortMode_sdp, 4,
+                        "port mode", pollPortMode);
+        return;
+    }
+
+    scheduler.requestRun(pollPortMode);
+}
+
+void StemWorker::setPipelinedAcquisition(bool enabled) {
+    pipelinedAcquisition = enabled;
+}
+
+// Each run of timings starts from empty. While off, the router doesn't read
+// the clock at all.
+void StemWorker::setCallTimingEnabled(bool enabled) {
+    callTimingEnabled = enabled;
+    if(enabled){
+        callStats.reset();
+    }
+    router.setCallStats(enabled ? &callStats : nullptr);
+}
+
+void StemWorker::setPacketCapture(QString path) {
+    if(packetCapture.isOpen()){
+        QString oldPath = packetCapture.path();
+        uint64_t captured = packetCapture.capturedCount();
+        uint64_t dropped = packetCapture.droppedCount();
+        packetCapture.close();
+        emit logStringReady(QString("Packet capture stopped: %1 packets to %2 (%3 dropped)")
+                            .arg(captured).arg(oldPath).arg(dropped));
+    }
+    if(path.isEmpty())
+        return;
+
+    if(!packetCapture.open(path)){
+        emit logStringReady(QString("Error starting packet capture to %1: %2").arg(path).arg(packetCapture.errorString()));
+        return;
+    }
+    emit logStringReady(QString("Packet capture started to %1 (%2MB ring)")
+                        .arg(path).arg(PacketCapture::DefaultCapacity/(1024*1024)));
+}
+
+void StemWorker::setSampleRecording(QString directory) {
+    if(sampleRecorder.isOpen()){
+        QString oldPath = sampleRecorder.path();
+        sampleRecorder.close();
+        emit logStringReady(QString("Sample recording stopped: %1 samples to %2 (%3 dropped)")
+                            .arg(sampleRecorder.recordedCount()).arg(oldPath).arg(sampleRecorder.droppedCount()));
+    }
+    sampleDirectory = directory;
+}
+
+// Called with every snapshot, but only the cycles that read the ports are
+// recorded. A recording that can't be written stops rather than retrying.
+void StemWorker::recordSamples(){
+    if(sampleRecorder.isOpen() && sampleFileAge.elapsed() >= SAMPLE_FILE_ROTATE_MS){
+        sampleRecorder.close();
+    }
+
+    if(!sampleRecorder.isOpen()){
+        if(snapshot.serialNumber == 0 || snapshot.serialNumber == 0xFFFFFFFF || snapshot.numUSB == 0)
+            return;
+
+        QString serial = QString("%1").arg(snapshot.serialNumber, 8, 16, QChar('0')).toUpper();
+        pruneSampleFiles(serial);
+        QString name = QString("hub-%1-%2.hubts").arg(serial)
+                       .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+        QDir().mkpath(sampleDirectory);
+        QString path = QDir(sampleDirectory).filePath(name);
+        if(!sampleRecorder.open(path, snapshot.serialNumber, snapshot.model, snapshot.numUSB)){
+            emit logStringReady(QString("Error recording samples to %1: %2").arg(path).arg(sampleRecorder.errorString()));
+            sampleDirectory.clear();
             return;
         }
+        sampleFileAge.start();
+        emit logStringReady(QString("Recording samples to %1").arg(path));
+    }
+
+    if(sampleRecorder.failed()){
+        emit logStringReady(QString("Error recording samples to %1, stopped after %2 samples")
+                            .arg(sampleRecorder.path()).arg(sampleRecorder.recordedCount()));
+        sampleRecorder.close();
+        sampleDirectory.clear();
+        return;
+    }
+
+    if(snapshot.changed & HubSnapshot::ChangedPortVoltageCurrent){
+        sampleRecorder.record(snapshot);
     }
 }
 
-void StemWorker::changeUSBPortEnableState(int channel, bool enabled) {
-    aErr err = aErrNone;
-    qDebug("changeUSBPortEnableState");
-    if(module.isConnected()) {
-        if(enabled){
-            err = usb.setPortEnable(channel);
-        }
-        else {
-            err = usb.setPortDisable(channel);
+// Removes this hub's recordings, oldest first, that are past the retention
+// age or don't fit under the size limit. Other hubs' files are left to their
+// own workers, which may still be writing them.
+void StemWorker::pruneSampleFiles(const QString &serial){
+    QDir dir(sampleDirectory);
+    QFileInfoList files = dir.entryInfoList(QStringList() << QString("hub-%1-*.hubts").arg(serial),
+                                            QDir::Files, QDir::Time | QDir::Reversed);
+
+    qint64 total = 0;
+    for(const QFileInfo &file : files){
+        total += file.size() + QFileInfo(file.filePath() + ".idx").size();
+    }
+
+    QDateTime cutoff = QDateTime::currentDateTime().addDays(-SAMPLE_RETENTION_DAYS);
+    int removed = 0;
+    for(const QFileInfo &file : files){
+        if(file.lastModified() >= cutoff && total <= SAMPLE_RETENTION_BYTES)
+            break;
+
+        qint64 size = file.size() + QFileInfo(file.filePath() + ".idx").size();
+        if(QFile::remove(file.filePath())){
+            QFile::remove(file.filePath() + ".idx");
+            total -= size;
+            removed++;
         }
-        if (err != aErrNone) {
-            emit logStringReady(QString("Error changing port %1 port state: %2").arg(channel).arg(err));
+    }
+
+    if(removed > 0){
+        emit logStringReady(QString("Removed %1 old sample recording(s) from %2").arg(removed).arg(sampleDirectory));
+    }
+}
+
+QString StemWorker::defaultEnergyDirectory(){
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("energy");
+}
+
+void StemWorker::setEnergyDirectory(QString directory) {
+    energyMeter.close();
+    energyDirectory = directory;
+}
+
+void StemWorker::resetEnergy(int port) {
+    energyMeter.reset(port, QDateTime::currentMSecsSinceEpoch());
+    publishEnergy();
+}
+
+// Adds a port reading, timed as it arrives, to the hub's totals. The totals
+// file is opened (or switched, if another hub is on the link now) once the
+// serial number is known.
+void StemWorker::accountEnergy(const int32_t *voltage, const int32_t *current){
+    if(energyDirectory.isEmpty() || snapshot.serialNumber == 0 || snapshot.serialNumber == 0xFFFFFFFF || numUSB == 0)
+        return;
+
+    if(!energyMeter.isOpen() || energyMeter.serialNumber() != snapshot.serialNumber){
+        QString serial = QString("%1").arg(snapshot.serialNumber, 8, 16, QChar('0')).toUpper();
+        QDir().mkpath(energyDirectory);
+        QString path = QDir(energyDirectory).filePath(QString("hub-%1.energy").arg(serial));
+        if(!energyMeter.open(path, snapshot.serialNumber, numUSB)){
+            emit logStringReady(QString("Error keeping energy totals in %1: %2").arg(path).arg(energyMeter.errorString()));
+            energyDirectory.clear();
             return;
         }
     }
+
+    energyMeter.addSample(energyClock.nsecsElapsed()/1000, voltage, current);
+    publishEnergy();
+}
+
+void StemWorker::publishEnergy(){
+    if(!energyMeter.isOpen())
+        return;
+
+    for(int channel = 0; channel < energyMeter.numPorts(); channel++){
+        EnergyMeter::Totals totals = energyMeter.port(channel);
+        snapshot.portEnergy[channel] = totals.microWattHours;
+        snapshot.portCharge[channel] = totals.microAmpHours;
+        snapshot.energySinceMs[channel] = totals.sinceMs;
+    }
+    EnergyMeter::Totals hub = energyMeter.hub();
+    snapshot.hubEnergy = hub.microWattHours;
+    snapshot.hubCharge = hub.microAmpHours;
+    snapshot.changed |= HubSnapshot::ChangedEnergy;
+}
+
+void StemWorker::setTriggerRules(QString path) {
+    if(path.isEmpty()){
+        triggers.setRules(std::vector<TriggerRule>());
+        return;
+    }
+
+    if(!triggers.load(path)){
+        emit logStringReady(QString("Error loading trigger rules from %1: %2").arg(path).arg(triggers.errorString()));
+        return;
+    }
+    emit logStringReady(QString("Loaded %1 trigger rule(s) from %2").arg(triggers.rules().size()).arg(path));
+}
+
+// Called with each reading as soon as it's in. Whatever fired goes out on
+// the link before returning, so the reaction is one round trip after the
+// reading rather than a poll cycle or more.
+void StemWorker::checkTriggers(TriggerEngine::Input input, const int64_t *values, int count){
+    if(triggers.isEmpty())
+        return;
+
+    if(input == TriggerEngine::PortVoltage){
+        triggers.setPoweredPorts(poweredPorts());
+    }
+
+    firedTriggers.clear();
+    triggers.evaluate(input, triggerClock.nsecsElapsed()/1000, values, count, &firedTriggers);
+    if(firedTriggers.empty())
+        return;
+
+    for(const TriggerEngine::Firing &firing: firedTriggers){
+        runTriggerAction(firing);
+    }
+    flushCommands();
+}
+
+static QString describeReading(TriggerRule::Condition condition, int64_t value){
+    switch(condition){
+    case TriggerRule::CurrentAbove:     return QString("current %1 A").arg(QString::number(value/1000000.0, 'f', 3));
+    case TriggerRule::VoltageBelow:
+    case TriggerRule::VoltageAbove:     return QString("voltage %1 V").arg(QString::number(value/1000000.0, 'f', 3));
+    case TriggerRule::PortErrorSet:     return QString("error 0x%1").arg((uint32_t)value, 8, 16, QChar('0'));
+    case TriggerRule::TemperatureAbove: return QString("temperature %1 C").arg(QString::number(value/1000000.0, 'f', 1));
+    }
+    return QString();
+}
+
+// The writes go through the command queue like the user's, so they work the
+// same on a simulated or replayed hub; the caller flushes it straight away.
+// A power cycle's second half waits here rather than on a timer, so it goes
+// out from the polling thread with the other writes, and a port that was
+// cycled while the link was down is powered again once it's back.
+void StemWorker::repowerDuePorts(){
+    int64_t nowUs = triggerClock.nsecsElapsed()/1000;
+    for (int channel = 0; channel < numUSB; channel++){
+        if(repowerDueUs[channel] < 0 || nowUs < repowerDueUs[channel])
+            continue;
+
+        repowerDueUs[channel] = -1;
+        postPortCommand(usbPowerEnable, usbPowerEnable, channel, 0, 0, "power", pollHubMode);
+    }
+}
+
+// The port state's VBUS bit where the firmware has it, the hub mode's power
+// bits (as the GUI shows them) where it doesn't.
+uint32_t StemWorker::poweredPorts() const {
+    uint32_t mask = 0;
+    for (int channel = 0; channel < numUSB; channel++){
+        bool powered = (firmwareVersion >= 0x25000000)
+                       ? (portState[channel] & _BIT(aUSBHUB3P_USB_VBUS_ENABLED)) != 0
+                       : ((hubMode >> (channel*2 + 1)) & 0x1) != 0;
+        if(powered) mask |= (1u << channel);
+    }
+    return mask;
+}
+
+void StemWorker::runTriggerAction(const TriggerEngine::Firing &firing){
+    const TriggerRule &rule = triggers.rules()[firing.rule];
+    QString where = firing.port < 0 ? QString("every port") : QString("port %1").arg(firing.port);
+    QString reading = describeReading(rule.condition, firing.value);
+
+    if(rule.action == TriggerRule::LogOnly){
+        emit logStringReady(QString("Trigger %1 on %2: %3").arg(rule.name).arg(where).arg(reading));
+        return;
+    }
+
+    uint8_t setting = usbPowerEnable;
+    uint8_t option = usbPowerDisable;
+    uint32_t value = 0;
+    uint8_t valueSize = 0;
+    int readbackEntity = pollHubMode;
+    QString what = "powered off";
+    switch(rule.action){
+    case TriggerRule::DisablePort:
+        setting = usbPortEnable;
+        option = usbPortDisable;
+        what = "disabled";
+        break;
+    case TriggerRule::SetCurrentLimit:
+        setting = usbPortCurrentLimit;
+        option = usbPortCurrentLimit;
+        value = rule.actionValue;
+        valueSize = 4;
+        readbackEntity = pollCurrentLimit;
+        what = QString("limited to %1 A").arg(QString::number(rule.actionValue/1000000.0, 'f', 3));
+        break;
+    case TriggerRule::PowerCycle:
+        what = QString("power cycled (%1 ms off)").arg(rule.actionValue);
+        break;
+    default:
+        break;
+    }
+
+    int first = firing.port < 0 ? 0 : firing.port;
+    int last = firing.port < 0 ? numUSB - 1 : firing.port;
+    for(int channel = first; channel <= last; channel++){
+        if(rule.action == TriggerRule::SetCurrentLimit){
+            currentLimit[channel] = value;
+        }
+
+        int ruleIndex = firing.rule;
+        int64_t sampleUs = firing.sampleUs;
+        QString name = rule.name;
+        bool powerCycle = rule.action == TriggerRule::PowerCycle;
+        uint32_t offMs = rule.actionValue;
+        commands.post(cmdUSB, setting, option, usb.getIndex(), channel, value, valueSize,
+                      [=](aErr err, uint32_t){
+            int64_t latencyUs = triggerClock.nsecsElapsed()/1000 - sampleUs;
+            if (err != aErrNone){
+                emit logStringReady(QString("Trigger %1: error acting on port %2: %3").arg(name).arg(channel).arg(err));
+                return;
+            }
+
+            triggers.recordLatency(ruleIndex, latencyUs);
+            emit logStringReady(QString("Trigger %1 on port %2: %3, %4 %5 us after the reading")
+                                .arg(name).arg(channel).arg(reading).arg(what).arg(latencyUs));
+            scheduler.requestRun(readbackEntity);
+
+            if(powerCycle){
+                repowerDueUs[channel] = triggerClock.nsecsElapsed()/1000 + (int64_t)offMs*1000;
+            }
+        });
+    }
+}
+
+void StemWorker::changeUSBPortEnableState(int channel, bool enabled) {
+    qDebug("changeUSBPortEnableState");
+    if(hubLinked()) {
+        postPortCommand(usbPortEnable, enabled ? usbPortEnable : usbPortDisable, channel, 0, 0,
+                        "port state", pollHubMode);
+        return;
+    }
+
+    scheduler.requestRun(pollHubMode);
 }
 
 
@@ -1170,29 +1890,25 @@ void StemWorker::changeUSBPortEnableState(int channel, bool enabled) {
 
 // upstream parts
 void StemWorker::changeUpstreamMode(int mode){
-    aErr err = aErrNone;
     qDebug("changeUpstreamMode");
-    if(module.isConnected()){
-        err = usb.setUpstreamMode(mode);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing upstream mode: %1").arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postHubCommand(cmdUSB, usbUpstreamMode, usb.getIndex(), (uint8_t)mode, 1,
+                       "upstream mode", pollUpstreamMode);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollUpstreamMode);
 }
 
 void StemWorker::changeUpstreamBoost(uint8_t boost){
-    aErr err = aErrNone;
     qDebug() << "changeUpstreamBoost" << boost;
-    if(module.isConnected()){
-        err = usb.setUpstreamBoostMode(boost);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing upstream boost: %1").arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postHubCommand(cmdUSB, usbUpstreamBoostMode, usb.getIndex(), boost, 1,
+                       "upstream boost", pollUpstreamBoost);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollUpstreamBoost);
 }
 
 
@@ -1200,30 +1916,25 @@ void StemWorker::changeUpstreamBoost(uint8_t boost){
 
 // downstream parts
 void StemWorker::changeEnumerationDelay(uint32_t ms_delay){
-    aErr err = aErrNone;
     qDebug("changeEnumerationDelay");
-    if(module.isConnected()){
-        err = usb.setEnumerationDelay(ms_delay);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing enumeration delay: %1").arg(err));
-            return;
-        } // if err
-
+    if(hubLinked()){
+        postHubCommand(cmdUSB, usbHubEnumerationDelay, usb.getIndex(), ms_delay, 4,
+                       "enumeration delay", pollEnumerationDelay);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollEnumerationDelay);
 }
 
 void StemWorker::changeDownstreamBoost(uint8_t boost){
-    aErr err = aErrNone;
     qDebug("changeDownstreamBoost");
-    if(module.isConnected()){
-        err = usb.setDownstreamBoostMode(boost);
-
-        if (err != aErrNone){
-            emit logStringReady(QString("Error changing downstream boost: %1").arg(err));
-            return;
-        } // if err
+    if(hubLinked()){
+        postHubCommand(cmdUSB, usbDownstreamBoostMode, usb.getIndex(), boost, 1,
+                       "downstream boost", pollDownstreamBoost);
+        return;
     } // if connected
+
+    scheduler.requestRun(pollDownstreamBoost);
 }
 
 
@@ -1242,9 +1953,10 @@ void StemWorker::changePortName(QString name, int index){
         portAndSystemNames[index] = name;
     }
 
-    // save to the connected device
-    setPortAndSystemNames();
-
+    // save to the connected device from the polling thread, between cycles,
+    // since the store write isn't a single UEI the router can carry
+    namesWritePending = true;
+    scheduleCommandFlush();
 }
 
 void StemWorker::changeSystemName(QString name){
@@ -1644,14 +2356,22 @@ void StemWorker::setPortAndSystemNames(){
         return;
     }
 
-    if(module.isConnected()){
-        qDebug() << "Writing names to store len: " << nameData.length();
-        qDebug() << nameData;
-        aErr err = aErrNone;
-        err = store[storeInternalStore].loadSlot(SLOT_FOR_NAMES, (uint8_t*) nameData.toLocal8Bit().constData(), nameData.length());
-        if(err != aErrNone){
-            emit logStringReady(QString("Error writing names to store: %1").arg(err));
+    if(!module.isConnected()){
+        if(hubLinked()){
+            emit logStringReady(QString("Names can't be saved over this link; they're kept until HubTool exits."));
+        }
+        else {
+            emit logStringReady(QString("Not connected; names weren't saved to the hub."));
         }
+        return;
+    }
+
+    qDebug() << "Writing names to store len: " << nameData.length();
+    qDebug() << nameData;
+    aErr err = aErrNone;
+    err = store[storeInternalStore].loadSlot(SLOT_FOR_NAMES, (uint8_t*) nameData.toLocal8Bit().constData(), nameData.length());
+    if(err != aErrNone){
+        emit logStringReady(QString("Error writing names to store: %1").arg(err));
     }
 
 }
@@ -7,9 +7,23 @@
 #include <QTimer>
 #include <QString>
 #include <QStringList>
+#include <QElapsedTimer>
 
 #include "BrainStem2/BrainStem-all.h"
 #include "appnap.h"
+#include "pollscheduler.h"
+#include "ueirouter.h"
+#include "commandqueue.h"
+#include "hubsnapshot.h"
+#include "ratecontroller.h"
+#include "connectionmonitor.h"
+#include "simulatedhub.h"
+#include "ueicallstats.h"
+#include "packetcapture.h"
+#include "linkrecording.h"
+#include "samplerecorder.h"
+#include "energymeter.h"
+#include "triggerengine.h"
 
 using namespace Acroname::BrainStem;
 
@@ -24,6 +38,28 @@ public:
     ~StemWorker();
     void getConnectedModel(uint8_t *model);
 
+    // how long until the next poll should start, for callers that schedule polls themselves
+    int nextPollDelayMs() const;
+
+    // one snapshot per poll cycle; only one thread may drain it
+    HubSnapshotQueue* snapshots() { return &snapshotQueue; }
+
+    // per entity timing, for the benchmark; the ids index pollEntityNames()
+    void setPollObserver(PollScheduler::RunObserver observer) { scheduler.setRunObserver(observer); }
+    QStringList pollEntityNames() const;
+    const SimulatedHub* simulation() const { return simulatedHub; }
+    const LinkReplay* replay() const { return linkReplay; }
+
+    // per UEI call timings, only gathered while setCallTimingEnabled(true);
+    // call from the worker's thread
+    QList<UEICallSummary> callTimings() const { return callStats.summaries(); }
+
+    // where each hub's energy totals are kept between runs
+    static QString defaultEnergyDirectory();
+
+    // Link::sDiscover callback collecting every USBHub2x4/USBHub3p into a std::list<linkSpec>
+    static bContinueSearch sFindAllHubs(const linkSpec* spec, bool* bSuccess, void* vpCBRef);
+
 signals:
     // test signal
     void resultReady(int channel, bool checked);
@@ -36,31 +72,7 @@ signals:
     void selectStemFromListSignal(QStringList availableSerialNumbers);
     void requestMsgBox(QString message);
 
-    // per port parts
-    void portVoltageCurrentChanged(int channel, int32_t newVoltage, int32_t newCurrent);
-    void portCurrentLimitChanged(int channel, uint32_t microAmps);
-    void portModeChanged(int channel, uint8_t mode);
-    void hubModeChanged(uint32_t hubMode);
-    void hubStateChanged(int channel, QString errorString, int8_t spd);
-    void hubErrorStatusChanged(int channel, QString errorString);
-
-
-    // system parts
-    void temperatureChanged(QString temperatureString);
-    void inputVoltageChanged(uint32_t inputVoltage);
-    void inputVoltageCurrentChanged(uint32_t newVoltage, uint32_t newCurrent);
-    void userLedChanged(uint8_t ledOn);
-    void stemInfoChanged(uint32_t serialNumber, QString model, uint32_t firmwareVersion);
-    void uptimeChanged(QString uptimeString);
-
-    // upstream parts
-    void upstreamPortChanged(QString upstreamPortSelection);
-    void upstreamModeChanged(uint8_t upstreamPortMode);
-    void upstreamBoostChanged(uint8_t boost);
-
-    // downstream parts
-    void enumerationDelayChanged(uint32_t ms_delay);
-    void downstreamBoostChanged(uint8_t boost);
+    // hub values go out through snapshots() rather than one signal apiece
 
     void Sig_Secondary_GUI_Init();
     void Sig_HandleDataSpeed(int channel, int mode);
@@ -68,11 +80,23 @@ signals:
     // port and system name
     void sig_nameChanged(QString name, int index);
 
+    // per entity polling rates, one "name: rate" line per entity
+    void pollRatesChanged(QString rateSummary);
+
+    // per UEI call timings, once a second while they're enabled
+    void callTimingsChanged(QList<UEICallSummary> summaries);
+
 public slots:
     void start();
+    void startPolling();
     void pollStemForChanges();
+    void setTargetRate(double hz);
     void connectUserChosenStem(QString stemSerialNumber);
 
+    // hot-plug events, ignored unless they're for this worker's hub
+    void hubAttached(const linkSpec &spec);
+    void hubDetached(uint32_t serialNumber);
+
     // per port parts
     void changeUSBPortDataState(int channel, bool enabled);
     void Slot_userChangedUSBDataState_SS(int channel, bool checked);
@@ -83,6 +107,22 @@ public slots:
     void changeUSBPortCurrentLimit(int channel, uint32_t limit);
     void changeUSBPortMode(int channel, bool enabled);
     void changeUSBPortEnableState(int channel, bool enabled);
+    void setPipelinedAcquisition(bool enabled);
+    void setCallTimingEnabled(bool enabled);
+    // capture the link's packets into a ring file at path; an empty path stops
+    void setPacketCapture(QString path);
+    // record every port sample into a new file in directory, named by serial
+    // number and start time; an empty directory stops. A new file is started
+    // every day and the hub's files from over a week ago are removed.
+    void setSampleRecording(QString directory);
+    // energy and charge totals are kept in a file per hub in directory; an
+    // empty directory stops counting
+    void setEnergyDirectory(QString directory);
+    // port -1 resets every port
+    void resetEnergy(int port);
+    // rules checked against every reading, from the JSON file at path (see
+    // triggerengine.h); an empty path stops them
+    void setTriggerRules(QString path);
 
     // upstream parts
     void changeUpstreamMode(int mode);
@@ -102,6 +142,9 @@ public slots:
     void changePortName(QString name, int index);
     void changeSystemName(QString name);
 
+private slots:
+    void flushCommands();
+
 private:
     Module module;
     SystemClass system;
@@ -110,6 +153,96 @@ private:
     TemperatureClass temp;
     linkSpec stemToolSpec;
 
+    // built up over a poll cycle, then copied into the queue
+    HubSnapshot snapshot;
+    HubSnapshotQueue snapshotQueue;
+    void publishSnapshot();
+    // the link health fields, filled in before every publish
+    void updateConnectionFields();
+
+    // the file is only opened once the hub's serial number is known
+    SampleRecorder sampleRecorder;
+    QString sampleDirectory;
+    QElapsedTimer sampleFileAge;
+    void recordSamples();
+    void pruneSampleFiles(const QString &serial);
+
+    // every port reading is counted, once the hub's serial number is known
+    EnergyMeter energyMeter;
+    QString energyDirectory;
+    QElapsedTimer energyClock;
+    void accountEnergy(const int32_t *voltage, const int32_t *current);
+    void publishEnergy();
+
+    // readings go past the rules as soon as they're read, and any action goes
+    // out on the link right then rather than with the next flush
+    TriggerEngine triggers;
+    QElapsedTimer triggerClock;
+    std::vector<TriggerEngine::Firing> firedTriggers;
+    void checkTriggers(TriggerEngine::Input input, const int64_t *values, int count);
+    uint32_t poweredPorts() const;
+
+    // when each power cycled port is due to be powered again, on the
+    // triggerClock; -1 for none. Kept across reconnects.
+    int64_t repowerDueUs[8];
+    void repowerDuePorts();
+    void runTriggerAction(const TriggerEngine::Firing &firing);
+
+    // poll cadence; the timer only exists once startPolling() has run
+    RateController rateController;
+    QTimer* pollTimer;
+    void finishPollCycle();
+
+    // link health and reconnect pacing
+    ConnectionMonitor connection;
+    void reconnectStem(const linkSpec &spec);
+    bool staticInfoStillValid(uint32_t serial);
+    void requestRunAfterReconnect(uint32_t serial);
+    bool isOwnHub(uint32_t serial) const;
+
+    // has to outlive the router, which hands it the link
+    PacketCapture packetCapture;
+
+    // polling reads go through the router on the module's link
+    UEIRouter router;
+    UEICallStats callStats;
+    bool callTimingEnabled;
+
+    // single value gets through the router, for any integer type
+    template <typename T>
+    aErr routerGet(uint8_t command, uint8_t option, uint8_t index, T* value){
+        uint32_t raw = 0;
+        aErr err = router.get(command, option, index, UEIRouter::NoSubindex, &raw);
+        if(err == aErrNone) *value = (T)raw;
+        return err;
+    }
+
+    // stands in for the hub when none is found; the router talks to it over a
+    // stream, so the polling and commands run the same as with hardware
+    SimulatedHub* simulatedHub;
+    void startSimulation(linkSpec* spec);
+    bool hubLinked() const;
+
+    // record mode talks to the hub through a logged stream of the router's
+    // own instead of the Module; replay stands in for the hub like the
+    // simulation does
+    LinkRecorder* linkRecorder;
+    LinkReplay* linkReplay;
+    void startRecording(linkSpec* spec);
+    void startReplay();
+
+    // user writes wait here and go out together, ahead of the next poll
+    CommandQueue commands;
+    bool commandFlushPending;
+    void postPortCommand(uint8_t setting, uint8_t option, int channel, uint32_t value, uint8_t valueSize,
+                         QString what, int readbackEntity);
+    void postHubCommand(uint8_t command, uint8_t option, uint8_t index, uint32_t value, uint8_t valueSize,
+                        QString what, int readbackEntity);
+    void scheduleCommandFlush();
+
+    // the name store write waits for the polling thread like the commands do
+    bool namesWritePending;
+
     uint8_t numUSB;
     uint8_t connectedModel;
     uint32_t firmwareVersion;
@@ -119,7 +252,6 @@ private:
 
 
 
-    uint8_t connectRetryCount;
     bool firstPollingEvent;
     uint32_t hubMode;
     uint32_t portState[8];
@@ -143,6 +275,32 @@ private:
     uint8_t boostDownstream;
     uint32_t uptime;
 
+    // when set, all port V/I requests go out on the link before any replies are read
+    bool pipelinedAcquisition;
+
+    // every update* function is an entity in the scheduler, registered in this order
+    enum PollEntity {
+        pollStemInfo,
+        pollPortVoltageCurrent,
+        pollHubState,
+        pollHubErrorStatus,
+        pollHubMode,
+        pollUpstreamPort,
+        pollInputVoltage,
+        pollTemperature,
+        pollUptime,
+        pollCurrentLimit,
+        pollPortMode,
+        pollUserLed,
+        pollUpstreamMode,
+        pollUpstreamBoost,
+        pollEnumerationDelay,
+        pollDownstreamBoost,
+    };
+    PollScheduler scheduler;
+    QElapsedTimer pollRatesReportTimer;
+    void setupPollScheduler();
+
     QString portAndSystemNames[9];
 
     void getLinkSpec(linkSpec* spec);
@@ -154,6 +312,9 @@ private:
 
     // per port parts
     void updatePortVoltageAndCurrent();
+    aErr acquirePortVoltageAndCurrentPipelined(int32_t* voltages, int32_t* currents);
+    aErr acquirePortValues(uint8_t option, uint32_t* values);
+    void submitPortGets(uint8_t option, uint32_t* values, aErr* firstErr);
     void updateHubMode();
     void updatedHubState();
     void updateHubErrorStatus();
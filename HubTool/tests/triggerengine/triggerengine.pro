@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# TriggerEngine unit tests.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_triggerengine
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/../..
+
+SOURCES += tst_triggerengine.cpp \
+           ../../triggerengine.cpp \
+           ../../latencyhistogram.cpp
+
+HEADERS  += ../../triggerengine.h \
+            ../../latencyhistogram.h
+
+CONFIG += c++11
@@ -0,0 +1,93 @@
+#include <QtTest>
+
+#include "triggerengine.h"
+
+class TestTriggerEngine : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void voltageBelowFiresOnPoweredPort();
+    void voltageSkipsUnpoweredPorts();
+    void currentIgnoresPower();
+    void powerOffClearsHeldCondition();
+
+private:
+    static TriggerRule rule(TriggerRule::Condition condition, int64_t threshold, int64_t holdUs = 0);
+};
+
+TriggerRule TestTriggerEngine::rule(TriggerRule::Condition condition, int64_t threshold, int64_t holdUs){
+    TriggerRule rule;
+    rule.name = "test";
+    rule.port = -1;
+    rule.condition = condition;
+    rule.threshold = threshold;
+    rule.holdUs = holdUs;
+    rule.action = TriggerRule::LogOnly;
+    rule.actionValue = 0;
+    return rule;
+}
+
+void TestTriggerEngine::voltageBelowFiresOnPoweredPort(){
+    TriggerEngine engine;
+    engine.setRules({rule(TriggerRule::VoltageBelow, 4600000)});
+
+    int64_t volts[4] = {5000000, 4000000, 5000000, 5000000};
+    std::vector<TriggerEngine::Firing> fired;
+    engine.evaluate(TriggerEngine::PortVoltage, 0, volts, 4, &fired);
+
+    QCOMPARE((int)fired.size(), 1);
+    QCOMPARE(fired[0].port, 1);
+}
+
+// an unpowered port reads 0V, which isn't a sag
+void TestTriggerEngine::voltageSkipsUnpoweredPorts(){
+    TriggerEngine engine;
+    engine.setRules({rule(TriggerRule::VoltageBelow, 4600000)});
+    engine.setPoweredPorts(0x5);
+
+    int64_t volts[4] = {5000000, 0, 4000000, 0};
+    std::vector<TriggerEngine::Firing> fired;
+    engine.evaluate(TriggerEngine::PortVoltage, 0, volts, 4, &fired);
+
+    QCOMPARE((int)fired.size(), 1);
+    QCOMPARE(fired[0].port, 2);
+}
+
+void TestTriggerEngine::currentIgnoresPower(){
+    TriggerEngine engine;
+    engine.setRules({rule(TriggerRule::CurrentAbove, 2000000)});
+    engine.setPoweredPorts(0);
+
+    int64_t amps[2] = {2500000, 0};
+    std::vector<TriggerEngine::Firing> fired;
+    engine.evaluate(TriggerEngine::PortCurrent, 0, amps, 2, &fired);
+
+    QCOMPARE((int)fired.size(), 1);
+    QCOMPARE(fired[0].port, 0);
+}
+
+// the hold starts over once the port is powered again
+void TestTriggerEngine::powerOffClearsHeldCondition(){
+    TriggerEngine engine;
+    engine.setRules({rule(TriggerRule::VoltageBelow, 4600000, 1000)});
+
+    int64_t volts[1] = {4000000};
+    std::vector<TriggerEngine::Firing> fired;
+    engine.evaluate(TriggerEngine::PortVoltage, 0, volts, 1, &fired);
+    QVERIFY(fired.empty());
+
+    engine.setPoweredPorts(0);
+    engine.evaluate(TriggerEngine::PortVoltage, 500, volts, 1, &fired);
+    QVERIFY(fired.empty());
+
+    engine.setPoweredPorts(0x1);
+    engine.evaluate(TriggerEngine::PortVoltage, 1200, volts, 1, &fired);
+    QVERIFY(fired.empty());
+    engine.evaluate(TriggerEngine::PortVoltage, 2200, volts, 1, &fired);
+    QCOMPARE((int)fired.size(), 1);
+}
+
+QTEST_APPLESS_MAIN(TestTriggerEngine)
+
+#include "tst_triggerengine.moc"
@@ -0,0 +1,230 @@
+#include "triggerengine.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+#include <math.h>
+
+namespace {
+
+struct Name {
+    const char *name;
+    int value;
+};
+
+const Name conditionNames[] = {
+    {"current_above", TriggerRule::CurrentAbove},
+    {"voltage_below", TriggerRule::VoltageBelow},
+    {"voltage_above", TriggerRule::VoltageAbove},
+    {"port_error", TriggerRule::PortErrorSet},
+    {"temperature_above", TriggerRule::TemperatureAbove},
+};
+
+const Name actionNames[] = {
+    {"log", TriggerRule::LogOnly},
+    {"disable_port", TriggerRule::DisablePort},
+    {"power_off", TriggerRule::PowerOff},
+    {"set_current_limit", TriggerRule::SetCurrentLimit},
+    {"power_cycle", TriggerRule::PowerCycle},
+};
+
+template <size_t N>
+bool lookup(const Name (&names)[N], const QString &name, int *value){
+    for(size_t i = 0; i < N; i++){
+        if(name == names[i].name){
+            *value = names[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline int64_t micro(double value){
+    return (int64_t)llround(value*1000000.0);
+}
+
+}
+
+TriggerEngine::TriggerEngine() :
+    m_poweredPorts(0xFFFFFFFF)
+{
+}
+
+bool TriggerEngine::load(const QString &path){
+    m_error.clear();
+
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)){
+        m_error = file.errorString();
+        return false;
+    }
+
+    std::vector<TriggerRule> rules;
+    if(!parse(file.readAll(), &rules, &m_error))
+        return false;
+
+    setRules(rules);
+    return true;
+}
+
+bool TriggerEngine::parse(const QByteArray &json, std::vector<TriggerRule> *rules, QString *error){
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(json, &parseError);
+    if(document.isNull()){
+        *error = parseError.errorString();
+        return false;
+    }
+
+    QJsonArray list = document.object().value("rules").toArray();
+    rules->clear();
+    for(int i = 0; i < list.size(); i++){
+        QJsonObject object = list[i].toObject();
+        TriggerRule rule;
+        rule.name = object.value("name").toString(QString("rule %1").arg(i + 1));
+        rule.port = object.value("port").toInt(-1);
+        rule.holdUs = (int64_t)llround(object.value("for_ms").toDouble(0)*1000.0);
+        rule.actionValue = 0;
+
+        int condition;
+        if(!lookup(conditionNames, object.value("when").toString(), &condition)){
+            *error = QString("%1: unknown condition \"%2\"").arg(rule.name).arg(object.value("when").toString());
+            return false;
+        }
+        rule.condition = (TriggerRule::Condition)condition;
+
+        int action;
+        if(!lookup(actionNames, object.value("action").toString("log"), &action)){
+            *error = QString("%1: unknown action \"%2\"").arg(rule.name).arg(object.value("action").toString());
+            return false;
+        }
+        rule.action = (TriggerRule::Action)action;
+
+        if(rule.port < -1 || rule.port > 7){
+            *error = QString("%1: no port %2").arg(rule.name).arg(rule.port);
+            return false;
+        }
+
+        if(rule.condition == TriggerRule::PortErrorSet){
+            rule.threshold = (int64_t)object.value("mask").toDouble(0xFFFFFFFF);
+        }
+        else if(object.contains("threshold")){
+            rule.threshold = micro(object.value("threshold").toDouble());
+        }
+        else {
+            *error = QString("%1: no threshold").arg(rule.name);
+            return false;
+        }
+
+        if(rule.action == TriggerRule::SetCurrentLimit){
+            if(!object.contains("limit")){
+                *error = QString("%1: no current limit").arg(rule.name);
+                return false;
+            }
+            rule.actionValue = (uint32_t)micro(object.value("limit").toDouble());
+        }
+        else if(rule.action == TriggerRule::PowerCycle){
+            rule.actionValue = (uint32_t)object.value("off_ms").toInt(1000);
+        }
+
+        rules->push_back(rule);
+    }
+    return true;
+}
+
+void TriggerEngine::setRules(const std::vector<TriggerRule> &rules){
+    m_rules = rules;
+    m_state.clear();
+    m_state.resize(m_rules.size());
+    for(RuleState &state: m_state){
+        state.firedCount = 0;
+    }
+    restart();
+}
+
+void TriggerEngine::restart(){
+    for(RuleState &state: m_state){
+        for(int port = 0; port < 8; port++){
+            state.ports[port].sinceUs = -1;
+            state.ports[port].fired = false;
+        }
+    }
+}
+
+TriggerEngine::Input TriggerEngine::inputFor(TriggerRule::Condition condition){
+    switch(condition){
+    case TriggerRule::CurrentAbove:     return PortCurrent;
+    case TriggerRule::VoltageBelow:
+    case TriggerRule::VoltageAbove:     return PortVoltage;
+    case TriggerRule::PortErrorSet:     return PortError;
+    case TriggerRule::TemperatureAbove: return Temperature;
+    }
+    return Temperature;
+}
+
+bool TriggerEngine::holds(const TriggerRule &rule, int64_t value){
+    switch(rule.condition){
+    case TriggerRule::CurrentAbove:
+    case TriggerRule::VoltageAbove:
+    case TriggerRule::TemperatureAbove: return value > rule.threshold;
+    case TriggerRule::VoltageBelow:     return value < rule.threshold;
+    case TriggerRule::PortErrorSet:     return (value & rule.threshold) != 0;
+    }
+    return false;
+}
+
+// A condition that stops holding before holdUs starts its timing over; one
+// that fired has to stop holding before it can fire again. Turning a port's
+// power off counts as its voltage conditions stopping.
+void TriggerEngine::evaluate(Input input, int64_t timeUs, const int64_t *values, int count, std::vector<Firing> *fired){
+    for(size_t i = 0; i < m_rules.size(); i++){
+        const TriggerRule &rule = m_rules[i];
+        if(inputFor(rule.condition) != input)
+            continue;
+
+        for(int channel = 0; channel < count && channel < 8; channel++){
+            if(input != Temperature && rule.port >= 0 && rule.port != channel)
+                continue;
+
+            PortState &state = m_state[i].ports[channel];
+            bool unpowered = (input == PortVoltage && !(m_poweredPorts & (1u << channel)));
+            if(unpowered || !holds(rule, values[channel])){
+                state.sinceUs = -1;
+                state.fired = false;
+                continue;
+            }
+
+            if(state.sinceUs < 0){
+                state.sinceUs = timeUs;
+            }
+            if(state.fired || timeUs - state.sinceUs < rule.holdUs)
+                continue;
+
+            state.fired = true;
+            m_state[i].firedCount++;
+            Firing firing = {(int)i, input == Temperature ? rule.port : channel, timeUs, values[channel]};
+            fired->push_back(firing);
+        }
+    }
+}
+
+void TriggerEngine::recordLatency(int rule, int64_t latencyUs){
+    if(rule >= 0 && rule < (int)m_state.size()){
+        m_state[rule].latency.record(latencyUs);
+    }
+}
+
+QString TriggerEngine::summary() const {
+    QStringList lines;
+    for(size_t i = 0; i < m_rules.size(); i++){
+        if(m_state[i].firedCount == 0)
+            continue;
+        lines << QString("trigger %1: fired %2, reaction %3")
+                 .arg(m_rules[i].name)
+                 .arg(m_state[i].firedCount)
+                 .arg(m_state[i].latency.summary());
+    }
+    return lines.join("\n");
+}
@@ -0,0 +1,121 @@
+#ifndef TRIGGERENGINE_H
+#define TRIGGERENGINE_H
+
+#include <QString>
+#include <QByteArray>
+
+#include <stdint.h>
+#include <vector>
+
+#include "latencyhistogram.h"
+
+// One condition on the hub's readings and what to do when it holds.
+struct TriggerRule {
+    enum Condition {
+        CurrentAbove,
+        VoltageBelow,
+        VoltageAbove,
+        PortErrorSet,       // any of the threshold's bits
+        TemperatureAbove
+    };
+
+    enum Action {
+        LogOnly,
+        DisablePort,
+        PowerOff,
+        SetCurrentLimit,
+        PowerCycle          // off, then on again actionValue ms later
+    };
+
+    QString name;
+    int port;               // -1 for every port; a temperature rule acts on this port
+    Condition condition;
+    int64_t threshold;      // uA, uV, error bits or micro degrees C
+    int64_t holdUs;         // how long it has to hold before firing
+    Action action;
+    uint32_t actionValue;   // current limit in uA, or off time in ms
+};
+
+// Checks the worker's readings against a list of rules as they're read, so
+// an action can go out in the same poll cycle as the reading that called for
+// it. Each rule fires once per port when its condition has held for holdUs,
+// then not again until the condition clears.
+//
+// Rules file, JSON:
+//   {"rules": [
+//     {"name": "overcurrent", "port": 2, "when": "current_above", "threshold": 2.5,
+//      "for_ms": 50, "action": "disable_port"},
+//     {"name": "sag", "when": "voltage_below", "threshold": 4.6, "action": "power_cycle",
+//      "off_ms": 2000},
+//     {"name": "fault", "when": "port_error", "action": "set_current_limit", "limit": 0.5},
+//     {"name": "hot", "when": "temperature_above", "threshold": 70, "action": "power_off"}
+//   ]}
+// Thresholds are in V, A or degrees C; port_error takes an optional "mask" of
+// error bits. "port" defaults to every port, "for_ms" to 0 and "action" to "log".
+class TriggerEngine
+{
+public:
+    enum Input {
+        PortVoltage,
+        PortCurrent,
+        PortError,
+        Temperature
+    };
+
+    struct Firing {
+        int rule;
+        int port;           // -1 when a temperature rule acts on every port
+        int64_t sampleUs;   // when the reading that fired it was taken
+        int64_t value;
+    };
+
+    TriggerEngine();
+
+    bool load(const QString &path);
+    static bool parse(const QByteArray &json, std::vector<TriggerRule> *rules, QString *error);
+    QString errorString() const { return m_error; }
+
+    // starts every rule over
+    void setRules(const std::vector<TriggerRule> &rules);
+    const std::vector<TriggerRule> &rules() const { return m_rules; }
+    bool isEmpty() const { return m_rules.empty(); }
+
+    // values are one per port, or the one temperature, read at timeUs; the
+    // rules that fire are added to fired
+    void evaluate(Input input, int64_t timeUs, const int64_t *values, int count, std::vector<Firing> *fired);
+
+    // partly held conditions start over, for after the link was lost
+    void restart();
+
+    // one bit per port with VBUS on; voltage conditions don't hold on the
+    // others, since an unpowered port reads 0V. Every port to begin with.
+    void setPoweredPorts(uint32_t mask) { m_poweredPorts = mask; }
+
+    // sample to action done, recorded by whoever carried out the action
+    void recordLatency(int rule, int64_t latencyUs);
+
+    // one "name: fired N, p50 .." line per rule that has fired
+    QString summary() const;
+
+private:
+    struct PortState {
+        int64_t sinceUs;    // -1 while the condition doesn't hold
+        bool fired;
+    };
+
+    struct RuleState {
+        PortState ports[8];
+        uint32_t firedCount;
+        LatencyHistogram latency;
+    };
+
+    static Input inputFor(TriggerRule::Condition condition);
+    static bool holds(const TriggerRule &rule, int64_t value);
+
+    std::vector<TriggerRule> m_rules;
+    std::vector<RuleState> m_state;
+    uint32_t m_poweredPorts;
+    QString m_error;
+};
+
+#endif // TRIGGERENGINE_H
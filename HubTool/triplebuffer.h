@@ -0,0 +1,48 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Hands the newest value from one producer thread to one consumer thread.
+// The producer fills back() and publishes it; the consumer takes whatever
+// was published last. Neither side locks or waits for the other, and values
+// the consumer didn't get to are simply replaced. The three buffers are
+// reused, so a T that keeps its capacity (a std::vector, say) stops
+// allocating once it has grown.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : m_middle(1), m_back(2), m_front(0) {}
+
+    // producer side: fill this completely, then publish()
+    T &back() { return m_buffers[m_back]; }
+    void publish(){
+        m_back = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // consumer side: the last value published, or the one before again if
+    // nothing new has been
+    const T &latest(){
+        if(m_middle.load(std::memory_order_relaxed) & Fresh){
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+        }
+        return m_buffers[m_front];
+    }
+
+private:
+    static const int IndexMask = 3;
+    static const int Fresh = 4;
+
+    T m_buffers[3];
+
+    // index of the buffer between the two sides, and whether it's newer than
+    // the consumer's; the other two indices belong to one side each
+    std::atomic<int> m_middle;
+    char m_middlePad[64 - sizeof(std::atomic<int>)];
+    int m_back;
+    char m_backPad[64 - sizeof(int)];
+    int m_front;
+};
+
+#endif // TRIPLEBUFFER_H
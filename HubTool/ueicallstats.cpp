@@ -0,0 +1,128 @@
+#include "ueicallstats.h"
+
+#include <QStringList>
+
+#include <algorithm>
+
+// the calls HubTool makes; anything else is named by its numbers
+static const struct {
+    uint8_t command;
+    uint8_t option;
+    const char *name;
+} knownCalls[] = {
+    { cmdUSB, usbPortVoltage,                   "usb.portVoltage"           },
+    { cmdUSB, usbPortCurrent,                   "usb.portCurrent"           },
+    { cmdUSB, usbPortState,                     "usb.portState"             },
+    { cmdUSB, usbPortError,                     "usb.portError"             },
+    { cmdUSB, usbHubMode,                       "usb.hubMode"               },
+    { cmdUSB, usbPortCurrentLimit,              "usb.portCurrentLimit"      },
+    { cmdUSB, usbPortMode,                      "usb.portMode"              },
+    { cmdUSB, usbUpstreamState,                 "usb.upstreamState"         },
+    { cmdUSB, usbUpstreamMode,                  "usb.upstreamMode"          },
+    { cmdUSB, usbUpstreamBoostMode,             "usb.upstreamBoostMode"     },
+    { cmdUSB, usbHubEnumerationDelay,           "usb.enumerationDelay"      },
+    { cmdUSB, usbDownstreamBoostMode,           "usb.downstreamBoostMode"   },
+    { cmdUSB, usbPortEnable,                    "usb.portEnable"            },
+    { cmdUSB, usbPortDisable,                   "usb.portDisable"           },
+    { cmdUSB, usbDataEnable,                    "usb.dataEnable"            },
+    { cmdUSB, usbDataDisable,                   "usb.dataDisable"           },
+    { cmdUSB, usbPowerEnable,                   "usb.powerEnable"           },
+    { cmdUSB, usbPowerDisable,                  "usb.powerDisable"          },
+    { cmdUSB, usbHiSpeedDataEnable,             "usb.hiSpeedDataEnable"     },
+    { cmdUSB, usbHiSpeedDataDisable,            "usb.hiSpeedDataDisable"    },
+    { cmdUSB, usbSuperSpeedDataEnable,          "usb.superSpeedDataEnable"  },
+    { cmdUSB, usbSuperSpeedDataDisable,         "usb.superSpeedDataDisable" },
+    { cmdUSB, usbPortClearErrorStatus,          "usb.clearPortErrorStatus"  },
+    { cmdSYSTEM, systemModule,                  "system.module"             },
+    { cmdSYSTEM, systemLED,                     "system.led"                },
+    { cmdSYSTEM, systemVersion,                 "system.version"            },
+    { cmdSYSTEM, systemModel,                   "system.model"              },
+    { cmdSYSTEM, systemSerialNumber,            "system.serialNumber"       },
+    { cmdSYSTEM, systemInputVoltage,            "system.inputVoltage"       },
+    { cmdSYSTEM, systemInputCurrent,            "system.inputCurrent"       },
+    { cmdSYSTEM, systemUptime,                  "system.uptime"             },
+    { cmdSYSTEM, systemMaxTemperature,          "system.maxTemperature"     },
+    { cmdTEMPERATURE, temperatureMicroCelsius,  "temperature.microCelsius"  },
+};
+
+UEICallStats::UEICallStats(){
+}
+
+UEICallStats::Call& UEICallStats::callFor(uint8_t command, uint8_t option){
+    uint16_t key = (uint16_t)((command << 8) | option);
+    auto found = m_index.find(key);
+    if(found != m_index.end()){
+        return m_calls[found->second];
+    }
+
+    Call call;
+    call.command = command;
+    call.option = option;
+    call.errors = 0;
+    call.timeouts = 0;
+    m_index[key] = m_calls.size();
+    m_calls.push_back(call);
+    return m_calls.back();
+}
+
+void UEICallStats::recordReply(uint8_t command, uint8_t option, qint64 latencyUs, aErr err){
+    Call &call = callFor(command, option);
+    call.latency.record(latencyUs);
+    if(err != aErrNone) call.errors++;
+}
+
+void UEICallStats::recordFailure(uint8_t command, uint8_t option, aErr err){
+    Call &call = callFor(command, option);
+    if(err == aErrTimeout)  call.timeouts++;
+    else                    call.errors++;
+}
+
+void UEICallStats::reset(){
+    m_calls.clear();
+    m_index.clear();
+}
+
+QList<UEICallSummary> UEICallStats::summaries() const {
+    QList<UEICallSummary> summaries;
+    for(const Call &call: m_calls){
+        UEICallSummary summary;
+        summary.name = callName(call.command, call.option);
+        summary.count = call.latency.count();
+        summary.p50Us = call.latency.percentile(50);
+        summary.p99Us = call.latency.percentile(99);
+        summary.maxUs = call.latency.max();
+        summary.meanUs = call.latency.mean();
+        summary.errors = call.errors;
+        summary.timeouts = call.timeouts;
+        summaries.append(summary);
+    }
+    std::sort(summaries.begin(), summaries.end(), [](const UEICallSummary &a, const UEICallSummary &b){
+        return a.name < b.name;
+    });
+    return summaries;
+}
+
+QString UEICallStats::callName(uint8_t command, uint8_t option){
+    for(const auto &known: knownCalls){
+        if(known.command == command && known.option == option)
+            return QString(known.name);
+    }
+    return QString("cmd%1.option%2").arg(command).arg(option);
+}
+
+QString UEICallStats::toCsv(const QList<UEICallSummary> &summaries){
+    QStringList lines;
+    lines << "name,count,p50_us,p99_us,max_us,mean_us,errors,timeouts";
+    for(const UEICallSummary &summary: summaries){
+        lines << QString("%1,%2,%3,%4,%5,%6,%7,%8")
+                 .arg(summary.name)
+                 .arg(summary.count)
+                 .arg(summary.p50Us)
+                 .arg(summary.p99Us)
+                 .arg(summary.maxUs)
+                 .arg(summary.meanUs, 0, 'f', 1)
+                 .arg(summary.errors)
+                 .arg(summary.timeouts);
+    }
+    return lines.join("\n") + "\n";
+}
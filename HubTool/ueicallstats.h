@@ -0,0 +1,64 @@
+#ifndef UEICALLSTATS_H
+#define UEICALLSTATS_H
+
+#include <QList>
+#include <QMetaType>
+#include <QString>
+
+#include <map>
+#include <vector>
+
+#include "BrainStem2/BrainStem-all.h"
+#include "latencyhistogram.h"
+
+// One UEI call's timings, as sent to the diagnostics window.
+struct UEICallSummary {
+    QString name;                   // "usb.portVoltage"
+    quint64 count;                  // replies, including error replies
+    qint64 p50Us;
+    qint64 p99Us;
+    qint64 maxUs;
+    double meanUs;
+    quint64 errors;                 // send errors and error replies
+    quint64 timeouts;
+};
+Q_DECLARE_METATYPE(UEICallSummary)
+Q_DECLARE_METATYPE(QList<UEICallSummary>)
+
+// Request to reply latency and failures for every (command, option) the
+// router sends, whatever the index or subindex. The router records into it
+// from the polling thread only, so there's no locking; the histograms are
+// fixed size, so once every call has been seen recording doesn't allocate.
+class UEICallStats
+{
+public:
+    UEICallStats();
+
+    void recordReply(uint8_t command, uint8_t option, qint64 latencyUs, aErr err);
+    void recordFailure(uint8_t command, uint8_t option, aErr err);
+    void reset();
+
+    // sorted by name
+    QList<UEICallSummary> summaries() const;
+
+    static QString callName(uint8_t command, uint8_t option);
+
+    // "name,count,p50_us,p99_us,max_us,mean_us,errors,timeouts" plus a row per call
+    static QString toCsv(const QList<UEICallSummary> &summaries);
+
+private:
+    struct Call {
+        uint8_t command;
+        uint8_t option;
+        LatencyHistogram latency;
+        quint64 errors;
+        quint64 timeouts;
+    };
+
+    Call& callFor(uint8_t command, uint8_t option);
+
+    std::vector<Call> m_calls;
+    std::map<uint16_t, size_t> m_index;     // (command << 8 | option) to m_calls
+};
+
+#endif // UEICALLSTATS_H
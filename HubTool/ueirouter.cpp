@@ -0,0 +1,419 @@
+#include "ueirouter.h"
+#include "ueicallstats.h"
+#include "packetcapture.h"
+
+#include <vector>
+
+#include "BrainStem2/aTime.h"
+
+// expired requests are kept around this long to soak up late replies
+#define UEI_ROUTER_STALE_MS 2000
+
+UEIRouter::UEIRouter() :
+    m_link(0),
+    m_moduleAddress(0),
+    m_nextTicket(1),
+    m_liveCount(0),
+    m_errorCount(0),
+    m_callStats(nullptr),
+    m_capture(nullptr)
+{
+    m_clock.start();
+}
+
+UEIRouter::~UEIRouter(){
+    detach();
+}
+
+aErr UEIRouter::attach(const linkSpec &spec, uint8_t moduleAddress){
+    detach();
+
+    // both of these hand back the existing link (with its use count bumped)
+    // when the Module already has one open to the device
+    if(spec.type == USB){
+        m_link = aLink_CreateUSB(spec.serial_num);
+    }
+    else if(spec.type == TCPIP){
+        m_link = aLink_CreateTCPIP(spec.t.ip.ip_address, (uint16_t)spec.t.ip.ip_port);
+    }
+
+    if(!m_link){
+        return aErrConnection;
+    }
+
+    m_moduleAddress = moduleAddress;
+    if(m_capture) m_capture->attachLink(m_link);
+    return aErrNone;
+}
+
+aErr UEIRouter::attachStream(aStreamRef stream, uint8_t moduleAddress, unsigned long msTimeout){
+    detach();
+
+    if(!stream){
+        return aErrParam;
+    }
+    m_link = aLink_Create(stream);
+    if(!m_link){
+        return aErrConnection;
+    }
+    m_moduleAddress = moduleAddress;
+
+    // the link comes up on its own thread
+    QElapsedTimer waited;
+    waited.start();
+    while(!linkUp()){
+        if(waited.elapsed() > (qint64)msTimeout){
+            detach();
+            return aErrTimeout;
+        }
+        aTime_MSSleep(1);
+    }
+    if(m_capture) m_capture->attachLink(m_link);
+    return aErrNone;
+}
+
+void UEIRouter::detach(){
+    // nobody is going to answer these now
+    std::vector<Callback> callbacks;
+    for(auto &entry: m_pending){
+        for(Pending &pending: entry.second){
+            if(!pending.expired && pending.callback){
+                callbacks.push_back(pending.callback);
+            }
+        }
+    }
+    m_pending.clear();
+    m_liveCount = 0;
+
+    if(m_link){
+        if(m_capture) m_capture->detachLink();
+        aLink_Destroy(&m_link);
+        m_link = 0;
+    }
+
+    for(Callback &callback: callbacks){
+        callback(aErrConnection, 0);
+    }
+}
+
+void UEIRouter::setPacketCapture(PacketCapture *capture){
+    if(m_capture) m_capture->detachLink();
+    m_capture = capture;
+    if(m_capture && m_link) m_capture->attachLink(m_link);
+}
+
+bool UEIRouter::linkUp() const {
+    return m_link && aLink_GetStatus(m_link) == RUNNING;
+}
+
+// A set is answered with an ack and a get with a value, so the two can be
+// outstanding on the same option at once without taking each other's replies.
+UEIRouter::Key UEIRouter::makeKey(bool set, uint8_t command, uint8_t option, uint8_t index, int subindex){
+    Key key = ((Key)set << 40) | ((Key)command << 32) | ((Key)option << 24) | ((Key)index << 16);
+    if(subindex != NoSubindex){
+        key |= 0x100 | (uint8_t)subindex;
+    }
+    return key;
+}
+
+UEIRouter::Ticket UEIRouter::submitGet(uint8_t command, uint8_t option, uint8_t index, int subindex, Callback callback){
+    return submit(command, ueiOPTION_GET, option, index, subindex, 0, 0, callback);
+}
+
+UEIRouter::Ticket UEIRouter::submitSet(uint8_t command, uint8_t option, uint8_t index, int subindex,
+                                       uint32_t value, uint8_t valueSize, Callback callback){
+    return submit(command, ueiOPTION_SET, option, index, subindex, value, valueSize, callback);
+}
+
+UEIRouter::Ticket UEIRouter::submit(uint8_t command, uint8_t operation, uint8_t option, uint8_t index, int subindex,
+                                    uint32_t value, uint8_t valueSize, Callback callback){
+    if(!m_link){
+        m_errorCount++;
+        if(m_callStats) m_callStats->recordFailure(command, option & ueiOPTION_MASK, aErrConnection);
+        if(callback) callback(aErrConnection, 0);
+        return 0;
+    }
+
+    // command, option, specifier, [subindex], [big endian value]
+    uint8_t data[aBRAINSTEM_MAXPACKETBYTES];
+    uint8_t length = 0;
+    data[length++] = command;
+    data[length++] = (uint8_t)(operation | (option & ueiOPTION_MASK));
+    data[length++] = (uint8_t)(ueiSPECIFIER_RETURN_HOST | (index & ueiSPECIFIER_INDEX_MASK));
+    if(subindex != NoSubindex){
+        data[length++] = (uint8_t)subindex;
+    }
+    for(int shift = (valueSize - 1)*8; shift >= 0; shift -= 8){
+        data[length++] = (uint8_t)(value >> shift);
+    }
+
+    aPacket *packet = aPacket_CreateWithData(m_moduleAddress, length, data);
+    if(!packet){
+        m_errorCount++;
+        if(m_callStats) m_callStats->recordFailure(command, option & ueiOPTION_MASK, aErrResource);
+        if(callback) callback(aErrResource, 0);
+        return 0;
+    }
+    aErr err = aLink_PutPacket(m_link, packet);
+    aPacket_Destroy(&packet);
+    if(err != aErrNone){
+        m_errorCount++;
+        if(m_callStats) m_callStats->recordFailure(command, option & ueiOPTION_MASK, err);
+        if(callback) callback(err, 0);
+        return 0;
+    }
+
+    Pending pending;
+    pending.ticket = m_nextTicket++;
+    if(m_nextTicket == 0) m_nextTicket = 1;
+    pending.callback = callback;
+    pending.sentMs = m_clock.elapsed();
+    pending.sentNs = m_callStats ? m_clock.nsecsElapsed() : 0;
+    pending.expired = false;
+    m_pending[makeKey(operation == ueiOPTION_SET, command, option & ueiOPTION_MASK,
+                      index & ueiSPECIFIER_INDEX_MASK, subindex)].push_back(pending);
+    m_liveCount++;
+
+    return pending.ticket;
+}
+
+// The subindex byte is only there for subindexed options, so try the key
+// with it first and fall back to the one without. Acks (and error replies to
+// sets) carry the set bit; values (and error replies to gets) don't.
+bool UEIRouter::findKey(const aPacket *packet, Key *key, uint8_t *headerSize) const {
+    if(packet->address != m_moduleAddress || packet->dataSize < 3)
+        return false;
+
+    bool set = (packet->data[1] & ueiOPTION_SET) != 0;
+    uint8_t command = packet->data[0];
+    uint8_t option = packet->data[1] & ueiOPTION_MASK;
+    uint8_t index = packet->data[2] & ueiSPECIFIER_INDEX_MASK;
+
+    if(packet->dataSize >= 4){
+        Key subKey = makeKey(set, command, option, index, packet->data[3]);
+        if(m_pending.count(subKey)){
+            *key = subKey;
+            *headerSize = 4;
+            return true;
+        }
+    }
+
+    Key plainKey = makeKey(set, command, option, index, NoSubindex);
+    if(m_pending.count(plainKey)){
+        *key = plainKey;
+        *headerSize = 3;
+        return true;
+    }
+    return false;
+}
+
+uint8_t UEIRouter::sMatchReply(const aPacket *packet, const void *vpRef){
+    const UEIRouter *router = (const UEIRouter*)vpRef;
+    Key key;
+    uint8_t headerSize;
+    return router->findKey(packet, &key, &headerSize) ? 1 : 0;
+}
+
+// a reply from the router's module that no request is waiting for
+uint8_t UEIRouter::sMatchUnclaimed(const aPacket *packet, const void *vpRef){
+    const UEIRouter *router = (const UEIRouter*)vpRef;
+    Key key;
+    uint8_t headerSize;
+    if(packet->address != router->m_moduleAddress || packet->dataSize < 3
+       || (packet->data[2] & ueiSPECIFIER_RETURN_MASK) != ueiSPECIFIER_RETURN_HOST)
+        return 0;
+    return router->findKey(packet, &key, &headerSize) ? 0 : 1;
+}
+
+int UEIRouter::dispatch(const aPacket *packet){
+    Key key;
+    uint8_t headerSize;
+    if(!findKey(packet, &key, &headerSize))
+        return 0;
+
+    // replies come back in the order the requests went out, so if the oldest
+    // request timed out this is its late reply; the timeout was already
+    // counted, and nobody is told
+    std::deque<Pending> &queue = m_pending[key];
+    if(queue.front().expired){
+        queue.pop_front();
+        if(queue.empty()){
+            m_pending.erase(key);
+        }
+        return 0;
+    }
+
+    aErr err = aErrNone;
+    uint32_t value = 0;
+    if(packet->data[2] & ueiREPLY_ERROR){
+        err = packet->dataSize > headerSize ? (aErr)packet->data[headerSize] : aErrUnknown;
+        m_errorCount++;
+    }
+    else {
+        for(uint8_t i = headerSize; i < packet->dataSize && i < headerSize + 4; i++){
+            value = (value << 8) | packet->data[i];
+        }
+    }
+
+    if(m_callStats && queue.front().sentNs){
+        m_callStats->recordReply(keyCommand(key), keyOption(key),
+                                 (m_clock.nsecsElapsed() - queue.front().sentNs)/1000, err);
+    }
+    Callback callback = queue.front().callback;
+    queue.pop_front();
+    m_liveCount--;
+    if(queue.empty()){
+        m_pending.erase(key);
+    }
+
+    // after the bookkeeping, the callback is free to submit more requests
+    if(callback){
+        callback(err, value);
+    }
+    return 1;
+}
+
+int UEIRouter::pump(unsigned long msTimeout){
+    if(!m_link)
+        return 0;
+
+    int answered = 0;
+    aPacket *packet = aLink_AwaitFirst(m_link, sMatchReply, this, msTimeout);
+    while(packet){
+        answered += dispatch(packet);
+        aPacket_Destroy(&packet);
+        packet = aLink_GetFirst(m_link, sMatchReply, this);
+    }
+
+    dropStale();
+    dropUnclaimed();
+    return answered;
+}
+
+bool UEIRouter::isPending(Ticket ticket) const {
+    for(auto &entry: m_pending){
+        for(const Pending &pending: entry.second){
+            if(pending.ticket == ticket)
+                return !pending.expired;
+        }
+    }
+    return false;
+}
+
+// The caller has given up on this request, so it hears about the timeout now
+// and the entry stays behind only to absorb the late reply.
+void UEIRouter::expire(Ticket ticket){
+    for(auto &entry: m_pending){
+        for(Pending &pending: entry.second){
+            if(pending.ticket == ticket && !pending.expired){
+                Callback callback = pending.callback;
+                pending.expired = true;
+                pending.callback = Callback();
+                m_liveCount--;
+                m_errorCount++;
+                if(m_callStats) m_callStats->recordFailure(keyCommand(entry.first), keyOption(entry.first), aErrTimeout);
+                if(callback) callback(aErrTimeout, 0);
+                return;
+            }
+        }
+    }
+}
+
+void UEIRouter::dropStale(){
+    qint64 now = m_clock.elapsed();
+    for(auto it = m_pending.begin(); it != m_pending.end(); ){
+        std::deque<Pending> &queue = it->second;
+        while(!queue.empty() && queue.front().expired && now - queue.front().sentMs > UEI_ROUTER_STALE_MS){
+            queue.pop_front();
+        }
+        if(queue.empty()) it = m_pending.erase(it);
+        else              ++it;
+    }
+}
+
+// Replies that arrive after their request was dropped as stale, or that were
+// never asked for, would otherwise sit in the link's queue for good.
+void UEIRouter::dropUnclaimed(){
+    if(!m_link)
+        return;
+
+    aPacket *packet = aLink_GetFirst(m_link, sMatchUnclaimed, this);
+    while(packet){
+        aPacket_Destroy(&packet);
+        packet = aLink_GetFirst(m_link, sMatchUnclaimed, this);
+    }
+}
+
+aErr UEIRouter::await(Ticket ticket, unsigned long msTimeout){
+    if(ticket == 0)
+        return aErrNone; // already failed, and the callback already knows
+
+    QElapsedTimer waited;
+    waited.start();
+    while(isPending(ticket)){
+        qint64 remaining = (qint64)msTimeout - waited.elapsed();
+        if(remaining <= 0 || !m_link){
+            expire(ticket);
+            return aErrTimeout;
+        }
+
+        aPacket *packet = aLink_AwaitFirst(m_link, sMatchReply, this, (unsigned long)remaining);
+        if(packet){
+            dispatch(packet);
+            aPacket_Destroy(&packet);
+        }
+    }
+    dropUnclaimed();
+    return aErrNone;
+}
+
+aErr UEIRouter::awaitAll(unsigned long msTimeout){
+    QElapsedTimer waited;
+    waited.start();
+    while(m_liveCount > 0){
+        qint64 remaining = (qint64)msTimeout - waited.elapsed();
+        if(remaining <= 0 || !m_link){
+            // give up on everything still outstanding
+            std::vector<Ticket> live;
+            for(auto &entry: m_pending){
+                for(const Pending &pending: entry.second){
+                    if(!pending.expired) live.push_back(pending.ticket);
+                }
+            }
+            for(Ticket ticket: live){
+                expire(ticket);
+            }
+            dropUnclaimed();
+            return aErrTimeout;
+        }
+
+        aPacket *packet = aLink_AwaitFirst(m_link, sMatchReply, this, (unsigned long)remaining);
+        if(packet){
+            dispatch(packet);
+            aPacket_Destroy(&packet);
+        }
+    }
+    dropUnclaimed();
+    return aErrNone;
+}
+
+aErr UEIRouter::get(uint8_t command, uint8_t option, uint8_t index, int subindex,
+                    uint32_t *value, unsigned long msTimeout){
+    aErr result = aErrNone;
+    Ticket ticket = submitGet(command, option, index, subindex, [&](aErr err, uint32_t reply){
+        result = err;
+        if(err == aErrNone && value) *value = reply;
+    });
+    await(ticket, msTimeout);
+    return result;
+}
+
+aErr UEIRouter::set(uint8_t command, uint8_t option, uint8_t index, int subindex,
+                    uint32_t value, uint8_t valueSize, unsigned long msTimeout){
+    aErr result = aErrNone;
+    Ticket ticket = submitSet(command, option, index, subindex, value, valueSize, [&](aErr err, uint32_t){
+        result = err;
+    });
+    await(ticket, msTimeout);
+    return result;
+}
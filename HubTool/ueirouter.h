@@ -0,0 +1,124 @@
+#ifndef UEIROUTER_H
+#define UEIROUTER_H
+
+#include <QElapsedTimer>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "BrainStem2/BrainStem-all.h"
+#include "BrainStem2/aLink.h"
+#include "BrainStem2/aPacket.h"
+#include "BrainStem2/aStream.h"
+
+class UEICallStats;
+class PacketCapture;
+
+// Sends UEI requests on a module's link and hands each reply to whoever is
+// waiting for it, keyed by (get or set, command, option, index, subindex) for
+// the router's module. Any number of requests can be outstanding at once, so
+// there's no need to drain the link before every get.
+//
+// Replies to the same key are handed out oldest request first. A request that
+// timed out stays queued for a while to soak up its own late reply, which
+// goes to nobody, so the requests after it still get their own. Replies from
+// the module that nothing is waiting for are thrown away rather than left on
+// the link.
+//
+// The router isn't thread safe. It has to be used from the thread that polls
+// the module.
+class UEIRouter
+{
+public:
+    typedef uint32_t Ticket;
+    typedef std::function<void(aErr err, uint32_t value)> Callback;
+
+    static const int NoSubindex = -1;
+    static const unsigned long DefaultTimeoutMs = 500;
+
+    UEIRouter();
+    ~UEIRouter();
+
+    // share the link the Module already has open to this device
+    aErr attach(const linkSpec &spec, uint8_t moduleAddress);
+    // or open a link of its own over a stream (a simulated hub, a replay);
+    // the link takes ownership of the stream
+    aErr attachStream(aStreamRef stream, uint8_t moduleAddress, unsigned long msTimeout = DefaultTimeoutMs);
+    void detach();
+    bool isAttached() const { return m_link != 0; }
+    bool linkUp() const;
+
+    // queue a request on the link; callback runs from pump()/await() on the
+    // calling thread. Returns 0 if the request couldn't be sent, after
+    // running the callback with the error.
+    Ticket submitGet(uint8_t command, uint8_t option, uint8_t index, int subindex, Callback callback);
+    Ticket submitSet(uint8_t command, uint8_t option, uint8_t index, int subindex,
+                     uint32_t value, uint8_t valueSize, Callback callback);
+
+    // dispatch replies as they come in, waiting up to msTimeout for the first
+    // one; returns how many requests were answered
+    int pump(unsigned long msTimeout);
+
+    // wait for one request, or for everything currently outstanding
+    aErr await(Ticket ticket, unsigned long msTimeout = DefaultTimeoutMs);
+    aErr awaitAll(unsigned long msTimeout = DefaultTimeoutMs);
+
+    // blocking helpers for a single request
+    aErr get(uint8_t command, uint8_t option, uint8_t index, int subindex,
+             uint32_t *value, unsigned long msTimeout = DefaultTimeoutMs);
+    aErr set(uint8_t command, uint8_t option, uint8_t index, int subindex,
+             uint32_t value, uint8_t valueSize, unsigned long msTimeout = DefaultTimeoutMs);
+
+    int pendingCount() const { return m_liveCount; }
+
+    // running count of requests that failed: send errors, error replies and timeouts
+    uint32_t errorCount() const { return m_errorCount; }
+
+    // per call latency and failures go here while set; nullptr (the default)
+    // turns the timing off
+    void setCallStats(UEICallStats *stats) { m_callStats = stats; }
+
+    // the capture follows the router's link across detach and attach, so it
+    // never drains a link that's been destroyed
+    void setPacketCapture(PacketCapture *capture);
+
+private:
+    struct Pending {
+        Ticket ticket;
+        Callback callback;
+        qint64 sentMs;
+        qint64 sentNs;      // only kept while call stats are on
+        bool expired;       // its caller gave up waiting
+    };
+
+    typedef uint64_t Key;
+    static Key makeKey(bool set, uint8_t command, uint8_t option, uint8_t index, int subindex);
+    static uint8_t keyCommand(Key key) { return (uint8_t)(key >> 32); }
+    static uint8_t keyOption(Key key) { return (uint8_t)(key >> 24); }
+
+    static uint8_t sMatchReply(const aPacket *packet, const void *vpRef);
+    static uint8_t sMatchUnclaimed(const aPacket *packet, const void *vpRef);
+    bool findKey(const aPacket *packet, Key *key, uint8_t *headerSize) const;
+
+    Ticket submit(uint8_t command, uint8_t operation, uint8_t option, uint8_t index, int subindex,
+                  uint32_t value, uint8_t valueSize, Callback callback);
+    int dispatch(const aPacket *packet);
+    bool isPending(Ticket ticket) const;
+    void expire(Ticket ticket);
+    void dropStale();
+    void dropUnclaimed();
+
+    aLinkRef m_link;
+    uint8_t m_moduleAddress;
+    Ticket m_nextTicket;
+    int m_liveCount;
+    uint32_t m_errorCount;
+    UEICallStats *m_callStats;
+    PacketCapture *m_capture;
+    std::map<Key, std::deque<Pending> > m_pending;
+    QElapsedTimer m_clock;
+};
+
+#endif // UEIROUTER_H